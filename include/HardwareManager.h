@@ -7,6 +7,16 @@
 #include <Ethernet.h>
 #include <Wire.h>
 #include "LittleFS.h"
+#include "i2cbus.h"
+#include "outputbank.h"
+#include "pulsewheel.h"
+#include "esp_timer.h"
+
+// Банк выходов строится по relays[] из config.json: выход n — бит n%8
+// расширителя n/8. Первые два расширителя по умолчанию 0x24 и 0x25,
+// адрес любого блока задаётся полем "address" реле из этого блока.
+#define OUTPUT_DEFAULT_ADDR0 0x24
+#define OUTPUT_MIN_EXPANDERS 2
 
 class HardwareManager {
 public:
@@ -15,30 +25,51 @@ public:
     void initEthernet(JsonDocument& config);
     
     void digitalWritePCF(uint8_t pin, bool state);
-    void pulsePCF(uint8_t pin, bool state, uint32_t durationMs);
+    // Атомарно: сначала гасит биты clearMask, затем поднимает setMask (HIGH)
+    void writeMask(OutputMask setMask, OutputMask clearMask) { _bank.writeMask(setMask, clearMask); }
+    OutputMask outputs() const { return _bank.value(); }
+    const OutputBank& bank() const { return _bank; }
+    // Импульсы на аппаратном таймере: включить (LOW) pins на ms и отпустить.
+    // Время отсчитывает esp_timer, а не loop(). Возвращают дескриптор, 0 — пул занят.
+    uint32_t pulse(OutputMask pins, uint32_t ms);
+    uint32_t blink(OutputMask pins, uint32_t onMs, uint32_t offMs, uint32_t count);
+    bool cancelPulse(uint32_t handle);
+    // Снять все импульсы с pins и отпустить их
+    uint32_t cancelPulses(OutputMask pins);
+    PulseStats pulseStats();
+    // Передаёт изменившиеся байты шине (loop(), DSL и таймер импульсов)
     void updateOutputs(); 
 
     uint8_t fastRead8(uint8_t address);
+    // То же, но сообщает, удалось ли прочитать (очередь шины полна или нет ответа)
+    bool tryRead8(uint8_t address, uint8_t& data);
     bool saveConfig(JsonDocument& config);
 
+    const I2CBus& bus() const { return _bus; }
+
 private:
     bool _initialized = false;
     bool _ethStarted = false;
-    SemaphoreHandle_t _i2cMutex;
-
-    // Состояние портов
-    uint8_t _portA = 0xFF; // 0x24
-    uint8_t _portB = 0xFF; // 0x25
-    bool _needUpdateA = false;
-    bool _needUpdateB = false;
-
-    struct OutputTimer {
-        uint8_t pin;
-        uint32_t endTime;
-        bool idleState;
-        bool active = false;
-    };
-    OutputTimer _timers[16];
+    I2CBus _bus;   // Единственный владелец Wire после init()
+
+    // Теневой регистр выходов. Любое изменение увеличивает поколение;
+    // updateOutputs() сравнивает его с последним переданным и не трогает шину зря.
+    OutputBank _bank;
+
+    void initOutputs(JsonDocument& config);
+
+    SemaphoreHandle_t _flushMutex = nullptr;   // flush() банка — из одной задачи за раз
+
+    // Колесо импульсов двигает периодический esp_timer (1 мс); пока импульсов нет, он стоит
+    PulseWheel _pulses;
+    SemaphoreHandle_t _pulseMutex = nullptr;
+    esp_timer_handle_t _pulseTimer = nullptr;
+    bool _pulseRunning = false;
+    int64_t _pulseUs = 0;                      // Время, до которого колесо уже продвинуто
+
+    static void pulseTick(void* arg);
+    void advancePulses(PulseOut& out);
+    void applyPulses(const PulseOut& out);
 };
 
 #endif
\ No newline at end of file
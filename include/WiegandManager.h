@@ -3,34 +3,85 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <atomic>
 #include "HardwareManager.h"
+#include "pipeline.h"
+#include "wiegandedge.h"
 #include <vector>
 #include "map"
 
-#define WIEGAND_TIMEOUT 100 
+class WiegandManager;
 
+// Линия D0/D1 считывателя на GPIO: аргумент обработчика прерывания
+struct WiegandLine {
+    WiegandManager* owner;
+    uint8_t reader;
+    uint8_t bit;
+};
+
+// Считыватель подключается одним из способов (devices[] в config.json):
+//   "address" + "pins"  — линии на входах PCF8574;
+//   "gpio": [d0, d1]    — линии прямо на GPIO, спады ловит прерывание.
+// Для расширителя "int_io" задаёт GPIO его линии INT: тогда он читается
+// по прерыванию, а не постоянным опросом. "formats": [26, 34] — какие длины
+// кадра ждать от считывателя (по умолчанию 26, 34 и 58).
 struct WiegandReader {
     uint8_t addr;
     uint8_t pinD0;
     uint8_t pinD1;
     int group;
-    uint64_t cardCode = 0; 
-    int bitCount = 0;
-    unsigned long lastBitTime = 0;
-    bool lastD0 = true;
-    bool lastD1 = true;
+    uint8_t index;
+    uint8_t maskD0;        // Биты линий в байте расширителя
+    uint8_t maskD1;
+    int8_t gpioD0 = -1;    // >= 0 — считыватель на GPIO
+    int8_t gpioD1 = -1;
+    WiegandLine lines[2];
+    uint32_t rejected = 0; // Кадры с неверной длиной или чётностью
+};
+
+// Один PCF8574 со всеми считывателями на нём: байт читается один раз за проход
+// и раздаётся всем его считывателям
+struct WiegandExpander {
+    WiegandManager* owner;
+    uint8_t addr;
+    int8_t intPin = -1;                // GPIO линии INT; -1 — опрос
+    uint8_t last = 0xFF;               // Предыдущий прочитанный байт (линии в покое — HIGH)
+    std::vector<WiegandReader*> readers;
+    std::atomic<bool> intFlag{false};  // INT сработал, байт ещё не прочитан
+    std::atomic<uint32_t> intTime{0};  // micros() срабатывания INT
+    uint32_t samples = 0;              // Удачных чтений в текущем окне
+    uint32_t windowStart = 0;
+    uint32_t rateHz = 0;               // Чтений в секунду за последнее окно
 };
 
 class WiegandManager {
 public:
     WiegandManager();
-    void init(JsonArray devices, HardwareManager* hw);
-    void internalUpdate(); 
+    void init(JsonArray devices, HardwareManager* hw, CardPipeline* pipeline);
+
+    // Один проход декодера. Возвращает, сколько мс можно спать до следующего:
+    // 0 — есть опрашиваемые расширители, UINT32_MAX — до прерывания.
+    uint32_t internalUpdate(); 
+
+    // Частота опроса каждого считывателя (= частота чтения его расширителя)
+    void printStats() const;
 
 private:
     std::vector<WiegandReader*> _readers;
+    std::vector<WiegandExpander*> _expanders;
     HardwareManager* _hw;
-    void handleCard(WiegandReader* r);
+    CardPipeline* _pipeline;
+    TaskHandle_t _task = nullptr;
+
+    WiegandEdgeRing _edges;            // Спады с GPIO (пишут только прерывания)
+    WiegandEdgeDecoder _decoder;
+    bool _polling = false;             // Есть расширители без INT
+
+    void sampleExpander(WiegandExpander* e, uint32_t tUs);
+    void handleCard(const WiegandRawFrame& frame);
+
+    static void onLineFall(void* arg);
+    static void onExpanderInt(void* arg);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,44 @@
+#ifndef CARDBATCH_H
+#define CARDBATCH_H
+
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+#include "search.h"
+
+#define CARD_BATCH_MAX    65536   // UID в одном потоке: 512 КБ тела, 256 КБ ответа в PSRAM
+#define CARD_BATCH_CHUNK  256     // UID на один findBatch(): столько проверяет один шаг loop()
+
+// Сверка пакетом, когда UID приходят потоком (POST /api/cards/batch больше HTTP_MAX_BODY).
+// Байты копятся до CARD_BATCH_CHUNK UID, каждая полная порция сразу уходит в findBatch(),
+// результаты ложатся подряд в один буфер PSRAM, который в конце забирает ответ.
+class CardBatchStream {
+public:
+    CardBatchStream() {}
+    ~CardBatchStream() { release(); }
+
+    // count — сколько UID будет в потоке. false — больше CARD_BATCH_MAX или нет PSRAM
+    bool begin(CardDatabase& db, uint32_t count);
+    // UID по 8 байт little-endian, любыми кусками. Принимает не больше одной порции за вызов
+    size_t write(const uint8_t* data, size_t len);
+    // Проверяет остаток. Результат — count() записей CardMembership в том же порядке;
+    // буфер переходит вызывающему (heap_caps_free). nullptr — тело короче заявленного
+    uint8_t* finish(uint32_t& found);
+    void release();
+
+    bool active() const { return _mem != nullptr; }
+    uint32_t count() const { return _count; }
+
+private:
+    CardDatabase* _db = nullptr;
+    uint8_t* _mem = nullptr;            // [ответ count * 4][порция ключей]
+    CardMembership* _out = nullptr;
+    uint64_t* _keys = nullptr;
+    uint32_t _count = 0;
+    uint32_t _done = 0;                 // UID уже проверено
+    uint32_t _fill = 0;                 // Байт в текущей порции
+    uint32_t _found = 0;
+
+    void flush();
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef CARDCACHE_H
+#define CARDCACHE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+
+// Количество наборов кэша горячих карт (степень двойки), в каждом по 2 записи
+#define CARD_CACHE_SETS 256
+
+struct Instruction;
+enum class CardSource : uint8_t;
+
+// Готовое решение по карте: то, что findView() вернул бы после полного поиска
+struct CardCacheEntry {
+    uint64_t uid = 0;
+    uint32_t gen = 0;                 // Поколение базы; 0 — запись пуста
+    const Instruction* instr = nullptr;
+    uint16_t count = 0;
+    uint16_t group_id = 0;
+    uint16_t actionMask = 0;
+    uint8_t topAction = 0;
+    uint8_t limit = 0;
+    uint8_t status = 0;
+    CardSource source;
+    uint8_t route = 0;                // Класс длины кадра: 0 — любая, 1 — <=34, 2 — >34
+};
+
+// Кэш горячих карт во внутренней SRAM, 2-way set-associative.
+// Хранит только найденные карты: поток чужих карт не вытесняет постоянные пропуска.
+// Запись действительна, пока её поколение совпадает с поколением базы, поэтому
+// сброс при перезагрузке или изменении базы — это просто инкремент счётчика.
+// Наборы защищены seqlock: чтение без блокировок, писатель, не получивший набор, пропускает вставку.
+class CardCache {
+public:
+    CardCache() {}
+    ~CardCache();
+
+    bool begin();
+    bool lookup(uint64_t uid, uint8_t route, uint32_t gen, CardCacheEntry& out);
+    void insert(const CardCacheEntry& e);
+
+    uint32_t hits() const { return _hits.load(std::memory_order_relaxed); }
+    uint32_t misses() const { return _misses.load(std::memory_order_relaxed); }
+    void resetStats() { _hits = 0; _misses = 0; }
+    size_t memory() const { return _sets ? CARD_CACHE_SETS * sizeof(Set) : 0; }
+
+private:
+    struct Set {
+        std::atomic<uint32_t> seq;    // Нечётный — набор переписывается
+        std::atomic<uint8_t> victim;  // Какую запись вытеснять следующей; пишут и читатели (relaxed)
+        CardCacheEntry way[2];
+    };
+
+    Set* _sets = nullptr;
+    std::atomic<uint32_t> _hits{0};
+    std::atomic<uint32_t> _misses{0};
+
+    static uint32_t setIndex(uint64_t uid, uint8_t route) {
+        uint64_t h = (uid ^ ((uint64_t)route << 62)) * 0x9E3779B97F4A7C15ULL;
+        return (uint32_t)(h >> 32) & (CARD_CACHE_SETS - 1);
+    }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef CARDFILE_H
+#define CARDFILE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "esp_heap_caps.h"
+
+// Формат файлов карт KCDB v1 (cards34.bin / cards56.bin).
+// Заголовок и записи хранятся в нативном порядке байт (little-endian),
+// записи выровнены так, что ключ читается одной загрузкой без сборки по байтам.
+//
+// Старый формат (без заголовка, big-endian) по-прежнему читается и
+// конвертируется в памяти при загрузке:
+//   34-бит: [тег 1Б][UID 4Б][флаги 2Б]  — 7 байт
+//   56-бит: [UID 7Б][флаги 2Б]          — 9 байт
+
+#define CARDFILE_MAGIC   0x4244434BUL  // "KCDB"
+#define CARDFILE_VERSION 1
+
+enum CardSortOrder : uint8_t { CARD_SORT_NONE = 0, CARD_SORT_ASC = 1 };
+
+struct CardFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t count;       // Количество записей
+    uint8_t keyBits;      // 32 или 56
+    uint8_t sortOrder;    // CardSortOrder
+    uint16_t stride;      // Размер записи в байтах
+    uint32_t crc32;       // CRC32 всех записей
+    uint32_t reserved[3];
+};
+static_assert(sizeof(CardFileHeader) == 32, "CardFileHeader layout");
+
+// Флаги: биты 0..13 — группа, 14..15 — лимит
+struct CardRecord34 {
+    uint32_t key;
+    uint16_t flags;
+    uint16_t reserved;
+};
+static_assert(sizeof(CardRecord34) == 8, "CardRecord34 layout");
+
+// 56-битный ключ хранится двумя выровненными словами: на Xtensa это
+// те же две 32-битные загрузки, что и для uint64_t, но без паддинга до 16 байт
+struct CardRecord56 {
+    uint32_t keyLo;
+    uint32_t keyHi;
+    uint16_t flags;
+    uint16_t reserved;
+
+    uint64_t key() const { return ((uint64_t)keyHi << 32) | keyLo; }
+};
+static_assert(sizeof(CardRecord56) == 12, "CardRecord56 layout");
+
+uint32_t cardCrc32(const uint8_t* data, size_t len, uint32_t crc = 0);
+
+// Загружают таблицу в PSRAM. Память освобождается через heap_caps_free.
+// legacy = true, если файл был в старом формате и сконвертирован.
+bool loadCardFile34(const char* path, CardRecord34*& out, uint32_t& count, bool& legacy);
+bool loadCardFile56(const char* path, CardRecord56*& out, uint32_t& count, bool& legacy);
+
+// Записывают отсортированную таблицу в формате KCDB v1: сначала во временный
+// файл, затем rename поверх старого, чтобы сбой не оставил таблицу наполовину записанной
+bool saveCardFile34(const char* path, const CardRecord34* recs, uint32_t count);
+bool saveCardFile56(const char* path, const CardRecord56* recs, uint32_t count);
+
+// Отпечаток файла базы (размер и CRC) для сверки с образом во флеше. У файла KCDB
+// CRC считается по заголовку — в нём число записей и CRC записей, — остальные
+// читаются целиком. Нет файла — нулевой отпечаток.
+void cardFileStamp(const char* path, uint32_t& size, uint32_t& crc);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef CARDFILTER_H
+#define CARDFILTER_H
+
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+
+// Размер фильтра считается от числа ключей: 10 бит на ключ — около 1.2% ложных срабатываний.
+// Больше почти не помогает, а SRAM тратит
+#define CARD_FILTER_BITS_PER_KEY 10
+// Меньше 6 бит на ключ (больше ~6% ложных срабатываний) — предупреждение в логе
+#define CARD_FILTER_MIN_BITS_PER_KEY 6
+// Потолок внутренней SRAM под фильтр (config.json: database.filter_kb):
+// ~300 тыс. карт рабочей базы по 10 бит на ключ
+#define CARD_FILTER_DEFAULT_KB 384
+// Сколько внутренней кучи фильтр оставляет остальной прошивке (стеки задач, буферы HTTP)
+#define CARD_FILTER_HEAP_RESERVE (96 * 1024)
+
+// Отрицательный фильтр карт во внутренней SRAM: блочный фильтр Блума,
+// биты ключа лежат в двух 32-битных словах, по k в каждом, — два чтения на проверку.
+// Одно слово на ключ при 10 битах на ключ даёт 2.4% ложных срабатываний, два — 1.2%.
+// Слова 32-битные, чтобы add() из задачи уплотнения был атомарным без блокировок.
+// mayContain() == false означает, что карты точно нет в базовых таблицах,
+// и бинарные поиски в PSRAM можно не делать.
+// Удалять ключи нельзя: отозванная карта остаётся ложным срабатыванием до перестроения.
+// Фильтр принадлежит набору таблиц и перестраивается вместе с ним (reload(), переполнение).
+class CardFilter {
+public:
+    CardFilter() {}
+    ~CardFilter();
+
+    // CARD_FILTER_BITS_PER_KEY бит на ключ, но не больше maxBytes и не больше, чем даёт
+    // внутренняя куча сверх CARD_FILTER_HEAP_RESERVE. false — фильтр выключен.
+    bool build(uint32_t keys, size_t maxBytes);
+    void clear();
+
+    void add(uint64_t key);
+    bool mayContain(uint64_t key) const {
+        if (!_words) return true;
+        uint64_t h1 = hash(key), h2 = hash(h1);
+        uint32_t m1 = mask(h1), m2 = mask(h2);
+        return (__atomic_load_n(&_words[wordIndex(h1)], __ATOMIC_RELAXED) & m1) == m1 &&
+               (__atomic_load_n(&_words[wordIndex(h2)], __ATOMIC_RELAXED) & m2) == m2;
+    }
+
+    bool enabled() const { return _words != nullptr; }
+    // Сколько ещё ключей можно добавить, не превысив расчётную заполненность
+    uint32_t room() const { return _keys < _capacity ? _capacity - _keys : 0; }
+    size_t memory() const { return _count * sizeof(uint32_t); }
+    // Бит на ключ: всего и в фактическом размере
+    uint8_t hashes() const { return 2 * _k; }
+    float bitsPerKey() const { return _capacity ? (float)_count * 32 / _capacity : 0; }
+    // Оценка доли ложных срабатываний по фактической заполненности слов
+    float falsePositiveRate() const;
+
+private:
+    uint32_t* _words = nullptr;   // Internal SRAM
+    uint32_t _count = 0;
+    uint32_t _capacity = 0;   // Под сколько ключей выбран размер
+    uint32_t _keys = 0;       // Сколько добавлено (add() зовут только сборка и уплотнение)
+    uint8_t _k = 0;
+
+    static uint64_t hash(uint64_t key) {
+        // Финализатор splitmix64: UID карт идут подряд, их надо перемешать
+        key ^= key >> 30; key *= 0xBF58476D1CE4E5B9ULL;
+        key ^= key >> 27; key *= 0x94D049BB133111EBULL;
+        return key ^ (key >> 31);
+    }
+    uint32_t wordIndex(uint64_t h) const { return (uint32_t)(((h >> 32) * (uint64_t)_count) >> 32); }
+    uint32_t mask(uint64_t h) const {
+        uint32_t m = 0;
+        for (uint8_t i = 0; i < _k; i++) m |= 1u << ((h >> (5 * i)) & 31);
+        return m;
+    }
+};
+
+#endif
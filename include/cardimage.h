@@ -0,0 +1,91 @@
+#ifndef CARDIMAGE_H
+#define CARDIMAGE_H
+
+#include <Arduino.h>
+#include "esp_partition.h"
+#include "cardfile.h"
+
+// Образ базы карт в сыром разделе флеша (partitions.csv: carddb).
+// Таблицы лежат в том виде, в каком их использует поиск, и читаются
+// прямо из отображённого флеша через esp_partition_mmap — без копии в PSRAM.
+//
+// [CardImageHeader][cards34][cards56][groups][instructions]
+// Секции выровнены на CARDIMAGE_ALIGN, CRC считается по содержимому секций подряд.
+// Заголовок помнит отпечатки файлов LittleFS, из которых собран образ: если файлы
+// с тех пор заменили, begin() собирает образ заново, а не отображает старый.
+
+#define CARDIMAGE_MAGIC     0x4D49434BUL  // "KCIM"
+#define CARDIMAGE_VERSION   3
+#define CARDIMAGE_SOURCES   4             // cards34, cards56, groups, rules
+#define CARDIMAGE_PARTITION "carddb"
+#define CARDIMAGE_SUBTYPE   0x40
+#define CARDIMAGE_ALIGN     16
+
+struct Instruction;
+struct CardGroup;
+
+// Размеры и CRC исходных файлов (cardFileStamp), в порядке cardDbFiles
+struct CardImageSource {
+    uint32_t size[CARDIMAGE_SOURCES];
+    uint32_t crc[CARDIMAGE_SOURCES];
+
+    bool operator==(const CardImageSource& o) const { return memcmp(this, &o, sizeof(o)) == 0; }
+    bool operator!=(const CardImageSource& o) const { return !(*this == o); }
+};
+
+struct CardImageHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t imageSize;
+    uint32_t crc32;
+    uint32_t count34, off34;
+    uint32_t count56, off56;
+    uint32_t groupCount, offGroups;
+    uint32_t groupSize;   // sizeof(CardGroup) на момент записи
+    uint32_t instrCount, offInstr;
+    uint32_t instrSize;   // sizeof(Instruction) на момент записи
+    CardImageSource source;
+    uint32_t reserved[2];
+};
+static_assert(sizeof(CardImageHeader) == 96, "CardImageHeader layout");
+
+struct CardImageSections {
+    const CardRecord34* cards34 = nullptr;
+    uint32_t count34 = 0;
+    const CardRecord56* cards56 = nullptr;
+    uint32_t count56 = 0;
+    const CardGroup* groups = nullptr;
+    uint32_t groupCount = 0;
+    const Instruction* instr = nullptr;
+    uint32_t instrCount = 0;
+};
+
+class CardImage {
+public:
+    CardImage() {}
+    ~CardImage();
+
+    // Отображает образ и проверяет заголовок и CRC
+    bool map(const char* label = CARDIMAGE_PARTITION);
+    void unmap();
+    bool mapped() const { return _base != nullptr; }
+    const CardImageSections& sections() const { return _sec; }
+    const CardImageSource& source() const { return _source; }
+    size_t size() const { return _size; }
+
+    // Стирает раздел и записывает в него таблицы. Заголовок пишется последним,
+    // поэтому прерванная запись оставляет раздел невалидным, а не битым.
+    static bool write(const CardImageSections& sec, const CardImageSource& source,
+                      const char* label = CARDIMAGE_PARTITION);
+
+private:
+    const esp_partition_t* _part = nullptr;
+    spi_flash_mmap_handle_t _handle = 0;
+    const uint8_t* _base = nullptr;
+    size_t _size = 0;
+    CardImageSections _sec;
+    CardImageSource _source{};
+};
+
+#endif
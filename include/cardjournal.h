@@ -0,0 +1,47 @@
+#ifndef CARDJOURNAL_H
+#define CARDJOURNAL_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <functional>
+
+// Журнал изменений базы карт (добавления и отзывы) поверх базовых таблиц.
+// Файл только дописывается; после уплотнения в нём остаются
+// лишь изменения, ещё не попавшие в cards34.bin / cards56.bin.
+
+#define CARDJOURNAL_PATH  "/cards.journal"
+#define CARDJOURNAL_MAGIC 0x524A434BUL  // "KCJR"
+
+enum CardDeltaOp : uint8_t { DELTA_ADD = 1, DELTA_REVOKE = 2 };
+
+struct CardDelta {
+    uint64_t uid;
+    uint32_t seq;     // Порядковый номер изменения
+    uint16_t flags;   // ADD: группа и лимит, как в записи таблицы
+    uint8_t op;       // CardDeltaOp
+    uint8_t wide;     // ADD: 1 — карта 56-битной таблицы, 0 — 32-битной
+};
+static_assert(sizeof(CardDelta) == 16, "CardDelta layout");
+
+struct CardJournalRecord {
+    uint32_t magic;
+    uint32_t crc32;   // CRC32 поля delta
+    CardDelta delta;
+};
+static_assert(sizeof(CardJournalRecord) == 24, "CardJournalRecord layout");
+
+class CardJournal {
+public:
+    explicit CardJournal(const char* path = CARDJOURNAL_PATH) : _path(path) {}
+
+    bool append(const CardDelta& d);
+    // Проигрывает журнал до первой повреждённой (недописанной) записи
+    uint32_t replay(std::function<void(const CardDelta&)> fn);
+    // Заменяет журнал оставшимися изменениями
+    bool rewrite(const CardDelta* items, uint32_t count);
+
+private:
+    const char* _path;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef CARDUPLOAD_H
+#define CARDUPLOAD_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "spsc.h"
+#include "search.h"
+
+// Новая база одним потоком (POST /api/db): заголовок и файлы в том виде,
+// в каком они лежат в data/ (собирает tools/make_db_bundle.py):
+//   [CardBundleHeader][cards34.bin][cards56.bin][groups.bin][rules.bin]
+// Файлы пишутся рядом с живыми с суффиксом CARDBUNDLE_SUFFIX; живые не трогаются,
+// пока новые не проверены и не загружены.
+
+#define CARDBUNDLE_MAGIC   0x5055434BUL  // "KCUP"
+#define CARDBUNDLE_VERSION 1
+#define CARDBUNDLE_FILES   CARD_DB_FILES   // В порядке cardDbFiles
+#define CARDBUNDLE_SUFFIX  ".new"
+
+#define CARD_UPLOAD_CHUNK  1460   // Порция из сокета (HTTP_WRITE_CHUNK)
+#define CARD_UPLOAD_DEPTH  16     // Порций в PSRAM между HTTP и задачей записи
+// Свободного места на LittleFS сверх пакета: журнал (до 24 КБ, при перезаписи — вдвое)
+// и метаданные. Худший случай — база KCDB из data/ (3.75 МБ) живая плюс такая же в пакете
+#define CARD_UPLOAD_FS_RESERVE 65536
+
+struct CardBundleHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t size[CARDBUNDLE_FILES];   // Длины файлов
+    uint32_t crc32;                    // CRC32 всего, что после заголовка
+    uint32_t reserved;
+};
+static_assert(sizeof(CardBundleHeader) == 32, "CardBundleHeader layout");
+
+enum class CardUploadState : uint8_t {
+    IDLE = 0,
+    RECEIVING,   // Тело идёт, задача пишет теневые файлы
+    BUILDING,    // CRC сошёлся, строятся и подменяются таблицы
+    DONE,
+    FAILED
+};
+const char* cardUploadStateName(CardUploadState state);
+
+// Приём базы по сети. HTTP (loop) только копирует порции в очередь и никогда
+// не ждёт флеш: запись файлов, проверка CRC и CardDatabase::reload() идут
+// в отдельной задаче. Полная очередь — это 0 из write(): сервер перестаёт
+// читать сокет, и клиента притормаживает окно TCP.
+class CardUpload {
+public:
+    explicit CardUpload(CardDatabase& db) : _db(db) {}
+
+    // length — Content-Length. false — загрузка уже идёт, нет памяти или пакет не
+    // помещается на LittleFS рядом с живой базой (noSpace(), причина в error())
+    bool begin(uint32_t length);
+    // Из того же потока, что begin(). Возвращает, сколько байт принято.
+    size_t write(const uint8_t* data, size_t len);
+    // Клиент ушёл, не дослав тело
+    void abort();
+
+    CardUploadState state() const { return _state.load(); }
+    bool busy() const { CardUploadState s = _state.load(); return s == CardUploadState::RECEIVING || s == CardUploadState::BUILDING; }
+    uint32_t total() const { return _total; }
+    uint32_t received() const { return _received; }
+    uint32_t written() const { return _written.load(); }
+    uint32_t elapsedMs() const { return _elapsedMs; }
+    const char* error() const { return _error; }
+    bool noSpace() const { return _noSpace; }
+
+private:
+    struct Chunk {
+        uint16_t len;
+        uint8_t data[CARD_UPLOAD_CHUNK];
+    };
+
+    CardDatabase& _db;
+    std::atomic<CardUploadState> _state{CardUploadState::IDLE};
+    std::atomic<bool> _abort{false};
+    uint32_t _total = 0;
+    uint32_t _received = 0;            // Пишет только HTTP
+    std::atomic<uint32_t> _written{0}; // Пишет только задача
+    uint32_t _startMs = 0;
+    uint32_t _elapsedMs = 0;
+    const char* _error = "";
+    char _errorBuf[64];
+    bool _noSpace = false;
+
+    // Порции в PSRAM; по кольцам ходят их номера: свободные — к HTTP, заполненные — к задаче
+    Chunk* _chunks = nullptr;
+    SpscRing<uint8_t, CARD_UPLOAD_DEPTH> _free;
+    SpscRing<uint8_t, CARD_UPLOAD_DEPTH> _filled;
+
+    void run();
+    bool receive();
+    void finish(CardUploadState state, const char* error);
+    static void removeShadows();
+
+    friend void cardUploadTask(void* pvParameters);
+};
+
+#endif
@@ -3,46 +3,67 @@
 
 #include <Arduino.h>
 #include <LittleFS.h>
-#include <deque>
-#include <vector>
-#include <list> // Для хранения списка активных процессов
+#include <memory>
 #include "HardwareManager.h"
+#include "dslcode.h"
 
-enum DSLAction { ACTION_NONE = 0, ACTION_OPEN, ACTION_CLOSE, ACTION_SLEEP };
-
-struct QueuedCommand {
-    DSLAction action = ACTION_NONE;
-    uint16_t pinMask = 0;
-    uint32_t duration = 0;
-};
+// Сколько сценариев может идти одновременно (пул без аллокаций)
+#define DSL_MAX_TASKS 32
+// SLEEP длиннее половины периода millis() сравнивать нельзя — ограничиваем (~24 дня)
+#define DSL_MAX_SLEEP_MS 0x7FFFFFFFUL
 
 // Состояние одного запущенного сценария
 struct DSLInstance {
-    std::deque<QueuedCommand> commands;
-    unsigned long nextStepTime = 0;
-    bool isWaiting = false;
+    std::shared_ptr<const DSLProgram> program; // Держит байткод, пока сценарий идёт
+    const uint8_t* pc = nullptr;               // Следующая команда
+    uint32_t wakeAt = 0;                       // Когда продолжить (millis)
+};
+
+struct DSLStats {
+    uint32_t active = 0;
+    uint32_t peak = 0;     // Максимум одновременно идущих сценариев
+    uint32_t dropped = 0;  // Не запущены: пул заполнен
 };
 
 class DSLProcessor {
 public:
     DSLProcessor(HardwareManager& hw);
     void begin();
+
+    // Перекомпилировать actions.bin (после замены файла).
+    // Уже запущенные сценарии дорабатывают по старому байткоду.
+    bool reload();
     
-    // Запускает НОВЫЙ параллельный процесс
-    void execute(String line); 
-    void runActionFromFile(int actionIdx);
+    // Запускает НОВЫЙ параллельный процесс; false — пул сценариев заполнен
+    bool execute(String line); 
+    void runAction(int actionIdx);
     
-    // Обновляет ВСЕ запущенные процессы
+    // Продвигает только те сценарии, чьё время пришло
     void tick(); 
     
     // Остановить вообще всё
     void stopAll();
 
+    DSLStats stats();
+
 private:
     HardwareManager& _hw;
-    std::list<DSLInstance> _activeInstances; // Список всех параллельных сценариев
+    std::shared_ptr<DSLProgram> _actions;    // Скомпилированный actions.bin
+    SemaphoreHandle_t _mutex;                // runAction() вызывается из задачи CardAct
+
+    // Пул сценариев и min-куча их номеров по wakeAt
+    DSLInstance _pool[DSL_MAX_TASKS];
+    uint8_t _free[DSL_MAX_TASKS];
+    uint8_t _freeCount = 0;
+    uint8_t _heap[DSL_MAX_TASKS];
+    uint8_t _heapSize = 0;
+    DSLStats _stats;
 
-    QueuedCommand parseSubCommand(String sub);
+    bool start(const std::shared_ptr<const DSLProgram>& program, const uint8_t* pc);
+    bool before(uint8_t a, uint8_t b) const { return (int32_t)(_pool[a].wakeAt - _pool[b].wakeAt) < 0; }
+    void heapPush(uint8_t slot);
+    uint8_t heapPop();
+    void release(uint8_t slot);
 };
 
-#endif
\ No newline at end of file
+#endif
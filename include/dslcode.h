@@ -0,0 +1,72 @@
+#ifndef DSLCODE_H
+#define DSLCODE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <vector>
+#include "esp_heap_caps.h"
+#include "outputbank.h"
+
+// Байткод сценариев DSL. Текст из actions.bin компилируется один раз при старте,
+// исполнение — это указатель команды (pc), который идёт по массиву байт.
+//
+//   OP_OPEN / OP_CLOSE  [op][маска пинов OUTPUT_MASK_BYTES LE]
+//   OP_SLEEP            [op][длительность, мс 4Б LE]
+//   OP_PULSE            [op][маска][длительность, мс 4Б LE] — импульс на таймере выходов
+//   OP_BLINK            [op][маска][вкл, мс 4Б][выкл, мс 4Б][раз 2Б LE; 0 — до отмены]
+//   OP_END              [op] — конец сценария
+
+enum DSLOpcode : uint8_t { OP_END = 0, OP_OPEN, OP_CLOSE, OP_SLEEP, OP_PULSE, OP_BLINK };
+
+// Компилирует строку сценария ("OPEN 1 2; SLEEP 500; CLOSE ALL") и дописывает OP_END.
+// Пины 1..OUTPUT_MAX_PINS: по одному, диапазоном ("OPEN 17-32") или ALL.
+// "PULSE 1 2 500" и "BLINK 3 200 300 5": числа после пинов — время и число миганий.
+// Неизвестные команды пропускаются, как и раньше. Возвращает число команд.
+uint32_t compileDSL(const char* text, size_t len, std::vector<uint8_t>& out);
+
+// Скомпилированный набор действий: байткод всех сценариев подряд и индекс начала каждого
+class DSLProgram {
+public:
+    DSLProgram() {}
+    ~DSLProgram();
+    DSLProgram(const DSLProgram&) = delete;
+    DSLProgram& operator=(const DSLProgram&) = delete;
+
+    // actions.bin: записи [длина 1Б][текст]
+    bool load(const char* path = "/actions.bin");
+    // Одиночный сценарий (команда из консоли)
+    bool compile(const char* text, size_t len);
+
+    // Начало сценария idx или nullptr, если такого нет
+    const uint8_t* action(uint32_t idx) const { return idx < _count ? _code + _offsets[idx] : nullptr; }
+    uint32_t count() const { return _count; }
+    size_t codeSize() const { return _size; }
+
+private:
+    uint8_t* _code = nullptr;       // PSRAM
+    uint32_t* _offsets = nullptr;   // PSRAM
+    uint32_t _count = 0;
+    size_t _size = 0;
+
+    bool adopt(const std::vector<uint8_t>& code, const std::vector<uint32_t>& offsets);
+    void clear();
+};
+
+#define DSL_MASK_CMD_SIZE  (1 + OUTPUT_MASK_BYTES)
+#define DSL_PULSE_CMD_SIZE (DSL_MASK_CMD_SIZE + 4)
+#define DSL_BLINK_CMD_SIZE (DSL_MASK_CMD_SIZE + 10)
+
+// Чтение аргументов команды из байткода
+static inline OutputMask dslReadMask(const uint8_t* p) {
+    OutputMask m = 0;
+    for (int i = OUTPUT_MASK_BYTES - 1; i >= 0; i--) m = (OutputMask)((m << 8) | p[i]);
+    return m;
+}
+static inline uint32_t dslReadDuration(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline uint16_t dslReadCount(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef EYTZINGER_H
+#define EYTZINGER_H
+
+#include <Arduino.h>
+#include <functional>
+#include "esp_heap_caps.h"
+
+// Сколько верхних уровней дерева держим копией во внутренней SRAM.
+// 10 уровней = 1023 ключа = 8 КБ: первые ~10 сравнений не ходят в PSRAM.
+#define EYTZ_TOP_LEVELS 10
+// Сколько поисков findBatch() ведёт одновременно
+#define EYTZ_BATCH_LANES 8
+
+// Статический индекс ключей в раскладке Эйтцингера (дерево поиска в порядке обхода в ширину).
+// Узел k имеет потомков 2k и 2k+1, поэтому соседние шаги поиска лежат рядом в памяти,
+// а следующие уровни можно заранее подтянуть в кэш.
+class EytzingerIndex {
+public:
+    EytzingerIndex() {}
+    ~EytzingerIndex();
+
+    // keyAt(i)/flagsAt(i) — i-я запись отсортированной таблицы.
+    // Возвращает false, если не хватило памяти или ключи не отсортированы.
+    bool build(uint32_t count,
+               std::function<uint64_t(uint32_t)> keyAt,
+               std::function<uint16_t(uint32_t)> flagsAt);
+    void clear();
+
+    // Точный поиск. Возвращает позицию узла (>0) или 0, если ключа нет.
+    uint32_t find(uint64_t key) const;
+    // pos[i] = find(keys[i]). EYTZ_BATCH_LANES ключей спускаются по дереву вместе:
+    // чтения PSRAM разных ключей идут вперемешку и перекрываются, а не ждут друг друга
+    void findBatch(const uint64_t* keys, uint32_t n, uint32_t* pos) const;
+    uint64_t keyAt(uint32_t pos) const { return _keys[pos]; }
+    uint16_t flagsAt(uint32_t pos) const { return _flags[pos]; }
+    // Обход записей в порядке возрастания ключей (для уплотнения журнала)
+    void forEachSorted(std::function<void(uint64_t, uint16_t)> fn) const;
+
+    uint32_t size() const { return _count; }
+    size_t memoryPSRAM() const { return _count ? (_count + 1) * (sizeof(uint64_t) + sizeof(uint16_t)) : 0; }
+    size_t memoryInternal() const { return _top ? (_topCount + 1) * sizeof(uint64_t) : 0; }
+
+#ifdef CARDDB_PROFILE
+    // Ключей прочитано из PSRAM (узлы вне верхнего каталога)
+    mutable uint64_t psramProbes = 0;
+#endif
+
+private:
+    uint64_t* _keys = nullptr;   // PSRAM, [1.._count]
+    uint16_t* _flags = nullptr;  // PSRAM, [1.._count]
+    uint64_t* _top = nullptr;    // Internal SRAM, копия [1.._topCount]
+    uint32_t _count = 0;
+    uint32_t _topCount = 0;
+};
+
+#endif
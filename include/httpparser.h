@@ -0,0 +1,82 @@
+#ifndef HTTPPARSER_H
+#define HTTPPARSER_H
+
+#include <Arduino.h>
+
+// Пошаговый разбор HTTP-запроса в буферы фиксированного размера.
+// Байты подаются любыми порциями по мере прихода из сокета, разбор
+// никогда не ждёт данных сам и не выделяет память.
+#define HTTP_MAX_LINE  256    // Строка запроса или заголовка (длиннее — обрезается)
+#define HTTP_MAX_PATH  128
+#define HTTP_MAX_AUTH  96
+#define HTTP_MAX_ETAG  24
+#define HTTP_MAX_BODY  1024   // Тело формы или JSON целиком в памяти; больше — только потоком
+
+enum HttpMethod : uint8_t { HTTP_UNKNOWN = 0, HTTP_GET, HTTP_POST, HTTP_HEAD, HTTP_DELETE };
+
+enum HttpParseState : uint8_t {
+    HTTP_REQUEST_LINE = 0,
+    HTTP_HEADERS,
+    HTTP_BODY,
+    HTTP_STREAM,  // Тело больше HTTP_MAX_BODY: дальше его читает не разборщик (setStreaming)
+    HTTP_DONE,    // Запрос принят целиком
+    HTTP_ERROR    // Ответить error() и закрыть
+};
+
+// "OK", "Not Found"... для строки статуса
+const char* httpStatusText(uint16_t status);
+
+class HttpRequestParser {
+public:
+    HttpRequestParser() { reset(); }
+    void reset();
+
+    // Возвращает, сколько байт принято; после STREAM/DONE/ERROR остальное не читается
+    size_t feed(const uint8_t* data, size_t len);
+    // Разрешить большие тела: вместо 413 разбор останавливается в HTTP_STREAM
+    // сразу после заголовков. Настройка переживает reset().
+    void setStreaming(bool on) { _streaming = on; }
+    // Тело прочитано потоком до конца
+    void endStream() { if (_state == HTTP_STREAM) _state = HTTP_DONE; }
+
+    HttpParseState state() const { return _state; }
+    bool done() const { return _state == HTTP_DONE; }
+    bool failed() const { return _state == HTTP_ERROR; }
+    bool streaming() const { return _state == HTTP_STREAM; }
+    // HTTP-статус ошибки: 400, 413, 414, 431
+    uint16_t error() const { return _error; }
+
+    HttpMethod method() const { return _method; }
+    // Путь без строки запроса; query() — то, что после '?', или ""
+    const char* path() const { return _path; }
+    const char* query() const { return _query; }
+    const char* authorization() const { return _auth; }
+    // If-None-Match без изменений, "" — не прислан
+    const char* ifNoneMatch() const { return _etag; }
+    uint32_t contentLength() const { return _contentLength; }
+    const char* body() const { return _body; }
+    size_t bodyLength() const { return _bodyLen; }
+
+private:
+    HttpParseState _state;
+    uint16_t _error;
+    HttpMethod _method;
+    char _line[HTTP_MAX_LINE];
+    uint16_t _lineLen;
+    bool _lineOverflow;
+    char _path[HTTP_MAX_PATH];
+    const char* _query;
+    char _auth[HTTP_MAX_AUTH];
+    char _etag[HTTP_MAX_ETAG];
+    uint32_t _contentLength;
+    char _body[HTTP_MAX_BODY + 1];
+    size_t _bodyLen;
+    bool _streaming = false;
+
+    void line();
+    void requestLine();
+    void header();
+    void fail(uint16_t status) { _state = HTTP_ERROR; _error = status; }
+};
+
+#endif
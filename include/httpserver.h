@@ -0,0 +1,373 @@
+#ifndef HTTPSERVER_H
+#define HTTPSERVER_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "esp_heap_caps.h"
+#include "httpparser.h"
+
+// Неблокирующий HTTP-сервер поверх сокетов W5500.
+// Каждый вызов handle() продвигает каждое соединение на один шаг: одно чтение
+// до HTTP_IO_CHUNK байт или одна запись до HTTP_WRITE_CHUNK, сколько влезает в буфер сокета.
+// Ни чтение, ни запись не ждут сеть, поэтому loop() не стоит, пока браузер
+// медленно шлёт запрос или медленно забирает страницу.
+#define HTTP_MAX_CLIENTS        4       // Из 8 сокетов W5500
+#define HTTP_IO_CHUNK           512
+#define HTTP_WRITE_CHUNK        1460    // Полный TCP-сегмент за одну запись в W5500
+#define HTTP_MAX_HEAD           256
+#define HTTP_REQUEST_TIMEOUT_MS 2000    // На приём всего запроса, как раньше
+#define HTTP_SEND_TIMEOUT_MS    5000    // Клиент не забирает ответ
+#define HTTP_CLOSE_WAIT_MS      2       // stop() ждёт ответный FIN не дольше
+#define HTTP_STREAM_IDLE_MS     5000    // Большое тело: ни байта от клиента или обработчик не берёт
+
+// Ответ: заголовок в фиксированном буфере, тело из памяти, из файла LittleFS
+// или из генератора. Сервер отдаёт его частями, пока сокет принимает.
+class HttpResponse {
+public:
+    // Генератор тела: кладёт в buf байты тела с offset, не больше cap, и возвращает их число
+    typedef size_t (*BodyFill)(void* ctx, size_t offset, uint8_t* buf, size_t cap);
+
+    ~HttpResponse() {
+        if (_heap) heap_caps_free(_heap);
+        if (_fillRelease) _fillRelease(_fillCtx);
+    }
+
+    void reset() {
+        if (_heap) heap_caps_free(_heap);
+        _heap = nullptr;
+        if (_fillRelease) _fillRelease(_fillCtx);
+        _fill = nullptr;
+        _fillCtx = nullptr;
+        _fillRelease = nullptr;
+        _headLen = _headSent = 0;
+        _owned = String();
+        _body = nullptr;
+        _bodyLen = _bodySent = 0;
+        if (_file) _file.close();
+        _file = File();
+        _chunkLen = _chunkPos = 0;
+    }
+
+    // extra — дополнительные заголовки, каждый с "\r\n" в конце
+    void send(uint16_t status, const char* type, const String& body, const char* extra = "") {
+        _owned = body;
+        sendStatic(status, type, _owned.c_str(), _owned.length(), extra);
+    }
+    // Тело живёт дольше ответа (константа во флеше)
+    void sendStatic(uint16_t status, const char* type, const char* body, size_t len, const char* extra = "") {
+        head(status, type, len, extra);
+        _body = body;
+        _bodyLen = len;
+        _bodySent = 0;
+    }
+    void sendStatus(uint16_t status, const char* extra = "") {
+        sendStatic(status, "text/plain", httpStatusText(status), strlen(httpStatusText(status)), extra);
+    }
+    // Тело из heap_caps_malloc (большой ответ в PSRAM): буфер освобождается вместе с ответом
+    void sendOwned(uint16_t status, const char* type, uint8_t* body, size_t len, const char* extra = "") {
+        sendStatic(status, type, (const char*)body, len, extra);
+        _heap = body;
+    }
+    // Файл целиком, кусками по HTTP_WRITE_CHUNK; закрывается вместе с ответом
+    void sendFile(uint16_t status, const char* type, File file, const char* extra = "") {
+        size_t len = file.size();
+        head(status, type, len, extra);
+        _file = file;
+        _bodyLen = len;
+        _bodySent = 0;
+    }
+
+    // Тело длиной len генерируется частями по HTTP_WRITE_CHUNK прямо в буфер отправки слота,
+    // когда предыдущая часть ушла в сокет. ctx живёт до конца ответа, потом отдаётся release
+    void sendStream(uint16_t status, const char* type, size_t len, BodyFill fill, void* ctx,
+                    void (*release)(void*), const char* extra = "") {
+        head(status, type, len, extra);
+        _fill = fill;
+        _fillCtx = ctx;
+        _fillRelease = release;
+        _bodyLen = len;
+        _bodySent = 0;
+    }
+
+    // Тело пишется прямо в буфер отправки слота (JSON и т. п.), без промежуточной String
+    char* bodyBuffer() { return (char*)_chunk; }
+    static size_t bodyCapacity() { return HTTP_WRITE_CHUNK; }
+    void sendBuffer(uint16_t status, const char* type, size_t len, const char* extra = "") {
+        if (len > HTTP_WRITE_CHUNK) len = HTTP_WRITE_CHUNK;
+        sendStatic(status, type, (const char*)_chunk, len, extra);
+    }
+
+    bool ready() const { return _headLen > 0; }
+    bool finished() const { return _headSent == _headLen && _bodySent == _bodyLen; }
+    // Следующий непрерывный кусок к отправке
+    const uint8_t* next(size_t& len) {
+        if (_headSent < _headLen) { len = _headLen - _headSent; return (const uint8_t*)_head + _headSent; }
+        if (_file || _fill) {
+            if (_chunkPos == _chunkLen) {
+                size_t want = _bodyLen - _bodySent < sizeof(_chunk) ? _bodyLen - _bodySent : sizeof(_chunk);
+                _chunkLen = _file ? _file.read(_chunk, sizeof(_chunk)) : _fill(_fillCtx, _bodySent, _chunk, want);
+                _chunkPos = 0;
+                // Файл (или тело генератора) оказался короче заявленного — дальше отдавать нечего
+                if (!_chunkLen) _bodyLen = _bodySent;
+            }
+            len = _chunkLen - _chunkPos;
+            return _chunk + _chunkPos;
+        }
+        len = _bodyLen - _bodySent;
+        return (const uint8_t*)_body + _bodySent;
+    }
+    void consume(size_t n) {
+        size_t h = _headLen - _headSent;
+        if (h > n) h = n;
+        _headSent += h;
+        _bodySent += n - h;
+        _chunkPos += n - h;
+    }
+
+private:
+    char _head[HTTP_MAX_HEAD];
+    size_t _headLen = 0, _headSent = 0;
+    String _owned;
+    uint8_t* _heap = nullptr;
+    const char* _body = nullptr;
+    size_t _bodyLen = 0, _bodySent = 0;
+    File _file;
+    BodyFill _fill = nullptr;
+    void* _fillCtx = nullptr;
+    void (*_fillRelease)(void*) = nullptr;
+    uint8_t _chunk[HTTP_WRITE_CHUNK];
+    size_t _chunkLen = 0, _chunkPos = 0;
+
+    void head(uint16_t status, const char* type, size_t len, const char* extra) {
+        int n = snprintf(_head, sizeof(_head),
+                         "HTTP/1.1 %u %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: close\r\n%s\r\n",
+                         status, httpStatusText(status), type, (unsigned)len, extra);
+        _headLen = (n > 0 && (size_t)n < sizeof(_head)) ? n : 0;
+        _headSent = 0;
+    }
+};
+
+struct HttpServerStats {
+    uint32_t accepted = 0;
+    uint32_t requests = 0;    // Дошли до обработчика
+    uint32_t errors = 0;      // Запрос не разобран (4xx от разборщика)
+    uint32_t timeouts = 0;
+    uint32_t rejected = 0;    // Все слоты заняты — 503
+    uint32_t streamed = 0;    // Тела больше HTTP_MAX_BODY, принятые обработчиком потоком
+    uint32_t maxStepUs = 0;   // Самый долгий handle()
+};
+
+// Server: accept() -> Client. Client: как EthernetClient (available, read, availableForWrite,
+// write, connected, stop, setConnectionTimeout). Handler: route(req, res) заполняет res.
+// Тело больше HTTP_MAX_BODY обработчик читает сам:
+//   bodyBegin(req, res)        — по заголовкам: принять? false — ответ в res (или 413)
+//   bodyWrite(req, data, len)  — очередная порция; вернуть, сколько принято (0 — позже)
+//   bodyAbort(req)             — клиент ушёл или замолчал, не дослав тело
+// После последней порции вызывается обычный route().
+template <typename Server, typename Client, typename Handler>
+class HttpServerT {
+public:
+    explicit HttpServerT(Handler& handler) : _handler(handler) {
+        for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++) _slots[i].req.setStreaming(true);
+    }
+
+    void begin(Server* server) { _server = server; }
+
+    void handle() {
+        if (!_server) return;
+        uint32_t t0 = micros();
+        acceptOne();
+        for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++) {
+            if (_slots[i].state != SLOT_FREE) step(_slots[i]);
+        }
+        uint32_t dt = micros() - t0;
+        if (dt > _stats.maxStepUs) _stats.maxStepUs = dt;
+    }
+
+    uint8_t active() const {
+        uint8_t n = 0;
+        for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++) n += _slots[i].state != SLOT_FREE;
+        return n;
+    }
+    const HttpServerStats& stats() const { return _stats; }
+
+private:
+    enum SlotState : uint8_t { SLOT_FREE = 0, SLOT_READING, SLOT_STREAMING, SLOT_WRITING, SLOT_DRAINING };
+
+    struct Slot {
+        Client client;
+        SlotState state = SLOT_FREE;
+        uint32_t since = 0;       // millis() начала текущей фазы
+        int txEmpty = 0;          // availableForWrite() пустого сокета
+        uint32_t left = 0;        // STREAMING: байт тела ещё в сокете
+        size_t pendPos = 0, pendLen = 0;   // STREAMING: прочитано, но обработчик ещё не взял
+        HttpRequestParser req;
+        HttpResponse res;
+    };
+
+    Handler& _handler;
+    Server* _server = nullptr;
+    Slot _slots[HTTP_MAX_CLIENTS];
+    HttpServerStats _stats;
+
+    void acceptOne() {
+        Client c = _server->accept();
+        if (!c) return;
+        _stats.accepted++;
+        for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++) {
+            Slot& s = _slots[i];
+            if (s.state != SLOT_FREE) continue;
+            s.client = c;
+            s.state = SLOT_READING;
+            s.since = millis();
+            s.txEmpty = c.availableForWrite();
+            s.req.reset();
+            s.res.reset();
+            return;
+        }
+        // Короткий ответ целиком влезает в буфер сокета
+        _stats.rejected++;
+        static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+        c.write((const uint8_t*)busy, sizeof(busy) - 1);
+        c.setConnectionTimeout(HTTP_CLOSE_WAIT_MS);
+        c.stop();
+    }
+
+    void step(Slot& s) {
+        uint32_t now = millis();
+        switch (s.state) {
+            case SLOT_READING: {
+                int avail = s.client.available();
+                if (avail > 0) {
+                    uint8_t buf[HTTP_IO_CHUNK];
+                    int n = s.client.read(buf, avail < HTTP_IO_CHUNK ? avail : HTTP_IO_CHUNK);
+                    size_t used = n > 0 ? s.req.feed(buf, n) : 0;
+                    if (s.req.streaming()) {
+                        startStreaming(s, buf + used, n - used, now);
+                    } else if (s.req.done()) {
+                        _stats.requests++;
+                        _handler.route(s.req, s.res);
+                        if (!s.res.ready()) s.res.sendStatus(500);
+                        startWriting(s, now);
+                    } else if (s.req.failed()) {
+                        _stats.errors++;
+                        s.res.sendStatus(s.req.error());
+                        startWriting(s, now);
+                    }
+                } else if (!s.client.connected()) {
+                    close(s);   // Клиент ушёл, не дослав запрос
+                    break;
+                }
+                // Срок на весь запрос, а не на тишину: иначе по байту в секунду можно держать слот вечно
+                if (s.state == SLOT_READING && now - s.since > HTTP_REQUEST_TIMEOUT_MS) {
+                    _stats.timeouts++;
+                    s.res.sendStatus(408);
+                    startWriting(s, now);
+                }
+                break;
+            }
+            case SLOT_STREAMING: {
+                // Следующее чтение — только когда обработчик забрал предыдущее:
+                // пока он занят, тело ждёт в окне TCP, а не в памяти
+                if (s.pendLen == 0 && s.left > 0) {
+                    int avail = s.client.available();
+                    if (avail > 0) {
+                        size_t want = (size_t)avail < s.left ? (size_t)avail : s.left;
+                        if (want > HTTP_WRITE_CHUNK) want = HTTP_WRITE_CHUNK;
+                        int n = s.client.read((uint8_t*)s.res.bodyBuffer(), want);
+                        if (n > 0) {
+                            s.pendPos = 0;
+                            s.pendLen = n;
+                            s.left -= n;
+                        }
+                    } else if (!s.client.connected()) {
+                        _handler.bodyAbort(s.req);
+                        close(s);
+                        break;
+                    }
+                }
+                if (s.pendLen) {
+                    size_t k = _handler.bodyWrite(s.req, (const uint8_t*)s.res.bodyBuffer() + s.pendPos, s.pendLen);
+                    s.pendPos += k;
+                    s.pendLen -= k;
+                    if (k) s.since = now;
+                }
+                if (s.left == 0 && s.pendLen == 0) {
+                    s.req.endStream();
+                    _stats.requests++;
+                    _handler.route(s.req, s.res);
+                    if (!s.res.ready()) s.res.sendStatus(500);
+                    startWriting(s, now);
+                } else if (now - s.since > HTTP_STREAM_IDLE_MS) {
+                    _stats.timeouts++;
+                    _handler.bodyAbort(s.req);
+                    s.res.sendStatus(408);
+                    startWriting(s, now);
+                }
+                break;
+            }
+            case SLOT_WRITING: {
+                if (!s.client.connected()) { close(s); break; }
+                int room = s.client.availableForWrite();
+                if (room > 0) {
+                    size_t len;
+                    const uint8_t* p = s.res.next(len);
+                    if (len > (size_t)room) len = room;
+                    if (len > HTTP_WRITE_CHUNK) len = HTTP_WRITE_CHUNK;
+                    size_t n = len ? s.client.write(p, len) : 0;
+                    s.res.consume(n);
+                    if (n) s.since = now;
+                }
+                if (s.res.finished()) {
+                    s.state = SLOT_DRAINING;
+                    s.since = now;
+                } else if (now - s.since > HTTP_SEND_TIMEOUT_MS) {
+                    _stats.timeouts++;
+                    close(s);
+                }
+                break;
+            }
+            case SLOT_DRAINING:
+                // stop() сразу после записи ждал бы подтверждения данных;
+                // закрываем, когда клиент подтвердил всё отправленное
+                if (s.client.availableForWrite() >= s.txEmpty || !s.client.connected() ||
+                    now - s.since > HTTP_SEND_TIMEOUT_MS) close(s);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Заголовки большого тела прочитаны; rest — начало тела, пришедшее с ними
+    void startStreaming(Slot& s, const uint8_t* rest, size_t len, uint32_t now) {
+        if (!_handler.bodyBegin(s.req, s.res)) {
+            if (!s.res.ready()) s.res.sendStatus(413);
+            startWriting(s, now);
+            return;
+        }
+        _stats.streamed++;
+        if (len > s.req.contentLength()) len = s.req.contentLength();
+        // Буфер ответа до route() свободен — в нём ждёт непринятая порция тела
+        memcpy(s.res.bodyBuffer(), rest, len);
+        s.pendPos = 0;
+        s.pendLen = len;
+        s.left = s.req.contentLength() - len;
+        s.state = SLOT_STREAMING;
+        s.since = now;
+    }
+
+    void startWriting(Slot& s, uint32_t now) {
+        s.state = SLOT_WRITING;
+        s.since = now;
+    }
+
+    void close(Slot& s) {
+        s.client.setConnectionTimeout(HTTP_CLOSE_WAIT_MS);
+        s.client.stop();
+        s.client = Client();
+        s.res.reset();
+        s.state = SLOT_FREE;
+    }
+};
+
+#endif
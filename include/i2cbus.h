@@ -0,0 +1,94 @@
+#ifndef I2CBUS_H
+#define I2CBUS_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <atomic>
+#include "latency.h"
+
+// Задача, владеющая шиной I2C: только она вызывает Wire.
+#define I2C_BUS_PRIO        6
+#define I2C_BUS_CORE        1
+#define I2C_READ_QUEUE      8
+#define I2C_MAX_OUTPUTS     8
+#define I2C_READ_RETRIES    1     // Чтение срочное: одна повторная попытка сразу
+#define I2C_WRITE_RETRIES   2     // Запись повторяется сразу, потом — через I2C_RETRY_MS
+#define I2C_RETRY_MS        10
+
+enum I2CClass : uint8_t { I2C_CLASS_READ = 0, I2C_CLASS_WRITE = 1, I2C_CLASS_COUNT };
+
+struct I2CClassStats {
+    uint32_t requests = 0;   // Запрошено (для записей — до слияния)
+    uint32_t done = 0;       // Выполнено транзакций
+    uint32_t retries = 0;
+    uint32_t errors = 0;     // Транзакции, не прошедшие и после повторов
+    uint32_t dropped = 0;    // Чтения: очередь полна
+    StageLatency latency;    // Запрос -> завершение
+};
+
+struct I2CBusStats {
+    I2CClassStats cls[I2C_CLASS_COUNT];
+    uint32_t utilization;    // Доля занятости шины за последнюю секунду, 0.1 %
+};
+
+// Очередь транзакций с приоритетами.
+// Чтения входов срочные: между любыми двумя транзакциями сначала выбираются
+// все ждущие чтения, поэтому чтение ждёт не дольше одной записи.
+// Записи выходов сливаются по расширителю: хранится только последнее значение
+// байта, и сколько бы раз его ни меняли до отправки, на шину уйдёт одна запись.
+class I2CBus {
+public:
+    I2CBus();
+
+    // Регистрация расширителей выходов — до begin()
+    bool addOutput(uint8_t addr, uint8_t initial = 0xFF);
+    void begin();
+
+    // Синхронное чтение байта: ставит запрос в очередь и ждёт задачу шины.
+    // false — очередь полна или устройство не ответило.
+    bool read8(uint8_t addr, uint8_t& data);
+
+    // Запомнить байт для расширителя; задача шины отправит его, когда освободится
+    bool write8(uint8_t addr, uint8_t value);
+
+    I2CBusStats stats() const;
+    void printStats() const;
+
+private:
+    struct ReadRequest {
+        uint8_t addr;
+        uint8_t data;
+        bool ok;
+        uint32_t tQueued;
+        SemaphoreHandle_t done;
+    };
+
+    struct Output {
+        uint8_t addr;
+        std::atomic<uint16_t> pending{0};   // 0x100 | байт — ждёт отправки
+        std::atomic<uint32_t> since{0};     // micros() первого неотправленного изменения
+        uint32_t retryAt = 0;               // millis() следующей попытки после ошибки; 0 — нет
+    };
+
+    QueueHandle_t _reads = nullptr;
+    TaskHandle_t _task = nullptr;
+    Output _outputs[I2C_MAX_OUTPUTS];
+    uint8_t _outputCount = 0;
+    uint8_t _nextOutput = 0;                // Круговой обход при отправке
+    bool _retryPending = false;
+
+    I2CClassStats _stats[I2C_CLASS_COUNT];
+    std::atomic<uint32_t> _readRequests{0};
+    std::atomic<uint32_t> _readDropped{0};
+    std::atomic<uint32_t> _writeRequests{0};
+    uint32_t _busyUs = 0;
+    uint32_t _windowStart = 0;
+    uint32_t _utilization = 0;
+
+    static void busTask(void* arg);
+    void doRead(ReadRequest* r);
+    bool flushOne();
+    void account(uint32_t nowUs);
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Задержка в микросекундах: последняя, скользящее среднее и максимум.
+// Пишет одна задача, читать можно из любой.
+struct StageLatency {
+    uint32_t count = 0;
+    uint32_t lastUs = 0;
+    uint32_t avgUs = 0;    // Скользящее среднее, вес 1/8
+    uint32_t maxUs = 0;
+
+    void add(uint32_t us) {
+        lastUs = us;
+        avgUs = count ? avgUs - avgUs / 8 + us / 8 : us;
+        if (us > maxUs) maxUs = us;
+        count++;
+    }
+};
+
+#endif
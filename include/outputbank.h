@@ -0,0 +1,106 @@
+#ifndef OUTPUTBANK_H
+#define OUTPUTBANK_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Ширина маски выходов задаётся при сборке: -D OUTPUT_MASK_BITS=16/32/64.
+// 32 бита атомарны на ESP32 без блокировок; 64 работают через атомики IDF
+// с критической секцией, зато дают 64 реле (8 расширителей).
+#ifndef OUTPUT_MASK_BITS
+#define OUTPUT_MASK_BITS 32
+#endif
+
+#if OUTPUT_MASK_BITS == 16
+typedef uint16_t OutputMask;
+#elif OUTPUT_MASK_BITS == 32
+typedef uint32_t OutputMask;
+#elif OUTPUT_MASK_BITS == 64
+typedef uint64_t OutputMask;
+#else
+#error "OUTPUT_MASK_BITS must be 16, 32 or 64"
+#endif
+
+#define OUTPUT_MAX_PINS      OUTPUT_MASK_BITS
+#define OUTPUT_MASK_BYTES    (OUTPUT_MASK_BITS / 8)
+
+// Теневой регистр банка выходов: бит n — выход n, байт i — расширитель i.
+// Изменения атомарны и увеличивают поколение; flush() отдаёт шине только
+// байты, изменившиеся с прошлой отправки, по одному на расширитель.
+template <typename Mask>
+class OutputBankT {
+public:
+    static const uint8_t maxExpanders = sizeof(Mask);
+
+    // Расширители — до начала работы, по порядку байтов регистра
+    bool addExpander(uint8_t addr) {
+        if (_count >= maxExpanders) return false;
+        _addr[_count++] = addr;
+        return true;
+    }
+
+    // Начальное состояние: считается уже отправленным, его пишет init
+    void reset(Mask value) {
+        _value.store(value);
+        _sent = value;
+        _flushedGen = _gen.load();
+    }
+
+    // Сначала гасит clearMask, затем поднимает setMask
+    void writeMask(Mask setMask, Mask clearMask) {
+        Mask old = _value.load(std::memory_order_relaxed);
+        Mask next;
+        do {
+            next = (old & ~clearMask) | setMask;
+            if (next == old) return;
+        } while (!_value.compare_exchange_weak(old, next, std::memory_order_acq_rel, std::memory_order_relaxed));
+        _gen.fetch_add(1, std::memory_order_release);
+    }
+
+    Mask value() const { return _value.load(std::memory_order_acquire); }
+    uint8_t expanders() const { return _count; }
+    uint8_t address(uint8_t i) const { return _addr[i]; }
+    // Выходы, за которыми есть расширитель
+    Mask wired() const { return (_count >= maxExpanders) ? (Mask)~(Mask)0 : (Mask)(((Mask)1 << (8 * _count)) - 1); }
+
+    // fn(addr, byte) -> true, если байт принят к отправке. Возвращает число отданных байтов.
+    // Вызывается из одной задачи.
+    template <typename Fn>
+    uint8_t flush(Fn fn) {
+        // Поколение читается раньше значения: изменение между ними попадёт в следующий вызов
+        uint32_t gen = _gen.load(std::memory_order_acquire);
+        if (gen == _flushedGen) return 0;
+        Mask value = _value.load(std::memory_order_acquire);
+        Mask diff = (value ^ _sent) & wired();
+        uint8_t n = 0;
+        bool all = true;
+        // Перебираем только изменившиеся байты, а не все расширители
+        while (diff) {
+            uint8_t i = ctz(diff) / 8;
+            Mask byteMask = (Mask)0xFF << (8 * i);
+            diff &= ~byteMask;
+            if (fn(_addr[i], (uint8_t)(value >> (8 * i)))) {
+                _sent = (_sent & ~byteMask) | (value & byteMask);
+                n++;
+            } else {
+                all = false;
+            }
+        }
+        if (all) _flushedGen = gen;
+        return n;
+    }
+
+private:
+    std::atomic<Mask> _value{(Mask)~(Mask)0};
+    std::atomic<uint32_t> _gen{1};
+    uint32_t _flushedGen = 0;
+    Mask _sent = (Mask)~(Mask)0;
+    uint8_t _addr[sizeof(Mask)] = {};
+    uint8_t _count = 0;
+
+    static uint8_t ctz(Mask m) { return (sizeof(Mask) > 4) ? __builtin_ctzll(m) : __builtin_ctz(m); }
+};
+
+typedef OutputBankT<OutputMask> OutputBank;
+
+#endif
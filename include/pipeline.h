@@ -0,0 +1,90 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <Arduino.h>
+#include "spsc.h"
+#include "latency.h"
+
+class CardDatabase;
+class DSLProcessor;
+
+// Конвейер обработки карт:
+//   WiegandTask (декодер фронтов) -> [кадры] -> CardDecide (поиск в базе)
+//   -> [действия] -> CardAct (запуск сценариев DSL)
+// Стадии связаны SPSC-кольцами без блокировок: декодер не ждёт ни поиска,
+// ни DSL и не пропускает биты, пока идёт обработка предыдущей карты.
+#define PIPE_FRAME_DEPTH   16
+#define PIPE_ACTION_DEPTH  32
+
+// Задачи стадий: приоритет и ядро. Декодер — самый срочный (биты идут раз в ~2 мс),
+// поиск вынесен на ядро 0 к фоновому уплотнению базы (у того приоритет 1).
+// Исполнение — тоже на ядре 0: без линии INT декодер опрашивает расширители
+// непрерывно (delayMicroseconds, а не сон — спад длится ~50 мкс) и отпускает ядро 1
+// только на время чтения I2C. Стадия ниже него на том же ядре ждала бы этих окон.
+#define PIPE_DECODE_PRIO   5
+#define PIPE_DECODE_CORE   1
+#define PIPE_DECIDE_PRIO   4
+#define PIPE_DECIDE_CORE   0
+#define PIPE_ACT_PRIO      3
+#define PIPE_ACT_CORE      0
+
+// Готовый кадр от считывателя
+struct CardFrame {
+    uint64_t uid = 0;
+    uint32_t t = 0;        // micros() в момент выдачи кадра
+    uint16_t group = 0;    // Группа считывателя из config.json
+    uint8_t bits = 0;
+    uint8_t reader = 0;    // Номер считывателя
+};
+
+// Решение: какой сценарий запустить
+struct ActionEvent {
+    uint32_t tFrame = 0;   // micros() кадра, из которого получено решение
+    uint32_t tDecided = 0;
+    uint16_t action = 0;   // Номер действия из actions.bin (с 1)
+};
+
+struct RingStats {
+    uint32_t depth, peak, capacity, dropped;
+};
+
+struct PipelineStats {
+    RingStats frames;
+    RingStats actions;
+    StageLatency decide;   // Кадр -> решение (очередь + поиск)
+    StageLatency act;      // Решение -> сценарий запущен
+    StageLatency total;    // Кадр -> сценарий запущен
+};
+
+class CardPipeline {
+public:
+    CardPipeline(CardDatabase& db, DSLProcessor& dsl) : _db(db), _dsl(dsl) {}
+
+    // Запускает задачи CardDecide и CardAct. Вызывать до старта декодера.
+    void begin();
+
+    // Стадия декодера: отдаёт кадр дальше и сразу возвращается.
+    // Единственный писатель — задача WiegandTask.
+    bool submit(const CardFrame& f);
+
+    PipelineStats stats() const;
+    void printStats() const;
+
+private:
+    CardDatabase& _db;
+    DSLProcessor& _dsl;
+    SpscRing<CardFrame, PIPE_FRAME_DEPTH> _frames;
+    SpscRing<ActionEvent, PIPE_ACTION_DEPTH> _actions;
+    TaskHandle_t _decideTask = nullptr;
+    TaskHandle_t _actTask = nullptr;
+    StageLatency _decideLat;
+    StageLatency _actLat;
+    StageLatency _totalLat;
+
+    static void decideTask(void* arg);
+    static void actTask(void* arg);
+    void decide(const CardFrame& f);
+    void act(const ActionEvent& ev);
+};
+
+#endif
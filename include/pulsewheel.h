@@ -0,0 +1,84 @@
+#ifndef PULSEWHEEL_H
+#define PULSEWHEEL_H
+
+#include <Arduino.h>
+#include "outputbank.h"
+
+// Колесо таймеров импульсов: тик 1 мс, PULSE_WHEEL_SLOTS ячеек.
+// Задержка длиннее оборота колеса хранится как число оставшихся оборотов.
+// Взвод, отмена и срабатывание — O(1) на импульс.
+#define PULSE_WHEEL_SLOTS 256
+#define PULSE_MAX         64
+#define PULSE_NONE        0xFFFF
+
+// Что поменять на выходах после вызова: активный уровень — LOW (как OPEN)
+struct PulseOut {
+    OutputMask set = 0;     // Отпустить (HIGH)
+    OutputMask clear = 0;   // Включить (LOW)
+    bool any() const { return (set | clear) != 0; }
+};
+
+struct PulseStats {
+    uint32_t active = 0;
+    uint32_t peak = 0;
+    uint32_t expired = 0;
+    uint32_t cancelled = 0;
+    uint32_t dropped = 0;    // Пул занят
+};
+
+// Чистая логика без таймера и железа: время двигает advance(), изменения
+// выходов копятся в PulseOut. Несколько импульсов на одном пине складываются:
+// пин держится включённым, пока его держит хотя бы один импульс.
+class PulseWheel {
+public:
+    PulseWheel();
+
+    // Включить pins на ms. Возвращает дескриптор (0 — пул занят).
+    uint32_t pulse(OutputMask pins, uint32_t ms, PulseOut& out);
+    // onMs включено / offMs выключено, count раз (0 — до отмены)
+    uint32_t blink(OutputMask pins, uint32_t onMs, uint32_t offMs, uint32_t count, PulseOut& out);
+
+    bool cancel(uint32_t handle, PulseOut& out);
+    // Все импульсы, задевающие pins
+    uint32_t cancelPins(OutputMask pins, PulseOut& out);
+    void cancelAll(PulseOut& out);
+
+    // Прошло ticks миллисекунд
+    void advance(uint32_t ticks, PulseOut& out);
+
+    uint32_t active() const { return _stats.active; }
+    const PulseStats& stats() const { return _stats; }
+
+private:
+    struct Entry {
+        OutputMask pins;
+        uint32_t rounds;      // Полных оборотов колеса до срабатывания
+        uint32_t onTicks;
+        uint32_t offTicks;    // 0 — простой импульс
+        uint32_t left;        // BLINK: сколько включений осталось; 0 — бесконечно
+        uint16_t prev, next;
+        uint16_t slot;
+        uint8_t gen;          // Защита от устаревшего дескриптора
+        bool on;              // Сейчас в фазе "включено"
+        bool used;
+    };
+
+    Entry _e[PULSE_MAX];
+    uint16_t _slots[PULSE_WHEEL_SLOTS];
+    uint16_t _free[PULSE_MAX];
+    uint16_t _freeCount = 0;
+    uint8_t _holders[OUTPUT_MAX_PINS];   // Сколько импульсов держат пин
+    uint32_t _now = 0;
+    PulseStats _stats;
+
+    uint32_t start(OutputMask pins, uint32_t onMs, uint32_t offMs, uint32_t count, PulseOut& out);
+    void arm(uint16_t i, uint32_t ticks);
+    void unlink(uint16_t i);
+    void release(uint16_t i);
+    void hold(OutputMask pins, PulseOut& out);
+    void unhold(OutputMask pins, PulseOut& out);
+    void expire(uint16_t i, PulseOut& out);
+    int find(uint32_t handle) const;
+};
+
+#endif
@@ -4,7 +4,23 @@
 #include <Arduino.h>
 #include <LittleFS.h>
 #include <vector>
+#include <atomic>
 #include "esp_heap_caps.h"
+#include "eytzinger.h"
+#include "cardfile.h"
+#include "cardimage.h"
+#include "cardjournal.h"
+#include "cardfilter.h"
+#include "cardcache.h"
+
+// Сколько изменений держим в слое поверх базовых таблиц
+#define CARD_DELTA_CAPACITY   1024
+// При скольких изменениях уплотнение запускается, не дожидаясь таймера
+#define CARD_DELTA_COMPACT_AT 256
+#define CARD_COMPACT_PERIOD_MS 60000
+// В режиме FLASH_MAPPED уплотнение перезаписывает раздел carddb: по таймеру раз в 6 часов,
+// чтобы не изнашивать флеш, а при CARD_DELTA_COMPACT_AT изменениях — сразу
+#define CARD_COMPACT_FLASH_PERIOD_MS (6UL * 3600 * 1000)
 
 struct Instruction {
     uint8_t mask;      
@@ -15,6 +31,86 @@ struct Instruction {
     uint8_t action;    
 };
 
+// Группа после распаковки при загрузке: диапазон инструкций в общем массиве
+// (одинаковые списки у разных групп хранятся один раз) и готовая сводка по нему
+struct CardGroup {
+    uint32_t offset;      // Начало в groupInstr
+    uint8_t count;
+    uint8_t topAction;    // action инструкции с наибольшим priority, 0 — действий нет
+    uint16_t actionMask;  // Бит N — в группе есть action N
+};
+static_assert(sizeof(CardGroup) == 8, "CardGroup layout");
+
+// Где найдена карта
+enum class CardSource : uint8_t { NONE = 0, PSRAM_34, PSRAM_56, FLASH_34, FLASH_56, DELTA };
+const char* cardSourceName(CardSource source);
+
+// Невладеющий диапазон инструкций группы. Память принадлежит набору таблиц
+// CardDatabase; набор не освобождается, пока жив CardView, который на него смотрит.
+struct InstructionSpan {
+    const Instruction* ptr = nullptr;
+    uint16_t count = 0;
+
+    const Instruction* begin() const { return ptr; }
+    const Instruction* end() const { return ptr + count; }
+    uint16_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const Instruction& operator[](size_t i) const { return ptr[i]; }
+};
+
+// Отметка читателя: пока она жива, уплотнение и reload() не освобождают старый набор таблиц
+class CardReadPin {
+public:
+    CardReadPin() {}
+    explicit CardReadPin(std::atomic<uint32_t>& readers) : _readers(&readers) { readers++; }
+    CardReadPin(CardReadPin&& o) : _readers(o._readers) { o._readers = nullptr; }
+    CardReadPin& operator=(CardReadPin&& o) {
+        if (this != &o) { release(); _readers = o._readers; o._readers = nullptr; }
+        return *this;
+    }
+    CardReadPin(const CardReadPin&) = delete;
+    CardReadPin& operator=(const CardReadPin&) = delete;
+    ~CardReadPin() { release(); }
+
+    void release() {
+        if (_readers) { (*_readers)--; _readers = nullptr; }
+    }
+
+private:
+    std::atomic<uint32_t>* _readers = nullptr;
+};
+
+// Результат поиска без аллокаций — для горячего пути считывания карты.
+// Если инструкции не пусты, CardView держит набор таблиц (pin) и только перемещается.
+// Держать его дольше решения по карте нельзя: compact(), reload() и begin() ждут,
+// пока отпустят все CardView, — из того же потока это взаимоблокировка.
+struct CardView {
+    bool found = false;
+    uint64_t uid = 0;
+    uint8_t status = 0;
+    uint8_t limit = 0;
+    uint16_t group_id = 0;
+    InstructionSpan instructions;
+    uint8_t topAction = 0;
+    uint16_t actionMask = 0;
+    uint32_t search_time_us = 0;
+    CardSource source = CardSource::NONE;
+    bool cached = false;   // Решение взято из кэша горячих карт
+    CardReadPin pin;
+};
+
+// Результат пакетной проверки (findBatch): 4 байта на карту вместо CardView
+struct CardMembership {
+    uint16_t flags = 0;                     // Группа и лимит, как в записи таблицы
+    CardSource source = CardSource::NONE;   // NONE — карты нет
+    uint8_t reserved = 0;
+
+    bool found() const { return source != CardSource::NONE; }
+    uint16_t group() const { return flags & 0x3FFF; }
+    uint8_t limit() const { return (flags >> 14) & 0x03; }
+};
+static_assert(sizeof(CardMembership) == 4, "CardMembership layout");
+
 struct CardResult {
     bool found = false;
     uint64_t uid = 0;
@@ -23,38 +119,180 @@ struct CardResult {
     uint16_t group_id = 0;
     std::vector<Instruction> instructions;
     uint32_t search_time_us = 0;
-    String source = "PSRAM";
+    CardSource source = CardSource::NONE;
+};
+
+// Файлы базы на LittleFS: cards34.bin, cards56.bin, groups.bin, rules.bin
+#define CARD_DB_FILES 4
+extern const char* const cardDbFiles[CARD_DB_FILES];
+
+// Подмена файлов в reload(): основные уходят в *.old, пока метка лежит на диске.
+// begin() после сбоя посреди подмены возвращает весь старый набор
+#define CARD_DB_BACKUP_SUFFIX ".old"
+#define CARD_DB_SWAP_MARK     "/cards.swap"
+
+// Порция чтения файлов базы при загрузке
+#define CARDDB_READ_CHUNK 16384
+
+// Время загрузки по файлам, мкс (0 — файл не загружался)
+struct CardLoadStats {
+    uint32_t cards34Us = 0;
+    uint32_t cards56Us = 0;
+    uint32_t groupsUs = 0;
+    uint32_t rulesUs = 0;
+    uint32_t instrUs = 0;   // Распаковка инструкций групп
+};
+
+// Раскладка индекса карт (config.json: database.index)
+enum class CardIndexLayout : uint8_t {
+    BINARY = 0,   // Бинарный поиск прямо по записям файла
+    EYTZINGER     // Дерево Эйтцингера, верхние уровни во внутренней SRAM
+};
+
+// Где живут таблицы (config.json: database.storage)
+enum class CardStorage : uint8_t {
+    PSRAM = 0,     // Копия файлов LittleFS в PSRAM
+    FLASH_MAPPED   // Образ в разделе carddb, читается через esp_partition_mmap
+};
+
+// Один согласованный набор таблиц. Поиск читает неизменяемый набор,
+// замена (уплотнение журнала) — атомарная подмена указателя на набор.
+struct CardTables {
+    CardRecord34* cards34 = nullptr;
+    CardRecord56* cards56 = nullptr;
+    uint32_t total34 = 0;
+    uint32_t total56 = 0;
+    EytzingerIndex index34;
+    EytzingerIndex index56;
+
+    // Распакованные инструкции всех групп подряд (индексируются groups[].offset)
+    CardGroup* groups = nullptr;
+    Instruction* groupInstr = nullptr;
+    uint32_t totalGroups = 0;
+    uint32_t totalInstr = 0;
+    bool ownsGroups = true;   // Таблицы групп могут перейти к следующему набору
+
+    // Отрицательный фильтр по ключам этого набора. nullptr — фильтра нет (ещё не построен
+    // или выключен), поиск идёт в таблицы. Уплотнение передаёт фильтр следующему набору,
+    // как таблицы групп
+    std::atomic<CardFilter*> filter{nullptr};
+    bool ownsFilter = true;
+
+    // В режиме FLASH_MAPPED указатели смотрят в отображённый образ
+    CardImage image;
+    bool mapped = false;
+
+    CardTables() {}
+    CardTables(const CardTables&) = delete;
+    CardTables& operator=(const CardTables&) = delete;
+    ~CardTables();
+
+    size_t psramUsage() const;
 };
 
 class CardDatabase {
 public:
     CardDatabase();
-    bool begin();
-    CardResult find(uint64_t uid);
+    // filterKB — потолок внутренней SRAM под отрицательный фильтр, 0 — без фильтра
+    bool begin(CardIndexLayout layout = CardIndexLayout::BINARY, CardStorage storage = CardStorage::PSRAM,
+               size_t filterKB = CARD_FILTER_DEFAULT_KB);
+    // bits — длина кадра Wiegand: <=34 ищем только в 32-битной таблице,
+    // >34 — только в 56-битной, 0 — длина неизвестна, ищем в обеих
+    CardResult find(uint64_t uid, uint8_t bits = 0);
+    // То же, что find(), но без копирования инструкций и без обращений к куче
+    CardView findView(uint64_t uid, uint8_t bits = 0);
+    // Проверка пакета UID (сверка с сервером): out[i] — результат для uids[i], как findView(uids[i]).
+    // Пакет сортируется и проходит таблицы одним слиянием, а не n независимыми поисками.
+    // Кэш горячих карт не используется и не засоряется. Возвращает число найденных.
+    uint32_t findBatch(const uint64_t* uids, uint32_t n, CardMembership* out);
+
+    // Точечные изменения без перезагрузки: действуют сразу, пишутся в журнал,
+    // фоновая задача периодически вливает их в базовые таблицы
+    bool addCard(uint64_t uid, uint16_t group, uint8_t limit, uint8_t bits = 0);
+    bool revokeCard(uint64_t uid);
+    uint32_t pendingChanges();
+    void startCompaction();
+    bool compact();
+    // Фоновое уплотнение переписывает файлы карт через .tmp; на время загрузки базы
+    // его место на LittleFS занимают теневые файлы
+    void pauseCompaction(bool paused) { _compactPaused = paused; }
+    // Новая база без перезагрузки: таблицы строятся из файлов "/cards34.bin<suffix>" и т. д.
+    // в фоне, пока поиски идут по старым, затем подменяются атомарно. Старый набор
+    // освобождается, когда его дочитают начатые поиски. Файлы становятся основными,
+    // журнал изменений, сделанных до вызова, отбрасывается. false — какой-то из файлов
+    // пакета не прочитался или не переименовался: живая база и файлы остаются прежними.
+    bool reload(const char* suffix);
+
+    // Сколько PSRAM занимают таблицы и сколько длилась загрузка
+    size_t psramUsage() const;
+    uint32_t bootTimeMs() const { return _boot_ms; }
+    const CardLoadStats& loadStats() const { return _loadStats; }
+    bool isMapped() const { CardTables* t = _live.load(); return t && t->mapped; }
+    // Фильтр живого набора (для диагностики): действителен до следующей подмены набора
+    const CardFilter* filter() const { CardTables* t = _live.load(); return t ? t->filter.load() : nullptr; }
+    CardCache& cache() { return _cache; }
+
+#ifdef CARDDB_PROFILE
+    // Сколько байт таблиц прочитал find() (для host-бенчмарка)
+    uint64_t bytesTouched() const;
+    void resetBytesTouched();
+#endif
     
 private:
-    // Массивы карт
-    uint8_t* _cards34 = nullptr;    
-    uint8_t* _cards56 = nullptr;
-    
-    // Таблицы групп и правил
+    std::atomic<CardTables*> _live{nullptr};
+    std::atomic<uint32_t> _readers{0};   // Поиски и живые CardView, которые читают набор таблиц
+
+    // Сырые таблицы групп и правил — нужны только во время загрузки
     uint16_t* _all_groups = nullptr;   
-    uint32_t* _group_offsets = nullptr; 
-    uint8_t* _group_lens = nullptr;    
     uint32_t* _rules_table = nullptr;  
-
-    uint32_t _total34 = 0;
-    uint32_t _total56 = 0;
-    uint32_t _total_groups = 0;
     uint32_t _total_rules = 0;
+    uint32_t _boot_ms = 0;
+    CardLoadStats _loadStats;
 
-    bool loadCards();
-    bool loadGroups();
-    bool loadRules();
+    CardStorage _storage = CardStorage::PSRAM;
+    CardIndexLayout _layout = CardIndexLayout::BINARY;
+
+    size_t _filterBytes = 0;   // Бюджет фильтра из begin()
+    // Поколение базы: меняется при загрузке, изменении и уплотнении, сбрасывает кэш
+    CardCache _cache;
+    std::atomic<uint32_t> _gen{1};
+
+    // Слой изменений: отсортирован по uid, живёт во внутренней SRAM
+    CardDelta* _delta = nullptr;
+    std::atomic<uint32_t> _deltaCount{0};
+    uint32_t _deltaSeq = 0;
+    uint32_t _lastCompactMs = 0;
+    std::atomic<bool> _compactPaused{false};
+    SemaphoreHandle_t _deltaMutex;     // Слой изменений
+    SemaphoreHandle_t _journalMutex;   // Дозапись и перезапись журнала
+    SemaphoreHandle_t _compactMutex;   // Одно уплотнение за раз
+    CardJournal _journal;
+
+#ifdef CARDDB_PROFILE
+    uint64_t _bytesTouched = 0;
+#endif
+
+    bool loadCards(CardTables& t, const char* suffix = "");
+    bool loadGroups(CardTables& t, const char* suffix = "");
+    bool loadRules(const char* suffix = "");
+    void buildIndex(CardTables& t);
+    CardFilter* buildFilter(const CardTables& t);
+    bool buildGroupInstructions(CardTables& t);
+    bool mapImage(CardTables& t);
+    void retire(CardTables* old);
+    CardTables* moveToImage(CardTables* t, const char* what);
+
+    bool lookup34(CardTables& t, uint64_t uid, uint16_t& flags);
+    bool lookup56(CardTables& t, uint64_t uid, uint16_t& flags);
+    bool lookupDelta(uint64_t uid, CardDelta& out);
+    // hits[i] = 0x10000 | flags для найденного keys[i], 0 — нет; keys отсортированы
+    void lookupBatch34(CardTables& t, const uint64_t* keys, uint32_t n, uint32_t* hits);
+    void lookupBatch56(CardTables& t, const uint64_t* keys, uint32_t n, uint32_t* hits);
+    bool applyDelta(const CardDelta& d);   // Под _deltaMutex
     
-    uint64_t getID34(uint32_t idx);
-    uint64_t getID56(uint32_t idx);
     Instruction unpackInstruction(uint32_t raw);
+
+    friend void compactionTask(void* pvParameters);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Размер строки кэша ESP32-S3: индексы производителя и потребителя
+// держим в разных строках, чтобы ядра не перетягивали одну строку друг у друга
+#define SPSC_CACHE_LINE 32
+
+// Кольцевой буфер без блокировок для ровно одного писателя и одного читателя.
+// Индексы растут бесконечно (uint32 с переполнением), позиция — младшие биты,
+// поэтому N должно быть степенью двойки. Заполненное кольцо не ждёт: push()
+// возвращает false и считает потерю, писатель никогда не блокируется.
+template <typename T, uint32_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+    // Только писатель
+    bool push(const T& v) {
+        uint32_t h = _head.load(std::memory_order_relaxed);
+        uint32_t t = _tail.load(std::memory_order_acquire);
+        if (h - t == N) {
+            _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        _buf[h & (N - 1)] = v;
+        _head.store(h + 1, std::memory_order_release);
+        uint32_t used = h + 1 - t;
+        if (used > _peak.load(std::memory_order_relaxed)) _peak.store(used, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Только читатель
+    bool pop(T& out) {
+        uint32_t t = _tail.load(std::memory_order_relaxed);
+        if (t == _head.load(std::memory_order_acquire)) return false;
+        out = _buf[t & (N - 1)];
+        _tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Статистика — из любой задачи, значения приблизительные
+    uint32_t size() const {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+    uint32_t peak() const { return _peak.load(std::memory_order_relaxed); }
+    uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+    static constexpr uint32_t capacity() { return N; }
+
+private:
+    // Пишет только производитель
+    alignas(SPSC_CACHE_LINE) std::atomic<uint32_t> _head{0};
+    std::atomic<uint32_t> _peak{0};
+    std::atomic<uint32_t> _dropped{0};
+    // Пишет только потребитель
+    alignas(SPSC_CACHE_LINE) std::atomic<uint32_t> _tail{0};
+    alignas(SPSC_CACHE_LINE) T _buf[N];
+};
+
+#endif
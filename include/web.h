@@ -4,6 +4,11 @@
 #include <ArduinoJson.h>
 #include <Ethernet.h>
 #include "HardwareManager.h"
+#include "httpserver.h"
+#include "search.h"
+#include "dsl.h"
+#include "cardupload.h"
+#include "cardbatch.h"
 
 // Создаем "исправленный" класс сервера, который не будет абстрактным
 class EspEthernetServer : public EthernetServer {
@@ -14,19 +19,68 @@ public:
     using EthernetServer::begin; 
 };
 
+// Статический интерфейс: web/index.html, сжатый tools/gzip_web.py в образ LittleFS
+#define WEB_INDEX_PATH "/index.html.gz"
+// Сколько UID принимает один POST /api/cards/batch. До HTTP_MAX_BODY тело лежит в буфере
+// разборщика, больше — идёт потоком через CardBatchStream порциями по CARD_BATCH_CHUNK
+#define WEB_BATCH_MAX CARD_BATCH_MAX
+
+class WebHandler;
+typedef HttpServerT<EspEthernetServer, EthernetClient, WebHandler> WebServer;
+
 class WebHandler {
 public:
-    WebHandler(JsonDocument& config, HardwareManager& hw);
+    WebHandler(JsonDocument& config, HardwareManager& hw, CardDatabase& db, DSLProcessor& dsl);
     void begin();
+    // Один неблокирующий шаг всех соединений — из loop()
     void handle();
 
+    // Разобранный запрос -> ответ (вызывает сервер)
+    void route(const HttpRequestParser& req, HttpResponse& res);
+    // Тело больше HTTP_MAX_BODY: новая база (POST /api/db) — потоком в CardUpload,
+    // пакет UID (POST /api/cards/batch) — в CardBatchStream
+    bool bodyBegin(const HttpRequestParser& req, HttpResponse& res);
+    size_t bodyWrite(const HttpRequestParser& req, const uint8_t* data, size_t len);
+    void bodyAbort(const HttpRequestParser& req);
+
+    const HttpServerStats& stats() const { return _http.stats(); }
+    void printStats() const;
+
 private:
     JsonDocument& _config;
     HardwareManager& _hw;
+    CardDatabase& _db;
+    DSLProcessor& _dsl;
     EspEthernetServer* _server; // Используем наш исправленный класс
+    WebServer _http;
+    CardUpload _upload;
+    const HttpRequestParser* _uploadReq = nullptr;   // Соединение, чьё тело сейчас идёт в _upload
+    CardBatchStream _batch[HTTP_MAX_CLIENTS];        // По одному на соединение
+    const HttpRequestParser* _batchReq[HTTP_MAX_CLIENTS] = {};
+    String _authExpected;       // "Basic <base64>"
+    uint32_t _restartAt = 0;    // Перезагрузка после отправки ответа; 0 — нет
+    char _indexEtag[12] = "";   // "\"xxxxxxxx\"" — FNV-1a содержимого, считается в begin()
+    char _indexHeaders[96] = "";
+
+    void saveSettings(const String& postData, HttpResponse& res);
+    void sendIndex(const HttpRequestParser& req, HttpResponse& res);
+    void sendSettings(HttpResponse& res);
 
-    void processClient(EthernetClient& client);
-    void sendHtmlPage(EthernetClient& client);
+    // REST API для сервера СКУД
+    void apiCard(const HttpRequestParser& req, HttpResponse& res);
+    void apiCardBatch(const HttpRequestParser& req, HttpResponse& res);
+    bool batchBegin(const HttpRequestParser& req, HttpResponse& res);
+    int batchSlot(const HttpRequestParser* req) const;
+    void apiCardAdd(const HttpRequestParser& req, HttpResponse& res);
+    void apiCardRevoke(const HttpRequestParser& req, HttpResponse& res);
+    void sendCardChange(HttpResponse& res, uint64_t uid, bool ok);
+    void apiDsl(const HttpRequestParser& req, HttpResponse& res);
+    void apiOutputs(HttpResponse& res);
+    void apiDbUpload(const HttpRequestParser& req, HttpResponse& res);
+    void apiDbStatus(HttpResponse& res, uint16_t status = 200);
+    // Сериализует doc прямо в буфер отправки ответа. Документ больше буфера ответ забирает
+    // себе (doc остаётся пустым) и сериализует по частям, пока они уходят в сокет
+    void sendJson(HttpResponse& res, uint16_t status, JsonDocument& doc, const char* extra = "Cache-Control: no-store\r\n");
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,120 @@
+#ifndef WIEGANDEDGE_H
+#define WIEGANDEDGE_H
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+#include "spsc.h"
+#include "wiegandformat.h"
+
+// Тишина на линиях дольше этого (мс) — кадр закончен, какой бы он ни был
+#define WIEGAND_TIMEOUT 100
+#define WIEGAND_FRAME_GAP_US (WIEGAND_TIMEOUT * 1000UL)
+// Кадр ожидаемой длины с верной чётностью закрывается раньше: после паузы
+// в WIEGAND_QUICK_GAP_FACTOR самых длинных межбитовых интервалов кадра
+#define WIEGAND_QUICK_GAP_FACTOR 4
+#define WIEGAND_QUICK_GAP_MIN_US 1000
+// Фронтов в кольце от прерываний: два кадра по 58 бит с запасом
+#define WIEGAND_EDGE_RING 256
+#define WIEGAND_MAX_READERS 16
+
+// Спад на линии считывателя: D0 — бит 0, D1 — бит 1
+struct WiegandEdge {
+    uint32_t t;        // micros() в момент спада
+    uint8_t reader;
+    uint8_t bit;
+};
+
+// Писатель — обработчик прерываний GPIO (или имитатор на хосте), читатель — задача декодера
+typedef SpscRing<WiegandEdge, WIEGAND_EDGE_RING> WiegandEdgeRing;
+
+// Собранный кадр: биты в порядке прихода, первый — старший
+struct WiegandRawFrame {
+    uint64_t code;
+    uint32_t tFirst;   // micros() первого и последнего фронта
+    uint32_t tLast;
+    uint8_t reader;
+    uint8_t bits;
+    bool early;        // Закрыт по длине и чётности, а не по таймауту
+};
+
+// Статистика считывателя
+struct WiegandReaderStats {
+    uint32_t frames = 0;
+    uint32_t early = 0;      // Из них закрыто без долгого таймаута
+    uint32_t avgGapUs = 0;   // Межбитовый интервал: скользящее среднее, вес 1/16
+    uint32_t maxGapUs = 0;
+};
+
+// Сборщик кадров из фронтов, независимо для каждого считывателя.
+// Не знает, откуда пришли фронты: опрос расширителя, INT PCF8574 или GPIO.
+class WiegandEdgeDecoder {
+public:
+    explicit WiegandEdgeDecoder(uint32_t gapUs = WIEGAND_FRAME_GAP_US) : _gapUs(gapUs) {}
+
+    // Какие длины кадра ждать от считывателя (маска WIEGAND_LEN). Если набранные
+    // биты дают такую длину с верной чётностью, а длиннее ждать нечего, кадр
+    // закрывается сразу; иначе — после короткой паузы.
+    void setFormats(uint8_t reader, uint64_t lengths);
+
+    void edge(const WiegandEdge& e);
+
+    // Отдаёт кадры, после последнего фронта которых прошло больше gapUs
+    // (или короткая пауза, если кадр уже сошёлся по длине и чётности)
+    uint32_t poll(uint32_t nowUs, const std::function<void(const WiegandRawFrame&)>& fn);
+
+    // Через сколько мкс закончится ближайший начатый кадр; UINT32_MAX — ждать нечего
+    uint32_t nextDeadline(uint32_t nowUs) const;
+
+    uint32_t edges() const { return _edges; }
+    const WiegandReaderStats& stats(uint8_t reader) const { return _stats[reader]; }
+
+private:
+    struct State {
+        uint64_t code = 0;
+        uint64_t lengths = WIEGAND_KNOWN_LENGTHS;
+        uint32_t tFirst = 0;
+        uint32_t tLast = 0;
+        uint32_t maxGapUs = 0;   // Самый длинный интервал в текущем кадре
+        uint32_t quickUs = 0;    // Пауза до досрочного закрытия; UINT32_MAX — ждать таймаут
+        uint8_t bits = 0;
+    };
+    WiegandReaderStats _stats[WIEGAND_MAX_READERS];
+    State _st[WIEGAND_MAX_READERS];
+    uint32_t _pending = 0;   // Считыватели с начатым кадром (битовая маска)
+    uint32_t _gapUs;
+    uint32_t _edges = 0;
+
+    uint32_t waitUs(const State& s) const { return (s.quickUs < _gapUs) ? s.quickUs : _gapUs + 1; }
+};
+
+// Имитатор считывателей для проверки декодера на хосте: превращает кадры
+// в фронты с заданными таймингами и выдаёт их в кольцо, как прерывание GPIO.
+struct WiegandTiming {
+    uint32_t pulseUs = 50;     // Длительность импульса (на спады не влияет, для справки)
+    uint32_t periodUs = 2000;  // Интервал между битами
+};
+
+class WiegandSimSource {
+public:
+    explicit WiegandSimSource(WiegandEdgeRing& ring) : _ring(ring) {}
+
+    // Запланировать кадр: bits младших битов code, начиная со старшего.
+    // Кадр с верной чётностью — WiegandFormat<N>::encode(uid).
+    void frame(uint8_t reader, uint64_t code, uint8_t bits, uint32_t startUs,
+               const WiegandTiming& tm = WiegandTiming());
+
+    // Выдать в кольцо все фронты с t <= nowUs. Возвращает, сколько выдано.
+    uint32_t run(uint32_t nowUs);
+
+    // Время следующего фронта; UINT32_MAX — фронтов больше нет
+    uint32_t nextEdge() const;
+    size_t pending() const { return _edges.size() - _next; }
+
+private:
+    WiegandEdgeRing& _ring;
+    std::vector<WiegandEdge> _edges;   // По возрастанию t
+    size_t _next = 0;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef WIEGANDFORMAT_H
+#define WIEGANDFORMAT_H
+
+#include <stdint.h>
+
+// Форматы кадров Wiegand: [P even][данные][P odd].
+// Первый бит дополняет до чётности первую половину кадра, последний —
+// до нечётности вторую. Для 26/34/58 бит это стандартные H10301 и их
+// расширения на 32 и 56 бит номера.
+template <uint8_t Bits>
+struct WiegandFormat {
+    static_assert(Bits >= 4 && Bits <= 64 && Bits % 2 == 0, "Wiegand frame must be even and fit 64 bits");
+
+    static constexpr uint8_t half = Bits / 2;
+    static constexpr uint8_t dataBits = Bits - 2;
+    static constexpr uint64_t frameMask = (Bits == 64) ? ~0ULL : ((1ULL << Bits) - 1);
+    static constexpr uint64_t lowMask = (1ULL << half) - 1;
+    static constexpr uint64_t dataMask = (1ULL << dataBits) - 1;
+
+    static bool valid(uint64_t code) {
+        code &= frameMask;
+        return (__builtin_popcountll(code >> half) & 1) == 0 &&
+               (__builtin_popcountll(code & lowMask) & 1) == 1;
+    }
+
+    static uint64_t uid(uint64_t code) { return (code >> 1) & dataMask; }
+
+    // Кадр с правильной чётностью для номера (имитатор и тесты)
+    static uint64_t encode(uint64_t uid) {
+        uint64_t code = (uid & dataMask) << 1;
+        if (__builtin_popcountll(code & lowMask) % 2 == 0) code |= 1;
+        if (__builtin_popcountll(code >> half) % 2 == 1) code |= 1ULL << (Bits - 1);
+        return code;
+    }
+};
+
+// Длины, которые умеем проверять: маска, бит n — кадр из n бит
+#define WIEGAND_LEN(n) (1ULL << (n))
+#define WIEGAND_KNOWN_LENGTHS (WIEGAND_LEN(26) | WIEGAND_LEN(34) | WIEGAND_LEN(58))
+
+// Проверка чётности и извлечение номера. false — длина неизвестна или кадр битый.
+inline bool wiegandDecode(uint64_t code, uint8_t bits, uint64_t& uid) {
+    switch (bits) {
+        case 26:
+            if (!WiegandFormat<26>::valid(code)) return false;
+            uid = WiegandFormat<26>::uid(code);
+            return true;
+        case 34:
+            if (!WiegandFormat<34>::valid(code)) return false;
+            uid = WiegandFormat<34>::uid(code);
+            return true;
+        case 58:
+            if (!WiegandFormat<58>::valid(code)) return false;
+            uid = WiegandFormat<58>::uid(code);
+            return true;
+        default:
+            return false;
+    }
+}
+
+inline bool wiegandValid(uint64_t code, uint8_t bits) {
+    uint64_t uid;
+    return wiegandDecode(code, bits, uid);
+}
+
+#endif
@@ -1,9 +1,6 @@
 #include "HardwareManager.h"
 
-HardwareManager::HardwareManager() : _initialized(false), _ethStarted(false) {
-    for(int i=0; i<16; i++) _timers[i].active = false;
-    _i2cMutex = xSemaphoreCreateMutex();
-}
+HardwareManager::HardwareManager() : _initialized(false), _ethStarted(false) {}
 
 void HardwareManager::init(JsonDocument& config) {
     if (_initialized) return;
@@ -14,82 +11,181 @@ void HardwareManager::init(JsonDocument& config) {
 
     int sda = config["i2c_master"]["sda_io"] | 9;
     int scl = config["i2c_master"]["scl_io"] | 10;
+    uint32_t clk = config["i2c_master"]["clk_speed"] | 400000;
     Wire.begin(sda, scl);
-    Wire.setClock(400000);
+    Wire.setClock(clk);
+
+    initOutputs(config);
+    _bus.begin();
 
-    // Первичная очистка
-    _portA = 0xFF; _portB = 0xFF;
-    Wire.beginTransmission(0x24); Wire.write(0xFF); Wire.endTransmission();
-    Wire.beginTransmission(0x25); Wire.write(0xFF); Wire.endTransmission();
+    _flushMutex = xSemaphoreCreateMutex();
+    _pulseMutex = xSemaphoreCreateMutex();
+    esp_timer_create_args_t args = {};
+    args.callback = pulseTick;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "pulses";
+    esp_timer_create(&args, &_pulseTimer);
 
     initEthernet(config);
     _initialized = true;
 }
 
-// Чтение для карт - теперь оно также сбрасывает "зависшие" команды записи
+// Чтение для карт: через очередь задачи шины, раньше любых записей
 uint8_t HardwareManager::fastRead8(uint8_t address) {
     uint8_t data = 0xFF;
-    if (xSemaphoreTake(_i2cMutex, 0)) {
-        // Если есть отложенная запись для реле - выполняем её попутно
-        if (_needUpdateA) {
-            Wire.beginTransmission(0x24); Wire.write(_portA); 
-            if(Wire.endTransmission() == 0) _needUpdateA = false;
+    tryRead8(address, data);
+    return data;
+}
+
+bool HardwareManager::tryRead8(uint8_t address, uint8_t& data) {
+    return _bus.read8(address, data);
+}
+
+// Банк выходов из relays[]: сколько расширителей, их адреса и начальные уровни
+void HardwareManager::initOutputs(JsonDocument& config) {
+    uint8_t addr[OutputBank::maxExpanders];
+    uint8_t blocks = OUTPUT_MIN_EXPANDERS;
+    for (uint8_t b = 0; b < OutputBank::maxExpanders; b++) addr[b] = (b < OUTPUT_MIN_EXPANDERS) ? OUTPUT_DEFAULT_ADDR0 + b : 0;
+    OutputMask initial = (OutputMask)~(OutputMask)0;
+
+    if (config["relays"].is<JsonArray>()) {
+        for (JsonObject relay : config["relays"].as<JsonArray>()) {
+            int pin = relay["pin"] | -1;
+            if (pin < 0 || pin >= OUTPUT_MAX_PINS) {
+                Serial.printf("⚠️ Relay %d: pin %d out of range (max %d)\n", (int)(relay["id"] | 0), pin, OUTPUT_MAX_PINS - 1);
+                continue;
+            }
+            uint8_t b = pin / 8;
+            if (b + 1 > blocks) blocks = b + 1;
+            int a = relay["address"] | 0;
+            if (a > 0) {
+                if (addr[b] && addr[b] != a) {
+                    Serial.printf("⚠️ Relay %d: expander for pins %d..%d is already 0x%02X\n", (int)(relay["id"] | 0), b * 8, b * 8 + 7, addr[b]);
+                } else {
+                    addr[b] = a;
+                }
+            }
+            if ((relay["default_state"] | 1) == 0) initial &= ~((OutputMask)1 << pin);
         }
-        if (_needUpdateB) {
-            Wire.beginTransmission(0x25); Wire.write(_portB); 
-            if(Wire.endTransmission() == 0) _needUpdateB = false;
+    }
+
+    // Блоки без адреса пропустить нельзя — номера выходов держатся на позиции байта
+    for (uint8_t b = 0; b < blocks; b++) {
+        if (!addr[b]) {
+            Serial.printf("⚠️ Outputs %d..%d: no expander address, bank cut to %d outputs\n", b * 8, b * 8 + 7, b * 8);
+            blocks = b;
+            break;
         }
+    }
 
-        // Читаем вход (карту)
-        Wire.requestFrom(address, (uint8_t)1);
-        if (Wire.available()) data = Wire.read();
-        
-        xSemaphoreGive(_i2cMutex);
+    // Начальные байты уходят первыми транзакциями задачи шины
+    for (uint8_t b = 0; b < blocks; b++) {
+        _bank.addExpander(addr[b]);
+        _bus.addOutput(addr[b], (uint8_t)(initial >> (8 * b)));
     }
-    return data;
+    _bank.reset(initial);
+    Serial.printf("✅ Outputs: %u expanders, %u pins (mask %d bit)\n", blocks, blocks * 8, OUTPUT_MASK_BITS);
 }
 
 void HardwareManager::digitalWritePCF(uint8_t pin, bool state) {
-    if (pin < 8) {
-        if (state) _portA |= (1 << pin); else _portA &= ~(1 << pin);
-        _needUpdateA = true;
-    } else if (pin < 16) {
-        uint8_t realPin = pin - 8;
-        if (state) _portB |= (1 << realPin); else _portB &= ~(1 << realPin);
-        _needUpdateB = true;
-    }
+    if (pin >= OUTPUT_MAX_PINS) return;
+    OutputMask bit = (OutputMask)1 << pin;
+    writeMask(state ? bit : 0, state ? 0 : bit);
 }
 
-void HardwareManager::pulsePCF(uint8_t pin, bool state, uint32_t durationMs) {
-    if (pin >= 16) return;
-    digitalWritePCF(pin, state);
-    _timers[pin].pin = pin;
-    _timers[pin].endTime = millis() + durationMs;
-    _timers[pin].idleState = !state; 
-    _timers[pin].active = true;
+// Догнать колесо до текущего времени (под _pulseMutex).
+// Считаем по esp_timer_get_time(): опоздавший вызов таймера не теряет тики.
+void HardwareManager::advancePulses(PulseOut& out) {
+    int64_t now = esp_timer_get_time();
+    if (!_pulseRunning) {
+        _pulseUs = now;
+        return;
+    }
+    uint32_t ticks = (uint32_t)((now - _pulseUs) / 1000);
+    _pulseUs += (int64_t)ticks * 1000;
+    _pulses.advance(ticks, out);
 }
 
-void HardwareManager::updateOutputs() {
-    uint32_t now = millis();
-    // 1. Проверка таймеров
-    for (int i = 0; i < 16; i++) {
-        if (_timers[i].active && now >= _timers[i].endTime) {
-            digitalWritePCF(_timers[i].pin, _timers[i].idleState);
-            _timers[i].active = false;
-        }
+// Изменения колеса — в регистр одним обновлением, пока ещё держим _pulseMutex,
+// чтобы включение и отпускание одного пина не поменялись местами
+void HardwareManager::applyPulses(const PulseOut& out) {
+    if (out.any()) writeMask(out.set, out.clear);
+    bool active = _pulses.active() > 0;
+    if (active && !_pulseRunning && _pulseTimer) {
+        _pulseRunning = esp_timer_start_periodic(_pulseTimer, 1000) == ESP_OK;
+    } else if (!active && _pulseRunning) {
+        esp_timer_stop(_pulseTimer);
+        _pulseRunning = false;
     }
+}
 
-    if ((_needUpdateA || _needUpdateB) && xSemaphoreTake(_i2cMutex, 0)) {
-        if (_needUpdateA) {
-            Wire.beginTransmission(0x24); Wire.write(_portA);
-            if(Wire.endTransmission() == 0) _needUpdateA = false;
-        }
-        if (_needUpdateB) {
-            Wire.beginTransmission(0x25); Wire.write(_portB);
-            if(Wire.endTransmission() == 0) _needUpdateB = false;
-        }
-        xSemaphoreGive(_i2cMutex);
-    }
+void HardwareManager::pulseTick(void* arg) {
+    HardwareManager* self = (HardwareManager*)arg;
+    PulseOut out;
+    xSemaphoreTake(self->_pulseMutex, portMAX_DELAY);
+    self->advancePulses(out);
+    self->applyPulses(out);
+    xSemaphoreGive(self->_pulseMutex);
+    if (out.any()) self->updateOutputs();
+}
+
+uint32_t HardwareManager::pulse(OutputMask pins, uint32_t ms) {
+    return blink(pins, ms, 0, 1);
+}
+
+uint32_t HardwareManager::blink(OutputMask pins, uint32_t onMs, uint32_t offMs, uint32_t count) {
+    if (!_pulseMutex) return 0;
+    PulseOut out;
+    xSemaphoreTake(_pulseMutex, portMAX_DELAY);
+    advancePulses(out);
+    uint32_t h = _pulses.blink(pins, onMs, offMs, count, out);
+    applyPulses(out);
+    xSemaphoreGive(_pulseMutex);
+    if (!h) Serial.printf("⚠️ Pulse pool full (%d), pulse dropped\n", PULSE_MAX);
+    updateOutputs();
+    return h;
+}
+
+bool HardwareManager::cancelPulse(uint32_t handle) {
+    if (!_pulseMutex) return false;
+    PulseOut out;
+    xSemaphoreTake(_pulseMutex, portMAX_DELAY);
+    advancePulses(out);
+    bool ok = _pulses.cancel(handle, out);
+    applyPulses(out);
+    xSemaphoreGive(_pulseMutex);
+    updateOutputs();
+    return ok;
+}
+
+uint32_t HardwareManager::cancelPulses(OutputMask pins) {
+    if (!_pulseMutex) return 0;
+    PulseOut out;
+    xSemaphoreTake(_pulseMutex, portMAX_DELAY);
+    advancePulses(out);
+    uint32_t n = _pulses.cancelPins(pins, out);
+    applyPulses(out);
+    xSemaphoreGive(_pulseMutex);
+    updateOutputs();
+    return n;
+}
+
+PulseStats HardwareManager::pulseStats() {
+    if (!_pulseMutex) return PulseStats();
+    xSemaphoreTake(_pulseMutex, portMAX_DELAY);
+    PulseStats st = _pulses.stats();
+    xSemaphoreGive(_pulseMutex);
+    return st;
+}
+
+void HardwareManager::updateOutputs() {
+    if (!_flushMutex) return;
+    // Поколение не менялось — шину не трогаем; иначе по байту на изменившийся расширитель.
+    // Повторы при ошибках — забота шины.
+    xSemaphoreTake(_flushMutex, portMAX_DELAY);
+    _bank.flush([this](uint8_t addr, uint8_t value) { return _bus.write8(addr, value); });
+    xSemaphoreGive(_flushMutex);
 }
 
 void HardwareManager::initEthernet(JsonDocument& config) {
@@ -1,97 +1,209 @@
 #include "WiegandManager.h"
-#include "search.h" 
 
-extern CardDatabase db; 
-
-WiegandManager::WiegandManager() : _hw(nullptr) {}
+WiegandManager::WiegandManager() : _hw(nullptr), _pipeline(nullptr) {}
 
 void wiegandTask(void* pvParameters) {
     WiegandManager* instance = (WiegandManager*)pvParameters;
     while(true) {
-        instance->internalUpdate();
-        delayMicroseconds(10); 
+        uint32_t waitMs = instance->internalUpdate();
+        if (waitMs == 0) {
+            delayMicroseconds(10);
+        } else {
+            // Спим до фронта (уведомление из прерывания) или до конца начатого кадра
+            ulTaskNotifyTake(pdTRUE, waitMs == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(waitMs));
+        }
     }
 }
 
-void WiegandManager::init(JsonArray devices, HardwareManager* hw) {
+// Прерывания GPIO обслуживаются одним обработчиком на ядре, вызвавшем init(),
+// поэтому для кольца фронтов они — один писатель
+void IRAM_ATTR WiegandManager::onLineFall(void* arg) {
+    WiegandLine* l = (WiegandLine*)arg;
+    WiegandEdge e;
+    e.t = micros();
+    e.reader = l->reader;
+    e.bit = l->bit;
+    l->owner->_edges.push(e);
+    BaseType_t woken = pdFALSE;
+    if (l->owner->_task) vTaskNotifyGiveFromISR(l->owner->_task, &woken);
+    if (woken) portYIELD_FROM_ISR();
+}
+
+// I2C из прерывания недоступен: отмечаем время и будим задачу, байт прочитает она
+void IRAM_ATTR WiegandManager::onExpanderInt(void* arg) {
+    WiegandExpander* e = (WiegandExpander*)arg;
+    if (!e->intFlag.load(std::memory_order_relaxed)) e->intTime.store(micros(), std::memory_order_relaxed);
+    e->intFlag.store(true, std::memory_order_release);
+    BaseType_t woken = pdFALSE;
+    if (e->owner->_task) vTaskNotifyGiveFromISR(e->owner->_task, &woken);
+    if (woken) portYIELD_FROM_ISR();
+}
+
+void WiegandManager::init(JsonArray devices, HardwareManager* hw, CardPipeline* pipeline) {
     _hw = hw;
+    _pipeline = pipeline;
+    std::map<uint8_t, int> intPins;
     for (JsonObject dev : devices) {
         if (dev["type"] == "wiegand") {
+            if (_readers.size() >= WIEGAND_MAX_READERS) {
+                Serial.printf("⚠️ Wiegand: more than %d readers, rest ignored\n", WIEGAND_MAX_READERS);
+                break;
+            }
             WiegandReader* r = new WiegandReader();
             r->addr = dev["address"] | 34;
             r->pinD0 = dev["pins"][0];
             r->pinD1 = dev["pins"][1];
             r->group = dev["group"];
+            r->index = _readers.size();
+            r->maskD0 = 1 << r->pinD0;
+            r->maskD1 = 1 << r->pinD1;
+            if (dev["gpio"].is<JsonArray>()) {
+                r->gpioD0 = dev["gpio"][0] | -1;
+                r->gpioD1 = dev["gpio"][1] | -1;
+            }
+            uint64_t lengths = 0;
+            if (dev["formats"].is<JsonArray>()) {
+                for (int len : dev["formats"].as<JsonArray>()) {
+                    if (len > 0 && len < 64 && (WIEGAND_KNOWN_LENGTHS & WIEGAND_LEN(len))) lengths |= WIEGAND_LEN(len);
+                    else Serial.printf("⚠️ Wiegand: unsupported frame length %d ignored\n", len);
+                }
+            }
+            _decoder.setFormats(r->index, lengths ? lengths : WIEGAND_KNOWN_LENGTHS);
+            int intPin = dev["int_io"] | -1;
+            if (intPin >= 0) intPins[r->addr] = intPin;
             _readers.push_back(r);
         }
     }
+
+    // Считыватели на GPIO: каждый спад — событие в кольце
+    for (auto r : _readers) {
+        if (r->gpioD0 < 0 || r->gpioD1 < 0) continue;
+        int8_t pins[2] = {r->gpioD0, r->gpioD1};
+        for (uint8_t b = 0; b < 2; b++) {
+            r->lines[b] = WiegandLine{this, r->index, b};
+            pinMode(pins[b], INPUT_PULLUP);
+            attachInterruptArg(pins[b], onLineFall, &r->lines[b], FALLING);
+        }
+    }
+
+    // Остальные группируем по адресу расширителя
+    std::map<uint8_t, WiegandExpander*> byAddr;
+    for (auto r : _readers) {
+        if (r->gpioD0 >= 0 && r->gpioD1 >= 0) continue;
+        WiegandExpander*& e = byAddr[r->addr];
+        if (!e) {
+            e = new WiegandExpander();
+            e->owner = this;
+            e->addr = r->addr;
+            auto it = intPins.find(r->addr);
+            if (it != intPins.end()) e->intPin = it->second;
+            _expanders.push_back(e);
+        }
+        e->readers.push_back(r);
+    }
+    for (auto e : _expanders) {
+        if (e->intPin < 0) { _polling = true; continue; }
+        pinMode(e->intPin, INPUT_PULLUP);
+        attachInterruptArg(e->intPin, onExpanderInt, e, FALLING);
+        e->intFlag = true; // Первое чтение — узнать исходный уровень и отпустить INT
+    }
+    Serial.printf("📟 Wiegand: %u readers on %u expanders (%s)\n", (unsigned)_readers.size(),
+                  (unsigned)_expanders.size(), _polling ? "polling" : "edge capture");
     
     xTaskCreatePinnedToCore(
-        wiegandTask, "WiegandTask", 16384, this, 5, NULL, 1               
+        wiegandTask, "WiegandTask", 16384, this, PIPE_DECODE_PRIO, &_task, PIPE_DECODE_CORE
     );
-    Serial.println("🚀 Wiegand Task started on Core 1");
+    Serial.printf("🚀 Wiegand Task started on Core %d\n", PIPE_DECODE_CORE);
 }
 
-void WiegandManager::internalUpdate() {
-    if (!_hw) return;
-    unsigned long now = millis();
-    
-    for (auto r : _readers) {
-        // Читаем состояние один раз за проход
-        uint8_t currentData = _hw->fastRead8(r->addr);
-        
-        // В Wiegand импульс - это переход из HIGH в LOW
-        bool d0 = (currentData >> r->pinD0) & 0x01;
-        bool d1 = (currentData >> r->pinD1) & 0x01;
-
-        // Обработка D0 (Бит 0)
-        if (d0 == LOW && r->lastD0 == HIGH) {
-            r->cardCode <<= 1;
-            r->bitCount++;
-            r->lastBitTime = now;
-        } 
-        // Обработка D1 (Бит 1) - НЕ используем else if, проверяем оба независимо
-        if (d1 == LOW && r->lastD1 == HIGH) {
-            r->cardCode = (r->cardCode << 1) | 1;
-            r->bitCount++;
-            r->lastBitTime = now;
-        }
+void WiegandManager::sampleExpander(WiegandExpander* e, uint32_t tUs) {
+    // Чтение не удалось — пропускаем проход: 0xFF вместо реального байта дал бы ложные фронты.
+    uint8_t currentData;
+    if (!_hw->tryRead8(e->addr, currentData)) return;
+    e->samples++;
 
-        r->lastD0 = d0;
-        r->lastD1 = d1;
+    // В Wiegand импульс - это переход из HIGH в LOW: все спады разом
+    uint8_t falling = e->last & ~currentData;
+    e->last = currentData;
+    if (!falling) return;
 
-        // Увеличим таймаут до 100мс, чтобы точно дождаться конца медленных карт
-        if (r->bitCount > 0 && (now - r->lastBitTime > 100)) {
-            handleCard(r);
-        }
+    for (auto r : e->readers) {
+        // Обработка D0 и D1 - НЕ используем else if, проверяем оба независимо
+        if (falling & r->maskD0) _decoder.edge(WiegandEdge{tUs, r->index, 0});
+        if (falling & r->maskD1) _decoder.edge(WiegandEdge{tUs, r->index, 1});
     }
 }
 
-void WiegandManager::handleCard(WiegandReader* r) {
-    uint64_t cleanUID = 0;
+uint32_t WiegandManager::internalUpdate() {
+    if (!_hw) return UINT32_MAX;
+    uint32_t nowMs = millis();
+    bool again = false;
+
+    // Спады с GPIO, накопленные прерываниями
+    WiegandEdge edge;
+    while (_edges.pop(edge)) _decoder.edge(edge);
 
-    if (r->bitCount == 26) {
-        // Wiegand 26: убираем 1 бит четности в начале и 1 в конце
-        cleanUID = (r->cardCode >> 1) & 0xFFFFFFULL;
-    } 
-    else if (r->bitCount == 34) {
-        // Wiegand 34: убираем 1 бит четности в начале и 1 в конце
-        cleanUID = (r->cardCode >> 1) & 0xFFFFFFFFULL;
+    for (auto e : _expanders) {
+        if (e->intPin < 0) {
+            // Одно чтение I2C на расширитель, сколько бы считывателей на нём ни было
+            sampleExpander(e, micros());
+        } else if (e->intFlag.exchange(false, std::memory_order_acquire)) {
+            sampleExpander(e, e->intTime.load(std::memory_order_relaxed));
+            // Чтение отпускает INT; если линия снова внизу, вход успел измениться
+            if (digitalRead(e->intPin) == LOW) { e->intFlag = true; again = true; }
+        }
+
+        if (nowMs - e->windowStart >= 1000) {
+            e->rateHz = e->samples * 1000 / (nowMs - e->windowStart);
+            e->samples = 0;
+            e->windowStart = nowMs;
+        }
     }
-    else if (r->bitCount == 58) {
-        // Твой текущий вариант для 58 бит
-        cleanUID = (r->cardCode >> 1) & 0xFFFFFFFFFFFFFFULL;
-    } 
-    else {
-        // Если длина нестандартная, берем как есть
-        cleanUID = r->cardCode;
+
+    // Кадры, после которых линии молчат дольше WIEGAND_TIMEOUT
+    _decoder.poll(micros(), [this](const WiegandRawFrame& f) { handleCard(f); });
+
+    if (_polling || again) return 0;
+    uint32_t leftUs = _decoder.nextDeadline(micros());
+    return (leftUs == UINT32_MAX) ? UINT32_MAX : leftUs / 1000 + 1;
+}
+
+void WiegandManager::printStats() const {
+    for (auto r : _readers) {
+        const WiegandReaderStats& st = _decoder.stats(r->index);
+        Serial.printf("Wiegand reader %u: %u frames (%u early, %u rejected), bit gap avg %u us / max %u us\n",
+                      r->index, (unsigned)st.frames, (unsigned)st.early, (unsigned)r->rejected, (unsigned)st.avgGapUs, (unsigned)st.maxGapUs);
+        if (r->gpioD0 >= 0 && r->gpioD1 >= 0) {
+            Serial.printf("Wiegand reader %u (GPIO D0=%d D1=%d): edge capture\n", r->index, r->gpioD0, r->gpioD1);
+        }
     }
-    
-    Serial.printf("[Wiegand] Raw Bits: %d, Clean UID: %llx\n", r->bitCount, cleanUID);
+    for (auto e : _expanders) {
+        for (auto r : e->readers) {
+            Serial.printf("Wiegand reader %u (0x%02X D0=%u D1=%u): %u samples/s (%s)\n",
+                          r->index, e->addr, r->pinD0, r->pinD1, (unsigned)e->rateHz, e->intPin < 0 ? "poll" : "INT");
+        }
+    }
+    Serial.printf("Wiegand edges: %u decoded, ring peak %u/%u, dropped %u\n",
+                  (unsigned)_decoder.edges(), (unsigned)_edges.peak(), (unsigned)_edges.capacity(), (unsigned)_edges.dropped());
+}
 
-    extern void onCardRead(uint64_t uid, int groupId);
-    onCardRead(cleanUID, r->group);
+void WiegandManager::handleCard(const WiegandRawFrame& frame) {
+    WiegandReader* r = _readers[frame.reader];
 
-    r->cardCode = 0;
-    r->bitCount = 0;
-}
\ No newline at end of file
+    // Битый кадр дальше не идёт: в базу попадают только номера с верной чётностью
+    uint64_t cleanUID = 0;
+    if (!wiegandDecode(frame.code, frame.bits, cleanUID)) {
+        r->rejected++;
+        Serial.printf("⚠️ [Wiegand] Reader %u: bad frame (%u bit, raw %llx) rejected\n", r->index, frame.bits, (unsigned long long)frame.code);
+        return;
+    }
+    
+    // Поиск, печать и DSL — в следующих стадиях конвейера, декодер сразу возвращается к битам
+    CardFrame f;
+    f.uid = cleanUID;
+    f.t = micros();
+    f.group = r->group;
+    f.bits = frame.bits;
+    f.reader = r->index;
+    if (_pipeline) _pipeline->submit(f);
+}
@@ -0,0 +1,54 @@
+#include "cardbatch.h"
+
+bool CardBatchStream::begin(CardDatabase& db, uint32_t count) {
+    release();
+    if (count == 0 || count > CARD_BATCH_MAX) return false;
+    // Ключи после ответа, с выравниванием на 8
+    size_t outBytes = ((size_t)count * sizeof(CardMembership) + 7) & ~(size_t)7;
+    _mem = (uint8_t*)heap_caps_malloc(outBytes + CARD_BATCH_CHUNK * sizeof(uint64_t), MALLOC_CAP_SPIRAM);
+    if (!_mem) return false;
+    _db = &db;
+    _out = (CardMembership*)_mem;
+    _keys = (uint64_t*)(_mem + outBytes);
+    _count = count;
+    _done = _fill = _found = 0;
+    return true;
+}
+
+size_t CardBatchStream::write(const uint8_t* data, size_t len) {
+    if (!_mem) return len;
+    size_t room = (size_t)(_count - _done) * sizeof(uint64_t) - _fill;
+    if (room > CARD_BATCH_CHUNK * sizeof(uint64_t) - _fill) room = CARD_BATCH_CHUNK * sizeof(uint64_t) - _fill;
+    if (len > room) len = room;
+    memcpy((uint8_t*)_keys + _fill, data, len);
+    _fill += len;
+    if (_fill == CARD_BATCH_CHUNK * sizeof(uint64_t)) flush();
+    return len;
+}
+
+void CardBatchStream::flush() {
+    uint32_t n = _fill / sizeof(uint64_t);
+    if (n) _found += _db->findBatch(_keys, n, _out + _done);
+    _done += n;
+    _fill = 0;
+}
+
+uint8_t* CardBatchStream::finish(uint32_t& found) {
+    if (!_mem) return nullptr;
+    flush();
+    if (_done != _count) {
+        release();
+        return nullptr;
+    }
+    uint8_t* result = _mem;
+    found = _found;
+    _mem = nullptr;
+    _count = 0;
+    return result;
+}
+
+void CardBatchStream::release() {
+    if (_mem) heap_caps_free(_mem);
+    _mem = nullptr;
+    _count = 0;
+}
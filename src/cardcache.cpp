@@ -0,0 +1,56 @@
+#include "cardcache.h"
+#include <new>
+
+CardCache::~CardCache() {
+    if (_sets) heap_caps_free(_sets);
+}
+
+bool CardCache::begin() {
+    if (_sets) return true;
+    _sets = (Set*)heap_caps_malloc(CARD_CACHE_SETS * sizeof(Set), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!_sets) return false;
+    for (uint32_t i = 0; i < CARD_CACHE_SETS; i++) new (&_sets[i]) Set{{0}, {0}, {}};
+    return true;
+}
+
+bool CardCache::lookup(uint64_t uid, uint8_t route, uint32_t gen, CardCacheEntry& out) {
+    if (!_sets) return false;
+    Set& s = _sets[setIndex(uid, route)];
+
+    uint32_t seq = s.seq.load(std::memory_order_acquire);
+    if (!(seq & 1)) {
+        for (uint8_t w = 0; w < 2; w++) {
+            const CardCacheEntry& e = s.way[w];
+            if (e.uid != uid || e.route != route || e.gen != gen) continue;
+            out = e;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // Набор переписали, пока мы читали — считаем промахом
+            if (s.seq.load(std::memory_order_relaxed) != seq) break;
+            s.victim.store(w ^ 1, std::memory_order_relaxed);
+            _hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    _misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void CardCache::insert(const CardCacheEntry& e) {
+    if (!_sets) return;
+    Set& s = _sets[setIndex(e.uid, e.route)];
+
+    // Писателей двое (задача решений и /api/card из loop()), поэтому набор захватывается CAS.
+    // Забор после него: записи в way[] не должны стать видны раньше нечётного seq
+    uint32_t seq = s.seq.load(std::memory_order_relaxed);
+    if ((seq & 1) || !s.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) return;
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // Та же карта уже в наборе (устаревшее поколение) — переписываем её место
+    uint8_t w = s.victim.load(std::memory_order_relaxed);
+    if (s.way[0].uid == e.uid && s.way[0].route == e.route) w = 0;
+    else if (s.way[1].uid == e.uid && s.way[1].route == e.route) w = 1;
+    s.way[w] = e;
+    s.victim.store(w ^ 1, std::memory_order_relaxed);
+
+    s.seq.store(seq + 2, std::memory_order_release);
+}
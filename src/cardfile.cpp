@@ -0,0 +1,200 @@
+#include "cardfile.h"
+#include <algorithm>
+
+// Записей старого формата на одно чтение из LittleFS
+#define LEGACY_CHUNK_RECORDS 512
+
+// Таблица считается компилятором и лежит во флеше: нечего инициализировать
+// при первом вызове, а значит, и гонки задач за неё нет
+struct CrcTable {
+    uint32_t v[256];
+    constexpr CrcTable() : v() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? (0xEDB88320UL ^ (c >> 1)) : (c >> 1);
+            v[i] = c;
+        }
+    }
+};
+static constexpr CrcTable crcTable;
+static_assert(crcTable.v[1] == 0x77073096UL, "CRC-32 table");
+
+uint32_t cardCrc32(const uint8_t* data, size_t len, uint32_t crc) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) crc = crcTable.v[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static inline uint64_t recordKey(const CardRecord34& r) { return r.key; }
+static inline uint64_t recordKey(const CardRecord56& r) { return r.key(); }
+
+// Старые записи — big-endian, у 34-битных первый байт — тег записи (не часть UID)
+static void fromLegacy(const uint8_t* p, CardRecord34& r) {
+    r.key = ((uint32_t)p[1] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 8) | p[4];
+    r.flags = (p[5] << 8) | p[6];
+    r.reserved = 0;
+}
+
+static void fromLegacy(const uint8_t* p, CardRecord56& r) {
+    uint64_t k = 0;
+    for (int i = 0; i < 7; i++) k = (k << 8) | p[i];
+    r.keyLo = (uint32_t)k;
+    r.keyHi = (uint32_t)(k >> 32);
+    r.flags = (p[7] << 8) | p[8];
+    r.reserved = 0;
+}
+
+template <typename Rec>
+static bool loadCardFile(const char* path, uint8_t keyBits, size_t legacyStride,
+                         Rec*& out, uint32_t& count, bool& legacy) {
+    out = nullptr;
+    count = 0;
+    legacy = false;
+    if (!LittleFS.exists(path)) return false;
+
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
+    size_t sz = f.size();
+
+    CardFileHeader h;
+    memset(&h, 0, sizeof(h));
+    bool hasHeader = sz >= sizeof(h) && f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) && h.magic == CARDFILE_MAGIC;
+    bool sorted = false;
+    Rec* recs = nullptr;
+
+    if (hasHeader) {
+        if (h.version != CARDFILE_VERSION || h.headerSize < sizeof(h) || h.keyBits != keyBits ||
+            h.stride != sizeof(Rec) || sz != h.headerSize + (size_t)h.count * h.stride) {
+            Serial.printf("❌ %s: unsupported KCDB header (v%u, %u bit, stride %u)\n",
+                          path, h.version, h.keyBits, h.stride);
+            f.close();
+            return false;
+        }
+        count = h.count;
+        if (count == 0) { f.close(); return false; }
+        recs = (Rec*)heap_caps_malloc((size_t)count * sizeof(Rec), MALLOC_CAP_SPIRAM);
+        if (!recs) { f.close(); return false; }
+
+        f.seek(h.headerSize);
+        size_t bytes = (size_t)count * sizeof(Rec);
+        if (f.read((uint8_t*)recs, bytes) != bytes || cardCrc32((uint8_t*)recs, bytes) != h.crc32) {
+            Serial.printf("❌ %s: CRC mismatch\n", path);
+            heap_caps_free(recs);
+            f.close();
+            count = 0;
+            return false;
+        }
+        sorted = (h.sortOrder == CARD_SORT_ASC);
+    } else {
+        if (sz % legacyStride != 0) {
+            Serial.printf("❌ %s: size %u is not a multiple of %u\n", path, (unsigned)sz, (unsigned)legacyStride);
+            f.close();
+            return false;
+        }
+        legacy = true;
+        count = sz / legacyStride;
+        if (count == 0) { f.close(); return false; }
+        recs = (Rec*)heap_caps_malloc((size_t)count * sizeof(Rec), MALLOC_CAP_SPIRAM);
+        uint8_t* chunk = (uint8_t*)malloc(legacyStride * LEGACY_CHUNK_RECORDS);
+        if (!recs || !chunk) {
+            if (recs) heap_caps_free(recs);
+            if (chunk) free(chunk);
+            f.close();
+            count = 0;
+            return false;
+        }
+
+        f.seek(0);
+        uint32_t done = 0;
+        while (done < count) {
+            uint32_t n = std::min<uint32_t>(count - done, LEGACY_CHUNK_RECORDS);
+            if (f.read(chunk, n * legacyStride) != n * legacyStride) break;
+            for (uint32_t i = 0; i < n; i++) fromLegacy(chunk + i * legacyStride, recs[done + i]);
+            done += n;
+        }
+        free(chunk);
+        if (done != count) {
+            heap_caps_free(recs);
+            f.close();
+            count = 0;
+            return false;
+        }
+    }
+    f.close();
+
+    if (!sorted) {
+        bool asc = true;
+        for (uint32_t i = 1; i < count && asc; i++) asc = recordKey(recs[i - 1]) <= recordKey(recs[i]);
+        if (!asc) {
+            Serial.printf("⚠️ %s: records not sorted, sorting %u entries\n", path, (unsigned)count);
+            std::sort(recs, recs + count, [](const Rec& a, const Rec& b) { return recordKey(a) < recordKey(b); });
+        }
+    }
+
+    out = recs;
+    return true;
+}
+
+bool loadCardFile34(const char* path, CardRecord34*& out, uint32_t& count, bool& legacy) {
+    return loadCardFile(path, 32, 7, out, count, legacy);
+}
+
+bool loadCardFile56(const char* path, CardRecord56*& out, uint32_t& count, bool& legacy) {
+    return loadCardFile(path, 56, 9, out, count, legacy);
+}
+
+template <typename Rec>
+static bool saveCardFile(const char* path, uint8_t keyBits, const Rec* recs, uint32_t count) {
+    CardFileHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = CARDFILE_MAGIC;
+    h.version = CARDFILE_VERSION;
+    h.headerSize = sizeof(h);
+    h.count = count;
+    h.keyBits = keyBits;
+    h.sortOrder = CARD_SORT_ASC;
+    h.stride = sizeof(Rec);
+    h.crc32 = cardCrc32((const uint8_t*)recs, (size_t)count * sizeof(Rec));
+
+    String tmp = String(path) + ".tmp";
+    File f = LittleFS.open(tmp.c_str(), "w");
+    if (!f) return false;
+    size_t bytes = (size_t)count * sizeof(Rec);
+    bool ok = f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+              f.write((const uint8_t*)recs, bytes) == bytes;
+    f.close();
+    if (!ok || !LittleFS.rename(tmp.c_str(), path)) {
+        LittleFS.remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+void cardFileStamp(const char* path, uint32_t& size, uint32_t& crc) {
+    size = 0;
+    crc = 0;
+    if (!LittleFS.exists(path)) return;
+    File f = LittleFS.open(path, "r");
+    if (!f) return;
+    size = f.size();
+
+    CardFileHeader h;
+    if (size >= sizeof(h) && f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) && h.magic == CARDFILE_MAGIC) {
+        crc = cardCrc32((const uint8_t*)&h, sizeof(h));
+        f.close();
+        return;
+    }
+    f.seek(0);
+    uint8_t buf[512];
+    size_t n;
+    while ((n = f.read(buf, sizeof(buf))) > 0) crc = cardCrc32(buf, n, crc);
+    f.close();
+}
+
+bool saveCardFile34(const char* path, const CardRecord34* recs, uint32_t count) {
+    return saveCardFile(path, 32, recs, count);
+}
+
+bool saveCardFile56(const char* path, const CardRecord56* recs, uint32_t count) {
+    return saveCardFile(path, 56, recs, count);
+}
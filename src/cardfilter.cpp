@@ -0,0 +1,66 @@
+#include "cardfilter.h"
+#include <math.h>
+
+CardFilter::~CardFilter() {
+    clear();
+}
+
+void CardFilter::clear() {
+    if (_words) heap_caps_free(_words);
+    _words = nullptr;
+    _count = 0;
+    _capacity = 0;
+    _keys = 0;
+    _k = 0;
+}
+
+bool CardFilter::build(uint32_t keys, size_t maxBytes) {
+    clear();
+    if (keys == 0 || maxBytes < sizeof(uint32_t)) return false;
+
+    uint64_t bytes = ((uint64_t)keys * CARD_FILTER_BITS_PER_KEY + 31) / 32 * sizeof(uint32_t);
+    if (bytes > maxBytes) bytes = maxBytes;
+    // Внутренняя куча может быть уже занята — соглашаемся на фильтр поменьше, но с запасом
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (largest < CARD_FILTER_HEAP_RESERVE) return false;
+    if (bytes > largest - CARD_FILTER_HEAP_RESERVE) bytes = largest - CARD_FILTER_HEAP_RESERVE;
+    uint32_t words = (uint32_t)(bytes / sizeof(uint32_t));
+    if (words < 2) return false;
+
+    _words = (uint32_t*)heap_caps_malloc(words * sizeof(uint32_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    while (!_words && words > 1024) {
+        words -= words / 8;
+        _words = (uint32_t*)heap_caps_malloc(words * sizeof(uint32_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (!_words) return false;
+    memset(_words, 0, words * sizeof(uint32_t));
+    _count = words;
+    _capacity = keys;
+
+    // Каждый ключ ставит биты в двух словах: k на слово около ln2 * (бит на ключ) / 2,
+    // не больше 5 позиций в слове
+    float perKey = (float)words * 32 / keys;
+    int k = (int)lroundf(perKey * 0.693f / 2);
+    _k = k < 1 ? 1 : (k > 5 ? 5 : k);
+    return true;
+}
+
+void CardFilter::add(uint64_t key) {
+    if (!_words) return;
+    uint64_t h1 = hash(key), h2 = hash(h1);
+    _keys++;
+    // Биты только добавляются: параллельный mayContain() видит старое или новое слово
+    __atomic_fetch_or(&_words[wordIndex(h1)], mask(h1), __ATOMIC_RELAXED);
+    __atomic_fetch_or(&_words[wordIndex(h2)], mask(h2), __ATOMIC_RELAXED);
+}
+
+float CardFilter::falsePositiveRate() const {
+    if (!_words) return 1.0f;
+    // Чужой ключ попадает в два случайных слова и проходит, если в обоих все k его бит уже стоят
+    double sum = 0;
+    for (uint32_t i = 0; i < _count; i++) {
+        sum += pow(__builtin_popcount(_words[i]) / 32.0, _k);
+    }
+    double word = sum / _count;
+    return (float)(word * word);
+}
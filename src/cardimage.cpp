@@ -0,0 +1,135 @@
+#include "cardimage.h"
+#include "search.h"
+
+// Запись во флеш порциями, чтобы между ними отдавать управление (watchdog)
+#define CARDIMAGE_WRITE_CHUNK 4096
+
+static uint32_t alignUp(uint32_t v, uint32_t a) { return (v + a - 1) & ~(a - 1); }
+
+// Смещения секций однозначно определяются количествами записей
+static void computeLayout(CardImageHeader& h) {
+    uint32_t off = alignUp(sizeof(CardImageHeader), CARDIMAGE_ALIGN);
+    h.off34 = off;           off = alignUp(off + h.count34 * sizeof(CardRecord34), CARDIMAGE_ALIGN);
+    h.off56 = off;           off = alignUp(off + h.count56 * sizeof(CardRecord56), CARDIMAGE_ALIGN);
+    h.offGroups = off;       off = alignUp(off + h.groupCount * sizeof(CardGroup), CARDIMAGE_ALIGN);
+    h.offInstr = off;        off = alignUp(off + h.instrCount * sizeof(Instruction), CARDIMAGE_ALIGN);
+    h.imageSize = off;
+}
+
+static uint32_t sectionsCrc(const CardImageSections& s) {
+    uint32_t crc = 0;
+    crc = cardCrc32((const uint8_t*)s.cards34, s.count34 * sizeof(CardRecord34), crc);
+    crc = cardCrc32((const uint8_t*)s.cards56, s.count56 * sizeof(CardRecord56), crc);
+    crc = cardCrc32((const uint8_t*)s.groups, s.groupCount * sizeof(CardGroup), crc);
+    crc = cardCrc32((const uint8_t*)s.instr, s.instrCount * sizeof(Instruction), crc);
+    return crc;
+}
+
+static bool writeSection(const esp_partition_t* part, uint32_t off, const void* src, size_t len) {
+    const uint8_t* p = (const uint8_t*)src;
+    for (size_t done = 0; done < len; done += CARDIMAGE_WRITE_CHUNK) {
+        size_t n = (len - done < CARDIMAGE_WRITE_CHUNK) ? len - done : CARDIMAGE_WRITE_CHUNK;
+        if (esp_partition_write(part, off + done, p + done, n) != ESP_OK) return false;
+        yield();
+    }
+    return true;
+}
+
+CardImage::~CardImage() {
+    unmap();
+}
+
+void CardImage::unmap() {
+    if (_base) spi_flash_munmap(_handle);
+    _base = nullptr;
+    _handle = 0;
+    _size = 0;
+    _sec = CardImageSections();
+    memset(&_source, 0, sizeof(_source));
+}
+
+bool CardImage::map(const char* label) {
+    unmap();
+    _part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)CARDIMAGE_SUBTYPE, label);
+    if (!_part) return false;
+
+    CardImageHeader h;
+    if (esp_partition_read(_part, 0, &h, sizeof(h)) != ESP_OK) return false;
+    if (h.magic != CARDIMAGE_MAGIC || h.version != CARDIMAGE_VERSION ||
+        h.headerSize != sizeof(h) || h.instrSize != sizeof(Instruction) || h.groupSize != sizeof(CardGroup)) return false;
+
+    CardImageHeader expect = h;
+    computeLayout(expect);
+    if (memcmp(&expect, &h, sizeof(h)) != 0 || h.imageSize > _part->size) {
+        Serial.println("❌ carddb: inconsistent image header");
+        return false;
+    }
+
+    const void* ptr = nullptr;
+    if (esp_partition_mmap(_part, 0, h.imageSize, SPI_FLASH_MMAP_DATA, &ptr, &_handle) != ESP_OK) {
+        Serial.println("❌ carddb: mmap failed");
+        return false;
+    }
+    _base = (const uint8_t*)ptr;
+    _size = h.imageSize;
+
+    _sec.cards34 = (const CardRecord34*)(_base + h.off34);
+    _sec.count34 = h.count34;
+    _sec.cards56 = (const CardRecord56*)(_base + h.off56);
+    _sec.count56 = h.count56;
+    _sec.groups = (const CardGroup*)(_base + h.offGroups);
+    _sec.groupCount = h.groupCount;
+    _sec.instr = (const Instruction*)(_base + h.offInstr);
+    _sec.instrCount = h.instrCount;
+    _source = h.source;
+
+    if (sectionsCrc(_sec) != h.crc32) {
+        Serial.println("❌ carddb: CRC mismatch");
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+bool CardImage::write(const CardImageSections& sec, const CardImageSource& source, const char* label) {
+    const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)CARDIMAGE_SUBTYPE, label);
+    if (!part) {
+        Serial.printf("❌ Partition '%s' not found\n", label);
+        return false;
+    }
+
+    CardImageHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = CARDIMAGE_MAGIC;
+    h.version = CARDIMAGE_VERSION;
+    h.headerSize = sizeof(h);
+    h.count34 = sec.count34;
+    h.count56 = sec.count56;
+    h.groupCount = sec.groupCount;
+    h.instrCount = sec.instrCount;
+    h.instrSize = sizeof(Instruction);
+    h.groupSize = sizeof(CardGroup);
+    h.source = source;
+    computeLayout(h);
+    if (h.imageSize > part->size) {
+        Serial.printf("❌ carddb: image %u B does not fit partition %u B\n", (unsigned)h.imageSize, (unsigned)part->size);
+        return false;
+    }
+
+    uint32_t eraseSize = alignUp(h.imageSize, 4096);
+    for (uint32_t off = 0; off < eraseSize; off += 0x10000) {
+        uint32_t n = (eraseSize - off < 0x10000) ? eraseSize - off : 0x10000;
+        if (esp_partition_erase_range(part, off, n) != ESP_OK) return false;
+        yield();
+    }
+
+    if (!writeSection(part, h.off34, sec.cards34, sec.count34 * sizeof(CardRecord34)) ||
+        !writeSection(part, h.off56, sec.cards56, sec.count56 * sizeof(CardRecord56)) ||
+        !writeSection(part, h.offGroups, sec.groups, sec.groupCount * sizeof(CardGroup)) ||
+        !writeSection(part, h.offInstr, sec.instr, sec.instrCount * sizeof(Instruction))) {
+        return false;
+    }
+
+    h.crc32 = sectionsCrc(sec);
+    return esp_partition_write(part, 0, &h, sizeof(h)) == ESP_OK;
+}
@@ -0,0 +1,55 @@
+#include "cardjournal.h"
+#include "cardfile.h"
+
+static CardJournalRecord makeRecord(const CardDelta& d) {
+    CardJournalRecord r;
+    r.magic = CARDJOURNAL_MAGIC;
+    r.delta = d;
+    r.crc32 = cardCrc32((const uint8_t*)&r.delta, sizeof(r.delta));
+    return r;
+}
+
+bool CardJournal::append(const CardDelta& d) {
+    File f = LittleFS.open(_path, "a");
+    if (!f) return false;
+    CardJournalRecord r = makeRecord(d);
+    bool ok = f.write((const uint8_t*)&r, sizeof(r)) == sizeof(r);
+    f.close();
+    return ok;
+}
+
+uint32_t CardJournal::replay(std::function<void(const CardDelta&)> fn) {
+    if (!LittleFS.exists(_path)) return 0;
+    File f = LittleFS.open(_path, "r");
+    if (!f) return 0;
+
+    uint32_t n = 0;
+    CardJournalRecord r;
+    while (f.read((uint8_t*)&r, sizeof(r)) == sizeof(r)) {
+        if (r.magic != CARDJOURNAL_MAGIC || cardCrc32((const uint8_t*)&r.delta, sizeof(r.delta)) != r.crc32) {
+            Serial.printf("⚠️ %s: damaged record #%u, rest of journal ignored\n", _path, (unsigned)n);
+            break;
+        }
+        fn(r.delta);
+        n++;
+    }
+    f.close();
+    return n;
+}
+
+bool CardJournal::rewrite(const CardDelta* items, uint32_t count) {
+    String tmp = String(_path) + ".tmp";
+    File f = LittleFS.open(tmp.c_str(), "w");
+    if (!f) return false;
+    bool ok = true;
+    for (uint32_t i = 0; i < count && ok; i++) {
+        CardJournalRecord r = makeRecord(items[i]);
+        ok = f.write((const uint8_t*)&r, sizeof(r)) == sizeof(r);
+    }
+    f.close();
+    if (!ok || !LittleFS.rename(tmp.c_str(), _path)) {
+        LittleFS.remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,185 @@
+#include "cardupload.h"
+#include <new>
+
+const char* cardUploadStateName(CardUploadState state) {
+    switch (state) {
+        case CardUploadState::RECEIVING: return "receiving";
+        case CardUploadState::BUILDING: return "building";
+        case CardUploadState::DONE: return "done";
+        case CardUploadState::FAILED: return "failed";
+        default: return "idle";
+    }
+}
+
+void cardUploadTask(void* pvParameters) {
+    ((CardUpload*)pvParameters)->run();
+    vTaskDelete(NULL);
+}
+
+bool CardUpload::begin(uint32_t length) {
+    if (busy()) return false;
+    _noSpace = false;
+    // Теневые файлы ложатся рядом с живыми, и пакет должен поместиться целиком:
+    // отказ до первого байта, а не "flash write failed" посреди записи
+    removeShadows();
+    size_t total = LittleFS.totalBytes(), used = LittleFS.usedBytes();
+    size_t avail = total > used ? total - used : 0;
+    size_t need = (size_t)length + CARD_UPLOAD_FS_RESERVE;
+    if (need > avail) {
+        snprintf(_errorBuf, sizeof(_errorBuf), "not enough LittleFS space: need %u KB, free %u KB",
+                 (unsigned)(need / 1024), (unsigned)(avail / 1024));
+        _noSpace = true;
+        _total = length;
+        _received = 0;
+        _written = 0;
+        _startMs = millis();
+        finish(CardUploadState::FAILED, _errorBuf);
+        return false;
+    }
+    if (!_chunks) _chunks = (Chunk*)heap_caps_malloc(CARD_UPLOAD_DEPTH * sizeof(Chunk), MALLOC_CAP_SPIRAM);
+    if (!_chunks) {
+        Serial.println("❌ DB upload: no PSRAM for buffers");
+        return false;
+    }
+
+    // Прошлая задача закончилась — кольца пересоздаём, все порции снова свободны
+    new (&_free) SpscRing<uint8_t, CARD_UPLOAD_DEPTH>();
+    new (&_filled) SpscRing<uint8_t, CARD_UPLOAD_DEPTH>();
+    for (uint8_t i = 0; i < CARD_UPLOAD_DEPTH; i++) _free.push(i);
+
+    _total = length;
+    _received = 0;
+    _written = 0;
+    _abort = false;
+    _error = "";
+    _startMs = millis();
+    _elapsedMs = 0;
+    _state = CardUploadState::RECEIVING;
+    _db.pauseCompaction(true);
+    if (xTaskCreatePinnedToCore(cardUploadTask, "DBUpload", 8192, this, 1, NULL, 0) != pdPASS) {
+        finish(CardUploadState::FAILED, "task not started");
+        return false;
+    }
+    Serial.printf("📥 DB upload: %u B\n", (unsigned)length);
+    return true;
+}
+
+size_t CardUpload::write(const uint8_t* data, size_t len) {
+    // Задача уже отказалась от этой базы — остаток тела просто дочитываем
+    if (_state.load() != CardUploadState::RECEIVING || _received >= _total) return len;
+    if (len > _total - _received) len = _total - _received;
+    if (len > CARD_UPLOAD_CHUNK) len = CARD_UPLOAD_CHUNK;
+
+    uint8_t idx;
+    if (!_free.pop(idx)) return 0;
+    _chunks[idx].len = len;
+    memcpy(_chunks[idx].data, data, len);
+    _filled.push(idx);
+    _received += len;
+    return len;
+}
+
+void CardUpload::abort() {
+    _abort = true;
+}
+
+void CardUpload::finish(CardUploadState state, const char* error) {
+    _error = error;
+    _elapsedMs = millis() - _startMs;
+    if (state == CardUploadState::FAILED) Serial.printf("❌ DB upload: %s\n", error);
+    _db.pauseCompaction(false);
+    // Последнее, что делает задача: после этого begin() может начать новую загрузку
+    _state = state;
+}
+
+void CardUpload::removeShadows() {
+    for (int i = 0; i < CARDBUNDLE_FILES; i++) {
+        String path = String(cardDbFiles[i]) + CARDBUNDLE_SUFFIX;
+        if (LittleFS.exists(path.c_str())) LittleFS.remove(path.c_str());
+    }
+}
+
+void CardUpload::run() {
+    if (!receive()) return;
+    Serial.printf("✅ DB upload: %u B written, CRC ok (%u ms)\n", (unsigned)_total, (unsigned)(millis() - _startMs));
+
+    _state = CardUploadState::BUILDING;
+    if (!_db.reload(CARDBUNDLE_SUFFIX)) {
+        removeShadows();
+        finish(CardUploadState::FAILED, "tables not built");
+        return;
+    }
+    finish(CardUploadState::DONE, "");
+}
+
+// Раскладывает поток по теневым файлам и считает CRC на лету, пока HTTP принимает следующие порции
+bool CardUpload::receive() {
+    CardBundleHeader h;
+    uint32_t got = 0;          // Байт заголовка
+    int file = -1;
+    uint32_t fileLeft = 0;
+    uint32_t crc = 0;
+    File f;
+    const char* err = nullptr;
+
+    // Следующий файл пакета; пустые тоже создаются
+    auto advance = [&]() {
+        while (fileLeft == 0 && file + 1 < CARDBUNDLE_FILES) {
+            f.close();
+            file++;
+            String path = String(cardDbFiles[file]) + CARDBUNDLE_SUFFIX;
+            f = LittleFS.open(path.c_str(), "w");
+            if (!f) return false;
+            fileLeft = h.size[file];
+        }
+        return true;
+    };
+
+    while (!err && _written.load() < _total) {
+        if (_abort.load()) { err = "client disconnected"; break; }
+        uint8_t idx;
+        if (!_filled.pop(idx)) {
+            vTaskDelay(1);
+            continue;
+        }
+        const uint8_t* p = _chunks[idx].data;
+        size_t n = _chunks[idx].len;
+
+        if (got < sizeof(h)) {
+            size_t k = (n < sizeof(h) - got) ? n : sizeof(h) - got;
+            memcpy((uint8_t*)&h + got, p, k);
+            got += k; p += k; n -= k;
+            if (got == sizeof(h)) {
+                uint64_t sum = sizeof(h);
+                for (int i = 0; i < CARDBUNDLE_FILES; i++) sum += h.size[i];
+                if (h.magic != CARDBUNDLE_MAGIC || h.version != CARDBUNDLE_VERSION || h.headerSize != sizeof(h)) {
+                    err = "not a DB bundle";
+                } else if (sum != _total) {
+                    err = "bundle size does not match Content-Length";
+                } else if (!advance()) {
+                    err = "cannot create shadow file";
+                }
+            }
+        }
+        while (!err && n > 0) {
+            size_t k = (n < fileLeft) ? n : fileLeft;
+            if (f.write(p, k) != k) { err = "flash write failed"; break; }
+            crc = cardCrc32(p, k, crc);
+            fileLeft -= k; p += k; n -= k;
+            if (!advance()) err = "cannot create shadow file";
+        }
+
+        _written += _chunks[idx].len;
+        _free.push(idx);
+    }
+    f.close();
+
+    if (!err && got < sizeof(h)) err = "not a DB bundle";
+    if (!err && crc != h.crc32) err = "CRC mismatch";
+    if (err) {
+        removeShadows();
+        finish(CardUploadState::FAILED, err);
+        return false;
+    }
+    return true;
+}
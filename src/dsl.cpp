@@ -1,162 +1,204 @@
 #include "dsl.h"
+#include <utility>
 
-DSLProcessor::DSLProcessor(HardwareManager& hw) : _hw(hw) {}
+static const uint8_t OP_END_BYTE = OP_END;
+
+DSLProcessor::DSLProcessor(HardwareManager& hw) : _hw(hw) {
+    _mutex = xSemaphoreCreateMutex();
+    for (int i = 0; i < DSL_MAX_TASKS; i++) _free[i] = DSL_MAX_TASKS - 1 - i;
+    _freeCount = DSL_MAX_TASKS;
+}
 
 void DSLProcessor::begin() {
+    reload();
     Serial.println("🚀 DSL Multi-Tasking Engine Ready");
 }
 
-// Запуск новой параллельной задачи
-void DSLProcessor::execute(String line) {
-    DSLInstance newProcess;
-    
-    int start = 0;
-    while (start < line.length()) {
-        int end = line.indexOf(';', start);
-        String sub = (end == -1) ? line.substring(start) : line.substring(start, end);
-        sub.trim();
-        
-        if (sub.length() > 0) {
-            QueuedCommand cmd = parseSubCommand(sub);
-            if (cmd.action != ACTION_NONE) {
-                newProcess.commands.push_back(cmd);
-            }
-        }
-        
-        if (end == -1) break;
-        start = end + 1;
+bool DSLProcessor::reload() {
+    uint32_t startMs = millis();
+    std::shared_ptr<DSLProgram> program = std::make_shared<DSLProgram>();
+    if (!program->load("/actions.bin")) {
+        Serial.println("❌ Error: actions.bin not found or out of memory");
+        return false;
     }
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _actions = program;
+    xSemaphoreGive(_mutex);
+    Serial.printf("✅ DSL actions compiled: %u (%u B bytecode, %u ms)\n",
+                  (unsigned)program->count(), (unsigned)program->codeSize(), (unsigned)(millis() - startMs));
+    return true;
+}
 
-    if (!newProcess.commands.empty()) {
-        _activeInstances.push_back(newProcess);
-        Serial.printf("➕ Started parallel task. Active tasks: %d\n", _activeInstances.size());
+void DSLProcessor::heapPush(uint8_t slot) {
+    uint8_t i = _heapSize++;
+    _heap[i] = slot;
+    while (i > 0) {
+        uint8_t parent = (i - 1) / 2;
+        if (!before(_heap[i], _heap[parent])) break;
+        std::swap(_heap[i], _heap[parent]);
+        i = parent;
     }
 }
 
-// Главный цикл обработки всех запущенных сценариев
-void DSLProcessor::tick() {
-    if (_activeInstances.empty()) return;
-
-    auto it = _activeInstances.begin();
-    while (it != _activeInstances.end()) {
-        // 1. Проверяем, не находится ли данный процесс в режиме сна
-        if (it->isWaiting) {
-            if (millis() >= it->nextStepTime) {
-                it->isWaiting = false;
-            } else {
-                ++it; // Процесс еще спит, идем к следующему в списке
-                continue;
-            }
-        }
-
-        // 2. Выполняем следующую команду процесса
-        if (!it->commands.empty()) {
-            QueuedCommand cmd = it->commands.front();
-            it->commands.pop_front();
-
-            if (cmd.action == ACTION_SLEEP) {
-                it->isWaiting = true;
-                it->nextStepTime = millis() + cmd.duration;
-            } else {
-                // Применяем OPEN или CLOSE к пинам
-                for (int i = 0; i < 16; i++) {
-                    if (cmd.pinMask & (1 << i)) {
-                        _hw.digitalWritePCF(i, (cmd.action == ACTION_CLOSE));
-                    }
-                }
-                _hw.updateOutputs();
-            }
-        }
-
-        // 3. Если команды закончились и мы не ждем — удаляем процесс
-        if (it->commands.empty() && !it->isWaiting) {
-            it = _activeInstances.erase(it);
-            Serial.println("➖ Task finished.");
-        } else {
-            ++it;
-        }
+uint8_t DSLProcessor::heapPop() {
+    uint8_t top = _heap[0];
+    _heap[0] = _heap[--_heapSize];
+    uint8_t i = 0;
+    while (true) {
+        uint8_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < _heapSize && before(_heap[l], _heap[m])) m = l;
+        if (r < _heapSize && before(_heap[r], _heap[m])) m = r;
+        if (m == i) break;
+        std::swap(_heap[i], _heap[m]);
+        i = m;
     }
+    return top;
 }
 
-// Парсинг строки в структуру команды
-QueuedCommand DSLProcessor::parseSubCommand(String sub) {
-    QueuedCommand q;
-    sub.trim();
-    
-    // Делим на части по пробелам для удобства (например: "OPEN 1 2 3")
-    std::vector<String> parts;
-    int p_start = 0;
-    while(p_start < sub.length()){
-        int p_space = sub.indexOf(' ', p_start);
-        if(p_space == -1){
-            parts.push_back(sub.substring(p_start));
-            break;
-        }
-        parts.push_back(sub.substring(p_start, p_space));
-        p_start = p_space + 1;
-    }
+void DSLProcessor::release(uint8_t slot) {
+    _pool[slot].program.reset();
+    _pool[slot].pc = nullptr;
+    _free[_freeCount++] = slot;
+    _stats.active--;
+}
 
-    if (parts.empty()) return q;
-
-    String actionStr = parts[0];
-    actionStr.toUpperCase();
-
-    if (actionStr == "OPEN") q.action = ACTION_OPEN;
-    else if (actionStr == "CLOSE") q.action = ACTION_CLOSE;
-    else if (actionStr == "SLEEP") {
-        q.action = ACTION_SLEEP;
-        if (parts.size() > 1) q.duration = parts[1].toInt();
-        return q;
-    } else return q; // Неизвестная команда
-
-    // Обработка пинов или слова ALL
-    for (size_t i = 1; i < parts.size(); i++) {
-        String p = parts[i];
-        p.toUpperCase();
-        if (p == "ALL") {
-            q.pinMask = 0xFFFF;
-            break;
-        }
-        int pinNum = p.toInt();
-        if (pinNum >= 1 && pinNum <= 16) {
-            q.pinMask |= (1 << (pinNum - 1));
-        }
+bool DSLProcessor::start(const std::shared_ptr<const DSLProgram>& program, const uint8_t* pc) {
+    if (!pc || *pc == OP_END) return true;   // Пустой сценарий выполнен сразу
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (_freeCount == 0) {
+        _stats.dropped++;
+        xSemaphoreGive(_mutex);
+        Serial.printf("⚠️ DSL task pool full (%d), action dropped\n", DSL_MAX_TASKS);
+        return false;
     }
+    uint8_t slot = _free[--_freeCount];
+    _pool[slot].program = program;
+    _pool[slot].pc = pc;
+    _pool[slot].wakeAt = millis();
+    heapPush(slot);
+    _stats.active++;
+    if (_stats.active > _stats.peak) _stats.peak = _stats.active;
+    uint32_t active = _stats.active;
+    xSemaphoreGive(_mutex);
+    Serial.printf("➕ Started parallel task. Active tasks: %u\n", (unsigned)active);
+    return true;
+}
 
-    return q;
+// Запуск новой параллельной задачи из текста (консоль)
+bool DSLProcessor::execute(String line) {
+    std::shared_ptr<DSLProgram> program = std::make_shared<DSLProgram>();
+    if (!program->compile(line.c_str(), line.length())) return false;
+    return start(program, program->action(0));
 }
 
-// Чтение действий из файла actions.bin
-void DSLProcessor::runActionFromFile(int actionIdx) {
-    File f = LittleFS.open("/actions.bin", "r");
-    if (!f) {
-        Serial.println("❌ Error: actions.bin not found");
+// Запуск действия из actions.bin: байткод уже в памяти, файл не читается
+void DSLProcessor::runAction(int actionIdx) {
+    // reload() может подменить байткод параллельно — берём свою ссылку
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    std::shared_ptr<const DSLProgram> actions = _actions;
+    xSemaphoreGive(_mutex);
+    if (!actions || actionIdx < 0 || (uint32_t)actionIdx >= actions->count()) {
+        Serial.printf("❌ Error: action #%d not found\n", actionIdx + 1);
         return;
     }
+    start(actions, actions->action(actionIdx));
+}
 
-    int currentIdx = 0;
-    while (f.available()) {
-        uint8_t len = f.read(); // 1 байт длины
-        if (currentIdx == actionIdx) {
-            char* buf = (char*)malloc(len + 1);
-            if (buf) {
-                f.readBytes(buf, len);
-                buf[len] = '\0';
-                execute(String(buf)); // Создает новый поток исполнения
-                free(buf);
+// Главный цикл: из кучи достаются только сценарии, чьё время пришло.
+// Команды сценария выполняются подряд до ближайшего SLEEP или конца.
+void DSLProcessor::tick() {
+    if (_heapSize == 0) return;
+
+    uint32_t now = millis();
+    // Все OPEN/CLOSE этого шага копятся в маски и применяются одним обновлением
+    OutputMask setMask = 0, clearMask = 0;
+    uint32_t finished = 0;
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    // Сравнение через разность со знаком не ломается при переполнении millis()
+    while (_heapSize > 0 && (int32_t)(now - _pool[_heap[0]].wakeAt) >= 0) {
+        uint8_t slot = heapPop();
+        DSLInstance& inst = _pool[slot];
+        const uint8_t* pc = inst.pc;
+        bool sleeping = false;
+
+        while (*pc != OP_END && !sleeping) {
+            switch (*pc) {
+                case OP_SLEEP: {
+                    uint32_t ms = dslReadDuration(pc + 1);
+                    if (ms > DSL_MAX_SLEEP_MS) ms = DSL_MAX_SLEEP_MS;
+                    pc += 5;
+                    if (ms > 0) {
+                        inst.wakeAt = now + ms;
+                        sleeping = true;
+                    }
+                    break;
+                }
+                case OP_OPEN:
+                case OP_CLOSE: {
+                    // OPEN — LOW, CLOSE — HIGH; более поздняя команда перекрывает раннюю
+                    OutputMask pinMask = dslReadMask(pc + 1);
+                    if (*pc == OP_CLOSE) { setMask |= pinMask; clearMask &= ~pinMask; }
+                    else { clearMask |= pinMask; setMask &= ~pinMask; }
+                    pc += DSL_MASK_CMD_SIZE;
+                    break;
+                }
+                case OP_PULSE:
+                case OP_BLINK: {
+                    // Таймер импульсов работает сам по себе; накопленное до него применяем
+                    // раньше, чтобы "CLOSE 1; PULSE 1 500" сделало именно импульс
+                    if (setMask | clearMask) {
+                        _hw.writeMask(setMask, clearMask);
+                        setMask = clearMask = 0;
+                    }
+                    OutputMask pinMask = dslReadMask(pc + 1);
+                    uint32_t onMs = dslReadDuration(pc + DSL_MASK_CMD_SIZE);
+                    if (*pc == OP_PULSE) {
+                        _hw.pulse(pinMask, onMs);
+                        pc += DSL_PULSE_CMD_SIZE;
+                    } else {
+                        _hw.blink(pinMask, onMs, dslReadDuration(pc + DSL_MASK_CMD_SIZE + 4),
+                                  dslReadCount(pc + DSL_MASK_CMD_SIZE + 8));
+                        pc += DSL_BLINK_CMD_SIZE;
+                    }
+                    break;
+                }
+                default:
+                    pc = &OP_END_BYTE;   // Повреждённый байткод — завершаем сценарий
+                    break;
             }
-            break;
+        }
+        inst.pc = pc;
+
+        if (sleeping) {
+            heapPush(slot);
         } else {
-            f.seek(f.position() + len);
+            release(slot);
+            finished++;
         }
-        currentIdx++;
     }
-    f.close();
+    xSemaphoreGive(_mutex);
+
+    if (setMask | clearMask) {
+        _hw.writeMask(setMask, clearMask);
+        _hw.updateOutputs();
+    }
+    for (uint32_t i = 0; i < finished; i++) Serial.println("➖ Task finished.");
 }
 
 // Экстренная остановка всех сценариев
 void DSLProcessor::stopAll() {
-    _activeInstances.clear();
-    _hw.updateOutputs();
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    while (_heapSize > 0) release(heapPop());
+    xSemaphoreGive(_mutex);
+    // Импульсы и мигания, запущенные сценариями, тоже снимаем
+    _hw.cancelPulses((OutputMask)~(OutputMask)0);
     Serial.println("🛑 All DSL tasks stopped.");
-}
\ No newline at end of file
+}
+
+DSLStats DSLProcessor::stats() {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    DSLStats st = _stats;
+    xSemaphoreGive(_mutex);
+    return st;
+}
@@ -0,0 +1,182 @@
+#include "dslcode.h"
+
+static inline char upper(char c) { return (c >= 'a' && c <= 'z') ? c - 32 : c; }
+static inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+// Сравнение слова без учёта регистра
+static bool wordIs(const char* w, size_t n, const char* kw) {
+    size_t i = 0;
+    for (; i < n && kw[i]; i++) {
+        if (upper(w[i]) != kw[i]) return false;
+    }
+    return i == n && kw[i] == 0;
+}
+
+// Аналог String::toInt(): необязательный знак и ведущие цифры
+static long wordToInt(const char* w, size_t n) {
+    size_t i = 0;
+    bool neg = false;
+    if (i < n && (w[i] == '-' || w[i] == '+')) neg = (w[i++] == '-');
+    long v = 0;
+    for (; i < n && w[i] >= '0' && w[i] <= '9'; i++) v = v * 10 + (w[i] - '0');
+    return neg ? -v : v;
+}
+
+// Длительности и счётчики отрицательными не бывают
+static uint32_t wordToUInt(const char* w, size_t n) {
+    long v = wordToInt(w, n);
+    return v < 0 ? 0 : (uint32_t)v;
+}
+
+static void pushU32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int b = 0; b < 4; b++) out.push_back((v >> (8 * b)) & 0xFF);
+}
+
+// Пины 1..OUTPUT_MAX_PINS, диапазоны "a-b" или слово ALL
+static OutputMask parsePins(const char* const* words, const size_t* lens, size_t count) {
+    OutputMask mask = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (wordIs(words[i], lens[i], "ALL")) return (OutputMask)~(OutputMask)0;
+        const char* dash = (const char*)memchr(words[i] + 1, '-', lens[i] > 1 ? lens[i] - 1 : 0);
+        long from = wordToInt(words[i], lens[i]);
+        long to = dash ? wordToInt(dash + 1, words[i] + lens[i] - dash - 1) : from;
+        if (from < 1) from = 1;
+        if (to > OUTPUT_MAX_PINS) to = OUTPUT_MAX_PINS;
+        for (long pin = from; pin <= to; pin++) mask |= (OutputMask)1 << (pin - 1);
+    }
+    return mask;
+}
+
+// Одна команда между ';'. Слова разделены пробелами.
+static bool compileCommand(const char* s, size_t n, std::vector<uint8_t>& out) {
+    const char* words[20];
+    size_t lens[20];
+    size_t count = 0;
+    for (size_t i = 0; i < n && count < 20; ) {
+        size_t j = i;
+        while (j < n && s[j] != ' ') j++;
+        words[count] = s + i;
+        lens[count] = j - i;
+        count++;
+        i = j + 1;
+    }
+    if (count == 0) return false;
+
+    if (wordIs(words[0], lens[0], "SLEEP")) {
+        uint32_t ms = count > 1 ? (uint32_t)wordToInt(words[1], lens[1]) : 0;
+        out.push_back(OP_SLEEP);
+        pushU32(out, ms);
+        return true;
+    }
+
+    // PULSE <пины> <мс>; BLINK <пины> <вкл мс> <выкл мс> <раз> — числа в конце, пины перед ними
+    uint8_t op;
+    size_t tail = 0;
+    if (wordIs(words[0], lens[0], "OPEN")) op = OP_OPEN;
+    else if (wordIs(words[0], lens[0], "CLOSE")) op = OP_CLOSE;
+    else if (wordIs(words[0], lens[0], "PULSE")) { op = OP_PULSE; tail = 1; }
+    else if (wordIs(words[0], lens[0], "BLINK")) { op = OP_BLINK; tail = 3; }
+    else return false;   // Неизвестная команда
+    if (tail && count < 2 + tail) return false;   // Без пинов или без времени
+
+    OutputMask mask = parsePins(words + 1, lens + 1, count - 1 - tail);
+    out.push_back(op);
+    for (int b = 0; b < OUTPUT_MASK_BYTES; b++) out.push_back((uint8_t)(mask >> (8 * b)));
+    if (op == OP_PULSE || op == OP_BLINK) {
+        size_t t = count - tail;
+        pushU32(out, wordToUInt(words[t], lens[t]));
+        if (op == OP_BLINK) {
+            pushU32(out, wordToUInt(words[t + 1], lens[t + 1]));
+            uint32_t times = wordToUInt(words[t + 2], lens[t + 2]);
+            if (times > 0xFFFF) times = 0xFFFF;
+            out.push_back(times & 0xFF);
+            out.push_back(times >> 8);
+        }
+    }
+    return true;
+}
+
+uint32_t compileDSL(const char* text, size_t len, std::vector<uint8_t>& out) {
+    uint32_t commands = 0;
+    size_t start = 0;
+    while (start < len) {
+        size_t end = start;
+        while (end < len && text[end] != ';' && text[end] != 0) end++;
+
+        // trim()
+        size_t a = start, b = end;
+        while (a < b && isBlank(text[a])) a++;
+        while (b > a && isBlank(text[b - 1])) b--;
+        if (b > a && compileCommand(text + a, b - a, out)) commands++;
+
+        if (end >= len || text[end] == 0) break;
+        start = end + 1;
+    }
+    out.push_back(OP_END);
+    return commands;
+}
+
+DSLProgram::~DSLProgram() {
+    clear();
+}
+
+void DSLProgram::clear() {
+    if (_code) heap_caps_free(_code);
+    if (_offsets) heap_caps_free(_offsets);
+    _code = nullptr;
+    _offsets = nullptr;
+    _count = 0;
+    _size = 0;
+}
+
+bool DSLProgram::adopt(const std::vector<uint8_t>& code, const std::vector<uint32_t>& offsets) {
+    clear();
+    _code = (uint8_t*)heap_caps_malloc(code.size() ? code.size() : 1, MALLOC_CAP_SPIRAM);
+    _offsets = (uint32_t*)heap_caps_malloc((offsets.size() ? offsets.size() : 1) * sizeof(uint32_t), MALLOC_CAP_SPIRAM);
+    if (!_code || !_offsets) {
+        clear();
+        return false;
+    }
+    memcpy(_code, code.data(), code.size());
+    memcpy(_offsets, offsets.data(), offsets.size() * sizeof(uint32_t));
+    _size = code.size();
+    _count = offsets.size();
+    return true;
+}
+
+bool DSLProgram::load(const char* path) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
+    size_t sz = f.size();
+    uint8_t* raw = (uint8_t*)heap_caps_malloc(sz ? sz : 1, MALLOC_CAP_SPIRAM);
+    if (!raw) {
+        f.close();
+        return false;
+    }
+    bool ok = f.read(raw, sz) == sz;
+    f.close();
+    if (!ok) {
+        heap_caps_free(raw);
+        return false;
+    }
+
+    std::vector<uint8_t> code;
+    std::vector<uint32_t> offsets;
+    code.reserve(sz);
+    for (size_t pos = 0; pos < sz; ) {
+        uint8_t len = raw[pos++];
+        if (len > sz - pos) len = sz - pos;   // Обрезанная последняя запись
+        offsets.push_back(code.size());
+        compileDSL((const char*)raw + pos, len, code);
+        pos += len;
+    }
+    heap_caps_free(raw);
+    return adopt(code, offsets);
+}
+
+bool DSLProgram::compile(const char* text, size_t len) {
+    std::vector<uint8_t> code;
+    std::vector<uint32_t> offsets(1, 0);
+    compileDSL(text, len, code);
+    return adopt(code, offsets);
+}
@@ -0,0 +1,121 @@
+#include "eytzinger.h"
+
+EytzingerIndex::~EytzingerIndex() {
+    clear();
+}
+
+void EytzingerIndex::clear() {
+    if (_keys) heap_caps_free(_keys);
+    if (_flags) heap_caps_free(_flags);
+    if (_top) heap_caps_free(_top);
+    _keys = nullptr; _flags = nullptr; _top = nullptr;
+    _count = 0; _topCount = 0;
+}
+
+// Рекурсивный обход дерева in-order: i-я по порядку запись попадает в i-й посещённый узел
+static bool fillInOrder(uint32_t k, uint32_t n, uint32_t& i, uint64_t* keys, uint16_t* flags,
+                        std::function<uint64_t(uint32_t)>& keyAt,
+                        std::function<uint16_t(uint32_t)>& flagsAt) {
+    if (k > n) return true;
+    if (!fillInOrder(2 * k, n, i, keys, flags, keyAt, flagsAt)) return false;
+    keys[k] = keyAt(i);
+    flags[k] = flagsAt(i);
+    // Раскладка корректна только для строго возрастающих ключей
+    if (i > 0 && keys[k] <= keyAt(i - 1)) return false;
+    i++;
+    return fillInOrder(2 * k + 1, n, i, keys, flags, keyAt, flagsAt);
+}
+
+bool EytzingerIndex::build(uint32_t count,
+                           std::function<uint64_t(uint32_t)> keyAt,
+                           std::function<uint16_t(uint32_t)> flagsAt) {
+    clear();
+    if (count == 0) return false;
+
+    _keys = (uint64_t*)heap_caps_malloc((count + 1) * sizeof(uint64_t), MALLOC_CAP_SPIRAM);
+    _flags = (uint16_t*)heap_caps_malloc((count + 1) * sizeof(uint16_t), MALLOC_CAP_SPIRAM);
+    if (!_keys || !_flags) { clear(); return false; }
+
+    uint32_t i = 0;
+    if (!fillInOrder(1, count, i, _keys, _flags, keyAt, flagsAt)) { clear(); return false; }
+    _count = count;
+
+    // Верхние уровни дерева — это просто начало массива
+    uint32_t top = (1u << EYTZ_TOP_LEVELS) - 1;
+    _topCount = (count < top) ? count : top;
+    _top = (uint64_t*)heap_caps_malloc((_topCount + 1) * sizeof(uint64_t), MALLOC_CAP_INTERNAL);
+    if (_top) memcpy(_top, _keys, (_topCount + 1) * sizeof(uint64_t));
+    else _topCount = 0; // Нет места во внутренней RAM — работаем только из PSRAM
+
+    return true;
+}
+
+uint32_t EytzingerIndex::find(uint64_t key) const {
+    uint32_t k = 1;
+    while (k <= _topCount) {
+        k = 2 * k + (_top[k] < key);
+    }
+    while (k <= _count) {
+        // Через 4 уровня понадобится блок из 16 соседних узлов — подтягиваем его заранее
+        if (k * 16 <= _count) __builtin_prefetch(_keys + k * 16);
+#ifdef CARDDB_PROFILE
+        psramProbes++;
+#endif
+        k = 2 * k + (_keys[k] < key);
+    }
+    // Убираем хвост из "правых" шагов — получаем lower_bound
+    k >>= __builtin_ffs(~k);
+    if (k == 0) return 0;
+    uint64_t v = (k <= _topCount) ? _top[k] : _keys[k];
+    return (v == key) ? k : 0;
+}
+
+void EytzingerIndex::findBatch(const uint64_t* keys, uint32_t n, uint32_t* pos) const {
+    for (uint32_t base = 0; base < n; base += EYTZ_BATCH_LANES) {
+        uint32_t lanes = (n - base < EYTZ_BATCH_LANES) ? n - base : EYTZ_BATCH_LANES;
+        const uint64_t* key = keys + base;
+        uint32_t k[EYTZ_BATCH_LANES];
+        for (uint32_t j = 0; j < lanes; j++) k[j] = 1;
+
+        // Верхние уровни во внутренней SRAM — общие для всех дорожек
+        for (uint32_t level = 1; level <= _topCount; level = 2 * level + 1) {
+            for (uint32_t j = 0; j < lanes; j++) k[j] = 2 * k[j] + (_top[k[j]] < key[j]);
+        }
+        // Дальше каждый шаг — чтение PSRAM; глубина дорожек отличается не больше чем на уровень
+        bool more = true;
+        while (more) {
+            more = false;
+            for (uint32_t j = 0; j < lanes; j++) {
+                if (k[j] > _count) continue;
+                if (k[j] * 16 <= _count) __builtin_prefetch(_keys + k[j] * 16);
+#ifdef CARDDB_PROFILE
+                psramProbes++;
+#endif
+                k[j] = 2 * k[j] + (_keys[k[j]] < key[j]);
+                more = true;
+            }
+        }
+        for (uint32_t j = 0; j < lanes; j++) {
+            uint32_t x = k[j] >> __builtin_ffs(~k[j]);
+            uint64_t v = x ? ((x <= _topCount) ? _top[x] : _keys[x]) : 0;
+            pos[base + j] = (x && v == key[j]) ? x : 0;
+        }
+    }
+}
+
+void EytzingerIndex::forEachSorted(std::function<void(uint64_t, uint16_t)> fn) const {
+    if (_count == 0) return;
+    // Итеративный in-order: спуск в самый левый узел, затем к следующему по порядку
+    uint32_t k = 1;
+    while (2 * k <= _count) k = 2 * k;
+    while (k) {
+        fn(_keys[k], _flags[k]);
+        if (2 * k + 1 <= _count) {
+            k = 2 * k + 1;
+            while (2 * k <= _count) k = 2 * k;
+        } else {
+            while (k & 1) k >>= 1;
+            k >>= 1;
+        }
+    }
+}
@@ -0,0 +1,159 @@
+#include "httpparser.h"
+
+static inline char lower(char c) { return (c >= 'A' && c <= 'Z') ? c + 32 : c; }
+
+// Имя заголовка без учёта регистра
+static bool nameIs(const char* s, size_t n, const char* name) {
+    size_t i = 0;
+    for (; i < n && name[i]; i++) {
+        if (lower(s[i]) != name[i]) return false;
+    }
+    return i == n && name[i] == 0;
+}
+
+const char* httpStatusText(uint16_t status) {
+    switch (status) {
+        case 200: return "OK";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 414: return "URI Too Long";
+        case 431: return "Request Header Fields Too Large";
+        case 503: return "Service Unavailable";
+        case 507: return "Insufficient Storage";
+        default: return status < 500 ? "Error" : "Internal Server Error";
+    }
+}
+
+void HttpRequestParser::reset() {
+    _state = HTTP_REQUEST_LINE;
+    _error = 0;
+    _method = HTTP_UNKNOWN;
+    _lineLen = 0;
+    _lineOverflow = false;
+    _path[0] = 0;
+    _query = _path;
+    _auth[0] = 0;
+    _etag[0] = 0;
+    _contentLength = 0;
+    _body[0] = 0;
+    _bodyLen = 0;
+}
+
+size_t HttpRequestParser::feed(const uint8_t* data, size_t len) {
+    size_t i = 0;
+    while (i < len && _state < HTTP_STREAM) {
+        if (_state == HTTP_BODY) {
+            size_t take = _contentLength - _bodyLen;
+            if (take > len - i) take = len - i;
+            memcpy(_body + _bodyLen, data + i, take);
+            _bodyLen += take;
+            i += take;
+            if (_bodyLen == _contentLength) {
+                _body[_bodyLen] = 0;
+                _state = HTTP_DONE;
+            }
+            continue;
+        }
+        char c = (char)data[i++];
+        if (c == '\n') {
+            if (_lineLen && _line[_lineLen - 1] == '\r') _lineLen--;
+            _line[_lineLen] = 0;
+            line();
+            _lineLen = 0;
+            _lineOverflow = false;
+        } else if (_lineLen < HTTP_MAX_LINE - 1) {
+            _line[_lineLen++] = c;
+        } else {
+            _lineOverflow = true;
+        }
+    }
+    return i;
+}
+
+void HttpRequestParser::line() {
+    if (_state == HTTP_REQUEST_LINE) {
+        // Пустые строки перед запросом допустимы (RFC 7230, 3.5)
+        if (_lineLen == 0 && !_lineOverflow) return;
+        if (_lineOverflow) return fail(414);
+        requestLine();
+        return;
+    }
+    if (_lineLen == 0 && !_lineOverflow) {
+        // Конец заголовков
+        if (_contentLength > HTTP_MAX_BODY) {
+            if (!_streaming) return fail(413);
+            _state = HTTP_STREAM;
+            return;
+        }
+        _state = _contentLength ? HTTP_BODY : HTTP_DONE;
+        return;
+    }
+    header();
+}
+
+// "GET /path?query HTTP/1.1"
+void HttpRequestParser::requestLine() {
+    char* sp1 = (char*)memchr(_line, ' ', _lineLen);
+    if (!sp1) return fail(400);
+    size_t mlen = sp1 - _line;
+    if (mlen == 3 && !memcmp(_line, "GET", 3)) _method = HTTP_GET;
+    else if (mlen == 4 && !memcmp(_line, "POST", 4)) _method = HTTP_POST;
+    else if (mlen == 4 && !memcmp(_line, "HEAD", 4)) _method = HTTP_HEAD;
+    else if (mlen == 6 && !memcmp(_line, "DELETE", 6)) _method = HTTP_DELETE;
+    else _method = HTTP_UNKNOWN;
+
+    char* target = sp1 + 1;
+    char* sp2 = (char*)memchr(target, ' ', _line + _lineLen - target);
+    if (!sp2 || sp2 == target || strncmp(sp2 + 1, "HTTP/1.", 7) != 0) return fail(400);
+    size_t tlen = sp2 - target;
+    if (tlen >= HTTP_MAX_PATH) return fail(414);
+    memcpy(_path, target, tlen);
+    _path[tlen] = 0;
+    char* q = strchr(_path, '?');
+    if (q) {
+        *q = 0;
+        _query = q + 1;
+    } else {
+        _query = _path + tlen;
+    }
+    _state = HTTP_HEADERS;
+}
+
+void HttpRequestParser::header() {
+    char* colon = (char*)memchr(_line, ':', _lineLen);
+    if (!colon) return fail(400);
+    size_t nlen = colon - _line;
+    const char* v = colon + 1;
+    while (*v == ' ' || *v == '\t') v++;
+    size_t vlen = _line + _lineLen - v;
+    while (vlen && (v[vlen - 1] == ' ' || v[vlen - 1] == '\t')) vlen--;
+
+    if (nameIs(_line, nlen, "content-length")) {
+        if (_lineOverflow || vlen == 0 || vlen > 9) return fail(_lineOverflow ? 431 : 400);
+        uint32_t n = 0;
+        for (size_t i = 0; i < vlen; i++) {
+            if (v[i] < '0' || v[i] > '9') return fail(400);
+            n = n * 10 + (v[i] - '0');
+        }
+        _contentLength = n;
+    } else if (nameIs(_line, nlen, "authorization")) {
+        if (_lineOverflow || vlen >= HTTP_MAX_AUTH) return fail(431);
+        memcpy(_auth, v, vlen);
+        _auth[vlen] = 0;
+    } else if (nameIs(_line, nlen, "if-none-match")) {
+        // Чужой длинный тег нам всё равно не совпадёт
+        if (!_lineOverflow && vlen < HTTP_MAX_ETAG) {
+            memcpy(_etag, v, vlen);
+            _etag[vlen] = 0;
+        }
+    }
+    // Остальные заголовки (включая обрезанные длинные Cookie, User-Agent) не нужны
+}
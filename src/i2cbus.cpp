@@ -0,0 +1,167 @@
+#include "i2cbus.h"
+
+#define PENDING_FLAG 0x100
+
+I2CBus::I2CBus() {}
+
+bool I2CBus::addOutput(uint8_t addr, uint8_t initial) {
+    if (_task || _outputCount >= I2C_MAX_OUTPUTS) return false;
+    Output& o = _outputs[_outputCount++];
+    o.addr = addr;
+    o.pending = PENDING_FLAG | initial;   // Начальное состояние уходит первой записью
+    o.since = micros();
+    _stats[I2C_CLASS_WRITE].requests++;
+    return true;
+}
+
+void I2CBus::begin() {
+    _reads = xQueueCreate(I2C_READ_QUEUE, sizeof(ReadRequest*));
+    _windowStart = micros();
+    xTaskCreatePinnedToCore(busTask, "I2CBus", 4096, this, I2C_BUS_PRIO, &_task, I2C_BUS_CORE);
+    Serial.printf("🚀 I2C bus task started on Core %d (%u outputs)\n", I2C_BUS_CORE, _outputCount);
+}
+
+bool I2CBus::read8(uint8_t addr, uint8_t& data) {
+    if (!_task) return false;
+    _readRequests.fetch_add(1, std::memory_order_relaxed);
+
+    // Запрос живёт на стеке вызывающего, пока задача шины его не выполнит
+    StaticSemaphore_t doneBuf;
+    ReadRequest req;
+    req.addr = addr;
+    req.data = 0xFF;
+    req.ok = false;
+    req.tQueued = micros();
+    req.done = xSemaphoreCreateBinaryStatic(&doneBuf);
+    ReadRequest* p = &req;
+    if (xQueueSend(_reads, &p, 0) != pdTRUE) {
+        _readDropped.fetch_add(1, std::memory_order_relaxed);
+        vSemaphoreDelete(req.done);
+        return false;
+    }
+    xTaskNotifyGive(_task);
+    // Без таймаута: задача шины обязательно завершит запрос (Wire сам ограничен по времени),
+    // а уйти раньше значит оставить ей указатель на уже чужой стек
+    xSemaphoreTake(req.done, portMAX_DELAY);
+    vSemaphoreDelete(req.done);
+    data = req.data;
+    return req.ok;
+}
+
+bool I2CBus::write8(uint8_t addr, uint8_t value) {
+    for (uint8_t i = 0; i < _outputCount; i++) {
+        Output& o = _outputs[i];
+        if (o.addr != addr) continue;
+        _writeRequests.fetch_add(1, std::memory_order_relaxed);
+        uint16_t prev = o.pending.exchange(PENDING_FLAG | value, std::memory_order_acq_rel);
+        if (!(prev & PENDING_FLAG)) {
+            o.since.store(micros(), std::memory_order_relaxed);
+            if (_task) xTaskNotifyGive(_task);
+        }
+        return true;
+    }
+    return false;
+}
+
+void I2CBus::busTask(void* arg) {
+    I2CBus* self = (I2CBus*)arg;
+    ReadRequest* r;
+    while (true) {
+        // Все ждущие чтения — раньше любой записи
+        while (xQueueReceive(self->_reads, &r, 0) == pdTRUE) self->doRead(r);
+        // Одна запись, и снова проверяем чтения
+        if (self->flushOne()) continue;
+
+        self->account(micros());
+        ulTaskNotifyTake(pdTRUE, self->_retryPending ? pdMS_TO_TICKS(I2C_RETRY_MS) : pdMS_TO_TICKS(1000));
+        self->_retryPending = false;
+    }
+}
+
+void I2CBus::doRead(ReadRequest* r) {
+    I2CClassStats& st = _stats[I2C_CLASS_READ];
+    uint32_t t0 = micros();
+    for (uint8_t attempt = 0; attempt <= I2C_READ_RETRIES && !r->ok; attempt++) {
+        if (attempt) st.retries++;
+        if (Wire.requestFrom(r->addr, (uint8_t)1) == 1 && Wire.available()) {
+            r->data = Wire.read();
+            r->ok = true;
+        }
+    }
+    uint32_t t1 = micros();
+    _busyUs += t1 - t0;
+    st.done++;
+    if (!r->ok) st.errors++;
+    st.latency.add(t1 - r->tQueued);
+    xSemaphoreGive(r->done);
+}
+
+bool I2CBus::flushOne() {
+    for (uint8_t n = 0; n < _outputCount; n++) {
+        Output& o = _outputs[_nextOutput];
+        _nextOutput = (_nextOutput + 1) % _outputCount;
+        // После ошибки не долбим устройство на каждом пробуждении
+        if (o.retryAt && (int32_t)(millis() - o.retryAt) < 0) { _retryPending = true; continue; }
+
+        uint32_t since = o.since.load(std::memory_order_relaxed);
+        uint16_t v = o.pending.exchange(0, std::memory_order_acq_rel);
+        if (!(v & PENDING_FLAG)) continue;
+
+        I2CClassStats& st = _stats[I2C_CLASS_WRITE];
+        uint32_t t0 = micros();
+        bool ok = false;
+        for (uint8_t attempt = 0; attempt <= I2C_WRITE_RETRIES && !ok; attempt++) {
+            if (attempt) st.retries++;
+            Wire.beginTransmission(o.addr);
+            Wire.write((uint8_t)v);
+            ok = Wire.endTransmission() == 0;
+        }
+        uint32_t t1 = micros();
+        _busyUs += t1 - t0;
+        st.done++;
+        if (ok) {
+            o.retryAt = 0;
+            st.latency.add(t1 - since);
+        } else {
+            // Не отправилось — возвращаем байт, если за это время не пришёл новый
+            st.errors++;
+            uint16_t expected = 0;
+            o.pending.compare_exchange_strong(expected, v, std::memory_order_acq_rel);
+            o.retryAt = millis() + I2C_RETRY_MS;
+            if (!o.retryAt) o.retryAt = 1;
+            _retryPending = true;
+        }
+        return true;
+    }
+    return false;
+}
+
+void I2CBus::account(uint32_t nowUs) {
+    uint32_t window = nowUs - _windowStart;
+    if (window < 1000000) return;
+    _utilization = (uint32_t)((uint64_t)_busyUs * 1000 / window);
+    _busyUs = 0;
+    _windowStart = nowUs;
+}
+
+I2CBusStats I2CBus::stats() const {
+    I2CBusStats s;
+    for (int c = 0; c < I2C_CLASS_COUNT; c++) s.cls[c] = _stats[c];
+    s.cls[I2C_CLASS_READ].requests = _readRequests.load(std::memory_order_relaxed);
+    s.cls[I2C_CLASS_READ].dropped = _readDropped.load(std::memory_order_relaxed);
+    s.cls[I2C_CLASS_WRITE].requests += _writeRequests.load(std::memory_order_relaxed);
+    s.utilization = _utilization;
+    return s;
+}
+
+void I2CBus::printStats() const {
+    I2CBusStats s = stats();
+    const char* names[I2C_CLASS_COUNT] = {"read", "write"};
+    Serial.printf("I2C bus: %u.%u%% busy\n", (unsigned)(s.utilization / 10), (unsigned)(s.utilization % 10));
+    for (int c = 0; c < I2C_CLASS_COUNT; c++) {
+        const I2CClassStats& st = s.cls[c];
+        Serial.printf("  %-5s: %u req, %u done, %u retries, %u errors, %u dropped, latency avg %u us / max %u us\n",
+                      names[c], (unsigned)st.requests, (unsigned)st.done, (unsigned)st.retries, (unsigned)st.errors, (unsigned)st.dropped,
+                      (unsigned)st.latency.avgUs, (unsigned)st.latency.maxUs);
+    }
+}
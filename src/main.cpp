@@ -7,44 +7,32 @@
 #include "web.h"
 #include "search.h"
 #include "dsl.h"
+#include "pipeline.h"
 
 
 JsonDocument config;
 HardwareManager hw;
 WiegandManager wiegand; 
 CardDatabase db;      
-WebHandler web(config, hw);
 DSLProcessor dsl(hw); 
+WebHandler web(config, hw, db, dsl);
+CardPipeline pipeline(db, dsl);
 
 void printMemoryStats() {
     Serial.println("\n--- [ MEMORY INFO ] ---");
     Serial.printf("RAM: %u KB | PSRAM: %u KB\n", 
-                  heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / 1024,
-                  heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024);
-}
-
-void onCardRead(uint64_t uid, int groupId) {
-    Serial.printf("\n[Wiegand] Card Read: %llx (Group %d)\n", uid, groupId);
-    
-    CardResult result = db.find(uid);
-
-    if (result.found && result.status == 1) {
-        bool actionExecuted = false;
-
-        for (auto& ins : result.instructions) {
-            if (ins.action > 0) {
-                Serial.printf("🚀 DSL Action #%d triggered\n", ins.action);
-                dsl.runActionFromFile(ins.action - 1); 
-                actionExecuted = true;
-            }
-        }
-
-        if (!actionExecuted) {
-            Serial.println("⚠️ Доступ разрешен, но для этой карты/группы не назначен DSL Action (action=0)");
-        }
-    } else {
-        Serial.printf("❌ Доступ запрещен или карта не найдена. UID: %llx\n", uid);
-    }
+                  (unsigned)(heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / 1024),
+                  (unsigned)(heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024));
+    Serial.printf("Card cache: %u hits / %u misses\n", (unsigned)db.cache().hits(), (unsigned)db.cache().misses());
+    DSLStats ds = dsl.stats();
+    Serial.printf("DSL tasks: %u active, %u peak, %u dropped (max %d)\n", (unsigned)ds.active, (unsigned)ds.peak, (unsigned)ds.dropped, DSL_MAX_TASKS);
+    PulseStats ps = hw.pulseStats();
+    Serial.printf("Pulses: %u active, %u peak, %u expired, %u cancelled, %u dropped (max %d)\n",
+                  (unsigned)ps.active, (unsigned)ps.peak, (unsigned)ps.expired, (unsigned)ps.cancelled, (unsigned)ps.dropped, PULSE_MAX);
+    pipeline.printStats();
+    wiegand.printStats();
+    hw.bus().printStats();
+    web.printStats();
 }
 
 void setup() {
@@ -64,14 +52,25 @@ void setup() {
     hw.init(config);
     
     // Загрузка БД карт в PSRAM
-    if (db.begin()) Serial.println("✅ DB Loaded to PSRAM");
+    String indexLayout = config["database"]["index"] | "binary";
+    CardIndexLayout layout = (indexLayout == "eytzinger") ? CardIndexLayout::EYTZINGER : CardIndexLayout::BINARY;
+    String dbStorage = config["database"]["storage"] | "psram";
+    CardStorage storage = (dbStorage == "flash") ? CardStorage::FLASH_MAPPED : CardStorage::PSRAM;
+    size_t filterKB = config["database"]["filter_kb"] | CARD_FILTER_DEFAULT_KB;
+    if (db.begin(layout, storage, filterKB)) {
+        Serial.println("✅ DB Loaded");
+        db.startCompaction();
+    }
 
     // Инициализация DSL
     dsl.begin();
 
+    // Стадии поиска и исполнения должны ждать кадры раньше, чем стартует декодер
+    pipeline.begin();
+
     // Запуск Wiegand
     if (config["devices"].is<JsonArray>()) {
-        wiegand.init(config["devices"].as<JsonArray>(), &hw); 
+        wiegand.init(config["devices"].as<JsonArray>(), &hw, &pipeline); 
     }
 
     web.begin();
@@ -80,25 +79,25 @@ void setup() {
     Serial.println("\n--- [ ТЕСТ ПОИСКА КАРТЫ ] ---");
     uint64_t testUid = 0x0100000002468AULL; 
     // uint64_t testUid = 0x01000000ULL;
-    CardResult res = db.find(testUid);
+    CardView res = db.findView(testUid);
 
     if (res.found) {
         Serial.printf("✅ КАРТА НАЙДЕНА!\n");
-        Serial.printf("ID: %llx\n", res.uid);
+        Serial.printf("ID: %llx\n", (unsigned long long)res.uid);
         Serial.printf("Статус: %d\n", res.status);
         Serial.printf("Группа: %d\n", res.group_id);
         Serial.printf("Лимит: %d\n", res.limit);
-        Serial.printf("Источник: %s\n", res.source.c_str());
-        Serial.printf("Время поиска: %u us\n", res.search_time_us);
-        Serial.printf("Инструкций найдено: %d\n", res.instructions.size());
+        Serial.printf("Источник: %s\n", cardSourceName(res.source));
+        Serial.printf("Время поиска: %u us\n", (unsigned)res.search_time_us);
+        Serial.printf("Инструкций найдено: %u\n", (unsigned)res.instructions.size());
 
         for (size_t i = 0; i < res.instructions.size(); i++) {
-            auto& ins = res.instructions[i];
+            const Instruction& ins = res.instructions[i];
             Serial.printf("  [%d] Action Index: %d, Priority: %d, Schedule: %d\n", 
-                          i, ins.action, ins.priority, ins.schedule);
+                          (int)i, ins.action, ins.priority, ins.schedule);
         }
     } else {
-        Serial.printf("❌ Карта %llx НЕ НАЙДЕНА в базе данных.\n", testUid);
+        Serial.printf("❌ Карта %llx НЕ НАЙДЕНА в базе данных.\n", (unsigned long long)testUid);
     }
     Serial.println("-----------------------------\n");
 }
@@ -112,8 +111,12 @@ void loop() {
         String input = Serial.readStringUntil('\n');
         input.trim();
         if (input.length() > 0) {
-            dsl.execute(input); 
-            Serial.println("📥 Command queued");
+            if (input == "RELOAD") {
+                dsl.reload();
+            } else {
+                dsl.execute(input); 
+                Serial.println("📥 Command queued");
+            }
         }
     }
     
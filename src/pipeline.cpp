@@ -0,0 +1,97 @@
+#include "pipeline.h"
+#include "search.h"
+#include "dsl.h"
+
+void CardPipeline::begin() {
+    xTaskCreatePinnedToCore(decideTask, "CardDecide", 8192, this, PIPE_DECIDE_PRIO, &_decideTask, PIPE_DECIDE_CORE);
+    xTaskCreatePinnedToCore(actTask, "CardAct", 4096, this, PIPE_ACT_PRIO, &_actTask, PIPE_ACT_CORE);
+    Serial.printf("🚀 Card pipeline started: decide on Core %d, act on Core %d\n", PIPE_DECIDE_CORE, PIPE_ACT_CORE);
+}
+
+bool CardPipeline::submit(const CardFrame& f) {
+    if (!_frames.push(f)) return false;
+    // Уведомление — счётчик задачи: кадр, пришедший во время разбора очереди, не теряется
+    if (_decideTask) xTaskNotifyGive(_decideTask);
+    return true;
+}
+
+void CardPipeline::decideTask(void* arg) {
+    CardPipeline* self = (CardPipeline*)arg;
+    CardFrame f;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (self->_frames.pop(f)) self->decide(f);
+    }
+}
+
+void CardPipeline::actTask(void* arg) {
+    CardPipeline* self = (CardPipeline*)arg;
+    ActionEvent ev;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (self->_actions.pop(ev)) self->act(ev);
+    }
+}
+
+void CardPipeline::decide(const CardFrame& f) {
+    // Невладеющий результат: поиск и перебор инструкций не трогают кучу
+    CardView result = _db.findView(f.uid, f.bits);
+    uint32_t now = micros();
+    _decideLat.add(now - f.t);
+
+    Serial.printf("\n[Wiegand] Card Read: %llx (Reader %u, Group %u, %u bit)\n", (unsigned long long)f.uid, f.reader, f.group, f.bits);
+
+    if (!result.found || result.status != 1) {
+        Serial.printf("❌ Доступ запрещен или карта не найдена. UID: %llx\n", (unsigned long long)f.uid);
+        return;
+    }
+    // Сводка группы посчитана при загрузке: пустую группу видно без перебора
+    if (result.actionMask == 0) {
+        Serial.println("⚠️ Доступ разрешен, но для этой карты/группы не назначен DSL Action (action=0)");
+        return;
+    }
+
+    bool queued = false;
+    for (const Instruction& ins : result.instructions) {
+        if (ins.action == 0) continue;
+        ActionEvent ev;
+        ev.tFrame = f.t;
+        ev.tDecided = now;
+        ev.action = ins.action;
+        if (_actions.push(ev)) queued = true;
+        else Serial.printf("⚠️ Action queue full (%u), action #%u dropped\n", (unsigned)_actions.capacity(), ins.action);
+    }
+    if (queued && _actTask) xTaskNotifyGive(_actTask);
+}
+
+void CardPipeline::act(const ActionEvent& ev) {
+    Serial.printf("🚀 DSL Action #%u triggered\n", ev.action);
+    _dsl.runAction(ev.action - 1);
+    uint32_t now = micros();
+    _actLat.add(now - ev.tDecided);
+    _totalLat.add(now - ev.tFrame);
+}
+
+template <typename Ring>
+static RingStats ringStats(const Ring& r) {
+    return RingStats{r.size(), r.peak(), r.capacity(), r.dropped()};
+}
+
+PipelineStats CardPipeline::stats() const {
+    PipelineStats s;
+    s.frames = ringStats(_frames);
+    s.actions = ringStats(_actions);
+    s.decide = _decideLat;
+    s.act = _actLat;
+    s.total = _totalLat;
+    return s;
+}
+
+void CardPipeline::printStats() const {
+    PipelineStats s = stats();
+    Serial.printf("Pipeline frames: %u/%u (peak %u, dropped %u) | actions: %u/%u (peak %u, dropped %u)\n",
+                  (unsigned)s.frames.depth, (unsigned)s.frames.capacity, (unsigned)s.frames.peak, (unsigned)s.frames.dropped,
+                  (unsigned)s.actions.depth, (unsigned)s.actions.capacity, (unsigned)s.actions.peak, (unsigned)s.actions.dropped);
+    Serial.printf("Pipeline latency us (avg/max): decide %u/%u | act %u/%u | total %u/%u\n",
+                  (unsigned)s.decide.avgUs, (unsigned)s.decide.maxUs, (unsigned)s.act.avgUs, (unsigned)s.act.maxUs, (unsigned)s.total.avgUs, (unsigned)s.total.maxUs);
+}
@@ -0,0 +1,164 @@
+#include "pulsewheel.h"
+
+PulseWheel::PulseWheel() {
+    for (int s = 0; s < PULSE_WHEEL_SLOTS; s++) _slots[s] = PULSE_NONE;
+    for (int i = 0; i < PULSE_MAX; i++) {
+        _e[i].used = false;
+        _e[i].gen = 0;
+        _free[i] = PULSE_MAX - 1 - i;
+    }
+    _freeCount = PULSE_MAX;
+    memset(_holders, 0, sizeof(_holders));
+}
+
+// Дескриптор: номер записи + поколение, 0 не бывает
+static inline uint32_t makeHandle(uint16_t i, uint8_t gen) { return ((uint32_t)gen << 16) | (i + 1); }
+
+int PulseWheel::find(uint32_t handle) const {
+    uint32_t i = (handle & 0xFFFF) - 1;
+    if (i >= PULSE_MAX || !_e[i].used || _e[i].gen != (uint8_t)(handle >> 16)) return -1;
+    return (int)i;
+}
+
+void PulseWheel::hold(OutputMask pins, PulseOut& out) {
+    while (pins) {
+        uint8_t p = (sizeof(OutputMask) > 4) ? __builtin_ctzll(pins) : __builtin_ctz(pins);
+        pins &= pins - 1;
+        if (_holders[p]++ == 0) {
+            OutputMask bit = (OutputMask)1 << p;
+            out.clear |= bit;
+            out.set &= ~bit;
+        }
+    }
+}
+
+void PulseWheel::unhold(OutputMask pins, PulseOut& out) {
+    while (pins) {
+        uint8_t p = (sizeof(OutputMask) > 4) ? __builtin_ctzll(pins) : __builtin_ctz(pins);
+        pins &= pins - 1;
+        if (_holders[p] && --_holders[p] == 0) {
+            OutputMask bit = (OutputMask)1 << p;
+            out.set |= bit;
+            out.clear &= ~bit;
+        }
+    }
+}
+
+// Срабатывание через ticks тиков от текущего
+void PulseWheel::arm(uint16_t i, uint32_t ticks) {
+    if (ticks == 0) ticks = 1;
+    Entry& e = _e[i];
+    e.slot = (_now + ticks) & (PULSE_WHEEL_SLOTS - 1);
+    e.rounds = (ticks - 1) / PULSE_WHEEL_SLOTS;
+    e.prev = PULSE_NONE;
+    e.next = _slots[e.slot];
+    if (e.next != PULSE_NONE) _e[e.next].prev = i;
+    _slots[e.slot] = i;
+}
+
+void PulseWheel::unlink(uint16_t i) {
+    Entry& e = _e[i];
+    if (e.prev != PULSE_NONE) _e[e.prev].next = e.next;
+    else _slots[e.slot] = e.next;
+    if (e.next != PULSE_NONE) _e[e.next].prev = e.prev;
+}
+
+void PulseWheel::release(uint16_t i) {
+    _e[i].used = false;
+    _e[i].gen++;
+    _free[_freeCount++] = i;
+    _stats.active--;
+}
+
+uint32_t PulseWheel::start(OutputMask pins, uint32_t onMs, uint32_t offMs, uint32_t count, PulseOut& out) {
+    if (!pins) return 0;
+    if (_freeCount == 0) {
+        _stats.dropped++;
+        return 0;
+    }
+    uint16_t i = _free[--_freeCount];
+    Entry& e = _e[i];
+    e.used = true;
+    e.pins = pins;
+    e.onTicks = onMs;
+    e.offTicks = offMs;
+    e.left = count;
+    e.on = true;
+    hold(pins, out);
+    arm(i, onMs);
+    _stats.active++;
+    if (_stats.active > _stats.peak) _stats.peak = _stats.active;
+    return makeHandle(i, e.gen);
+}
+
+uint32_t PulseWheel::pulse(OutputMask pins, uint32_t ms, PulseOut& out) {
+    return start(pins, ms, 0, 1, out);
+}
+
+uint32_t PulseWheel::blink(OutputMask pins, uint32_t onMs, uint32_t offMs, uint32_t count, PulseOut& out) {
+    // Без паузы мигание — это просто импульс
+    if (offMs == 0) return start(pins, onMs * (count ? count : 1), 0, 1, out);
+    return start(pins, onMs, offMs, count, out);
+}
+
+bool PulseWheel::cancel(uint32_t handle, PulseOut& out) {
+    int i = find(handle);
+    if (i < 0) return false;
+    unlink(i);
+    if (_e[i].on) unhold(_e[i].pins, out);
+    release(i);
+    _stats.cancelled++;
+    return true;
+}
+
+uint32_t PulseWheel::cancelPins(OutputMask pins, PulseOut& out) {
+    uint32_t n = 0;
+    for (uint16_t i = 0; i < PULSE_MAX; i++) {
+        if (_e[i].used && (_e[i].pins & pins) && cancel(makeHandle(i, _e[i].gen), out)) n++;
+    }
+    return n;
+}
+
+void PulseWheel::cancelAll(PulseOut& out) {
+    cancelPins((OutputMask)~(OutputMask)0, out);
+}
+
+void PulseWheel::expire(uint16_t i, PulseOut& out) {
+    Entry& e = _e[i];
+    if (e.on) {
+        unhold(e.pins, out);
+        e.on = false;
+        // Простой импульс или последнее включение мигания
+        if (e.offTicks == 0 || e.left == 1) {
+            release(i);
+            _stats.expired++;
+            return;
+        }
+        if (e.left) e.left--;
+        arm(i, e.offTicks);
+    } else {
+        hold(e.pins, out);
+        e.on = true;
+        arm(i, e.onTicks);
+    }
+}
+
+void PulseWheel::advance(uint32_t ticks, PulseOut& out) {
+    while (ticks--) {
+        _now++;
+        if (_stats.active == 0) continue;
+        uint16_t slot = _now & (PULSE_WHEEL_SLOTS - 1);
+        uint16_t i = _slots[slot];
+        while (i != PULSE_NONE) {
+            // Следующий запоминаем заранее: перевзвод на полный оборот вставит запись в эту же ячейку
+            uint16_t next = _e[i].next;
+            if (_e[i].rounds) {
+                _e[i].rounds--;
+            } else {
+                unlink(i);
+                expire(i, out);
+            }
+            i = next;
+        }
+    }
+}
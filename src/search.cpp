@@ -1,133 +1,362 @@
 #include "search.h"
+#include <algorithm>
+#include <unordered_map>
 
-CardDatabase::CardDatabase() {}
+#ifdef CARDDB_PROFILE
+#define DB_TOUCH(n) (_bytesTouched += (n))
+#else
+#define DB_TOUCH(n) ((void)0)
+#endif
 
-bool CardDatabase::begin() {
+static void recoverDbFiles();
+static void stampDbFiles(CardImageSource& src);
+
+CardDatabase::CardDatabase() {
+    _deltaMutex = xSemaphoreCreateMutex();
+    _journalMutex = xSemaphoreCreateMutex();
+    _compactMutex = xSemaphoreCreateMutex();
+}
+
+const char* cardSourceName(CardSource source) {
+    switch (source) {
+        case CardSource::PSRAM_34: return "PSRAM-34";
+        case CardSource::PSRAM_56: return "PSRAM-56";
+        case CardSource::FLASH_34: return "FLASH-34";
+        case CardSource::FLASH_56: return "FLASH-56";
+        case CardSource::DELTA: return "DELTA";
+        default: return "NONE";
+    }
+}
+
+CardTables::~CardTables() {
+    if (ownsFilter) delete filter.load();
+    if (mapped) {
+        image.unmap();
+        return;
+    }
+    if (cards34) heap_caps_free(cards34);
+    if (cards56) heap_caps_free(cards56);
+    if (ownsGroups) {
+        if (groups) heap_caps_free(groups);
+        if (groupInstr) heap_caps_free(groupInstr);
+    }
+}
+
+size_t CardTables::psramUsage() const {
+    size_t n = index34.memoryPSRAM() + index56.memoryPSRAM();
+    if (mapped) return n;
+    if (cards34) n += total34 * sizeof(CardRecord34);
+    if (cards56) n += total56 * sizeof(CardRecord56);
+    if (groups) n += totalGroups * sizeof(CardGroup);
+    if (groupInstr) n += totalInstr * sizeof(Instruction);
+    return n;
+}
+
+bool CardDatabase::begin(CardIndexLayout layout, CardStorage storage, size_t filterKB) {
     Serial.println("\n--- [ DATABASE STARTUP ] ---");
+    uint32_t startMs = millis();
+    _loadStats = CardLoadStats();
+    _layout = layout;
+    _storage = storage;
+    recoverDbFiles();
+    CardTables* t = new CardTables();
     
-    if (!loadCards()) { Serial.println("❌ Error loading Cards"); return false; }
-    if (!loadGroups()) { Serial.println("❌ Error loading Groups"); return false; }
-    if (!loadRules()) { Serial.println("❌ Error loading Rules"); return false; }
-    
+    // Быстрый путь: готовый образ в разделе флеша, ничего не копируем. Образ, собранный
+    // не из нынешних файлов (их заменили, а раздел не обновился), собирается заново
+    CardImageSource source{};
+    bool mapped = false;
+    if (_storage == CardStorage::FLASH_MAPPED) {
+        stampDbFiles(source);
+        if (mapImage(*t)) {
+            mapped = t->image.source() == source;
+            if (!mapped) {
+                Serial.println("⚠️ carddb image does not match DB files, rebuilding it");
+                delete t;
+                t = new CardTables();
+            }
+        }
+    }
+    if (mapped) {
+        Serial.println("✅ Card DB mapped from flash partition");
+    } else {
+        if (!loadCards(*t)) { Serial.println("❌ Error loading Cards"); delete t; return false; }
+        if (!loadGroups(*t)) { Serial.println("❌ Error loading Groups"); delete t; return false; }
+        if (!loadRules()) { Serial.println("❌ Error loading Rules"); delete t; return false; }
+        if (!buildGroupInstructions(*t)) { Serial.println("❌ Error unpacking group instructions"); delete t; return false; }
+
+        // Первая загрузка в режиме flash: переносим таблицы в раздел и переключаемся на него
+        if (_storage == CardStorage::FLASH_MAPPED) {
+            CardImageSections sec;
+            sec.cards34 = t->cards34; sec.count34 = t->cards34 ? t->total34 : 0;
+            sec.cards56 = t->cards56; sec.count56 = t->cards56 ? t->total56 : 0;
+            sec.groups = t->groups; sec.groupCount = t->totalGroups;
+            sec.instr = t->groupInstr; sec.instrCount = t->totalInstr;
+
+            if (CardImage::write(sec, source)) {
+                delete t;
+                t = new CardTables();
+                if (mapImage(*t)) Serial.println("✅ Card DB written to flash partition and mapped");
+                else { Serial.println("❌ Error mapping written image"); delete t; return false; }
+            } else {
+                Serial.println("⚠️ carddb partition unavailable, keeping tables in PSRAM");
+            }
+        }
+    }
+
+    // Фильтр строится по записям таблиц, пока индекс их ещё не заменил
+    _filterBytes = filterKB * 1024;
+    t->filter.store(buildFilter(*t));
+    // Индекс Эйтцингера — это копия ключей в PSRAM, для образа во флеше не строим
+    if (!t->mapped) buildIndex(*t);
+    else if (_layout != CardIndexLayout::BINARY) Serial.println("ℹ️ Flash-mapped DB uses binary search");
+    retire(_live.exchange(t));
+
+    // Изменения из журнала ложатся поверх только что загруженных таблиц
+    if (!_delta) _delta = (CardDelta*)heap_caps_malloc(CARD_DELTA_CAPACITY * sizeof(CardDelta), MALLOC_CAP_INTERNAL);
+    if (!_delta) { Serial.println("❌ Error allocating card delta"); return false; }
+    _deltaCount = 0;
+    xSemaphoreTake(_deltaMutex, portMAX_DELAY);
+    uint32_t replayed = _journal.replay([this](const CardDelta& d) { applyDelta(d); });
+    xSemaphoreGive(_deltaMutex);
+    if (replayed) Serial.printf("✅ Journal: %u changes replayed, %u pending\n", (unsigned)replayed, (unsigned)_deltaCount);
+
+    // Решения, закэшированные до перезагрузки, больше не действительны
+    _gen++;
+    if (_cache.begin()) Serial.printf("✅ Hot-card cache: %u entries, %u B SRAM\n", (unsigned)(CARD_CACHE_SETS * 2), (unsigned)_cache.memory());
+
+    _boot_ms = millis() - startMs;
+    Serial.printf("⏱ DB ready in %u ms, tables in PSRAM: %u KB (%s)\n",
+                  (unsigned)_boot_ms, (unsigned)(psramUsage() / 1024), t->mapped ? "flash-mapped" : "copied");
     Serial.println("--- [ DATABASE READY ] ---\n");
     return true;
 }
 
-bool CardDatabase::loadCards() {
+bool CardDatabase::mapImage(CardTables& t) {
+    if (!t.image.map()) return false;
+
+    // Образ только для чтения: таблицы никогда не модифицируются после загрузки
+    const CardImageSections& sec = t.image.sections();
+    t.cards34 = const_cast<CardRecord34*>(sec.cards34);
+    t.total34 = sec.count34;
+    t.cards56 = const_cast<CardRecord56*>(sec.cards56);
+    t.total56 = sec.count56;
+    t.groups = const_cast<CardGroup*>(sec.groups);
+    t.totalGroups = sec.groupCount;
+    t.groupInstr = const_cast<Instruction*>(sec.instr);
+    t.totalInstr = sec.instrCount;
+    t.mapped = true;
+    return true;
+}
+
+// Старый набор освобождается только после того, как его дочитали все начатые поиски
+// и отпустили все CardView. Читатель отмечается до того, как прочитать _gen и _live:
+// если здесь видно _readers == 0, следующий поиск уже увидит новый набор и поколение
+void CardDatabase::retire(CardTables* old) {
+    if (!old) return;
+    while (_readers.load() != 0) vTaskDelay(1);
+    delete old;
+}
+
+size_t CardDatabase::psramUsage() const {
+    CardTables* t = _live.load();
+    return t ? t->psramUsage() : 0;
+}
+
+#ifdef CARDDB_PROFILE
+uint64_t CardDatabase::bytesTouched() const {
+    CardTables* t = _live.load();
+    return _bytesTouched + (t ? (t->index34.psramProbes + t->index56.psramProbes) * sizeof(uint64_t) : 0);
+}
+
+void CardDatabase::resetBytesTouched() {
+    CardTables* t = _live.load();
+    _bytesTouched = 0;
+    if (t) { t->index34.psramProbes = 0; t->index56.psramProbes = 0; }
+}
+#endif
+
+const char* const cardDbFiles[CARD_DB_FILES] = {"/cards34.bin", "/cards56.bin", "/groups.bin", "/rules.bin"};
+
+static String dbPath(int file, const char* suffix) {
+    return String(cardDbFiles[file]) + suffix;
+}
+
+static_assert(CARD_DB_FILES == CARDIMAGE_SOURCES, "image sources are the DB files");
+
+// Отпечатки основных файлов — из них собран (или будет собран) образ во флеше
+static void stampDbFiles(CardImageSource& src) {
+    for (int i = 0; i < CARD_DB_FILES; i++) cardFileStamp(cardDbFiles[i], src.size[i], src.crc[i]);
+}
+
+static size_t fileSize(const char* path) {
+    if (!LittleFS.exists(path)) return 0;
+    File f = LittleFS.open(path, "r");
+    size_t sz = f.size();
+    f.close();
+    return sz;
+}
+
+// Основные файлы -> *.old, файлы с суффиксом -> основные. При любой ошибке всё
+// переносится обратно, и файлы с суффиксом остаются на месте.
+static bool swapDbFiles(const char* suffix) {
+    File mark = LittleFS.open(CARD_DB_SWAP_MARK, "w");
+    if (!mark) return false;
+    mark.close();
+
+    bool backed[CARD_DB_FILES] = {}, moved[CARD_DB_FILES] = {};
+    bool ok = true;
+    for (int i = 0; ok && i < CARD_DB_FILES; i++) {
+        if (!LittleFS.exists(cardDbFiles[i])) continue;
+        backed[i] = LittleFS.rename(cardDbFiles[i], dbPath(i, CARD_DB_BACKUP_SUFFIX).c_str());
+        ok = backed[i];
+    }
+    for (int i = 0; ok && i < CARD_DB_FILES; i++) {
+        moved[i] = LittleFS.rename(dbPath(i, suffix).c_str(), cardDbFiles[i]);
+        ok = moved[i];
+    }
+    if (!ok) {
+        Serial.println("❌ Reload: rename failed, restoring old files");
+        for (int i = CARD_DB_FILES - 1; i >= 0; i--) {
+            if (moved[i]) LittleFS.rename(cardDbFiles[i], dbPath(i, suffix).c_str());
+            if (backed[i]) LittleFS.rename(dbPath(i, CARD_DB_BACKUP_SUFFIX).c_str(), cardDbFiles[i]);
+        }
+        LittleFS.remove(CARD_DB_SWAP_MARK);
+        return false;
+    }
+    // Метка снята — подмена состоялась, копии больше не нужны
+    LittleFS.remove(CARD_DB_SWAP_MARK);
+    for (int i = 0; i < CARD_DB_FILES; i++) {
+        if (backed[i]) LittleFS.remove(dbPath(i, CARD_DB_BACKUP_SUFFIX).c_str());
+    }
+    return true;
+}
+
+// Сбой питания посреди swapDbFiles(): с меткой — возвращаем старый набор целиком
+// (журнал на диске относится к нему), без метки — дочищаем копии
+static void recoverDbFiles() {
+    bool restore = LittleFS.exists(CARD_DB_SWAP_MARK);
+    for (int i = 0; i < CARD_DB_FILES; i++) {
+        String bak = dbPath(i, CARD_DB_BACKUP_SUFFIX);
+        if (!LittleFS.exists(bak.c_str())) continue;
+        if (restore) LittleFS.rename(bak.c_str(), cardDbFiles[i]);
+        else LittleFS.remove(bak.c_str());
+    }
+    if (restore) {
+        LittleFS.remove(CARD_DB_SWAP_MARK);
+        Serial.println("⚠️ Interrupted DB file swap: old files restored");
+    }
+}
+
+bool CardDatabase::loadCards(CardTables& t, const char* suffix) {
+    bool legacy = false;
+
     // Загрузка 34-бит
-    if (LittleFS.exists("/cards34.bin")) {
-        File f = LittleFS.open("/cards34.bin", "r");
-        size_t sz = f.size();
-        _total34 = sz / 7;
-        _cards34 = (uint8_t*)heap_caps_malloc(sz, MALLOC_CAP_SPIRAM);
-        if (_cards34) f.read(_cards34, sz);
-        f.close();
-        Serial.printf("✅ Loaded 34-bit cards: %u\n", _total34);
+    uint32_t startUs = micros();
+    if (loadCardFile34(dbPath(0, suffix).c_str(), t.cards34, t.total34, legacy)) {
+        _loadStats.cards34Us = micros() - startUs;
+        Serial.printf("✅ Loaded 34-bit cards: %u%s (%u ms)\n", (unsigned)t.total34,
+                      legacy ? " (legacy format converted)" : "", (unsigned)(_loadStats.cards34Us / 1000));
     }
 
     // Загрузка 56-бит
-    if (LittleFS.exists("/cards56.bin")) {
-        File f = LittleFS.open("/cards56.bin", "r");
-        size_t sz = f.size();
-        _total56 = sz / 9;
-        _cards56 = (uint8_t*)heap_caps_malloc(sz, MALLOC_CAP_SPIRAM);
-        if (_cards56) f.read(_cards56, sz);
-        f.close();
-        Serial.printf("✅ Loaded 56-bit cards: %u\n", _total56);
+    startUs = micros();
+    if (loadCardFile56(dbPath(1, suffix).c_str(), t.cards56, t.total56, legacy)) {
+        _loadStats.cards56Us = micros() - startUs;
+        Serial.printf("✅ Loaded 56-bit cards: %u%s (%u ms)\n", (unsigned)t.total56,
+                      legacy ? " (legacy format converted)" : "", (unsigned)(_loadStats.cards56Us / 1000));
     }
-    return (_cards34 || _cards56);
+    return (t.cards34 || t.cards56);
 }
 
-bool CardDatabase::loadGroups() {
-    if (!LittleFS.exists("/groups.bin")) return false;
-    File f = LittleFS.open("/groups.bin", "r");
-    
-    uint32_t expected_groups = 16384;
-    _total_groups = 0;
-    size_t total_instr_in_file = 0;
-
-    // 1. Первый проход: Считаем точное кол-во инструкций для аллокации
-    while (f.available() >= 2) {
-        uint16_t bSize;
-        f.read((uint8_t*)&bSize, 2);
-        // Переводим из Big Endian (из файла) в формат процессора
-        bSize = (bSize << 8) | (bSize >> 8); 
-        
-        total_instr_in_file += (bSize / 2);
-        f.seek(f.position() + bSize); // Прыгаем через блок данных
-        _total_groups++;
-    }
-
-    Serial.printf("🔍 Считано из файла: %u групп, %u инструкций\n", _total_groups, total_instr_in_file);
-
-    // 2. Выделяем память
-    _all_groups = (uint16_t*)heap_caps_malloc(total_instr_in_file * 2, MALLOC_CAP_SPIRAM);
-    _group_offsets = (uint32_t*)heap_caps_malloc(_total_groups * 4, MALLOC_CAP_SPIRAM);
-    _group_lens = (uint8_t*)heap_caps_malloc(_total_groups, MALLOC_CAP_SPIRAM);
-
-    if (!_all_groups || !_group_offsets || !_group_lens) {
+// Читает файл целиком крупными порциями; между порциями отдаём управление (watchdog)
+static bool readWhole(File& f, uint8_t* dst, size_t len) {
+    for (size_t done = 0; done < len; ) {
+        size_t n = (len - done < CARDDB_READ_CHUNK) ? len - done : CARDDB_READ_CHUNK;
+        if (f.read(dst + done, n) != n) return false;
+        done += n;
+        yield();
+    }
+    return true;
+}
+
+// Перестановка байт двух 16-битных слов за одну 32-битную операцию
+static void swap16Words(uint16_t* p, size_t n) {
+    uint32_t* w = (uint32_t*)p;
+    for (size_t i = 0; i < n / 2; i++) {
+        uint32_t x = w[i];
+        w[i] = ((x & 0x00FF00FFu) << 8) | ((x >> 8) & 0x00FF00FFu);
+    }
+    if (n & 1) p[n - 1] = __builtin_bswap16(p[n - 1]);
+}
+
+bool CardDatabase::loadGroups(CardTables& t, const char* suffix) {
+    String path = dbPath(2, suffix);
+    if (!LittleFS.exists(path.c_str())) return false;
+    uint32_t startUs = micros();
+    File f = LittleFS.open(path.c_str(), "r");
+    size_t sz = f.size() & ~(size_t)1;
+
+    // Файл: [длина BE][индексы BE]... Читаем его целиком в буфер, который потом
+    // становится массивом индексов: заголовки групп выбрасываются сдвигом на месте.
+    _all_groups = (uint16_t*)heap_caps_malloc(sz ? sz : 2, MALLOC_CAP_SPIRAM);
+    uint32_t capGroups = 16384;
+    t.groups = (CardGroup*)heap_caps_malloc(capGroups * sizeof(CardGroup), MALLOC_CAP_SPIRAM);
+    if (!_all_groups || !t.groups) {
         Serial.println("❌ Ошибка памяти PSRAM для групп");
         f.close();
         return false;
     }
+    bool ok = readWhole(f, (uint8_t*)_all_groups, sz);
+    f.close();
+    if (!ok) return false;
 
-    // 3. Второй проход: Загружаем данные
-    f.seek(0);
-    uint32_t current_instr_idx = 0;
-    for (uint32_t i = 0; i < _total_groups; i++) {
-        uint16_t bSize;
-        f.read((uint8_t*)&bSize, 2);
-        bSize = (bSize << 8) | (bSize >> 8);
-
-        _group_lens[i] = bSize / 2;
-        _group_offsets[i] = current_instr_idx;
-
-        // Читаем все индексы этой группы за один раз
-        f.read((uint8_t*)(_all_groups + current_instr_idx), bSize);
+    // Все поля файла — 16-битные big-endian слова
+    size_t words = sz / 2;
+    swap16Words(_all_groups, words);
 
-        // Исправляем endianness для каждого индекса в группе
-        for (int n = 0; n < _group_lens[i]; n++) {
-            uint16_t raw_idx = _all_groups[current_instr_idx + n];
-            _all_groups[current_instr_idx + n] = (raw_idx << 8) | (raw_idx >> 8);
+    t.totalGroups = 0;
+    uint32_t out = 0;
+    for (size_t pos = 0; pos < words; ) {
+        uint16_t len = _all_groups[pos++] / 2;
+        if (len > words - pos) len = words - pos;   // Обрезанный хвост файла
+        if (t.totalGroups == capGroups) {
+            CardGroup* grown = (CardGroup*)heap_caps_realloc(t.groups, capGroups * 2 * sizeof(CardGroup), MALLOC_CAP_SPIRAM);
+            if (!grown) { Serial.println("❌ Ошибка памяти PSRAM для групп"); return false; }
+            t.groups = grown;
+            capGroups *= 2;
         }
-        current_instr_idx += _group_lens[i];
+        t.groups[t.totalGroups].offset = out;
+        t.groups[t.totalGroups].count = len;
+        t.totalGroups++;
+        memmove(_all_groups + out, _all_groups + pos, len * sizeof(uint16_t));
+        out += len;
+        pos += len;
     }
 
-    f.close();
-    Serial.printf("✅ Успешно загружено групп: %u\n", _total_groups);
+    _loadStats.groupsUs = micros() - startUs;
+    Serial.printf("✅ Успешно загружено групп: %u, индексов: %u (%u ms)\n",
+                  (unsigned)t.totalGroups, (unsigned)out, (unsigned)(_loadStats.groupsUs / 1000));
     return true;
 }
 
-bool CardDatabase::loadRules() {
-    if (!LittleFS.exists("/rules.bin")) return false;
-    File f = LittleFS.open("/rules.bin", "r");
-    size_t sz = f.size();
+bool CardDatabase::loadRules(const char* suffix) {
+    String path = dbPath(3, suffix);
+    if (!LittleFS.exists(path.c_str())) return false;
+    uint32_t startUs = micros();
+    File f = LittleFS.open(path.c_str(), "r");
+    size_t sz = f.size() & ~(size_t)3;
     _total_rules = sz / 4;
-    _rules_table = (uint32_t*)heap_caps_malloc(sz, MALLOC_CAP_SPIRAM);
-    if (!_rules_table) return false;
-    
-    for(uint32_t i=0; i<_total_rules; i++) {
-        uint32_t raw;
-        f.read((uint8_t*)&raw, 4);
-        _rules_table[i] = __builtin_bswap32(raw);
-    }
-    f.close();
-    Serial.printf("✅ Loaded rules: %u\n", _total_rules);
-    return true;
-}
+    _rules_table = (uint32_t*)heap_caps_malloc(sz ? sz : 4, MALLOC_CAP_SPIRAM);
+    if (!_rules_table) { f.close(); return false; }
 
-uint64_t CardDatabase::getID34(uint32_t idx) {
-    uint64_t id = 0;
-    uint8_t* p = _cards34 + (idx * 6);
-    for (int i = 0; i < 4; i++) id = (id << 8) | p[i];
-    return id;
-}
+    bool ok = readWhole(f, (uint8_t*)_rules_table, sz);
+    f.close();
+    if (!ok) return false;
+    for (uint32_t i = 0; i < _total_rules; i++) _rules_table[i] = __builtin_bswap32(_rules_table[i]);
 
-uint64_t CardDatabase::getID56(uint32_t idx) {
-    uint64_t id = 0;
-    uint8_t* p = _cards56 + (idx * 9);
-    for (int i = 0; i < 7; i++) id = (id << 8) | p[i];
-    return id;
+    _loadStats.rulesUs = micros() - startUs;
+    Serial.printf("✅ Loaded rules: %u (%u ms)\n", (unsigned)_total_rules, (unsigned)(_loadStats.rulesUs / 1000));
+    return true;
 }
 
 Instruction CardDatabase::unpackInstruction(uint32_t r) {
@@ -141,62 +370,828 @@ Instruction CardDatabase::unpackInstruction(uint32_t r) {
     return ins;
 }
 
-CardResult CardDatabase::find(uint64_t uid) {
+CardFilter* CardDatabase::buildFilter(const CardTables& t) {
+    if (!_filterBytes) return nullptr;
+    CardFilter* f = new CardFilter();
+    // Запас под карты, которые уплотнение добавит в этот же фильтр
+    if (!f->build(t.total34 + t.total56 + CARD_DELTA_CAPACITY, _filterBytes)) {
+        delete f;
+        Serial.println("⚠️ Card filter not built, misses go to PSRAM");
+        return nullptr;
+    }
+    // После buildIndex() записей уже нет — ключи берём из индекса
+    if (t.cards34) for (uint32_t i = 0; i < t.total34; i++) f->add(t.cards34[i].key);
+    else t.index34.forEachSorted([f](uint64_t k, uint16_t) { f->add(k); });
+    if (t.cards56) for (uint32_t i = 0; i < t.total56; i++) f->add(t.cards56[i].key());
+    else t.index56.forEachSorted([f](uint64_t k, uint16_t) { f->add(k); });
+    Serial.printf("✅ Card filter: %u KB SRAM, %.1f bits/key, k=%u, false positives ~%.2f%%\n",
+                  (unsigned)(f->memory() / 1024), f->bitsPerKey(), (unsigned)f->hashes(), f->falsePositiveRate() * 100);
+    if (f->bitsPerKey() < CARD_FILTER_MIN_BITS_PER_KEY) {
+        Serial.printf("⚠️ Card filter below %u bits/key: raise database.filter_kb or free internal RAM\n",
+                      (unsigned)CARD_FILTER_MIN_BITS_PER_KEY);
+    }
+    return f;
+}
+
+void CardDatabase::buildIndex(CardTables& t) {
+    if (_layout != CardIndexLayout::EYTZINGER) return;
+
+    // Таблица, для которой индекс построить не удалось, остаётся на бинарном поиске
+    if (t.cards34 && t.index34.build(t.total34,
+            [&t](uint32_t i) { return (uint64_t)t.cards34[i].key; },
+            [&t](uint32_t i) { return t.cards34[i].flags; })) {
+        heap_caps_free(t.cards34);
+        t.cards34 = nullptr;
+        Serial.printf("✅ Eytzinger index 34: %u keys, PSRAM %u B, SRAM %u B\n",
+                      (unsigned)t.index34.size(), (unsigned)t.index34.memoryPSRAM(), (unsigned)t.index34.memoryInternal());
+    } else if (t.cards34) {
+        Serial.println("⚠️ Eytzinger index 34 not built, using binary search");
+    }
+
+    if (t.cards56 && t.index56.build(t.total56,
+            [&t](uint32_t i) { return t.cards56[i].key(); },
+            [&t](uint32_t i) { return t.cards56[i].flags; })) {
+        heap_caps_free(t.cards56);
+        t.cards56 = nullptr;
+        Serial.printf("✅ Eytzinger index 56: %u keys, PSRAM %u B, SRAM %u B\n",
+                      (unsigned)t.index56.size(), (unsigned)t.index56.memoryPSRAM(), (unsigned)t.index56.memoryInternal());
+    } else if (t.cards56) {
+        Serial.println("⚠️ Eytzinger index 56 not built, using binary search");
+    }
+}
+
+bool CardDatabase::lookup34(CardTables& t, uint64_t uid, uint16_t& flags) {
+    if (t.index34.size() > 0) {
+        uint32_t pos = t.index34.find(uid);
+        if (pos == 0) return false;
+        flags = t.index34.flagsAt(pos);
+        DB_TOUCH(2);
+        return true;
+    }
+
+    int32_t low = 0, high = t.total34 - 1;
+    while (low <= high) {
+        int32_t mid = low + (high - low) / 2;
+        uint64_t midId = t.cards34[mid].key;
+        DB_TOUCH(sizeof(uint32_t));
+        if (midId == uid) {
+            flags = t.cards34[mid].flags;
+            DB_TOUCH(2);
+            return true;
+        }
+        if (midId < uid) low = mid + 1; else high = mid - 1;
+    }
+    return false;
+}
+
+bool CardDatabase::lookup56(CardTables& t, uint64_t uid, uint16_t& flags) {
+    if (t.index56.size() > 0) {
+        uint32_t pos = t.index56.find(uid);
+        if (pos == 0) return false;
+        flags = t.index56.flagsAt(pos);
+        DB_TOUCH(2);
+        return true;
+    }
+
+    int32_t low = 0, high = t.total56 - 1;
+    while (low <= high) {
+        int32_t mid = low + (high - low) / 2;
+        uint64_t midId = t.cards56[mid].key();
+        DB_TOUCH(sizeof(uint64_t));
+        if (midId == uid) {
+            flags = t.cards56[mid].flags;
+            DB_TOUCH(2);
+            return true;
+        }
+        if (midId < uid) low = mid + 1; else high = mid - 1;
+    }
+    return false;
+}
+
+static inline uint64_t packInstruction(const Instruction& ins) {
+    return (uint64_t)ins.mask | ((uint64_t)ins.count << 8) | ((uint64_t)ins.schedule << 16) |
+           ((uint64_t)ins.priority << 32) | ((uint64_t)ins.polarity << 40) | ((uint64_t)ins.action << 48);
+}
+
+static bool sameInstructions(const Instruction* a, const Instruction* b, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) {
+        if (packInstruction(a[i]) != packInstruction(b[i])) return false;
+    }
+    return true;
+}
+
+// Один раз распаковываем правила каждой группы, чтобы поиск возвращал готовый диапазон.
+// Индексы вне rules.bin отбрасываются здесь, а не на каждом считывании.
+// Группы с одинаковым списком инструкций делят один диапазон.
+bool CardDatabase::buildGroupInstructions(CardTables& t) {
+    uint32_t startUs = micros();
+    uint32_t total = 0;
+    for (uint32_t g = 0; g < t.totalGroups; g++) total += t.groups[g].count;
+    size_t rawBytes = total * sizeof(uint16_t) + t.totalGroups * (sizeof(uint32_t) + sizeof(uint8_t)) +
+                      _total_rules * sizeof(uint32_t);
+
+    t.groupInstr = (Instruction*)heap_caps_malloc((total ? total : 1) * sizeof(Instruction), MALLOC_CAP_SPIRAM);
+    if (!t.groupInstr) return false;
+
+    // Хэш списка инструкций -> первая группа с таким списком
+    std::unordered_map<uint64_t, uint32_t> seen;
+    seen.reserve(t.totalGroups);
+
+    uint32_t out = 0, shared = 0;
+    for (uint32_t g = 0; g < t.totalGroups; g++) {
+        CardGroup& grp = t.groups[g];
+        uint32_t off = grp.offset;
+        uint8_t len = grp.count;
+        uint32_t start = out;
+        for (int k = 0; k < len; k++) {
+            uint16_t ruleIdx = _all_groups[off + k];
+            if (ruleIdx < _total_rules) t.groupInstr[out++] = unpackInstruction(_rules_table[ruleIdx]);
+        }
+        grp.offset = start;
+        grp.count = out - start;
+
+        // Сводка: какие действия есть в группе и какое из них главное
+        grp.actionMask = 0;
+        grp.topAction = 0;
+        int topPriority = -1;
+        for (uint32_t k = start; k < out; k++) {
+            const Instruction& ins = t.groupInstr[k];
+            if (ins.action == 0) continue;
+            grp.actionMask |= 1u << ins.action;
+            if (ins.priority > topPriority) { topPriority = ins.priority; grp.topAction = ins.action; }
+        }
+
+        uint64_t h = 0xCBF29CE484222325ULL;
+        for (uint32_t k = start; k < out; k++) h = (h ^ packInstruction(t.groupInstr[k])) * 0x100000001B3ULL;
+        h ^= grp.count;
+        auto it = seen.find(h);
+        if (it != seen.end() && t.groups[it->second].count == grp.count &&
+            sameInstructions(t.groupInstr + t.groups[it->second].offset, t.groupInstr + start, grp.count)) {
+            grp.offset = t.groups[it->second].offset;
+            out = start;   // Такой список уже есть — забираем место обратно
+            shared++;
+        } else if (it == seen.end()) {
+            seen[h] = g;
+        }
+    }
+    t.totalInstr = out;
+    if (out < total) {
+        Instruction* fit = (Instruction*)heap_caps_realloc(t.groupInstr, (out ? out : 1) * sizeof(Instruction), MALLOC_CAP_SPIRAM);
+        if (fit) t.groupInstr = fit;
+    }
+
+    // Сырые таблицы больше не нужны
+    heap_caps_free(_all_groups);
+    heap_caps_free(_rules_table);
+    _all_groups = nullptr;
+    _rules_table = nullptr;
+
+    _loadStats.instrUs = micros() - startUs;
+    size_t builtBytes = t.totalGroups * sizeof(CardGroup) + out * sizeof(Instruction);
+    Serial.printf("✅ Group tables: %u groups (%u share a list), %u instructions, %u KB vs %u KB raw (%+d KB)\n",
+                  (unsigned)t.totalGroups, (unsigned)shared, (unsigned)out, (unsigned)(builtBytes / 1024), (unsigned)(rawBytes / 1024),
+                  (int)(builtBytes / 1024) - (int)(rawBytes / 1024));
+    return true;
+}
+
+// Ищет uid в слое изменений
+bool CardDatabase::lookupDelta(uint64_t uid, CardDelta& out) {
+    bool hit = false;
+    xSemaphoreTake(_deltaMutex, portMAX_DELAY);
+    int32_t low = 0, high = (int32_t)_deltaCount - 1;
+    while (low <= high) {
+        int32_t mid = low + (high - low) / 2;
+        if (_delta[mid].uid == uid) { out = _delta[mid]; hit = true; break; }
+        if (_delta[mid].uid < uid) low = mid + 1; else high = mid - 1;
+    }
+    xSemaphoreGive(_deltaMutex);
+    return hit;
+}
+
+// Вставляет изменение в слой (вызывать под _deltaMutex). Более позднее изменение той же карты побеждает.
+bool CardDatabase::applyDelta(const CardDelta& d) {
+    uint32_t low = 0, high = _deltaCount;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if (_delta[mid].uid < d.uid) low = mid + 1; else high = mid;
+    }
+    if (d.seq > _deltaSeq) _deltaSeq = d.seq;
+
+    if (low < _deltaCount && _delta[low].uid == d.uid) {
+        if (d.seq >= _delta[low].seq) _delta[low] = d;
+        return true;
+    }
+    if (_deltaCount >= CARD_DELTA_CAPACITY) return false;
+    memmove(_delta + low + 1, _delta + low, (_deltaCount - low) * sizeof(CardDelta));
+    _delta[low] = d;
+    _deltaCount++;
+    return true;
+}
+
+bool CardDatabase::addCard(uint64_t uid, uint16_t group, uint8_t limit, uint8_t bits) {
+    bool wide = bits ? (bits > 34) : (uid > 0xFFFFFFFFULL);
+    if (!wide && uid > 0xFFFFFFFFULL) return false;
+    if (group > 0x3FFF || limit > 3 || !_delta) return false;
+
+    CardDelta d;
+    d.uid = uid;
+    d.flags = group | (limit << 14);
+    d.op = DELTA_ADD;
+    d.wide = wide;
+
+    xSemaphoreTake(_journalMutex, portMAX_DELAY);
+    xSemaphoreTake(_deltaMutex, portMAX_DELAY);
+    d.seq = _deltaSeq + 1;
+    bool ok = applyDelta(d);
+    if (ok) _gen++;
+    xSemaphoreGive(_deltaMutex);
+    if (ok && !_journal.append(d)) Serial.printf("⚠️ Card %llx added but not journaled\n", (unsigned long long)uid);
+    xSemaphoreGive(_journalMutex);
+
+    if (!ok) Serial.println("⚠️ Card delta full, waiting for compaction");
+    return ok;
+}
+
+bool CardDatabase::revokeCard(uint64_t uid) {
+    if (!_delta) return false;
+    CardDelta d;
+    d.uid = uid;
+    d.flags = 0;
+    d.op = DELTA_REVOKE;
+    d.wide = 0;
+
+    xSemaphoreTake(_journalMutex, portMAX_DELAY);
+    xSemaphoreTake(_deltaMutex, portMAX_DELAY);
+    d.seq = _deltaSeq + 1;
+    bool ok = applyDelta(d);
+    if (ok) _gen++;
+    xSemaphoreGive(_deltaMutex);
+    if (ok && !_journal.append(d)) Serial.printf("⚠️ Card %llx revoked but not journaled\n", (unsigned long long)uid);
+    xSemaphoreGive(_journalMutex);
+
+    if (!ok) Serial.println("⚠️ Card delta full, waiting for compaction");
+    return ok;
+}
+
+uint32_t CardDatabase::pendingChanges() {
+    return _deltaCount;
+}
+
+static inline void setRecord(CardRecord34& r, uint64_t key, uint16_t flags) {
+    r.key = (uint32_t)key; r.flags = flags; r.reserved = 0;
+}
+
+static inline void setRecord(CardRecord56& r, uint64_t key, uint16_t flags) {
+    r.keyLo = (uint32_t)key; r.keyHi = (uint32_t)(key >> 32); r.flags = flags; r.reserved = 0;
+}
+
+// Сливает базовую таблицу (подаётся по возрастанию ключей) со снимком слоя изменений
+template <typename Rec>
+struct TableMerger {
+    Rec* out = nullptr;
+    uint32_t n = 0;
+    const CardDelta* d;
+    uint32_t dn;
+    uint32_t j = 0;
+    uint8_t wide;
+
+    TableMerger(const CardDelta* delta, uint32_t count, uint8_t w) : d(delta), dn(count), wide(w) {}
+
+    bool adds(const CardDelta& e) const { return e.op == DELTA_ADD && e.wide == wide; }
+    void emit(uint64_t key, uint16_t flags) { setRecord(out[n++], key, flags); }
+
+    void base(uint64_t key, uint16_t flags) {
+        while (j < dn && d[j].uid < key) { if (adds(d[j])) emit(d[j].uid, d[j].flags); j++; }
+        if (j < dn && d[j].uid == key) {
+            if (adds(d[j])) emit(key, d[j].flags);
+            else if (d[j].op != DELTA_REVOKE) emit(key, flags);
+            j++;
+            return;
+        }
+        emit(key, flags);
+    }
+
+    void finish() {
+        for (; j < dn; j++) if (adds(d[j])) emit(d[j].uid, d[j].flags);
+    }
+};
+
+// Вливает накопленные изменения в новые базовые таблицы и подменяет их атомарно.
+// Поиски во время слияния продолжают работать по старому набору + слою изменений.
+// Образ во флеше перезаписывается так же, как в reload(): сначала публикуется набор в PSRAM,
+// и только когда отображённый набор отпустили, новый уходит в раздел.
+bool CardDatabase::compact() {
+    // Набор берём только под замком: иначе reload() мог подменить и освободить его,
+    // пока мы ждали
+    xSemaphoreTake(_compactMutex, portMAX_DELAY);
+    CardTables* old = _live.load();
+    if (!old || !_delta) {
+        xSemaphoreGive(_compactMutex);
+        return false;
+    }
+
+    // 1. Снимок слоя изменений
+    xSemaphoreTake(_deltaMutex, portMAX_DELAY);
+    uint32_t dn = _deltaCount;
+    uint32_t snapSeq = _deltaSeq;
+    CardDelta* snap = dn ? (CardDelta*)heap_caps_malloc(dn * sizeof(CardDelta), MALLOC_CAP_SPIRAM) : nullptr;
+    if (snap) memcpy(snap, _delta, dn * sizeof(CardDelta));
+    xSemaphoreGive(_deltaMutex);
+    if (!snap) {
+        xSemaphoreGive(_compactMutex);
+        return dn == 0;
+    }
+
+    uint32_t startMs = millis();
+    uint32_t adds34 = 0, adds56 = 0;
+    for (uint32_t i = 0; i < dn; i++) {
+        if (snap[i].op == DELTA_ADD) { if (snap[i].wide) adds56++; else adds34++; }
+    }
+
+    // 2. Слияние в новые массивы
+    TableMerger<CardRecord34> m34(snap, dn, 0);
+    TableMerger<CardRecord56> m56(snap, dn, 1);
+    uint32_t cap34 = old->total34 + adds34, cap56 = old->total56 + adds56;
+    m34.out = cap34 ? (CardRecord34*)heap_caps_malloc(cap34 * sizeof(CardRecord34), MALLOC_CAP_SPIRAM) : nullptr;
+    m56.out = cap56 ? (CardRecord56*)heap_caps_malloc(cap56 * sizeof(CardRecord56), MALLOC_CAP_SPIRAM) : nullptr;
+    if ((cap34 && !m34.out) || (cap56 && !m56.out)) {
+        if (m34.out) heap_caps_free(m34.out);
+        if (m56.out) heap_caps_free(m56.out);
+        heap_caps_free(snap);
+        xSemaphoreGive(_compactMutex);
+        Serial.println("❌ Compaction: not enough PSRAM");
+        return false;
+    }
+
+    if (old->cards34) for (uint32_t i = 0; i < old->total34; i++) m34.base(old->cards34[i].key, old->cards34[i].flags);
+    else old->index34.forEachSorted([&m34](uint64_t k, uint16_t f) { m34.base(k, f); });
+    m34.finish();
+    if (old->cards56) for (uint32_t i = 0; i < old->total56; i++) m56.base(old->cards56[i].key(), old->cards56[i].flags);
+    else old->index56.forEachSorted([&m56](uint64_t k, uint16_t f) { m56.base(k, f); });
+    m56.finish();
+
+    CardTables* t = new CardTables();
+    t->cards34 = m34.out; t->total34 = m34.n;
+    t->cards56 = m56.out; t->total56 = m56.n;
+    t->totalGroups = old->totalGroups;
+    t->totalInstr = old->totalInstr;
+    bool wasMapped = old->mapped;
+    if (!wasMapped) {
+        // Таблицы групп не меняются — переходят к новому набору без копирования
+        t->groups = old->groups;
+        t->groupInstr = old->groupInstr;
+    } else {
+        // Группы лежат в образе, который будет перезаписан, — новому набору нужна своя копия
+        t->groups = (CardGroup*)heap_caps_malloc(t->totalGroups * sizeof(CardGroup), MALLOC_CAP_SPIRAM);
+        t->groupInstr = (Instruction*)heap_caps_malloc(t->totalInstr * sizeof(Instruction), MALLOC_CAP_SPIRAM);
+        if ((t->totalGroups && !t->groups) || (t->totalInstr && !t->groupInstr)) {
+            delete t;
+            heap_caps_free(snap);
+            xSemaphoreGive(_compactMutex);
+            Serial.println("❌ Compaction: not enough PSRAM");
+            return false;
+        }
+        if (t->groups) memcpy(t->groups, old->groups, t->totalGroups * sizeof(CardGroup));
+        if (t->groupInstr) memcpy(t->groupInstr, old->groupInstr, t->totalInstr * sizeof(Instruction));
+    }
+
+    // 3. Сохраняем новые базовые файлы, пока массивы ещё не заменены индексом
+    bool saved = saveCardFile34("/cards34.bin", t->cards34, t->total34) &&
+                 saveCardFile56("/cards56.bin", t->cards56, t->total56);
+    if (!saved) Serial.println("⚠️ Compaction: base files not saved, journal kept");
+    // Набор, который уйдёт в раздел, остаётся таблицами записей — индекс не строим, как в reload()
+    if (!wasMapped) buildIndex(*t);
+    // Фильтр переходит к новому набору, если в нём есть место: новые карты должны пройти
+    // его раньше, чем уйдут из слоя изменений. Иначе новый набор публикуется без фильтра,
+    // а свежий строится, когда старый освободит SRAM
+    CardFilter* f = old->filter.load();
+    bool keepFilter = f && f->room() >= adds34 + adds56;
+    if (keepFilter) {
+        for (uint32_t i = 0; i < dn; i++) {
+            if (snap[i].op == DELTA_ADD) f->add(snap[i].uid);
+        }
+        t->filter.store(f);
+    }
+    heap_caps_free(snap);
+
+    // 4. Публикация: подмена набора и удаление влитых изменений — атомарно для поиска
+    xSemaphoreTake(_journalMutex, portMAX_DELAY);
+    xSemaphoreTake(_deltaMutex, portMAX_DELAY);
+    old->ownsGroups = false;
+    if (keepFilter) old->ownsFilter = false;
+    _live.store(t);
+    _gen++;
+    uint32_t keep = 0;
+    for (uint32_t i = 0; i < _deltaCount; i++) {
+        if (_delta[i].seq > snapSeq) _delta[keep++] = _delta[i];
+    }
+    _deltaCount = keep;
+    xSemaphoreGive(_deltaMutex);
+    if (saved) _journal.rewrite(_delta, keep);
+    xSemaphoreGive(_journalMutex);
+
+    retire(old);
+    if (!keepFilter) t->filter.store(buildFilter(*t));
+    // 5. Раздел больше никто не читает — переносим туда новый набор
+    if (wasMapped) t = moveToImage(t, "Compaction");
+    _lastCompactMs = millis();
+    Serial.printf("✅ Compaction: %u changes merged in %u ms (34: %u, 56: %u cards)\n",
+                  (unsigned)dn, (unsigned)(_lastCompactMs - startMs), (unsigned)t->total34, (unsigned)t->total56);
+    xSemaphoreGive(_compactMutex);
+    return true;
+}
+
+// Полная замена базы (загрузка по сети). Как compact(), но набор строится из новых файлов,
+// а не слиянием: поиски до подмены идут по старому набору и слою изменений.
+bool CardDatabase::reload(const char* suffix) {
+    // Как в compact(): живой набор меняют только под _compactMutex
+    xSemaphoreTake(_compactMutex, portMAX_DELAY);
+    CardTables* old = _live.load();
+    if (!old || !_delta) {
+        xSemaphoreGive(_compactMutex);
+        return false;
+    }
+    uint32_t startMs = millis();
+    Serial.println("🔄 Reloading card DB in background");
+
+    // Изменения до этого момента сделаны поверх старой базы — новая их заменяет
+    xSemaphoreTake(_deltaMutex, portMAX_DELAY);
+    uint32_t snapSeq = _deltaSeq;
+    xSemaphoreGive(_deltaMutex);
+
+    // 1. Второй набор таблиц рядом с живым
+    CardTables* t = new CardTables();
+    bool ok = loadCards(*t, suffix) && loadGroups(*t, suffix) && loadRules(suffix) && buildGroupInstructions(*t);
+    // loadCards() довольно одной таблицей; непустой файл пакета, который не прочитался
+    // (заголовок, CRC, PSRAM), — отказ, а не база без этих карт
+    if (ok && !t->cards34 && fileSize(dbPath(0, suffix).c_str()) > 0) ok = false;
+    if (ok && !t->cards56 && fileSize(dbPath(1, suffix).c_str()) > 0) ok = false;
+    // 2. Новые файлы становятся основными до публикации: после перезагрузки поднимется
+    // та же база, а при ошибке живой набор и его файлы остаются как были
+    if (ok && !swapDbFiles(suffix)) ok = false;
+    if (!ok) {
+        if (_all_groups) heap_caps_free(_all_groups);
+        if (_rules_table) heap_caps_free(_rules_table);
+        _all_groups = nullptr;
+        _rules_table = nullptr;
+        delete t;
+        xSemaphoreGive(_compactMutex);
+        Serial.println("❌ Reload: new tables not built or files not replaced, live DB kept");
+        return false;
+    }
+
+    // Отображённый раздел перезаписывается только после того, как старый набор отпустят,
+    // а для записи нужны таблицы записей — индекс для такого набора не строим
+    bool wasMapped = old->mapped;
+    if (!wasMapped) buildIndex(*t);
+
+    // 3. Публикация, как при уплотнении
+    xSemaphoreTake(_journalMutex, portMAX_DELAY);
+    xSemaphoreTake(_deltaMutex, portMAX_DELAY);
+    _live.store(t);
+    _gen++;
+    uint32_t keep = 0, dropped = _deltaCount;
+    for (uint32_t i = 0; i < _deltaCount; i++) {
+        if (_delta[i].seq > snapSeq) _delta[keep++] = _delta[i];
+    }
+    _deltaCount = keep;
+    dropped -= keep;
+    xSemaphoreGive(_deltaMutex);
+    _journal.rewrite(_delta, keep);
+    xSemaphoreGive(_journalMutex);
+
+    uint32_t swapMs = millis() - startMs;
+    retire(old);
+    // Новый набор опубликован без фильтра: старый фильтр освобождён вместе со своим набором,
+    // и во внутренней SRAM есть место под фильтр по новым ключам. До его публикации
+    // неизвестные карты ищутся в таблицах
+    t->filter.store(buildFilter(*t));
+
+    // 4. Раздел больше никто не читает — переносим туда новый набор и освобождаем PSRAM
+    if (wasMapped) t = moveToImage(t, "Reload");
+
+    Serial.printf("✅ Reload: DB swapped in %u ms without restart (34: %u, 56: %u cards, %u changes dropped)\n",
+                  (unsigned)swapMs, (unsigned)t->total34, (unsigned)t->total56, (unsigned)dropped);
+    xSemaphoreGive(_compactMutex);
+    return true;
+}
+
+// Записывает набор t из PSRAM в раздел carddb и подменяет живой набор отображённым.
+// Зовётся под _compactMutex, когда прежний отображённый набор уже освобождён.
+// Возвращает живой набор: отображённый или t, если раздел не обновился
+CardTables* CardDatabase::moveToImage(CardTables* t, const char* what) {
+    CardImageSections sec;
+    sec.cards34 = t->cards34; sec.count34 = t->cards34 ? t->total34 : 0;
+    sec.cards56 = t->cards56; sec.count56 = t->cards56 ? t->total56 : 0;
+    sec.groups = t->groups; sec.groupCount = t->totalGroups;
+    sec.instr = t->groupInstr; sec.instrCount = t->totalInstr;
+    // Файлы на LittleFS уже новые — их отпечаток говорит begin(), что образ актуален
+    CardImageSource source;
+    stampDbFiles(source);
+    CardTables* m = new CardTables();
+    if (!CardImage::write(sec, source) || !mapImage(*m)) {
+        delete m;
+        Serial.printf("⚠️ %s: partition not updated, tables stay in PSRAM\n", what);
+        return t;
+    }
+    // Ключи те же — фильтр переходит к отображённому набору
+    m->filter.store(t->filter.load());
+    t->ownsFilter = false;
+    _live.store(m);
+    _gen++;
+    retire(t);
+    Serial.printf("✅ %s: new DB written to flash partition and mapped\n", what);
+    return m;
+}
+
+void compactionTask(void* pvParameters) {
+    CardDatabase* db = (CardDatabase*)pvParameters;
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        if (db->_compactPaused) continue;
+        uint32_t pending = db->pendingChanges();
+        // Уплотнение образа во флеше перезаписывает весь раздел — по таймеру реже
+        uint32_t period = db->isMapped() ? CARD_COMPACT_FLASH_PERIOD_MS : CARD_COMPACT_PERIOD_MS;
+        if (pending >= CARD_DELTA_COMPACT_AT || (pending > 0 && millis() - db->_lastCompactMs > period)) {
+            db->compact();
+        }
+    }
+}
+
+void CardDatabase::startCompaction() {
+    _lastCompactMs = millis();
+    xTaskCreatePinnedToCore(compactionTask, "DBCompact", 8192, this, 1, NULL, 0);
+    Serial.println("🚀 DB compaction task started on Core 0");
+}
+
+CardView CardDatabase::findView(uint64_t uid, uint8_t bits) {
     uint32_t startTime = micros();
-    CardResult res;
+    CardView res;
     res.uid = uid;
-    res.found = false;
+    uint16_t flags = 0;
+    // Отметка до кэша: инструкции из записи кэша смотрят в тот же набор таблиц
+    CardReadPin pin(_readers);
+
+    // Горячая карта: готовое решение из SRAM, без слоя изменений и таблиц.
+    // Поколение читаем до поиска: если база изменится во время него, запись сразу устареет.
+    uint8_t route = bits == 0 ? 0 : (bits > 34 ? 2 : 1);
+    uint32_t gen = _gen.load();
+    CardCacheEntry ce;
+    if (_cache.lookup(uid, route, gen, ce)) {
+        res.found = true;
+        res.cached = true;
+        res.status = ce.status;
+        res.limit = ce.limit;
+        res.group_id = ce.group_id;
+        res.topAction = ce.topAction;
+        res.actionMask = ce.actionMask;
+        res.instructions.ptr = ce.instr;
+        res.instructions.count = ce.count;
+        res.source = ce.source;
+        if (!res.instructions.empty()) res.pin = std::move(pin);
+        res.search_time_us = micros() - startTime;
+        return res;
+    }
+
+    // 0. Слой изменений: отзыв действует сразу, добавленная карта находится до уплотнения
+    CardDelta d;
+    bool inDelta = _deltaCount > 0 && lookupDelta(uid, d);
+    if (inDelta && d.op == DELTA_REVOKE) {
+        res.search_time_us = micros() - startTime;
+        return res;
+    }
+
+    bool deltaHit = inDelta && (bits == 0 || (bits > 34) == (d.wide != 0));
+
+    // Набора нет, если begin() не загрузил базу: карта просто не найдена
+    CardTables* live = _live.load();
+    if (!live) {
+        res.search_time_us = micros() - startTime;
+        return res;
+    }
+    CardTables& t = *live;
+
+    // Неизвестная карта отсекается по фильтру набора во внутренней SRAM, без поисков в PSRAM
+    CardFilter* filter = t.filter.load();
+    if (!deltaHit && filter && !filter->mayContain(uid)) {
+        res.search_time_us = micros() - startTime;
+        return res;
+    }
+
+    if (deltaHit) {
+        res.found = true;
+        res.source = CardSource::DELTA;
+        flags = d.flags;
+    }
 
     // 1. Поиск в 34-битном массиве
-    if (uid <= 0xFFFFFFFFULL && _total34 > 0) {
-        int32_t low = 0, high = _total34 - 1;
-        while (low <= high) {
-            int32_t mid = low + (high - low) / 2;
-            uint64_t midId = getID34(mid);
-            if (midId == uid) {
-                res.found = true;
-                uint8_t* p = _cards34 + (mid * 6) + 4;
-                uint16_t flags = (p[0] << 8) | p[1];
-                res.group_id = flags & 0x3FFF;
-                res.limit = (flags >> 14) & 0x03;
-                res.source = "PSRAM-34";
-                break;
-            }
-            if (midId < uid) low = mid + 1; else high = mid - 1;
-        }
+    if (!res.found && bits <= 34 && uid <= 0xFFFFFFFFULL && t.total34 > 0 && lookup34(t, uid, flags)) {
+        res.found = true;
+        res.source = t.mapped ? CardSource::FLASH_34 : CardSource::PSRAM_34;
     }
 
     // 2. Поиск в 56-битном массиве
-    if (!res.found && _total56 > 0) {
-        int32_t low = 0, high = _total56 - 1;
-        while (low <= high) {
-            int32_t mid = low + (high - low) / 2;
-            uint64_t midId = getID56(mid);
-            if (midId == uid) {
-                res.found = true;
-                uint8_t* p = _cards56 + (mid * 9) + 7;
-                uint16_t flags = (p[0] << 8) | p[1];
-                res.group_id = flags & 0x3FFF;
-                res.limit = (flags >> 14) & 0x03;
-                res.source = "PSRAM-56";
-                break;
+    if (!res.found && (bits == 0 || bits > 34) && t.total56 > 0 && lookup56(t, uid, flags)) {
+        res.found = true;
+        res.source = t.mapped ? CardSource::FLASH_56 : CardSource::PSRAM_56;
+    }
+
+    if (res.found) {
+        res.group_id = flags & 0x3FFF;
+        res.limit = (flags >> 14) & 0x03;
+    }
+
+    // 3. Инструкции группы — уже распакованы, отдаём диапазон
+    if (res.found && res.group_id < t.totalGroups) {
+        const CardGroup& g = t.groups[res.group_id];
+        res.status = 1;
+        res.instructions.ptr = t.groupInstr + g.offset;
+        res.instructions.count = g.count;
+        res.topAction = g.topAction;
+        res.actionMask = g.actionMask;
+        DB_TOUCH(sizeof(CardGroup) + res.instructions.count * sizeof(Instruction));
+    }
+
+    if (res.found) {
+        ce.uid = uid;
+        ce.gen = gen;
+        ce.instr = res.instructions.ptr;
+        ce.count = res.instructions.count;
+        ce.group_id = res.group_id;
+        ce.topAction = res.topAction;
+        ce.actionMask = res.actionMask;
+        ce.limit = res.limit;
+        ce.status = res.status;
+        ce.source = res.source;
+        ce.route = route;
+        _cache.insert(ce);
+    }
+    if (!res.instructions.empty()) res.pin = std::move(pin);
+
+    res.search_time_us = micros() - startTime;
+    return res;
+}
+
+CardResult CardDatabase::find(uint64_t uid, uint8_t bits) {
+    CardView v = findView(uid, bits);
+    CardResult res;
+    res.found = v.found;
+    res.uid = v.uid;
+    res.status = v.status;
+    res.limit = v.limit;
+    res.group_id = v.group_id;
+    res.instructions.assign(v.instructions.begin(), v.instructions.end());
+    res.search_time_us = v.search_time_us;
+    res.source = v.source;
+    return res;
+}
+
+// Поиск отсортированного пакета в отсортированной таблице слиянием: граница каждого
+// следующего поиска не левее предыдущей, галоп от неё находит близкий ключ за пару
+// сравнений, а соседние ключи пакета читают уже подтянутые строки кэша
+template <typename Rec, typename KeyOf>
+static uint32_t mergeLookup(const Rec* recs, uint32_t total, const uint64_t* keys, uint32_t n,
+                            uint32_t* hits, KeyOf keyOf) {
+    uint32_t lo = 0, probes = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t key = keys[i];
+        uint32_t hi = lo, step = 1;
+        while (hi < total && keyOf(recs[hi]) < key) {
+            probes++;
+            lo = hi + 1;
+            hi += step;
+            step <<= 1;
+        }
+        if (hi > total) hi = total;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            probes++;
+            if (keyOf(recs[mid]) < key) lo = mid + 1; else hi = mid;
+        }
+        hits[i] = (lo < total && keyOf(recs[lo]) == key) ? 0x10000u | recs[lo].flags : 0;
+    }
+    return probes;
+}
+
+void CardDatabase::lookupBatch34(CardTables& t, const uint64_t* keys, uint32_t n, uint32_t* hits) {
+    if (t.index34.size() > 0) {
+        t.index34.findBatch(keys, n, hits);
+        for (uint32_t i = 0; i < n; i++) if (hits[i]) hits[i] = 0x10000u | t.index34.flagsAt(hits[i]);
+        return;
+    }
+    uint32_t probes = mergeLookup(t.cards34, t.total34, keys, n, hits,
+                                  [](const CardRecord34& r) { return (uint64_t)r.key; });
+    DB_TOUCH(probes * sizeof(uint32_t));
+    (void)probes;
+}
+
+void CardDatabase::lookupBatch56(CardTables& t, const uint64_t* keys, uint32_t n, uint32_t* hits) {
+    if (t.index56.size() > 0) {
+        t.index56.findBatch(keys, n, hits);
+        for (uint32_t i = 0; i < n; i++) if (hits[i]) hits[i] = 0x10000u | t.index56.flagsAt(hits[i]);
+        return;
+    }
+    uint32_t probes = mergeLookup(t.cards56, t.total56, keys, n, hits,
+                                  [](const CardRecord56& r) { return r.key(); });
+    DB_TOUCH(probes * sizeof(uint64_t));
+    (void)probes;
+}
+
+uint32_t CardDatabase::findBatch(const uint64_t* uids, uint32_t n, CardMembership* out) {
+    for (uint32_t i = 0; i < n; i++) out[i] = CardMembership();
+    // База не загружена (begin() не прошёл) — ничего не найдено; набор, раз появившись, не исчезает
+    if (n == 0 || !_live.load()) return 0;
+
+    // keys — отсортированный пакет, order — откуда ключ, hits — результат по таблице
+    uint8_t* mem = (uint8_t*)heap_caps_malloc(n * (sizeof(uint64_t) + 2 * sizeof(uint32_t)), MALLOC_CAP_SPIRAM);
+    if (!mem) {
+        // Нет памяти под сортировку — по одному, результат тот же
+        uint32_t found = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            CardView v = findView(uids[i]);
+            if (!v.found) continue;
+            out[i].flags = v.group_id | (v.limit << 14);
+            out[i].source = v.source;
+            found++;
+        }
+        return found;
+    }
+    uint64_t* keys = (uint64_t*)mem;
+    uint32_t* order = (uint32_t*)(keys + n);
+    uint32_t* hits = order + n;
+
+    for (uint32_t i = 0; i < n; i++) order[i] = i;
+    std::sort(order, order + n, [uids](uint32_t a, uint32_t b) { return uids[a] < uids[b]; });
+    for (uint32_t i = 0; i < n; i++) keys[i] = uids[order[i]];
+
+    CardReadPin pin(_readers);
+    CardTables& t = *_live.load();
+    CardFilter* filter = t.filter.load();
+
+    // 0. Слой изменений — тоже отсортирован, сливаем за один проход под одним захватом.
+    // Отзыв и добавление решают судьбу ключа сразу; остальные ключи сдвигаются к началу.
+    uint32_t found = 0, pending = 0;
+    xSemaphoreTake(_deltaMutex, portMAX_DELAY);
+    uint32_t dn = _deltaCount, j = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        while (j < dn && _delta[j].uid < keys[i]) j++;
+        if (j < dn && _delta[j].uid == keys[i]) {
+            if (_delta[j].op != DELTA_REVOKE) {
+                out[order[i]].flags = _delta[j].flags;
+                out[order[i]].source = CardSource::DELTA;
+                found++;
             }
-            if (midId < uid) low = mid + 1; else high = mid - 1;
+            continue;
         }
+        // Неизвестная карта отсекается фильтром во внутренней SRAM
+        if (filter && !filter->mayContain(keys[i])) continue;
+        keys[pending] = keys[i];
+        order[pending] = order[i];
+        pending++;
     }
+    xSemaphoreGive(_deltaMutex);
 
-    // 3. Сбор инструкций
-    if (res.found && res.group_id < _total_groups) {
-        res.status = 1;
-        uint32_t off = _group_offsets[res.group_id];
-        for(int k = 0; k < _group_lens[res.group_id]; k++) {
-            uint16_t ruleIdx = _all_groups[off + k];
-            if (ruleIdx < _total_rules) {
-                res.instructions.push_back(unpackInstruction(_rules_table[ruleIdx]));
+    // 1. 32-битные UID — начало отсортированного пакета
+    uint32_t n32 = 0;
+    while (n32 < pending && keys[n32] <= 0xFFFFFFFFULL) n32++;
+    uint32_t rest = 0;
+    if (n32 && t.total34 > 0) {
+        lookupBatch34(t, keys, n32, hits);
+        CardSource src = t.mapped ? CardSource::FLASH_34 : CardSource::PSRAM_34;
+        for (uint32_t i = 0; i < n32; i++) {
+            if (hits[i]) {
+                out[order[i]].flags = (uint16_t)hits[i];
+                out[order[i]].source = src;
+                found++;
+            } else {
+                keys[rest] = keys[i];
+                order[rest] = order[i];
+                rest++;
             }
         }
+    } else {
+        rest = n32;
+    }
+    // Не найденные в 34-битной таблице остаются перед 56-битными, порядок не нарушен
+    for (uint32_t i = n32; i < pending; i++) {
+        keys[rest] = keys[i];
+        order[rest] = order[i];
+        rest++;
     }
 
-    res.search_time_us = micros() - startTime;
-    return res;
-}
\ No newline at end of file
+    // 2. Всё, что осталось, — в 56-битной таблице
+    if (rest && t.total56 > 0) {
+        lookupBatch56(t, keys, rest, hits);
+        CardSource src = t.mapped ? CardSource::FLASH_56 : CardSource::PSRAM_56;
+        for (uint32_t i = 0; i < rest; i++) {
+            if (!hits[i]) continue;
+            out[order[i]].flags = (uint16_t)hits[i];
+            out[order[i]].source = src;
+            found++;
+        }
+    }
+    pin.release();
+
+    heap_caps_free(mem);
+    return found;
+}
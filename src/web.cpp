@@ -1,152 +1,514 @@
 #include "web.h"
+#include <LittleFS.h>
 #include <base64.h>
 #include <time.h>
 #include <sys/time.h>
 
-WebHandler::WebHandler(JsonDocument& config, HardwareManager& hw) 
-    : _config(config), _hw(hw) {
+WebHandler::WebHandler(JsonDocument& config, HardwareManager& hw, CardDatabase& db, DSLProcessor& dsl) 
+    : _config(config), _hw(hw), _db(db), _dsl(dsl), _http(*this), _upload(db) {
     _server = new EspEthernetServer(80); 
 }
 
 void WebHandler::begin() {
     _server->begin();
+    _http.begin(_server);
+    String authUser = _config["system"]["web_admin"]["login"] | "admin";
+    String authPass = _config["system"]["web_admin"]["password"] | "smart20241";
+    _authExpected = "Basic " + base64::encode(authUser + ":" + authPass);
+
+    // ETag страницы — по содержимому, чтобы новый образ LittleFS сбросил кэш браузера
+    File f = LittleFS.open(WEB_INDEX_PATH, "r");
+    if (f) {
+        uint32_t h = 2166136261u;
+        uint8_t buf[256];
+        size_t n;
+        while ((n = f.read(buf, sizeof(buf))) > 0) {
+            for (size_t i = 0; i < n; i++) h = (h ^ buf[i]) * 16777619u;
+        }
+        Serial.printf("✅ Web UI: %s, %u B\n", WEB_INDEX_PATH, (unsigned)f.size());
+        f.close();
+        snprintf(_indexEtag, sizeof(_indexEtag), "\"%08x\"", (unsigned)h);
+        snprintf(_indexHeaders, sizeof(_indexHeaders),
+                 "Content-Encoding: gzip\r\nCache-Control: no-cache\r\nETag: %s\r\n", _indexEtag);
+    } else {
+        Serial.printf("⚠️ Web UI: %s not found, upload the filesystem image\n", WEB_INDEX_PATH);
+    }
 }
 
 void WebHandler::handle() {
-    EthernetClient client = _server->available();
-    if (client) processClient(client);
-}
-
-void WebHandler::processClient(EthernetClient& client) {
-    String header = "";
-    String postData = "";
-    bool readingBody = false;
-    int contentLength = 0;
-
-    unsigned long timeout = millis();
-    while (client.connected() && (millis() - timeout < 2000)) {
-        if (client.available()) {
-            char c = client.read();
-            if (!readingBody) {
-                header += c;
-                if (header.endsWith("\r\n\r\n")) {
-                    if (header.startsWith("POST")) {
-                        readingBody = true;
-                        int pos = header.indexOf("Content-Length: ");
-                        if (pos != -1) contentLength = header.substring(pos + 16).toInt();
-                    } else break;
-                }
-            } else {
-                postData += c;
-                if (postData.length() >= contentLength) break;
-            }
-        }
+    _http.handle();
+    // Ответ "Saved!" уже ушёл — теперь можно перезагружаться
+    if (_restartAt && (int32_t)(millis() - _restartAt) >= 0) ESP.restart();
+}
+
+void WebHandler::route(const HttpRequestParser& req, HttpResponse& res) {
+    if (_authExpected != req.authorization()) {
+        res.sendStatus(401, "WWW-Authenticate: Basic realm=\"A16\"\r\n");
+        return;
     }
 
-    String authUser = _config["system"]["web_admin"]["login"] | "admin";
-    String authPass = _config["system"]["web_admin"]["password"] | "smart20241";
-    String authExpected = base64::encode(authUser + ":" + authPass);
-    if (header.indexOf("Authorization: Basic " + authExpected) == -1) {
-        client.println("HTTP/1.1 401 Unauthorized\r\nWWW-Authenticate: Basic realm=\"A16\"\r\n\r\n");
-        client.stop(); return;
-    }
-
-    if (header.startsWith("POST")) {
-        auto getParam = [&](String name) {
-            int idx = postData.indexOf(name + "=");
-            if (idx == -1) return String("");
-            int endIdx = postData.indexOf("&", idx);
-            String val = postData.substring(idx + name.length() + 1, endIdx == -1 ? postData.length() : endIdx);
-            val.replace("+", " "); val.replace("%2E", "."); val.replace("%3A", ":");
-            return val;
-        };
-
-        _config["network"]["use_static"] = (getParam("ip_mode") == "static");
-        _config["network"]["ip_address"] = getParam("ip");
-        _config["network"]["subnet"] = getParam("mask");
-        _config["network"]["gateway"] = getParam("gw");
-        _config["network"]["dns"] = getParam("dns1");
-
-        _config["ntp"]["use_ntp"] = (postData.indexOf("use_ntp=on") != -1);
-        _config["ntp"]["ntp_server"] = getParam("ntp_srv");
-        
-        String rtcTime = getParam("manual_time");
-        if (rtcTime.length() > 10) {
-            struct tm tm;
-            int y, m, d, hh, mm;
-            if (sscanf(rtcTime.c_str(), "%d-%d-%dT%d:%d", &y, &m, &d, &hh, &mm) == 5) {
-                tm.tm_year = y - 1900; tm.tm_mon = m - 1; tm.tm_mday = d;
-                tm.tm_hour = hh; tm.tm_min = mm; tm.tm_sec = 0;
-                time_t t = mktime(&tm);
-                struct timeval now_tv = { .tv_sec = t };
-                settimeofday(&now_tv, NULL); 
-            }
-        }
+    bool root = !strcmp(req.path(), "/") || !strcmp(req.path(), "/index.html");
+    if (req.method() == HTTP_POST && root) {
+        saveSettings(String(req.body()), res);
+    } else if (req.method() == HTTP_GET && root) {
+        sendIndex(req, res);
+    } else if (req.method() == HTTP_GET && !strcmp(req.path(), "/api/settings")) {
+        sendSettings(res);
+    } else if (req.method() == HTTP_GET && !strncmp(req.path(), "/api/card/", 10)) {
+        apiCard(req, res);
+    } else if (req.method() == HTTP_POST && !strcmp(req.path(), "/api/cards/batch")) {
+        apiCardBatch(req, res);
+    } else if (req.method() == HTTP_POST && !strcmp(req.path(), "/api/cards")) {
+        apiCardAdd(req, res);
+    } else if (req.method() == HTTP_DELETE && !strncmp(req.path(), "/api/cards/", 11)) {
+        apiCardRevoke(req, res);
+    } else if (req.method() == HTTP_POST && !strcmp(req.path(), "/api/dsl")) {
+        apiDsl(req, res);
+    } else if (req.method() == HTTP_GET && !strcmp(req.path(), "/api/outputs")) {
+        apiOutputs(res);
+    } else if (req.method() == HTTP_POST && !strcmp(req.path(), "/api/db")) {
+        apiDbUpload(req, res);
+    } else if (req.method() == HTTP_GET && !strcmp(req.path(), "/api/db")) {
+        apiDbStatus(res);
+    } else if (root) {
+        res.sendStatus(405);
+    } else {
+        res.sendStatus(404);
+    }
+}
 
-        _config["server_connection"]["server_ip"] = getParam("srv_ip");
-        _config["server_connection"]["server_port"] = getParam("srv_port").toInt();
-        String newPwd = getParam("pwd");
-        if (newPwd.length() > 0) _config["system"]["web_admin"]["password"] = newPwd;
+bool WebHandler::bodyBegin(const HttpRequestParser& req, HttpResponse& res) {
+    // Мегабайты без пароля не принимаем: проверка до первого байта тела
+    if (_authExpected != req.authorization()) {
+        res.sendStatus(401, "WWW-Authenticate: Basic realm=\"A16\"\r\n");
+        return false;
+    }
+    if (req.method() == HTTP_POST && !strcmp(req.path(), "/api/cards/batch")) return batchBegin(req, res);
+    if (req.method() != HTTP_POST || strcmp(req.path(), "/api/db") != 0) return false;
+    if (_uploadReq || _upload.busy()) {
+        res.sendStatus(409);
+        return false;
+    }
+    if (!_upload.begin(req.contentLength())) {
+        // Пакет не помещается на LittleFS — 507 с размерами, как их покажет GET /api/db
+        if (_upload.noSpace()) apiDbStatus(res, 507);
+        else res.sendStatus(503);
+        return false;
+    }
+    _uploadReq = &req;
+    return true;
+}
 
-        _hw.saveConfig(_config);
+size_t WebHandler::bodyWrite(const HttpRequestParser& req, const uint8_t* data, size_t len) {
+    if (&req == _uploadReq) return _upload.write(data, len);
+    int b = batchSlot(&req);
+    return b >= 0 ? _batch[b].write(data, len) : len;
+}
 
-        client.println("HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n\r\n");
-        client.println("<html><body><h1>Saved!</h1><script>setTimeout(()=>location.href='/',2000);</script></body></html>");
-        client.stop();
-        delay(500);
-        ESP.restart();
-    } else {
-        sendHtmlPage(client);
+void WebHandler::bodyAbort(const HttpRequestParser& req) {
+    int b = batchSlot(&req);
+    if (b >= 0) {
+        _batch[b].release();
+        _batchReq[b] = nullptr;
     }
+    if (&req != _uploadReq) return;
+    _upload.abort();
+    _uploadReq = nullptr;
 }
 
-void WebHandler::sendHtmlPage(EthernetClient& client) {
-    client.println("HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=UTF-8\r\nConnection: close\r\n\r\n");
+// Страница не меняется между запросами: браузер переспрашивает с If-None-Match
+// и получает 304 без тела; иначе — готовый gzip с LittleFS большими кусками
+void WebHandler::sendIndex(const HttpRequestParser& req, HttpResponse& res) {
+    if (_indexEtag[0] && !strcmp(req.ifNoneMatch(), _indexEtag)) {
+        res.sendStatic(304, "text/html; charset=UTF-8", "", 0, _indexHeaders);
+        return;
+    }
+    File f = LittleFS.open(WEB_INDEX_PATH, "r");
+    if (!f) {
+        res.sendStatus(404);
+        return;
+    }
+    res.sendFile(200, "text/html; charset=UTF-8", f, _indexHeaders);
+}
+
+void WebHandler::saveSettings(const String& postData, HttpResponse& res) {
+    auto getParam = [&](String name) {
+        int idx = postData.indexOf(name + "=");
+        if (idx == -1) return String("");
+        int endIdx = postData.indexOf("&", idx);
+        String val = postData.substring(idx + name.length() + 1, endIdx == -1 ? postData.length() : endIdx);
+        val.replace("+", " "); val.replace("%2E", "."); val.replace("%3A", ":");
+        return val;
+    };
+
+    _config["network"]["use_static"] = (getParam("ip_mode") == "static");
+    _config["network"]["ip_address"] = getParam("ip");
+    _config["network"]["subnet"] = getParam("mask");
+    _config["network"]["gateway"] = getParam("gw");
+    _config["network"]["dns"] = getParam("dns1");
+
+    _config["ntp"]["use_ntp"] = (postData.indexOf("use_ntp=on") != -1);
+    _config["ntp"]["ntp_server"] = getParam("ntp_srv");
     
+    String rtcTime = getParam("manual_time");
+    if (rtcTime.length() > 10) {
+        struct tm tm;
+        int y, m, d, hh, mm;
+        if (sscanf(rtcTime.c_str(), "%d-%d-%dT%d:%d", &y, &m, &d, &hh, &mm) == 5) {
+            tm.tm_year = y - 1900; tm.tm_mon = m - 1; tm.tm_mday = d;
+            tm.tm_hour = hh; tm.tm_min = mm; tm.tm_sec = 0;
+            time_t t = mktime(&tm);
+            struct timeval now_tv = { .tv_sec = t };
+            settimeofday(&now_tv, NULL); 
+        }
+    }
+
+    _config["server_connection"]["server_ip"] = getParam("srv_ip");
+    _config["server_connection"]["server_port"] = getParam("srv_port").toInt();
+    String newPwd = getParam("pwd");
+    if (newPwd.length() > 0) _config["system"]["web_admin"]["password"] = newPwd;
+
+    _hw.saveConfig(_config);
+
+    static const char saved[] = "<html><body><h1>Saved!</h1><script>setTimeout(()=>location.href='/',2000);</script></body></html>";
+    res.sendStatic(200, "text/html", saved, sizeof(saved) - 1);
+    // Вместо delay(500): loop() продолжает крутиться, ответ уходит, потом перезагрузка
+    _restartAt = millis() + 500;
+    if (!_restartAt) _restartAt = 1;
+}
+
+// Всё, что раньше подставлялось в HTML: текущий IP, MAC, время и поля формы
+void WebHandler::sendSettings(HttpResponse& res) {
     time_t now; time(&now);
     struct tm ti; localtime_r(&now, &ti);
     char curTime[25]; strftime(curTime, sizeof(curTime), "%d.%m.%Y %H:%M", &ti);
 
-    IPAddress currentIp = Ethernet.localIP();
     byte mac[6]; Ethernet.MACAddress(mac);
     char macStr[20]; sprintf(macStr, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    bool isStatic = _config["network"]["use_static"] | false;
-
-    // Отправляем частями, чтобы не перегружать память
-    client.print("<!DOCTYPE html><html><head><meta charset='UTF-8'><style>");
-    client.print("body{font-family:sans-serif;background:#f0f2f5;padding:20px;}");
-    client.print(".box{max-width:500px;margin:auto;background:#fff;padding:20px;border-radius:10px;box-shadow:0 2px 10px rgba(0,0,0,0.1);}");
-    client.print("section{border:1px solid #ddd;padding:15px;margin-bottom:15px;border-radius:5px;}");
-    client.print("label{display:block;font-weight:bold;margin-top:10px;}");
-    client.print("input,select{width:100%;padding:8px;box-sizing:border-box;margin-top:5px;}");
-    client.print(".info-bar{background:#e9ecef;padding:12px;border-radius:5px;margin-bottom:15px;font-size:13px;color:#444;}");
-    client.print("</style></head><body><div class='box'><h2>Kincony A16 Config</h2>");
-    
-    client.print("<div class='info-bar'><strong>Текущий IP:</strong> " + currentIp.toString() + "<br>");
-    client.print("<strong>MAC-адрес:</strong> " + String(macStr) + "<br>");
-    client.print("<strong>Системное время:</strong> " + String(curTime) + "</div>");
-
-    client.print("<form method='POST'><section><h3>1. Сетевые настройки</h3><label>Режим IP</label>");
-    client.print("<select name='ip_mode'>");
-    client.print("<option value='static'" + String(isStatic ? " selected" : "") + ">Статический IP</option>");
-    client.print("<option value='dhcp'" + String(!isStatic ? " selected" : "") + ">DHCP</option></select>");
-    
-    client.print("<label>IP адрес (для Static)</label><input name='ip' value='" + _config["network"]["ip_address"].as<String>() + "'>");
-    client.print("<label>Маска подсети</label><input name='mask' value='" + _config["network"]["subnet"].as<String>() + "'>");
-    client.print("<label>Шлюз</label><input name='gw' value='" + _config["network"]["gateway"].as<String>() + "'>");
-    client.print("<label>DNS сервер</label><input name='dns1' value='" + _config["network"]["dns"].as<String>() + "'></section>");
-
-    client.print("<section><h3>2. Дата и время</h3>");
-    client.print("<label><input type='checkbox' name='use_ntp' " + String(_config["ntp"]["use_ntp"] ? "checked" : "") + " style='width:auto;'> Включить NTP</label>");
-    client.print("<label>NTP Сервер</label><input name='ntp_srv' value='" + _config["ntp"]["ntp_server"].as<String>() + "'>");
-    client.print("<label>Установить время вручную</label><input type='datetime-local' name='manual_time'></section>");
-
-    client.print("<section><h3>3. Сервер и Доступ</h3>");
-    client.print("<label>IP Сервера СКУД</label><input name='srv_ip' value='" + _config["server_connection"]["server_ip"].as<String>() + "'>");
-    client.print("<label>Порт сервера</label><input name='srv_port' type='number' value='" + _config["server_connection"]["server_port"].as<String>() + "'>");
-    client.print("<label>Сменить пароль входа</label><input name='pwd' type='password' placeholder='Оставьте пустым'></section>");
-
-    client.print("<button type='submit' style='width:100%;padding:15px;background:#28a745;color:#fff;border:none;border-radius:5px;font-weight:bold;cursor:pointer;'>СОХРАНИТЬ И ПЕРЕЗАГРУЗИТЬ</button>");
-    client.print("</form></div></body></html>");
-    client.stop();
+
+    JsonDocument doc;
+    doc["ip"] = Ethernet.localIP().toString();
+    doc["mac"] = macStr;
+    doc["time"] = curTime;
+    doc["use_static"] = _config["network"]["use_static"] | false;
+    doc["ip_address"] = _config["network"]["ip_address"];
+    doc["subnet"] = _config["network"]["subnet"];
+    doc["gateway"] = _config["network"]["gateway"];
+    doc["dns"] = _config["network"]["dns"];
+    doc["use_ntp"] = _config["ntp"]["use_ntp"] | false;
+    doc["ntp_server"] = _config["ntp"]["ntp_server"];
+    doc["server_ip"] = _config["server_connection"]["server_ip"];
+    doc["server_port"] = _config["server_connection"]["server_port"];
+
+    sendJson(res, 200, doc);
+}
+
+// Print поверх буфера отправки: serializeJson проходит документ целиком,
+// а в буфер попадают только байты [offset, offset + cap) — очередная часть тела
+class JsonChunkPrint : public Print {
+public:
+    JsonChunkPrint(size_t offset, uint8_t* buf, size_t cap) : _offset(offset), _buf(buf), _cap(cap) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* p, size_t n) override {
+        // Пересечение [_pos, _pos + n) с окном [_offset, _offset + _cap)
+        size_t from = _pos > _offset ? _pos : _offset;
+        size_t to = _pos + n < _offset + _cap ? _pos + n : _offset + _cap;
+        if (from < to) {
+            memcpy(_buf + (from - _offset), p + (from - _pos), to - from);
+            _len = to - _offset;
+        }
+        _pos += n;
+        return n;
+    }
+    size_t length() const { return _len; }
+
+private:
+    size_t _offset;
+    uint8_t* _buf;
+    size_t _cap;
+    size_t _pos = 0;
+    size_t _len = 0;
+};
+
+static size_t fillJson(void* ctx, size_t offset, uint8_t* buf, size_t cap) {
+    JsonChunkPrint out(offset, buf, cap);
+    serializeJson(*(JsonDocument*)ctx, out);
+    return out.length();
+}
+
+static void releaseJson(void* ctx) {
+    delete (JsonDocument*)ctx;
+}
+
+void WebHandler::sendJson(HttpResponse& res, uint16_t status, JsonDocument& doc, const char* extra) {
+    // serializeJson дописывает '\0', поэтому нужен запас в байт
+    size_t len = measureJson(doc);
+    if (len < HttpResponse::bodyCapacity()) {
+        serializeJson(doc, res.bodyBuffer(), HttpResponse::bodyCapacity());
+        res.sendBuffer(status, "application/json", len, extra);
+    } else {
+        // Больше одного сегмента: документ переходит к ответу и сериализуется заново
+        // на каждую часть прямо в буфер слота — тело целиком в памяти не собирается
+        JsonDocument* body = new JsonDocument(std::move(doc));
+        res.sendStream(status, "application/json", len, fillJson, body, releaseJson, extra);
+    }
+}
+
+// Шестнадцатеричный uid, как его печатает консоль ("100000002468a", можно с "0x")
+static bool parseUid(const char* s, uint64_t& uid) {
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) s += 2;
+    uid = 0;
+    int digits = 0;
+    for (; *s; s++, digits++) {
+        char c = *s;
+        uint8_t v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else return false;
+        if (digits >= 16) return false;
+        uid = (uid << 4) | v;
+    }
+    return digits > 0;
+}
+
+// GET /api/card/{uid}[?bits=26] — то же решение, что получит считыватель
+void WebHandler::apiCard(const HttpRequestParser& req, HttpResponse& res) {
+    uint64_t uid;
+    if (!parseUid(req.path() + 10, uid)) {
+        res.sendStatus(400);
+        return;
+    }
+    uint8_t bits = 0;
+    const char* b = strstr(req.query(), "bits=");
+    if (b) bits = (uint8_t)atoi(b + 5);
+
+    CardView v = _db.findView(uid, bits);
+    char uidHex[20];
+    snprintf(uidHex, sizeof(uidHex), "%llx", (unsigned long long)uid);
+
+    JsonDocument doc;
+    doc["uid"] = uidHex;
+    doc["found"] = v.found;
+    if (v.found) {
+        doc["status"] = v.status;
+        doc["group"] = v.group_id;
+        doc["limit"] = v.limit;
+        doc["source"] = cardSourceName(v.source);
+        doc["cached"] = v.cached;
+        doc["top_action"] = v.topAction;
+        JsonArray list = doc["instructions"].to<JsonArray>();
+        for (const Instruction& ins : v.instructions) {
+            JsonObject o = list.add<JsonObject>();
+            o["action"] = ins.action;
+            o["priority"] = ins.priority;
+            o["schedule"] = ins.schedule;
+            o["mask"] = ins.mask;
+            o["count"] = ins.count;
+            o["polarity"] = ins.polarity;
+        }
+    }
+    doc["us"] = v.search_time_us;
+    sendJson(res, v.found ? 200 : 404, doc);
+}
+
+// POST /api/cards/batch — сверка пакетом. Тело: UID по 8 байт little-endian, до WEB_BATCH_MAX.
+// Ответ в том же порядке по 4 байта (CardMembership): [флаги 2Б LE][CardSource 1Б][0],
+// число найденных — в заголовке X-Cards-Found
+static_assert((HTTP_MAX_BODY / sizeof(uint64_t)) * sizeof(CardMembership) <= HTTP_WRITE_CHUNK,
+              "small batch reply must fit the send buffer");
+
+int WebHandler::batchSlot(const HttpRequestParser* req) const {
+    for (int i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        if (_batchReq[i] == req) return i;
+    }
+    return -1;
+}
+
+// Большой пакет: буфер ответа выделяется по Content-Length до первого байта тела,
+// дальше каждая порция проверяется, пока сокет принимает следующую
+bool WebHandler::batchBegin(const HttpRequestParser& req, HttpResponse& res) {
+    uint32_t len = req.contentLength();
+    if (len % sizeof(uint64_t)) {
+        res.sendStatus(400);
+        return false;
+    }
+    if (len / sizeof(uint64_t) > WEB_BATCH_MAX) {
+        res.sendStatus(413);
+        return false;
+    }
+    int b = batchSlot(nullptr);
+    if (b < 0 || !_batch[b].begin(_db, len / sizeof(uint64_t))) {
+        res.sendStatus(503);
+        return false;
+    }
+    _batchReq[b] = &req;
+    return true;
+}
+
+void WebHandler::apiCardBatch(const HttpRequestParser& req, HttpResponse& res) {
+    char extra[64];
+    int b = batchSlot(&req);
+    if (b >= 0) {
+        _batchReq[b] = nullptr;
+        uint32_t found = 0;
+        uint32_t n = _batch[b].count();
+        uint8_t* out = _batch[b].finish(found);
+        if (!out) {
+            res.sendStatus(400);
+            return;
+        }
+        snprintf(extra, sizeof(extra), "X-Cards-Found: %u\r\nCache-Control: no-store\r\n", (unsigned)found);
+        res.sendOwned(200, "application/octet-stream", out, n * sizeof(CardMembership), extra);
+        return;
+    }
+
+    size_t n = req.bodyLength() / sizeof(uint64_t);
+    if (n == 0 || req.bodyLength() % sizeof(uint64_t)) {
+        res.sendStatus(400);
+        return;
+    }
+    // Тело в буфере разборщика не выровнено — копируем
+    uint64_t uids[HTTP_MAX_BODY / sizeof(uint64_t)];
+    CardMembership out[HTTP_MAX_BODY / sizeof(uint64_t)];
+    memcpy(uids, req.body(), n * sizeof(uint64_t));
+    uint32_t found = _db.findBatch(uids, n, out);
+
+    memcpy(res.bodyBuffer(), out, n * sizeof(CardMembership));
+    snprintf(extra, sizeof(extra), "X-Cards-Found: %u\r\nCache-Control: no-store\r\n", (unsigned)found);
+    res.sendBuffer(200, "application/octet-stream", n * sizeof(CardMembership), extra);
+}
+
+// POST /api/cards {"uid":"2468a","group":3,"limit":1,"bits":26} — добавить карту или сменить ей группу.
+// Действует сразу (слой изменений + журнал), без новой базы и перезагрузки.
+void WebHandler::apiCardAdd(const HttpRequestParser& req, HttpResponse& res) {
+    JsonDocument body;
+    uint64_t uid;
+    if (deserializeJson(body, req.body(), req.bodyLength()) || !body["uid"].is<const char*>() ||
+        !parseUid(body["uid"].as<const char*>(), uid) || !body["group"].is<int>()) {
+        res.sendStatus(400);
+        return;
+    }
+    int group = body["group"];
+    int limit = body["limit"] | 0;
+    int bits = body["bits"] | 0;
+    if (group < 0 || group > 0x3FFF || limit < 0 || limit > 3 || bits < 0 || bits > 64) {
+        res.sendStatus(400);
+        return;
+    }
+    sendCardChange(res, uid, _db.addCard(uid, group, limit, bits));
+}
+
+// DELETE /api/cards/{uid} — отзыв потерянной карты, действует с ближайшего поднесения
+void WebHandler::apiCardRevoke(const HttpRequestParser& req, HttpResponse& res) {
+    uint64_t uid;
+    if (!parseUid(req.path() + 11, uid)) {
+        res.sendStatus(400);
+        return;
+    }
+    sendCardChange(res, uid, _db.revokeCard(uid));
+}
+
+// Слой изменений ограничен CARD_DELTA_CAPACITY записей. Его разгружает уплотнение,
+// и 503 означает "повторить позже" — в том числе для образа во флеше.
+void WebHandler::sendCardChange(HttpResponse& res, uint64_t uid, bool ok) {
+    char uidHex[20];
+    snprintf(uidHex, sizeof(uidHex), "%llx", (unsigned long long)uid);
+
+    JsonDocument doc;
+    doc["uid"] = uidHex;
+    doc["ok"] = ok;
+    doc["pending"] = _db.pendingChanges();
+    doc["capacity"] = CARD_DELTA_CAPACITY;
+    if (!ok && _db.pendingChanges() >= CARD_DELTA_CAPACITY) {
+        doc["error"] = "change log full, retry after compaction";
+        sendJson(res, 503, doc);
+        return;
+    }
+    // Иначе отказ — из-за самих данных (40-битный uid на 26-битный кадр) или база не загружена
+    sendJson(res, ok ? 200 : 400, doc);
+}
+
+// POST /api/dsl, тело — сценарий ("OPEN 1; SLEEP 500; CLOSE 1"), запускается параллельно остальным
+void WebHandler::apiDsl(const HttpRequestParser& req, HttpResponse& res) {
+    if (req.bodyLength() == 0) {
+        res.sendStatus(400);
+        return;
+    }
+    bool accepted = _dsl.execute(String(req.body()));
+
+    JsonDocument doc;
+    doc["accepted"] = accepted;
+    doc["active"] = _dsl.stats().active;
+    sendJson(res, accepted ? 202 : 503, doc);
+}
+
+// POST /api/db — новая база (tools/make_db_bundle.py). Тело уже в очереди задачи записи;
+// проверка и замена таблиц идут в фоне, итог — GET /api/db
+void WebHandler::apiDbUpload(const HttpRequestParser& req, HttpResponse& res) {
+    if (req.contentLength() <= HTTP_MAX_BODY) {
+        // Маленькое тело разборщик принял сам — отдаём его тем же путём
+        if (_uploadReq || _upload.busy()) {
+            res.sendStatus(409);
+            return;
+        }
+        if (req.bodyLength() < sizeof(CardBundleHeader)) {
+            res.sendStatus(400);
+            return;
+        }
+        if (!_upload.begin(req.bodyLength())) {
+            if (_upload.noSpace()) apiDbStatus(res, 507);
+            else res.sendStatus(503);
+            return;
+        }
+        _upload.write((const uint8_t*)req.body(), req.bodyLength());
+    } else if (&req != _uploadReq) {
+        res.sendStatus(409);
+        return;
+    }
+    _uploadReq = nullptr;
+    // Заголовок и CRC могли уже не сойтись; иначе — принято, проверка идёт
+    apiDbStatus(res, _upload.state() == CardUploadState::FAILED ? 400 : 202);
+}
+
+// GET /api/db — ход последней загрузки базы
+void WebHandler::apiDbStatus(HttpResponse& res, uint16_t status) {
+    CardUploadState st = _upload.state();
+    JsonDocument doc;
+    doc["state"] = cardUploadStateName(st);
+    doc["total"] = _upload.total();
+    doc["received"] = _upload.received();
+    doc["written"] = _upload.written();
+    if (st == CardUploadState::FAILED) doc["error"] = _upload.error();
+    if (st == CardUploadState::DONE || st == CardUploadState::FAILED) doc["ms"] = _upload.elapsedMs();
+    doc["psram_kb"] = _db.psramUsage() / 1024;
+    sendJson(res, status, doc);
+}
+
+// GET /api/outputs — теневой регистр выходов; открыт = LOW
+void WebHandler::apiOutputs(HttpResponse& res) {
+    OutputMask value = _hw.outputs();
+    OutputMask wired = _hw.bank().wired();
+    char hex[OUTPUT_MASK_BYTES * 2 + 1];
+    for (int i = 0; i < OUTPUT_MASK_BYTES; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", (uint8_t)(value >> (8 * (OUTPUT_MASK_BYTES - 1 - i))));
+    }
+
+    JsonDocument doc;
+    doc["value"] = hex;
+    doc["pins"] = _hw.bank().expanders() * 8;
+    JsonArray open = doc["open"].to<JsonArray>();
+    for (int pin = 0; pin < OUTPUT_MAX_PINS; pin++) {
+        OutputMask bit = (OutputMask)1 << pin;
+        if ((wired & bit) && !(value & bit)) open.add(pin + 1);
+    }
+    doc["pulses"] = _hw.pulseStats().active;
+    sendJson(res, 200, doc);
+}
+
+void WebHandler::printStats() const {
+    const HttpServerStats& s = _http.stats();
+    Serial.printf("HTTP: %u conn, %u req, %u bad, %u timeouts, %u busy, %u streamed, %u active, step max %u us\n",
+                  (unsigned)s.accepted, (unsigned)s.requests, (unsigned)s.errors, (unsigned)s.timeouts, (unsigned)s.rejected, (unsigned)s.streamed, (unsigned)_http.active(), (unsigned)s.maxStepUs);
 }
\ No newline at end of file
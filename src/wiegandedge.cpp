@@ -0,0 +1,109 @@
+#include "wiegandedge.h"
+#include <algorithm>
+
+void WiegandEdgeDecoder::setFormats(uint8_t reader, uint64_t lengths) {
+    if (reader < WIEGAND_MAX_READERS) _st[reader].lengths = lengths;
+}
+
+void WiegandEdgeDecoder::edge(const WiegandEdge& e) {
+    if (e.reader >= WIEGAND_MAX_READERS) return;
+    State& s = _st[e.reader];
+    if (!(_pending & (1u << e.reader))) {
+        s.code = 0;
+        s.bits = 0;
+        s.tFirst = e.t;
+        s.maxGapUs = 0;
+        _pending |= 1u << e.reader;
+    } else {
+        uint32_t gap = e.t - s.tLast;
+        if (gap > s.maxGapUs) s.maxGapUs = gap;
+        WiegandReaderStats& st = _stats[e.reader];
+        st.avgGapUs = st.avgGapUs ? st.avgGapUs - st.avgGapUs / 16 + gap / 16 : gap;
+        if (gap > st.maxGapUs) st.maxGapUs = gap;
+    }
+    s.code = (s.code << 1) | (e.bit & 1);
+    if (s.bits < 255) s.bits++;
+    s.tLast = e.t;
+    _edges++;
+
+    // Досрочное закрытие: длина ожидаемая и чётность сошлась
+    s.quickUs = UINT32_MAX;
+    if (s.bits < 64 && (s.lengths & WIEGAND_LEN(s.bits)) && wiegandValid(s.code, s.bits)) {
+        uint64_t longer = (s.bits < 63) ? (s.lengths >> (s.bits + 1)) : 0;
+        if (!longer) {
+            s.quickUs = 0;
+        } else {
+            // Может прийти ещё бит более длинного формата — ждём несколько интервалов
+            uint32_t q = s.maxGapUs * WIEGAND_QUICK_GAP_FACTOR;
+            s.quickUs = (q < WIEGAND_QUICK_GAP_MIN_US) ? WIEGAND_QUICK_GAP_MIN_US : q;
+        }
+    }
+}
+
+uint32_t WiegandEdgeDecoder::poll(uint32_t nowUs, const std::function<void(const WiegandRawFrame&)>& fn) {
+    uint32_t n = 0;
+    uint32_t mask = _pending;
+    while (mask) {
+        uint8_t r = __builtin_ctz(mask);
+        mask &= mask - 1;
+        State& s = _st[r];
+        // Разность без знака не ломается при переполнении micros()
+        if (nowUs - s.tLast < waitUs(s)) continue;
+        _pending &= ~(1u << r);
+        WiegandRawFrame f;
+        f.code = s.code;
+        f.tFirst = s.tFirst;
+        f.tLast = s.tLast;
+        f.reader = r;
+        f.bits = s.bits;
+        f.early = s.quickUs <= _gapUs;
+        _stats[r].frames++;
+        if (f.early) _stats[r].early++;
+        fn(f);
+        n++;
+    }
+    return n;
+}
+
+uint32_t WiegandEdgeDecoder::nextDeadline(uint32_t nowUs) const {
+    uint32_t best = UINT32_MAX;
+    uint32_t mask = _pending;
+    while (mask) {
+        uint8_t r = __builtin_ctz(mask);
+        mask &= mask - 1;
+        uint32_t elapsed = nowUs - _st[r].tLast;
+        uint32_t wait = waitUs(_st[r]);
+        uint32_t left = (elapsed >= wait) ? 0 : wait - elapsed;
+        if (left < best) best = left;
+    }
+    return best;
+}
+
+void WiegandSimSource::frame(uint8_t reader, uint64_t code, uint8_t bits, uint32_t startUs,
+                             const WiegandTiming& tm) {
+    for (uint8_t i = 0; i < bits; i++) {
+        WiegandEdge e;
+        e.t = startUs + i * tm.periodUs;
+        e.reader = reader;
+        e.bit = (code >> (bits - 1 - i)) & 1;
+        _edges.push_back(e);
+    }
+    // Кадры разных считывателей могут перекрываться — держим общий порядок по времени
+    std::stable_sort(_edges.begin() + _next, _edges.end(),
+                     [](const WiegandEdge& a, const WiegandEdge& b) { return a.t < b.t; });
+}
+
+uint32_t WiegandSimSource::run(uint32_t nowUs) {
+    uint32_t n = 0;
+    while (_next < _edges.size() && _edges[_next].t <= nowUs) {
+        // Как и настоящее прерывание, при полном кольце фронт теряется
+        _ring.push(_edges[_next]);
+        _next++;
+        n++;
+    }
+    return n;
+}
+
+uint32_t WiegandSimSource::nextEdge() const {
+    return (_next < _edges.size()) ? _edges[_next].t : UINT32_MAX;
+}
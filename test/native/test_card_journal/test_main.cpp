@@ -0,0 +1,307 @@
+// Журнал изменений базы карт: добавление/отзыв без перезагрузки и уплотнение.
+
+#include <unity.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "search.h"
+
+static const uint64_t WIDE = 0x0100000000ULL;
+
+static void writeFile(const char* path, const std::vector<uint8_t>& data) {
+    File f = LittleFS.open(path, "w");
+    f.write(data.data(), data.size());
+    f.close();
+}
+
+// Маленькая база: карты 10..N*10 в обеих таблицах, 4 группы по одному правилу
+static void makeDb(uint32_t n) {
+    std::vector<CardRecord34> c34(n);
+    std::vector<CardRecord56> c56(n);
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t key = (i + 1) * 10;
+        c34[i] = {(uint32_t)key, (uint16_t)(i % 4), 0};
+        c56[i].keyLo = (uint32_t)(WIDE + key);
+        c56[i].keyHi = (uint32_t)((WIDE + key) >> 32);
+        c56[i].flags = i % 4;
+        c56[i].reserved = 0;
+    }
+    saveCardFile34("/cards34.bin", c34.data(), n);
+    saveCardFile56("/cards56.bin", c56.data(), n);
+
+    // [размер BE][индексы правил BE]
+    writeFile("/groups.bin", {0, 2, 0, 0,  0, 2, 0, 1,  0, 2, 0, 2,  0, 2, 0, 3});
+    // action = номер правила
+    writeFile("/rules.bin", {0xFF, 0, 0, 0,  0xFF, 0, 0, 1,  0xFF, 0, 0, 2,  0xFF, 0, 0, 3});
+    LittleFS.remove(CARDJOURNAL_PATH);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_changes_visible_immediately() {
+    makeDb(100);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+
+    TEST_ASSERT_TRUE(db.findView(20, 34).found);
+    TEST_ASSERT_TRUE(db.findView(20, 34).cached);
+    TEST_ASSERT_TRUE(db.revokeCard(20));
+    TEST_ASSERT_FALSE(db.findView(20, 34).found);
+    TEST_ASSERT_FALSE(db.findView(20).found);
+
+    TEST_ASSERT_TRUE(db.addCard(15, 3, 1, 26));
+    CardView v = db.findView(15, 26);
+    TEST_ASSERT_TRUE(v.found);
+    TEST_ASSERT_EQUAL(CardSource::DELTA, v.source);
+    TEST_ASSERT_EQUAL(3, v.group_id);
+    TEST_ASSERT_EQUAL(1, v.limit);
+    TEST_ASSERT_EQUAL(1, v.instructions.size());
+    TEST_ASSERT_EQUAL(3, v.instructions[0].action);
+
+    // 34-битная карта не видна при поиске по длинному кадру
+    TEST_ASSERT_FALSE(db.findView(15, 56).found);
+    // Изменение группы существующей карты
+    TEST_ASSERT_EQUAL(2, db.findView(WIDE + 30, 56).group_id);
+    TEST_ASSERT_TRUE(db.addCard(WIDE + 30, 1, 0, 56));
+    TEST_ASSERT_EQUAL(1, db.findView(WIDE + 30, 56).group_id);
+    TEST_ASSERT_EQUAL(3, db.pendingChanges());
+
+    // 40-битный uid не может попасть в 32-битную таблицу
+    TEST_ASSERT_FALSE(db.addCard(WIDE + 1, 0, 0, 26));
+}
+
+void test_journal_replayed_on_boot() {
+    makeDb(100);
+    {
+        CardDatabase db;
+        TEST_ASSERT_TRUE(db.begin());
+        db.revokeCard(WIDE + 50);
+        db.addCard(7, 2, 0);
+        db.revokeCard(7);
+        db.addCard(7, 1, 0);   // Последнее изменение побеждает
+    }
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    TEST_ASSERT_EQUAL(2, db.pendingChanges());
+    TEST_ASSERT_FALSE(db.findView(WIDE + 50).found);
+    CardView v = db.findView(7);
+    TEST_ASSERT_TRUE(v.found);
+    TEST_ASSERT_EQUAL(1, v.group_id);
+}
+
+static void checkCompaction(CardIndexLayout layout, CardStorage storage = CardStorage::PSRAM) {
+    makeDb(1000);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin(layout, storage));
+    bool mapped = storage == CardStorage::FLASH_MAPPED;
+    TEST_ASSERT_EQUAL(mapped, db.isMapped());
+    db.revokeCard(10);           // Первая запись
+    db.revokeCard(10000);        // Последняя запись
+    db.revokeCard(WIDE + 5000);
+    db.addCard(5, 1, 2, 26);     // Перед первой
+    db.addCard(5005, 2, 0, 26);  // Между записями
+    db.addCard(99999, 3, 0, 26); // После последней
+    db.addCard(WIDE + 20, 3, 3, 56);
+    TEST_ASSERT_TRUE(db.compact());
+    TEST_ASSERT_EQUAL(0, db.pendingChanges());
+    // Образ во флеше перезаписан и снова отображён
+    TEST_ASSERT_EQUAL(mapped, db.isMapped());
+
+    // Новые базовые таблицы: в памяти (или разделе) и в файлах
+    CardDatabase fresh;
+    TEST_ASSERT_TRUE(fresh.begin(layout, storage));
+    TEST_ASSERT_EQUAL(0, fresh.pendingChanges());
+    CardDatabase* dbs[] = {&db, &fresh};
+    for (CardDatabase* d : dbs) {
+        TEST_ASSERT_FALSE(d->findView(10).found);
+        TEST_ASSERT_FALSE(d->findView(10000).found);
+        TEST_ASSERT_FALSE(d->findView(WIDE + 5000).found);
+        TEST_ASSERT_TRUE(d->findView(20).found);
+        TEST_ASSERT_TRUE(d->findView(9990).found);
+
+        CardView v = d->findView(5, 26);
+        TEST_ASSERT_TRUE(v.found);
+        TEST_ASSERT_EQUAL(mapped ? CardSource::FLASH_34 : CardSource::PSRAM_34, v.source);
+        TEST_ASSERT_EQUAL(2, v.limit);
+        TEST_ASSERT_EQUAL(2, d->findView(5005).group_id);
+        TEST_ASSERT_TRUE(d->findView(99999).found);
+        v = d->findView(WIDE + 20, 56);
+        TEST_ASSERT_EQUAL(mapped ? CardSource::FLASH_56 : CardSource::PSRAM_56, v.source);
+        TEST_ASSERT_EQUAL(3, v.group_id);
+        TEST_ASSERT_EQUAL(1, v.instructions.size());
+    }
+}
+
+void test_compaction_binary() { checkCompaction(CardIndexLayout::BINARY); }
+void test_compaction_eytzinger() { checkCompaction(CardIndexLayout::EYTZINGER); }
+void test_compaction_flash_mapped() { checkCompaction(CardIndexLayout::BINARY, CardStorage::FLASH_MAPPED); }
+
+// Фильтр переходит к новому набору, пока в нём есть запас; переполненный строится заново
+void test_compaction_refills_filter() {
+    makeDb(1000);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    TEST_ASSERT_NOT_NULL(db.filter());
+    for (uint32_t round = 0; round < 3; round++) {
+        for (uint32_t i = 0; i < 600; i++) TEST_ASSERT_TRUE(db.addCard(WIDE + 100000 + round * 1000 + i, 1, 0, 56));
+        TEST_ASSERT_TRUE(db.compact());
+        TEST_ASSERT_NOT_NULL(db.filter());
+        // Второй раз 600 карт в запас не помещаются — фильтр перестроен по новым таблицам,
+        // третий раз они снова идут в запас
+        TEST_ASSERT_EQUAL(CARD_DELTA_CAPACITY - (round == 1 ? 0 : 600), db.filter()->room());
+    }
+    for (uint32_t round = 0; round < 3; round++) {
+        for (uint32_t i = 0; i < 600; i += 7) TEST_ASSERT_TRUE(db.findView(WIDE + 100000 + round * 1000 + i).found);
+    }
+    TEST_ASSERT_TRUE(db.findView(WIDE + 10000).found);
+}
+
+void test_changes_after_snapshot_kept() {
+    makeDb(100);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    db.revokeCard(30);
+    TEST_ASSERT_TRUE(db.compact());
+    db.addCard(30, 1, 0);
+    TEST_ASSERT_EQUAL(1, db.pendingChanges());
+
+    CardDatabase fresh;
+    TEST_ASSERT_TRUE(fresh.begin());
+    TEST_ASSERT_EQUAL(1, fresh.pendingChanges());
+    TEST_ASSERT_TRUE(fresh.findView(30).found);
+}
+
+static void checkLookupsDuringCompaction(CardStorage storage) {
+    makeDb(20000);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin(CardIndexLayout::EYTZINGER, storage));
+    for (uint32_t i = 0; i < 500; i++) db.revokeCard(WIDE + (i + 1) * 10);
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint32_t> misses{0}, lookups{0};
+    std::thread reader([&] {
+        uint32_t i = 0;
+        while (!stop) {
+            // Карты, которых изменения не касаются, должны находиться всегда
+            uint64_t key = (1000 + (i++ % 19000)) * 10;
+            if (!db.findView(key, 26).found || !db.findView(WIDE + key, 56).found) misses++;
+            lookups++;
+        }
+    });
+    for (int round = 0; round < 5; round++) {
+        db.addCard(1 + round, 0, 0, 26);
+        TEST_ASSERT_TRUE(db.compact());
+    }
+    stop = true;
+    reader.join();
+
+    printf("[journal] lookups during compaction (%s): %u, misses: %u\n",
+           db.isMapped() ? "flash" : "psram", (unsigned)lookups, (unsigned)misses);
+    TEST_ASSERT_EQUAL(0, (uint32_t)misses);
+    TEST_ASSERT_FALSE(db.findView(WIDE + 10).found);
+    TEST_ASSERT_TRUE(db.findView(5).found);
+}
+
+void test_lookups_during_compaction() { checkLookupsDuringCompaction(CardStorage::PSRAM); }
+void test_lookups_during_flash_compaction() { checkLookupsDuringCompaction(CardStorage::FLASH_MAPPED); }
+
+// Одинаковые списки правил у разных групп хранятся один раз, сводка считается при загрузке
+void test_group_tables_shared() {
+    makeDb(100);
+    // Группы 0 и 2 ссылаются на разные, но одинаковые правила; группа 3 пустая
+    writeFile("/groups.bin", {0, 4, 0, 0, 0, 1,  0, 2, 0, 2,  0, 4, 0, 3, 0, 4,  0, 0});
+    // priority — биты 5..12, action — 0..3
+    writeFile("/rules.bin", {0xFF, 0, 0x01, 0x01,  0xFF, 0, 0x04, 0x02,  0xFF, 0, 0, 0x05,
+                             0xFF, 0, 0x01, 0x01,  0xFF, 0, 0x04, 0x02});
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+
+    CardView g0 = db.findView(10);   // Группа 0
+    CardView g2 = db.findView(30);   // Группа 2
+    CardView g3 = db.findView(40);   // Группа 3
+    TEST_ASSERT_EQUAL(2, g0.instructions.size());
+    TEST_ASSERT_EQUAL_PTR(g0.instructions.ptr, g2.instructions.ptr);
+    TEST_ASSERT_EQUAL((1 << 1) | (1 << 2), g0.actionMask);
+    TEST_ASSERT_EQUAL(2, g0.topAction);   // priority 0x20 > 0x08
+    TEST_ASSERT_EQUAL(0, g3.instructions.size());
+    TEST_ASSERT_EQUAL(0, g3.actionMask);
+    TEST_ASSERT_EQUAL(0, g3.topAction);
+}
+
+// Пакетная проверка видит слой изменений так же, как findView: отзыв, добавление, новая группа
+static void checkBatch(CardIndexLayout layout) {
+    makeDb(100);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin(layout));
+    db.revokeCard(20);
+    db.revokeCard(WIDE + 40);
+    db.addCard(15, 3, 1, 26);
+    db.addCard(WIDE + 30, 1, 0, 56);
+
+    // Неотсортированный пакет с повторами и промахами по обе стороны таблиц
+    std::vector<uint64_t> uids = {WIDE + 30, 20, 15, 10, 1000, 5, WIDE + 40, 20, WIDE + 1000, WIDE + 10, 990, 0};
+    std::vector<CardMembership> out(uids.size());
+    uint32_t found = db.findBatch(uids.data(), uids.size(), out.data());
+    uint32_t expect = 0;
+    for (size_t i = 0; i < uids.size(); i++) {
+        CardView v = db.findView(uids[i]);
+        expect += v.found;
+        TEST_ASSERT_EQUAL(v.found, out[i].found());
+        TEST_ASSERT_EQUAL(v.source, out[i].source);
+        TEST_ASSERT_EQUAL(v.group_id, out[i].group());
+        TEST_ASSERT_EQUAL(v.limit, out[i].limit());
+    }
+    TEST_ASSERT_EQUAL(7, expect);
+    TEST_ASSERT_EQUAL(expect, found);
+    TEST_ASSERT_EQUAL(CardSource::DELTA, out[2].source);
+    TEST_ASSERT_EQUAL(1, out[0].group());
+    TEST_ASSERT_FALSE(out[1].found());
+}
+
+void test_batch_binary() { checkBatch(CardIndexLayout::BINARY); }
+void test_batch_eytzinger() { checkBatch(CardIndexLayout::EYTZINGER); }
+
+// База не загрузилась: поиски (самопроверка, /api/card, конвейер) отвечают "не найдена", а не падают
+void test_lookups_without_db() {
+    makeDb(100);
+    LittleFS.remove("/cards34.bin");
+    LittleFS.remove("/cards56.bin");
+    CardDatabase db;
+    TEST_ASSERT_FALSE(db.begin());
+
+    TEST_ASSERT_FALSE(db.findView(20, 34).found);
+    TEST_ASSERT_FALSE(db.findView(WIDE + 20).found);
+    TEST_ASSERT_FALSE(db.find(20).found);
+    uint64_t uids[] = {20, WIDE + 20};
+    CardMembership out[2];
+    TEST_ASSERT_EQUAL(0, db.findBatch(uids, 2, out));
+    TEST_ASSERT_FALSE(out[0].found());
+    TEST_ASSERT_FALSE(db.addCard(15, 3, 1, 26));
+}
+
+int main(int argc, char** argv) {
+    char dir[] = "/tmp/kcdb_journal_XXXXXX";
+    char partDir[] = "/tmp/kcdb_journal_part_XXXXXX";
+    if (!mkdtemp(dir) || !mkdtemp(partDir)) return 1;
+    setenv("LITTLEFS_ROOT", dir, 1);
+    setenv("PARTITION_ROOT", partDir, 1);
+    LittleFS.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_changes_visible_immediately);
+    RUN_TEST(test_journal_replayed_on_boot);
+    RUN_TEST(test_compaction_binary);
+    RUN_TEST(test_compaction_eytzinger);
+    RUN_TEST(test_compaction_flash_mapped);
+    RUN_TEST(test_compaction_refills_filter);
+    RUN_TEST(test_changes_after_snapshot_kept);
+    RUN_TEST(test_lookups_during_compaction);
+    RUN_TEST(test_lookups_during_flash_compaction);
+    RUN_TEST(test_group_tables_shared);
+    RUN_TEST(test_batch_binary);
+    RUN_TEST(test_batch_eytzinger);
+    RUN_TEST(test_lookups_without_db);
+    return UNITY_END();
+}
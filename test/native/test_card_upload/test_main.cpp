@@ -0,0 +1,411 @@
+// Новая база по сети без перезагрузки: пакет файлов, проверка CRC в задаче записи,
+// второй набор таблиц и подмена, пока другой поток непрерывно ищет карты.
+
+#include <unity.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "cardupload.h"
+
+static const uint64_t WIDE = 0x0100000000ULL;
+static const uint32_t CARDS = 20000;
+
+static void writeFile(const char* path, const std::vector<uint8_t>& data) {
+    File f = LittleFS.open(path, "w");
+    f.write(data.data(), data.size());
+    f.close();
+}
+
+static std::vector<uint8_t> readFile(const char* path) {
+    File f = LittleFS.open(path, "r");
+    std::vector<uint8_t> out(f.size());
+    f.read(out.data(), out.size());
+    f.close();
+    return out;
+}
+
+// Поколение 0: карты 10..CARDS*10, группа i % 4.
+// Поколение 1: первая половина та же, но с другой группой, вторая заменена картами ...5.
+static uint64_t keyAt(uint32_t gen, uint32_t i) { return (i + 1) * 10 + ((gen && i >= CARDS / 2) ? 5 : 0); }
+static uint16_t groupAt(uint32_t gen, uint32_t i) { return (i + gen) % 4; }
+
+static void makeFiles(uint32_t gen, const char* suffix) {
+    std::vector<CardRecord34> c34(CARDS);
+    std::vector<CardRecord56> c56(CARDS);
+    for (uint32_t i = 0; i < CARDS; i++) {
+        uint64_t key = keyAt(gen, i);
+        c34[i] = {(uint32_t)key, groupAt(gen, i), 0};
+        c56[i].keyLo = (uint32_t)(WIDE + key);
+        c56[i].keyHi = (uint32_t)((WIDE + key) >> 32);
+        c56[i].flags = groupAt(gen, i);
+        c56[i].reserved = 0;
+    }
+    saveCardFile34((String("/cards34.bin") + suffix).c_str(), c34.data(), CARDS);
+    saveCardFile56((String("/cards56.bin") + suffix).c_str(), c56.data(), CARDS);
+    // 4 группы по одному правилу, action = номер правила
+    writeFile((String("/groups.bin") + suffix).c_str(), {0, 2, 0, 0,  0, 2, 0, 1,  0, 2, 0, 2,  0, 2, 0, 3});
+    writeFile((String("/rules.bin") + suffix).c_str(), {0xFF, 0, 0, 0,  0xFF, 0, 0, 1,  0xFF, 0, 0, 2,  0xFF, 0, 0, 3});
+}
+
+// То же, что делает tools/make_db_bundle.py
+static std::vector<uint8_t> makeBundle(uint32_t gen) {
+    makeFiles(gen, ".src");
+    CardBundleHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = CARDBUNDLE_MAGIC;
+    h.version = CARDBUNDLE_VERSION;
+    h.headerSize = sizeof(h);
+    std::vector<uint8_t> payload;
+    for (int i = 0; i < CARDBUNDLE_FILES; i++) {
+        String path = String(cardDbFiles[i]) + ".src";
+        std::vector<uint8_t> f = readFile(path.c_str());
+        LittleFS.remove(path.c_str());
+        h.size[i] = f.size();
+        payload.insert(payload.end(), f.begin(), f.end());
+    }
+    h.crc32 = cardCrc32(payload.data(), payload.size());
+    std::vector<uint8_t> out((uint8_t*)&h, (uint8_t*)&h + sizeof(h));
+    out.insert(out.end(), payload.begin(), payload.end());
+    return out;
+}
+
+// Как WebHandler: порции из сокета, пока очередь их берёт
+static void send(CardUpload& up, const std::vector<uint8_t>& b, size_t upTo) {
+    for (size_t pos = 0; pos < upTo; ) {
+        size_t n = up.write(b.data() + pos, std::min<size_t>(CARD_UPLOAD_CHUNK, upTo - pos));
+        if (!n) delayMicroseconds(100);
+        pos += n;
+    }
+}
+
+static CardUploadState wait(CardUpload& up) {
+    uint32_t t0 = millis();
+    while (up.busy() && millis() - t0 < 20000) delay(5);
+    return up.state();
+}
+
+static bool shadowsLeft() {
+    for (int i = 0; i < CARDBUNDLE_FILES; i++) {
+        if (LittleFS.exists((String(cardDbFiles[i]) + CARDBUNDLE_SUFFIX).c_str())) return true;
+    }
+    return false;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void checkSwap(CardIndexLayout layout, CardStorage storage) {
+    makeFiles(0, "");
+    LittleFS.remove(CARDJOURNAL_PATH);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin(layout, storage));
+    db.addCard(3, 1, 0, 26);   // Изменение старой базы — новая его заменяет
+    std::vector<uint8_t> bundle = makeBundle(1);
+
+    // Поиски идут всё время: общие карты находятся всегда, с группой и инструкциями
+    // того или другого поколения, но никогда не мусором
+    std::atomic<bool> stop{false};
+    std::atomic<uint32_t> lookups{0}, lost{0}, torn{0}, sawNew{0};
+    std::atomic<uint32_t> worstUs{0};
+    std::thread reader([&] {
+        uint32_t n = 0;
+        while (!stop) {
+            uint32_t i = n++ % (CARDS / 2);
+            uint64_t key = (n & 1) ? keyAt(0, i) : WIDE + keyAt(0, i);
+            uint32_t t0 = micros();
+            CardView v = db.findView(key);
+            uint32_t dt = micros() - t0;
+            if (dt > worstUs) worstUs = dt;
+            lookups++;
+            if (!v.found) { lost++; continue; }
+            if (v.group_id != groupAt(0, i) && v.group_id != groupAt(1, i)) torn++;
+            if (v.instructions.size() != 1 || v.instructions[0].action != v.group_id) torn++;
+            if (v.group_id == groupAt(1, i)) sawNew++;
+        }
+    });
+
+    CardUpload up(db);
+    uint32_t t0 = millis();
+    TEST_ASSERT_TRUE(up.begin(bundle.size()));
+    TEST_ASSERT_FALSE(up.begin(bundle.size()));   // Вторая загрузка ждёт первую
+    send(up, bundle, bundle.size());
+    CardUploadState st = wait(up);
+    uint32_t ms = millis() - t0;
+    stop = true;
+    reader.join();
+
+    printf("[upload] %zu B, done in %u ms (%s); %u lookups meanwhile, lost %u, torn %u, worst %u us\n",
+           bundle.size(), (unsigned)ms, up.error(), (unsigned)lookups, (unsigned)lost, (unsigned)torn, (unsigned)worstUs);
+    TEST_ASSERT_EQUAL(CardUploadState::DONE, st);
+    TEST_ASSERT_EQUAL(bundle.size(), up.written());
+    TEST_ASSERT_EQUAL(0, (uint32_t)lost);
+    TEST_ASSERT_EQUAL(0, (uint32_t)torn);
+    TEST_ASSERT_TRUE(sawNew > 0);
+    TEST_ASSERT_FALSE(shadowsLeft());
+    TEST_ASSERT_EQUAL(0, db.pendingChanges());
+    TEST_ASSERT_EQUAL(storage == CardStorage::FLASH_MAPPED, db.isMapped());
+
+    // Новая база — в памяти и в основных файлах
+    CardDatabase fresh;
+    TEST_ASSERT_TRUE(fresh.begin(layout, storage));
+    CardDatabase* dbs[] = {&db, &fresh};
+    for (CardDatabase* d : dbs) {
+        TEST_ASSERT_FALSE(d->findView(3).found);
+        TEST_ASSERT_EQUAL(groupAt(1, 7), d->findView(keyAt(1, 7)).group_id);
+        TEST_ASSERT_TRUE(d->findView(WIDE + keyAt(1, CARDS - 1)).found);
+        TEST_ASSERT_FALSE(d->findView(WIDE + keyAt(0, CARDS - 1)).found);
+        TEST_ASSERT_FALSE(d->findView(keyAt(0, CARDS / 2)).found);
+    }
+}
+
+void test_swap_binary() { checkSwap(CardIndexLayout::BINARY, CardStorage::PSRAM); }
+void test_swap_eytzinger() { checkSwap(CardIndexLayout::EYTZINGER, CardStorage::PSRAM); }
+void test_swap_flash_mapped() { checkSwap(CardIndexLayout::BINARY, CardStorage::FLASH_MAPPED); }
+
+// Файлы базы заменены в обход reload() (или раздел не обновился): образ во флеше
+// от старых файлов не отображается, а собирается заново
+void test_stale_image_rebuilt() {
+    makeFiles(0, "");
+    LittleFS.remove(CARDJOURNAL_PATH);
+    {
+        CardDatabase db;
+        TEST_ASSERT_TRUE(db.begin(CardIndexLayout::BINARY, CardStorage::FLASH_MAPPED));
+        TEST_ASSERT_TRUE(db.isMapped());
+        TEST_ASSERT_EQUAL(groupAt(0, 7), db.findView(keyAt(0, 7)).group_id);
+    }
+    makeFiles(1, "");
+    for (int boot = 0; boot < 2; boot++) {
+        CardDatabase db;
+        TEST_ASSERT_TRUE(db.begin(CardIndexLayout::BINARY, CardStorage::FLASH_MAPPED));
+        TEST_ASSERT_TRUE(db.isMapped());
+        TEST_ASSERT_EQUAL(groupAt(1, 7), db.findView(keyAt(1, 7)).group_id);
+        TEST_ASSERT_TRUE(db.findView(keyAt(1, CARDS - 1)).found);
+        TEST_ASSERT_FALSE(db.findView(keyAt(0, CARDS - 1)).found);
+    }
+}
+
+// Загрузка закончилась, пока фоновое уплотнение держит замок: каждый из двоих
+// должен взять живой набор уже после другого, без двойного освобождения
+void test_reload_races_compaction() {
+    makeFiles(0, "");
+    LittleFS.remove(CARDJOURNAL_PATH);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    for (uint32_t round = 0; round < 6; round++) {
+        for (uint32_t i = 0; i < 50; i++) db.addCard(WIDE + 7 + i * 10, 1, 0, 56);
+        makeFiles(round & 1, CARDBUNDLE_SUFFIX);
+        std::thread compactor([&db] { db.compact(); });
+        delayMicroseconds(200 * round);   // Уплотнение успевает взять замок раньше — или нет
+        TEST_ASSERT_TRUE(db.reload(CARDBUNDLE_SUFFIX));
+        compactor.join();
+        TEST_ASSERT_TRUE(db.findView(keyAt(round & 1, CARDS - 1)).found);
+        TEST_ASSERT_EQUAL(groupAt(round & 1, 7), db.findView(keyAt(round & 1, 7)).group_id);
+    }
+}
+
+// Фильтр строится заново с каждой новой базой: ключи, которых в ней нет, им отсекаются
+void test_reload_rebuilds_filter() {
+    makeFiles(0, "");
+    LittleFS.remove(CARDJOURNAL_PATH);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    for (uint32_t round = 1; round <= 4; round++) {
+        makeFiles(round & 1, CARDBUNDLE_SUFFIX);
+        TEST_ASSERT_TRUE(db.reload(CARDBUNDLE_SUFFIX));
+        const CardFilter* f = db.filter();
+        TEST_ASSERT_NOT_NULL(f);
+        // Вторая половина карт другого поколения в новой базе отсутствует
+        uint32_t passed = 0;
+        for (uint32_t i = CARDS / 2; i < CARDS; i++) passed += f->mayContain(keyAt(!(round & 1), i));
+        TEST_ASSERT_TRUE(passed < CARDS / 20);
+        TEST_ASSERT_TRUE(f->mayContain(keyAt(round & 1, CARDS - 1)));
+    }
+}
+
+static std::vector<std::vector<uint8_t>> readDbFiles() {
+    std::vector<std::vector<uint8_t>> out;
+    for (int i = 0; i < CARD_DB_FILES; i++) out.push_back(readFile(cardDbFiles[i]));
+    return out;
+}
+
+static bool backupsLeft() {
+    for (int i = 0; i < CARD_DB_FILES; i++) {
+        if (LittleFS.exists((String(cardDbFiles[i]) + CARD_DB_BACKUP_SUFFIX).c_str())) return true;
+    }
+    return LittleFS.exists(CARD_DB_SWAP_MARK);
+}
+
+// Пакет с целым CRC, но файл карт внутри не читается: раньше база поднималась
+// без 56-битных карт и файлы подменялись
+void test_reload_rejects_unread_table() {
+    makeFiles(0, "");
+    LittleFS.remove(CARDJOURNAL_PATH);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    std::vector<std::vector<uint8_t>> before = readDbFiles();
+
+    makeFiles(1, CARDBUNDLE_SUFFIX);
+    std::vector<uint8_t> c56 = readFile("/cards56.bin" CARDBUNDLE_SUFFIX);
+    c56[c56.size() / 2] ^= 0x01;
+    writeFile("/cards56.bin" CARDBUNDLE_SUFFIX, c56);
+    TEST_ASSERT_FALSE(db.reload(CARDBUNDLE_SUFFIX));
+
+    TEST_ASSERT_TRUE(readDbFiles() == before);
+    TEST_ASSERT_FALSE(backupsLeft());
+    TEST_ASSERT_TRUE(db.findView(WIDE + keyAt(0, CARDS - 1)).found);
+    TEST_ASSERT_FALSE(db.findView(keyAt(1, CARDS - 1)).found);
+}
+
+// Последнее переименование не проходит: уже перенесённые файлы возвращаются,
+// живой набор не подменяется
+void test_reload_rename_rollback() {
+    makeFiles(0, "");
+    LittleFS.remove(CARDJOURNAL_PATH);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    std::vector<std::vector<uint8_t>> before = readDbFiles();
+
+    makeFiles(1, CARDBUNDLE_SUFFIX);
+    // Каталог на месте копии rules.bin — rename() в него не пройдёт
+    String blocker = String(getenv("LITTLEFS_ROOT")) + "/rules.bin" CARD_DB_BACKUP_SUFFIX;
+    TEST_ASSERT_EQUAL(0, mkdir(blocker.c_str(), 0700));
+    writeFile("/rules.bin" CARD_DB_BACKUP_SUFFIX "/x", {1});
+    TEST_ASSERT_FALSE(db.reload(CARDBUNDLE_SUFFIX));
+    LittleFS.remove("/rules.bin" CARD_DB_BACKUP_SUFFIX "/x");
+    rmdir(blocker.c_str());
+
+    TEST_ASSERT_TRUE(readDbFiles() == before);
+    TEST_ASSERT_FALSE(backupsLeft());
+    TEST_ASSERT_TRUE(LittleFS.exists("/cards34.bin" CARDBUNDLE_SUFFIX));
+    TEST_ASSERT_TRUE(db.findView(keyAt(0, CARDS - 1)).found);
+    TEST_ASSERT_FALSE(db.findView(keyAt(1, CARDS - 1)).found);
+    // Препятствие убрано — та же подмена проходит
+    TEST_ASSERT_TRUE(db.reload(CARDBUNDLE_SUFFIX));
+    TEST_ASSERT_TRUE(db.findView(keyAt(1, CARDS - 1)).found);
+    TEST_ASSERT_FALSE(backupsLeft());
+}
+
+// Питание пропало посреди подмены: два файла уже новые, метка на месте
+void test_interrupted_swap_restored() {
+    makeFiles(0, "");
+    LittleFS.remove(CARDJOURNAL_PATH);
+    std::vector<std::vector<uint8_t>> before = readDbFiles();
+    for (int i = 0; i < CARD_DB_FILES; i++) {
+        LittleFS.rename(cardDbFiles[i], (String(cardDbFiles[i]) + CARD_DB_BACKUP_SUFFIX).c_str());
+    }
+    makeFiles(1, "");
+    LittleFS.remove("/groups.bin");
+    LittleFS.remove("/rules.bin");
+    LittleFS.open(CARD_DB_SWAP_MARK, "w").close();
+
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    TEST_ASSERT_TRUE(readDbFiles() == before);
+    TEST_ASSERT_FALSE(backupsLeft());
+    TEST_ASSERT_TRUE(db.findView(keyAt(0, CARDS - 1)).found);
+    TEST_ASSERT_FALSE(db.findView(keyAt(1, CARDS - 1)).found);
+}
+
+// Пакет не помещается на LittleFS рядом с живой базой: отказ до первого байта,
+// с размерами в ошибке; места хватает — та же загрузка проходит
+void test_no_space() {
+    makeFiles(0, "");
+    LittleFS.remove(CARDJOURNAL_PATH);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    std::vector<uint8_t> bundle = makeBundle(1);
+    size_t used = LittleFS.usedBytes();
+
+    setenv("LITTLEFS_BYTES", std::to_string(used + bundle.size()).c_str(), 1);
+    LittleFS.begin();
+    CardUpload up(db);
+    TEST_ASSERT_FALSE(up.begin(bundle.size()));
+    TEST_ASSERT_TRUE(up.noSpace());
+    TEST_ASSERT_EQUAL(CardUploadState::FAILED, up.state());
+    printf("[upload] refused: %s\n", up.error());
+    TEST_ASSERT_NOT_NULL(strstr(up.error(), "not enough LittleFS space"));
+    TEST_ASSERT_FALSE(shadowsLeft());
+    TEST_ASSERT_TRUE(db.findView(keyAt(0, CARDS - 1)).found);
+
+    setenv("LITTLEFS_BYTES", std::to_string(used + bundle.size() + 2 * CARD_UPLOAD_FS_RESERVE).c_str(), 1);
+    LittleFS.begin();
+    TEST_ASSERT_TRUE(up.begin(bundle.size()));
+    TEST_ASSERT_FALSE(up.noSpace());
+    send(up, bundle, bundle.size());
+    TEST_ASSERT_EQUAL(CardUploadState::DONE, wait(up));
+    TEST_ASSERT_TRUE(db.findView(keyAt(1, CARDS - 1)).found);
+
+    unsetenv("LITTLEFS_BYTES");
+    LittleFS.begin();
+}
+
+// Любая ошибка оставляет живую базу и основные файлы как были
+static void checkRejected(std::vector<uint8_t> bundle, size_t upTo, const char* error) {
+    makeFiles(0, "");
+    LittleFS.remove(CARDJOURNAL_PATH);
+    CardDatabase db;
+    TEST_ASSERT_TRUE(db.begin());
+    std::vector<uint8_t> before = readFile("/cards56.bin");
+
+    CardUpload up(db);
+    TEST_ASSERT_TRUE(up.begin(bundle.size()));
+    send(up, bundle, upTo);
+    if (upTo < bundle.size()) up.abort();
+    TEST_ASSERT_EQUAL(CardUploadState::FAILED, wait(up));
+    TEST_ASSERT_EQUAL_STRING(error, up.error());
+
+    TEST_ASSERT_FALSE(shadowsLeft());
+    TEST_ASSERT_TRUE(readFile("/cards56.bin") == before);
+    TEST_ASSERT_TRUE(db.findView(keyAt(0, CARDS - 1)).found);
+    TEST_ASSERT_FALSE(db.findView(keyAt(1, CARDS - 1)).found);
+    // После отказа можно загружать снова
+    TEST_ASSERT_TRUE(up.begin(bundle.size()));
+    up.abort();
+    wait(up);
+}
+
+void test_bad_crc() {
+    std::vector<uint8_t> b = makeBundle(1);
+    b[b.size() / 2] ^= 0x01;
+    checkRejected(b, b.size(), "CRC mismatch");
+}
+
+void test_not_a_bundle() {
+    std::vector<uint8_t> b = makeBundle(1);
+    b[0] = 'X';
+    checkRejected(b, b.size(), "not a DB bundle");
+}
+
+void test_client_gone() {
+    std::vector<uint8_t> b = makeBundle(1);
+    checkRejected(b, b.size() / 3, "client disconnected");
+}
+
+int main(int argc, char** argv) {
+    char dir[] = "/tmp/kcdb_upload_XXXXXX";
+    char partDir[] = "/tmp/kcdb_upload_part_XXXXXX";
+    if (!mkdtemp(dir) || !mkdtemp(partDir)) return 1;
+    setenv("LITTLEFS_ROOT", dir, 1);
+    setenv("PARTITION_ROOT", partDir, 1);
+    LittleFS.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_swap_binary);
+    RUN_TEST(test_swap_eytzinger);
+    RUN_TEST(test_swap_flash_mapped);
+    RUN_TEST(test_stale_image_rebuilt);
+    RUN_TEST(test_reload_races_compaction);
+    RUN_TEST(test_reload_rebuilds_filter);
+    RUN_TEST(test_reload_rejects_unread_table);
+    RUN_TEST(test_reload_rename_rollback);
+    RUN_TEST(test_interrupted_swap_restored);
+    RUN_TEST(test_no_space);
+    RUN_TEST(test_bad_crc);
+    RUN_TEST(test_not_a_bundle);
+    RUN_TEST(test_client_gone);
+    return UNITY_END();
+}
@@ -0,0 +1,136 @@
+// Загрузчик файлов карт: формат KCDB v1 и конвертация старого формата.
+
+#include <unity.h>
+#include <stdlib.h>
+#include <vector>
+#include "cardfile.h"
+
+static void writeFile(const char* path, const std::vector<uint8_t>& data) {
+    File f = LittleFS.open(path, "w");
+    f.write(data.data(), data.size());
+    f.close();
+}
+
+static std::vector<uint8_t> makeV1_56(const std::vector<CardRecord56>& recs, uint8_t sortOrder) {
+    CardFileHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = CARDFILE_MAGIC;
+    h.version = CARDFILE_VERSION;
+    h.headerSize = sizeof(h);
+    h.count = recs.size();
+    h.keyBits = 56;
+    h.sortOrder = sortOrder;
+    h.stride = sizeof(CardRecord56);
+    h.crc32 = cardCrc32((const uint8_t*)recs.data(), recs.size() * sizeof(CardRecord56));
+
+    std::vector<uint8_t> out((uint8_t*)&h, (uint8_t*)&h + sizeof(h));
+    out.insert(out.end(), (const uint8_t*)recs.data(), (const uint8_t*)(recs.data() + recs.size()));
+    return out;
+}
+
+static CardRecord56 rec56(uint64_t key, uint16_t flags) {
+    CardRecord56 r;
+    r.keyLo = (uint32_t)key;
+    r.keyHi = (uint32_t)(key >> 32);
+    r.flags = flags;
+    r.reserved = 0;
+    return r;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_crc32_reference() {
+    // Контрольное значение CRC-32/ISO-HDLC
+    TEST_ASSERT_EQUAL_UINT32(0xCBF43926, cardCrc32((const uint8_t*)"123456789", 9));
+}
+
+void test_legacy34_converted() {
+    // [тег][UID BE][флаги BE], записи намеренно не отсортированы
+    writeFile("/c34.bin", {
+        0x01, 0x00, 0x00, 0x00, 0x05, 0xC0, 0x02,
+        0x01, 0x00, 0x00, 0x00, 0x01, 0x40, 0x07,
+    });
+    CardRecord34* recs = nullptr;
+    uint32_t n = 0;
+    bool legacy = false;
+    TEST_ASSERT_TRUE(loadCardFile34("/c34.bin", recs, n, legacy));
+    TEST_ASSERT_TRUE(legacy);
+    TEST_ASSERT_EQUAL(2, n);
+    TEST_ASSERT_EQUAL_UINT32(1, recs[0].key);
+    TEST_ASSERT_EQUAL(0x4007, recs[0].flags);
+    TEST_ASSERT_EQUAL_UINT32(5, recs[1].key);
+    TEST_ASSERT_EQUAL(0xC002, recs[1].flags);
+    heap_caps_free(recs);
+}
+
+void test_legacy_bad_size_rejected() {
+    writeFile("/c34.bin", { 0x01, 0x00, 0x00, 0x00, 0x05, 0xC0 });
+    CardRecord34* recs = nullptr;
+    uint32_t n = 0;
+    bool legacy = false;
+    TEST_ASSERT_FALSE(loadCardFile34("/c34.bin", recs, n, legacy));
+    TEST_ASSERT_NULL(recs);
+}
+
+void test_v1_56_loaded() {
+    writeFile("/c56.bin", makeV1_56({ rec56(0x01000000012345ULL, 0xC001), rec56(0x04000000000001ULL, 0x0005) }, CARD_SORT_ASC));
+    CardRecord56* recs = nullptr;
+    uint32_t n = 0;
+    bool legacy = true;
+    TEST_ASSERT_TRUE(loadCardFile56("/c56.bin", recs, n, legacy));
+    TEST_ASSERT_FALSE(legacy);
+    TEST_ASSERT_EQUAL(2, n);
+    TEST_ASSERT_EQUAL_UINT64(0x01000000012345ULL, recs[0].key());
+    TEST_ASSERT_EQUAL(0x0005, recs[1].flags);
+    heap_caps_free(recs);
+}
+
+void test_v1_unsorted_gets_sorted() {
+    writeFile("/c56.bin", makeV1_56({ rec56(9, 1), rec56(3, 2), rec56(5, 3) }, CARD_SORT_NONE));
+    CardRecord56* recs = nullptr;
+    uint32_t n = 0;
+    bool legacy = false;
+    TEST_ASSERT_TRUE(loadCardFile56("/c56.bin", recs, n, legacy));
+    TEST_ASSERT_EQUAL_UINT64(3, recs[0].key());
+    TEST_ASSERT_EQUAL_UINT64(5, recs[1].key());
+    TEST_ASSERT_EQUAL_UINT64(9, recs[2].key());
+    heap_caps_free(recs);
+}
+
+void test_v1_crc_mismatch_rejected() {
+    std::vector<uint8_t> img = makeV1_56({ rec56(1, 1), rec56(2, 2) }, CARD_SORT_ASC);
+    img.back() ^= 0xFF;
+    writeFile("/c56.bin", img);
+    CardRecord56* recs = nullptr;
+    uint32_t n = 0;
+    bool legacy = false;
+    TEST_ASSERT_FALSE(loadCardFile56("/c56.bin", recs, n, legacy));
+    TEST_ASSERT_NULL(recs);
+}
+
+void test_v1_wrong_key_width_rejected() {
+    // 56-битный файл не должен загрузиться как 34-битный
+    writeFile("/c34.bin", makeV1_56({ rec56(1, 1) }, CARD_SORT_ASC));
+    CardRecord34* recs = nullptr;
+    uint32_t n = 0;
+    bool legacy = false;
+    TEST_ASSERT_FALSE(loadCardFile34("/c34.bin", recs, n, legacy));
+}
+
+int main(int argc, char** argv) {
+    char dir[] = "/tmp/kcdb_test_XXXXXX";
+    if (!mkdtemp(dir)) return 1;
+    setenv("LITTLEFS_ROOT", dir, 1);
+    LittleFS.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_crc32_reference);
+    RUN_TEST(test_legacy34_converted);
+    RUN_TEST(test_legacy_bad_size_rejected);
+    RUN_TEST(test_v1_56_loaded);
+    RUN_TEST(test_v1_unsorted_gets_sorted);
+    RUN_TEST(test_v1_crc_mismatch_rejected);
+    RUN_TEST(test_v1_wrong_key_width_rejected);
+    return UNITY_END();
+}
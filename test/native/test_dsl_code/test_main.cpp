@@ -0,0 +1,126 @@
+// Компилятор сценариев DSL в байткод.
+
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "dslcode.h"
+
+static std::vector<uint8_t> compile(const char* text) {
+    std::vector<uint8_t> out;
+    compileDSL(text, strlen(text), out);
+    return out;
+}
+
+// [op][маска OUTPUT_MASK_BYTES LE]
+static void pushMask(std::vector<uint8_t>& v, uint8_t op, OutputMask m) {
+    v.push_back(op);
+    for (int b = 0; b < OUTPUT_MASK_BYTES; b++) v.push_back((uint8_t)(m >> (8 * b)));
+}
+
+static const OutputMask ALL_PINS = (OutputMask)~(OutputMask)0;
+
+void setUp() {}
+void tearDown() {}
+
+void test_open_sleep_close() {
+    std::vector<uint8_t> c = compile("OPEN 1 3; SLEEP 1500; close all");
+    std::vector<uint8_t> expect;
+    pushMask(expect, OP_OPEN, 0x05);
+    expect.insert(expect.end(), {OP_SLEEP, 0xDC, 0x05, 0, 0});
+    pushMask(expect, OP_CLOSE, ALL_PINS);
+    expect.push_back(OP_END);
+    TEST_ASSERT_EQUAL(expect.size(), c.size());
+    TEST_ASSERT_EQUAL_MEMORY(expect.data(), c.data(), c.size());
+}
+
+void test_pins_and_unknown_commands() {
+    // Пины вне 1..OUTPUT_MAX_PINS игнорируются, ALL перекрывает остальные, неизвестная команда пропускается
+    std::vector<uint8_t> c = compile("  open 16 0 99 x ;BEEP 3;; CLOSE 2 ALL 5 ");
+    std::vector<uint8_t> expect;
+    pushMask(expect, OP_OPEN, 0x8000);
+    pushMask(expect, OP_CLOSE, ALL_PINS);
+    expect.push_back(OP_END);
+    TEST_ASSERT_EQUAL(expect.size(), c.size());
+    TEST_ASSERT_EQUAL_MEMORY(expect.data(), c.data(), c.size());
+}
+
+void test_pin_ranges() {
+    // Диапазоны для больших панелей; выходящий за ширину маски конец обрезается
+    std::vector<uint8_t> c = compile("OPEN 1-4 9; CLOSE 30-200; OPEN 5-3");
+    std::vector<uint8_t> expect;
+    pushMask(expect, OP_OPEN, 0x10F);
+    OutputMask high = 0;
+    for (int pin = 30; pin <= OUTPUT_MAX_PINS; pin++) high |= (OutputMask)1 << (pin - 1);
+    pushMask(expect, OP_CLOSE, high);
+    pushMask(expect, OP_OPEN, 0);
+    expect.push_back(OP_END);
+    TEST_ASSERT_EQUAL(expect.size(), c.size());
+    TEST_ASSERT_EQUAL_MEMORY(expect.data(), c.data(), c.size());
+    TEST_ASSERT_TRUE(dslReadMask(c.data() + 1 + DSL_MASK_CMD_SIZE) == high);
+}
+
+void test_pulse_and_blink() {
+    // Числа в конце — время (и для BLINK число миганий), всё перед ними — пины
+    std::vector<uint8_t> c = compile("PULSE 1 2 500; BLINK 3-4 200 300 5; PULSE 700; BLINK 1 100");
+    std::vector<uint8_t> expect;
+    pushMask(expect, OP_PULSE, 0x03);
+    expect.insert(expect.end(), {0xF4, 0x01, 0, 0});
+    pushMask(expect, OP_BLINK, 0x0C);
+    expect.insert(expect.end(), {200, 0, 0, 0, 0x2C, 0x01, 0, 0, 5, 0});
+    expect.push_back(OP_END);
+    TEST_ASSERT_EQUAL(expect.size(), c.size());
+    TEST_ASSERT_EQUAL_MEMORY(expect.data(), c.data(), c.size());
+    const uint8_t* blink = c.data() + DSL_PULSE_CMD_SIZE;
+    TEST_ASSERT_EQUAL(300, dslReadDuration(blink + DSL_MASK_CMD_SIZE + 4));
+    TEST_ASSERT_EQUAL(5, dslReadCount(blink + DSL_MASK_CMD_SIZE + 8));
+    TEST_ASSERT_EQUAL(OP_END, blink[DSL_BLINK_CMD_SIZE]);
+}
+
+void test_empty_script() {
+    std::vector<uint8_t> out;
+    TEST_ASSERT_EQUAL(0, compileDSL("  ;; ", 5, out));
+    TEST_ASSERT_EQUAL(1, out.size());
+    TEST_ASSERT_EQUAL(OP_END, out[0]);
+}
+
+void test_load_actions_file() {
+    // [длина][текст] x3, вторая запись пустая
+    const char* a = "OPEN 1";
+    const char* b = "SLEEP 10;CLOSE 1";
+    std::vector<uint8_t> file;
+    file.push_back(strlen(a)); file.insert(file.end(), a, a + strlen(a));
+    file.push_back(0);
+    file.push_back(strlen(b)); file.insert(file.end(), b, b + strlen(b));
+    File f = LittleFS.open("/actions.bin", "w");
+    f.write(file.data(), file.size());
+    f.close();
+
+    DSLProgram p;
+    TEST_ASSERT_TRUE(p.load("/actions.bin"));
+    TEST_ASSERT_EQUAL(3, p.count());
+    TEST_ASSERT_EQUAL(OP_OPEN, p.action(0)[0]);
+    TEST_ASSERT_EQUAL(1, dslReadMask(p.action(0) + 1));
+    TEST_ASSERT_EQUAL(OP_END, p.action(1)[0]);
+    TEST_ASSERT_EQUAL(OP_SLEEP, p.action(2)[0]);
+    TEST_ASSERT_EQUAL(10, dslReadDuration(p.action(2) + 1));
+    TEST_ASSERT_EQUAL(OP_CLOSE, p.action(2)[5]);
+    TEST_ASSERT_TRUE(dslReadMask(p.action(2) + 6) == 1);
+    TEST_ASSERT_NULL(p.action(3));
+}
+
+int main(int argc, char** argv) {
+    char dir[] = "/tmp/dsl_test_XXXXXX";
+    if (!mkdtemp(dir)) return 1;
+    setenv("LITTLEFS_ROOT", dir, 1);
+    LittleFS.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_open_sleep_close);
+    RUN_TEST(test_pins_and_unknown_commands);
+    RUN_TEST(test_pin_ranges);
+    RUN_TEST(test_pulse_and_blink);
+    RUN_TEST(test_empty_script);
+    RUN_TEST(test_load_actions_file);
+    return UNITY_END();
+}
@@ -0,0 +1,598 @@
+// Пошаговый разбор HTTP и неблокирующий сервер: разбор по кускам, ошибки,
+// и нагрузочный тест — насколько handle() задерживает loop() при нескольких
+// медленных клиентах, против старого побайтового чтения с ожиданием.
+
+#include <unity.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "httpserver.h"
+#include "cardbatch.h"
+
+// ---------- Замена сокета W5500: байты приходят и уходят со скоростью по часам ----------
+
+struct Conn {
+    std::string rx;              // Запрос клиента целиком
+    size_t rxPos = 0;            // Сколько прочитал сервер
+    uint32_t start = micros();
+    uint32_t usPerByte = 0;      // 0 — весь запрос уже пришёл
+    std::string tx;              // Что получил клиент
+    int txCap = 2048;            // Буфер передачи сокета W5500 (16 КБ на 8 сокетов)
+    int txQueued = 0;            // Отправлено, но не подтверждено клиентом
+    uint32_t writes = 0;         // Записей в сокет (транзакций SPI к W5500)
+    uint32_t txBytesPerMs = 200; // Скорость, с которой клиент забирает ответ
+    uint32_t lastDrain = micros();
+    bool open = true;
+    bool closedByServer = false;
+
+    size_t arrived() const {
+        if (!usPerByte) return rx.size();
+        return std::min(rx.size(), (size_t)((micros() - start) / usPerByte));
+    }
+    void drain() {
+        uint32_t now = micros();
+        uint32_t n = (uint64_t)(now - lastDrain) * txBytesPerMs / 1000;
+        if (n) {
+            txQueued = std::max(0, txQueued - (int)n);
+            lastDrain = now;
+        }
+    }
+};
+
+class FakeClient {
+public:
+    FakeClient() {}
+    explicit FakeClient(std::shared_ptr<Conn> c) : _c(c) {}
+    explicit operator bool() const { return (bool)_c; }
+
+    int available() { return _c ? (int)(_c->arrived() - _c->rxPos) : 0; }
+    int read() { return available() > 0 ? (uint8_t)_c->rx[_c->rxPos++] : -1; }
+    int read(uint8_t* buf, size_t n) {
+        n = std::min(n, (size_t)available());
+        memcpy(buf, _c->rx.data() + _c->rxPos, n);
+        _c->rxPos += n;
+        return (int)n;
+    }
+    int availableForWrite() {
+        if (!_c) return 0;
+        _c->drain();
+        return _c->txCap - _c->txQueued;
+    }
+    size_t write(const uint8_t* p, size_t n) {
+        n = std::min(n, (size_t)availableForWrite());
+        _c->tx.append((const char*)p, n);
+        _c->txQueued += n;
+        _c->writes++;
+        return n;
+    }
+    uint8_t connected() { return _c && (_c->open || available() > 0); }
+    void setConnectionTimeout(uint16_t) {}
+    void stop() {
+        if (_c) _c->closedByServer = true;
+        _c.reset();
+    }
+
+private:
+    std::shared_ptr<Conn> _c;
+};
+
+class FakeServer {
+public:
+    std::deque<std::shared_ptr<Conn>> incoming;
+    FakeClient accept() {
+        if (incoming.empty()) return FakeClient();
+        std::shared_ptr<Conn> c = incoming.front();
+        incoming.pop_front();
+        return FakeClient(c);
+    }
+};
+
+static std::string bigPage(4096, 'x');
+
+static const char* INDEX_ETAG = "\"0badf00d\"";
+static const char* INDEX_HEADERS = "Content-Encoding: gzip\r\nCache-Control: no-cache\r\nETag: \"0badf00d\"\r\n";
+
+static CardDatabase db;
+
+// Как WebHandler::apiCard; JSON — snprintf вместо ArduinoJson, но так же прямо в буфер слота
+static void apiCard(const HttpRequestParser& req, HttpResponse& res) {
+    uint64_t uid = strtoull(req.path() + 10, nullptr, 16);
+    CardView v = db.findView(uid);
+    int n = snprintf(res.bodyBuffer(), HttpResponse::bodyCapacity(),
+                     "{\"uid\":\"%llx\",\"found\":%s,\"status\":%u,\"group\":%u,\"limit\":%u,\"instructions\":[",
+                     (unsigned long long)uid, v.found ? "true" : "false", v.status, v.group_id, v.limit);
+    for (const Instruction& ins : v.instructions) {
+        n += snprintf(res.bodyBuffer() + n, HttpResponse::bodyCapacity() - n,
+                      "%s{\"action\":%u,\"priority\":%u,\"schedule\":%u}", &ins == v.instructions.begin() ? "" : ",",
+                      ins.action, ins.priority, ins.schedule);
+    }
+    n += snprintf(res.bodyBuffer() + n, HttpResponse::bodyCapacity() - n, "]}");
+    res.sendBuffer(v.found ? 200 : 404, "application/json", n);
+}
+
+// Как JSON из WebHandler::sendJson больше буфера слота: каждая часть генерируется заново
+// с начала тела, в буфер идёт только окно [offset, offset + cap)
+static std::string streamBody(10000, 'j');
+static uint32_t streamReleased = 0;
+static size_t fillStream(void* ctx, size_t offset, uint8_t* buf, size_t cap) {
+    const std::string& body = *(const std::string*)ctx;
+    size_t n = std::min(cap, body.size() - offset);
+    memcpy(buf, body.data() + offset, n);
+    return n;
+}
+static void releaseStream(void*) { streamReleased++; }
+
+struct TestHandler {
+    uint32_t routed = 0;
+    std::map<const HttpRequestParser*, std::string> streams;   // Тела, которые идут потоком
+    std::string streamed;         // Последнее тело, принятое целиком
+    size_t sinkRoom = SIZE_MAX;   // Сколько приёмник берёт за вызов (как очередь CardUpload)
+    uint32_t aborted = 0;
+    std::map<const HttpRequestParser*, CardBatchStream> batches;   // Как WebHandler::_batch
+
+    // Как WebHandler::bodyBegin: большое тело — только на /upload и /api/cards/batch и только с паролем
+    bool bodyBegin(const HttpRequestParser& req, HttpResponse& res) {
+        if (strcmp(req.authorization(), "Basic YWRtaW46YWRtaW4=") != 0) {
+            res.sendStatus(401);
+            return false;
+        }
+        if (!strcmp(req.path(), "/api/cards/batch")) {
+            return req.contentLength() % 8 == 0 && batches[&req].begin(db, req.contentLength() / 8);
+        }
+        return !strcmp(req.path(), "/upload");
+    }
+    size_t bodyWrite(const HttpRequestParser& req, const uint8_t* data, size_t len) {
+        auto b = batches.find(&req);
+        if (b != batches.end()) return b->second.write(data, len);
+        len = std::min(len, sinkRoom);
+        streams[&req].append((const char*)data, len);
+        return len;
+    }
+    void bodyAbort(const HttpRequestParser& req) {
+        streams.erase(&req);
+        batches.erase(&req);
+        aborted++;
+    }
+
+    void route(const HttpRequestParser& req, HttpResponse& res) {
+        routed++;
+        if (!strncmp(req.path(), "/api/card/", 10)) return apiCard(req, res);
+        if (!strcmp(req.path(), "/api/stream")) {
+            res.sendStream(200, "application/json", streamBody.size(), fillStream, &streamBody, releaseStream);
+            return;
+        }
+        // Как WebHandler::apiCardBatch для потока: ответ в PSRAM уходит вместе с буфером
+        if (batches.count(&req)) {
+            uint32_t found = 0, n = batches[&req].count();
+            uint8_t* out = batches[&req].finish(found);
+            batches.erase(&req);
+            char extra[48];
+            snprintf(extra, sizeof(extra), "X-Cards-Found: %u\r\n", (unsigned)found);
+            res.sendOwned(200, "application/octet-stream", out, n * sizeof(CardMembership), extra);
+            return;
+        }
+        if (!strcmp(req.path(), "/upload")) {
+            streamed = streams[&req];
+            streams.erase(&req);
+            res.send(200, "text/plain", String(std::to_string(streamed.size())));
+            return;
+        }
+        // Как WebHandler::sendIndex
+        if (!strcmp(req.path(), "/index.html.gz")) {
+            if (!strcmp(req.ifNoneMatch(), INDEX_ETAG)) {
+                res.sendStatic(304, "text/html", "", 0, INDEX_HEADERS);
+            } else {
+                res.sendFile(200, "text/html", LittleFS.open("/index.html.gz", "r"), INDEX_HEADERS);
+            }
+        } else if (strcmp(req.authorization(), "Basic YWRtaW46YWRtaW4=") != 0) {
+            res.sendStatus(401, "WWW-Authenticate: Basic realm=\"A16\"\r\n");
+        } else if (req.method() == HTTP_POST) {
+            res.send(200, "text/plain", String(std::to_string(req.bodyLength())));
+        } else {
+            res.sendStatic(200, "text/html", bigPage.data(), bigPage.size());
+        }
+    }
+};
+
+typedef HttpServerT<FakeServer, FakeClient, TestHandler> TestServer;
+
+static const char* GET_REQ =
+    "GET /index.html?x=1 HTTP/1.1\r\nHost: 10.0.0.1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "authorization: Basic YWRtaW46YWRtaW4=\r\n\r\n";
+
+static std::string postReq(size_t bodyLen, const char* path = "/") {
+    std::string body(bodyLen, 'a');
+    for (size_t i = 0; i < bodyLen; i++) body[i] = 'a' + i % 23;
+    return std::string("POST ") + path + " HTTP/1.1\r\nAuthorization: Basic YWRtaW46YWRtaW4=\r\nContent-Length: " +
+           std::to_string(bodyLen) + "\r\n\r\n" + body;
+}
+
+static std::shared_ptr<Conn> conn(const std::string& req, uint32_t usPerByte = 0) {
+    std::shared_ptr<Conn> c = std::make_shared<Conn>();
+    c->rx = req;
+    c->usPerByte = usPerByte;
+    return c;
+}
+
+static HttpRequestParser parser;
+
+static void parseAll(const std::string& s, size_t chunk) {
+    parser.reset();
+    for (size_t i = 0; i < s.size() && parser.state() < HTTP_DONE; i += chunk) {
+        parser.feed((const uint8_t*)s.data() + i, std::min(chunk, s.size() - i));
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_parse_any_split() {
+    std::string post = postReq(300);
+    // Любая нарезка даёт один и тот же результат
+    for (size_t chunk : {1, 2, 3, 7, 64, 1000}) {
+        parseAll(std::string("\r\n") + GET_REQ, chunk);
+        TEST_ASSERT_TRUE(parser.done());
+        TEST_ASSERT_EQUAL(HTTP_GET, parser.method());
+        TEST_ASSERT_EQUAL_STRING("/index.html", parser.path());
+        TEST_ASSERT_EQUAL_STRING("x=1", parser.query());
+        TEST_ASSERT_EQUAL_STRING("Basic YWRtaW46YWRtaW4=", parser.authorization());
+
+        parseAll(post, chunk);
+        TEST_ASSERT_TRUE(parser.done());
+        TEST_ASSERT_EQUAL(HTTP_POST, parser.method());
+        TEST_ASSERT_EQUAL(300, parser.bodyLength());
+        TEST_ASSERT_EQUAL(300, strlen(parser.body()));
+    }
+}
+
+void test_parse_methods() {
+    parseAll("DELETE /api/cards/2a HTTP/1.1\r\n\r\n", 7);
+    TEST_ASSERT_TRUE(parser.done());
+    TEST_ASSERT_EQUAL(HTTP_DELETE, parser.method());
+    TEST_ASSERT_EQUAL_STRING("/api/cards/2a", parser.path());
+
+    parseAll("PUT / HTTP/1.1\r\n\r\n", 100);
+    TEST_ASSERT_TRUE(parser.done());
+    TEST_ASSERT_EQUAL(HTTP_UNKNOWN, parser.method());
+}
+
+void test_parse_errors() {
+    parseAll(postReq(HTTP_MAX_BODY + 1), 100);
+    TEST_ASSERT_EQUAL(413, parser.error());
+
+    parseAll("GET /" + std::string(HTTP_MAX_PATH, 'p') + " HTTP/1.1\r\n\r\n", 100);
+    TEST_ASSERT_EQUAL(414, parser.error());
+
+    parseAll("GET / HTTP/1.1\r\nAuthorization: Basic " + std::string(200, 'A') + "\r\n\r\n", 100);
+    TEST_ASSERT_EQUAL(431, parser.error());
+
+    parseAll("GET / HTTP/1.1\r\nContent-Length: 12x\r\n\r\n", 100);
+    TEST_ASSERT_EQUAL(400, parser.error());
+
+    parseAll("HELLO\r\n\r\n", 100);
+    TEST_ASSERT_EQUAL(400, parser.error());
+
+    // Длинный ненужный заголовок обрезается, но запрос принимается
+    parseAll("GET / HTTP/1.1\r\nCookie: " + std::string(2000, 'c') + "\r\n\r\n", 100);
+    TEST_ASSERT_TRUE(parser.done());
+}
+
+// Запускает loop() с сервером, пока все соединения не закрыты; возвращает длительности шагов
+static std::vector<uint32_t> runLoop(TestServer& http, FakeServer& srv, const std::vector<std::shared_ptr<Conn>>& conns,
+                                     uint32_t limitMs) {
+    std::vector<uint32_t> steps;
+    uint32_t t0 = millis();
+    while (millis() - t0 < limitMs) {
+        uint32_t a = micros();
+        http.handle();
+        steps.push_back(micros() - a);
+        bool all = srv.incoming.empty() && std::all_of(conns.begin(), conns.end(),
+                                                       [](const std::shared_ptr<Conn>& c) { return c->closedByServer; });
+        if (all) break;
+        delayMicroseconds(200);   // Остальная работа loop(): выходы, DSL
+    }
+    return steps;
+}
+
+static bool responseIs(const std::shared_ptr<Conn>& c, const char* status, size_t bodyLen) {
+    size_t hdrEnd = c->tx.find("\r\n\r\n");
+    return c->tx.compare(0, strlen(status), status) == 0 && hdrEnd != std::string::npos &&
+           c->tx.size() - hdrEnd - 4 == bodyLen;
+}
+
+void test_single_request() {
+    TestHandler h;
+    TestServer http(h);
+    FakeServer srv;
+    http.begin(&srv);
+    std::shared_ptr<Conn> c = conn(GET_REQ);
+    srv.incoming.push_back(c);
+    runLoop(http, srv, {c}, 1000);
+    TEST_ASSERT_TRUE(c->closedByServer);
+    TEST_ASSERT_TRUE(responseIs(c, "HTTP/1.1 200 OK", bigPage.size()));
+}
+
+void test_concurrent_clients_jitter() {
+    TestHandler h;
+    TestServer http(h);
+    FakeServer srv;
+    http.begin(&srv);
+
+    std::string get = GET_REQ;
+    std::vector<std::shared_ptr<Conn>> conns = {
+        conn(get, 1000),            // Запрос по байту в миллисекунду
+        conn(get),                  // Быстрый запрос, медленное чтение ответа
+        conn(postReq(800), 200),
+        conn("GET / HTTP/1.1\r\nHost: x\r\n", 10000),   // Так и не дошлёт запрос
+        conn(get),                  // Пятому слота нет
+    };
+    conns[1]->txBytesPerMs = 20;
+    for (auto& c : conns) srv.incoming.push_back(c);
+
+    std::vector<uint32_t> steps = runLoop(http, srv, conns, HTTP_REQUEST_TIMEOUT_MS + 1500);
+    std::sort(steps.begin(), steps.end());
+    uint32_t p99 = steps[steps.size() * 99 / 100];
+    uint32_t worst = steps.back();
+    printf("  http: %zu loop steps, handle() p99 %u us, max %u us\n", steps.size(), (unsigned)p99, (unsigned)worst);
+
+    TEST_ASSERT_TRUE(responseIs(conns[0], "HTTP/1.1 200 OK", bigPage.size()));
+    TEST_ASSERT_TRUE(responseIs(conns[1], "HTTP/1.1 200 OK", bigPage.size()));
+    TEST_ASSERT_TRUE(responseIs(conns[2], "HTTP/1.1 200 OK", 3));
+    TEST_ASSERT_EQUAL(0, conns[3]->tx.compare(0, 12, "HTTP/1.1 408"));
+    TEST_ASSERT_EQUAL(0, conns[4]->tx.compare(0, 12, "HTTP/1.1 503"));
+    TEST_ASSERT_EQUAL(1, http.stats().timeouts);
+    TEST_ASSERT_EQUAL(1, http.stats().rejected);
+    TEST_ASSERT_EQUAL(3, h.routed);
+    // Шаг сервера не ждёт сеть: даже на хосте под нагрузкой — доли миллисекунды
+    TEST_ASSERT_TRUE(worst < 5000);
+}
+
+// Тело из генератора проходит через буфер слота частями и совпадает с исходным;
+// контекст генератора освобождается ровно один раз — и после отправки, и при обрыве
+void test_streamed_response() {
+    for (size_t i = 0; i < streamBody.size(); i++) streamBody[i] = 'a' + i % 26;
+    streamReleased = 0;
+    TestHandler h;
+    TestServer http(h);
+    FakeServer srv;
+    http.begin(&srv);
+    std::shared_ptr<Conn> c = conn("GET /api/stream HTTP/1.1\r\n\r\n");
+    srv.incoming.push_back(c);
+    runLoop(http, srv, {c}, 2000);
+    TEST_ASSERT_TRUE(c->closedByServer);
+    TEST_ASSERT_TRUE(responseIs(c, "HTTP/1.1 200 OK", streamBody.size()));
+    TEST_ASSERT_TRUE(c->tx.compare(c->tx.size() - streamBody.size(), streamBody.size(), streamBody) == 0);
+    TEST_ASSERT_EQUAL(1, streamReleased);
+
+    HttpResponse res;
+    res.sendStream(200, "application/json", streamBody.size(), fillStream, &streamBody, releaseStream);
+    size_t len = 0;
+    res.next(len);      // Заголовок
+    res.consume(len);
+    res.next(len);      // Первая часть тела
+    TEST_ASSERT_EQUAL(HTTP_WRITE_CHUNK, len);
+    res.reset();        // Клиент ушёл посреди тела
+    TEST_ASSERT_EQUAL(2, streamReleased);
+    res.reset();
+    TEST_ASSERT_EQUAL(2, streamReleased);
+}
+
+static size_t fileSize(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    size_t n = ftell(f);
+    fclose(f);
+    return n;
+}
+
+void test_static_gzip_with_etag() {
+    // Готовый data/index.html.gz из web/index.html (tools/gzip_web.py)
+    size_t html = fileSize("web/index.html");
+    size_t gz = fileSize("data/index.html.gz");
+    TEST_ASSERT_TRUE(html > 0 && gz > 0 && gz < html);
+
+    TestHandler h;
+    TestServer http(h);
+    FakeServer srv;
+    http.begin(&srv);
+    std::string get = "GET /index.html.gz HTTP/1.1\r\nAuthorization: Basic YWRtaW46YWRtaW4=\r\n";
+    std::shared_ptr<Conn> full = conn(get + "\r\n");
+    std::shared_ptr<Conn> cached = conn(get + "If-None-Match: \"0badf00d\"\r\n\r\n");
+    full->txBytesPerMs = cached->txBytesPerMs = 1000;   // ~8 Мбит/с до браузера
+    srv.incoming.push_back(full);
+    srv.incoming.push_back(cached);
+    uint32_t t0 = micros();
+    std::vector<uint32_t> steps = runLoop(http, srv, {full, cached}, 2000);
+    uint32_t us = micros() - t0;
+
+    TEST_ASSERT_TRUE(responseIs(full, "HTTP/1.1 200 OK", gz));
+    TEST_ASSERT_TRUE(full->tx.find("Content-Encoding: gzip\r\n") != std::string::npos);
+    TEST_ASSERT_TRUE(full->tx.find("ETag: \"0badf00d\"\r\n") != std::string::npos);
+    TEST_ASSERT_EQUAL(0x1f, (uint8_t)full->tx[full->tx.find("\r\n\r\n") + 4]);
+    TEST_ASSERT_TRUE(responseIs(cached, "HTTP/1.1 304 Not Modified", 0));
+    // Заголовок и тело — кусками до сегмента, а не по строке на запись
+    TEST_ASSERT_TRUE(full->writes <= 1 + (gz + HTTP_WRITE_CHUNK - 1) / HTTP_WRITE_CHUNK);
+    printf("  index: html %zu B -> gzip %zu B; 200: %zu B in %u writes, 304: %zu B; %zu steps, %u us\n",
+           html, gz, full->tx.size(), (unsigned)full->writes, cached->tx.size(), steps.size(), (unsigned)us);
+}
+
+void test_api_request_rate() {
+    // Сервер СКУД опрашивает карты: 4 соединения одновременно, каждое — один запрос
+    TEST_ASSERT_TRUE(db.begin(CardIndexLayout::EYTZINGER, CardStorage::PSRAM, 0));
+    File f = LittleFS.open("/cards56.bin", "r");
+    std::vector<uint64_t> uids;
+    uint8_t rec[9];
+    while (uids.size() < 1000 && f.read(rec, 9) == 9) {
+        uint64_t k = 0;
+        for (int i = 0; i < 7; i++) k = (k << 8) | rec[i];
+        uids.push_back(k);
+    }
+    f.close();
+    TEST_ASSERT_FALSE(uids.empty());
+
+    TestHandler h;
+    TestServer http(h);
+    FakeServer srv;
+    http.begin(&srv);
+    const size_t total = 20000;
+    std::vector<std::shared_ptr<Conn>> live;
+    size_t issued = 0, ok = 0, found = 0, bytes = 0;
+    uint32_t t0 = micros();
+    while (ok < total) {
+        while (live.size() < HTTP_MAX_CLIENTS && issued < total) {
+            char req[128];
+            // Каждый десятый uid неизвестен
+            uint64_t uid = (issued % 10 == 9) ? 0xdeadbeefULL + issued : uids[issued % uids.size()];
+            snprintf(req, sizeof(req), "GET /api/card/%llx HTTP/1.1\r\nAuthorization: Basic YWRtaW46YWRtaW4=\r\n\r\n",
+                     (unsigned long long)uid);
+            live.push_back(conn(req));
+            live.back()->txBytesPerMs = 1u << 30;   // Локальный клиент забирает ответ сразу
+            srv.incoming.push_back(live.back());
+            issued++;
+        }
+        http.handle();
+        for (size_t i = 0; i < live.size(); ) {
+            if (live[i]->closedByServer) {
+                ok++;
+                bytes += live[i]->tx.size();
+                if (!live[i]->tx.compare(0, 15, "HTTP/1.1 200 OK")) found++;
+                live[i] = live.back();
+                live.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+    double sec = (micros() - t0) / 1e6;
+    printf("  api: %zu card requests, %zu found, %.0f req/s, %.0f B/response, step max %u us\n",
+           ok, found, ok / sec, (double)bytes / ok, (unsigned)http.stats().maxStepUs);
+    TEST_ASSERT_EQUAL(total - total / 10, found);
+}
+
+// Тело больше HTTP_MAX_BODY идёт обработчику порциями, с обратным давлением от приёмника
+void test_streamed_body() {
+    // Разборщик с потоком останавливается сразу после заголовков
+    std::string big = postReq(300000, "/upload");
+    HttpRequestParser p;
+    p.setStreaming(true);
+    size_t used = p.feed((const uint8_t*)big.data(), 4096);
+    TEST_ASSERT_TRUE(p.streaming());
+    TEST_ASSERT_EQUAL(big.find("\r\n\r\n") + 4, used);
+
+    TestHandler h;
+    h.sinkRoom = 700;
+    TestServer http(h);
+    FakeServer srv;
+    http.begin(&srv);
+    std::vector<std::shared_ptr<Conn>> conns = {
+        conn(big),
+        conn(postReq(5000)),                                    // Большое тело туда, где его не ждут
+        conn("POST /upload HTTP/1.1\r\nContent-Length: 9000\r\n\r\n"),   // Без пароля
+        conn(postReq(100000, "/upload").substr(0, 20000)),      // Клиент ушёл на середине
+    };
+    conns[3]->open = false;
+    for (auto& c : conns) srv.incoming.push_back(c);
+
+    std::vector<uint32_t> steps = runLoop(http, srv, conns, 5000);
+    uint32_t worst = *std::max_element(steps.begin(), steps.end());
+    printf("  stream: %zu B in %zu loop steps, handle() max %u us\n", h.streamed.size(), steps.size(), (unsigned)worst);
+
+    TEST_ASSERT_TRUE(responseIs(conns[0], "HTTP/1.1 200 OK", 6));
+    TEST_ASSERT_EQUAL(0, conns[1]->tx.compare(0, 12, "HTTP/1.1 413"));
+    TEST_ASSERT_EQUAL(0, conns[2]->tx.compare(0, 12, "HTTP/1.1 401"));
+    TEST_ASSERT_TRUE(conns[3]->closedByServer);
+    TEST_ASSERT_EQUAL(1, h.aborted);
+    TEST_ASSERT_EQUAL(2, http.stats().streamed);
+    // Тело пришло байт в байт, от оборванного ничего не осталось
+    TEST_ASSERT_TRUE(h.streamed == big.substr(big.size() - 300000));
+    TEST_ASSERT_TRUE(h.streams.empty());
+    TEST_ASSERT_TRUE(worst < 5000);
+}
+
+void test_streamed_batch() {
+    // Ночная сверка одним запросом: 20000 UID (160 КБ) вместо 157 запросов по 128
+    std::vector<uint64_t> uids;
+    File f = LittleFS.open("/cards56.bin", "r");
+    uint8_t rec[9];
+    while (uids.size() < 20000 && f.read(rec, 9) == 9) {
+        uint64_t k = 0;
+        for (int i = 0; i < 7; i++) k = (k << 8) | rec[i];
+        uids.push_back(uids.size() % 5 == 4 ? k + 1 : k);   // Каждый пятый — промах
+    }
+    f.close();
+    TEST_ASSERT_EQUAL(20000, uids.size());
+    std::vector<CardMembership> expect(uids.size());
+    uint32_t expectFound = db.findBatch(uids.data(), uids.size(), expect.data());
+
+    std::string body((const char*)uids.data(), uids.size() * sizeof(uint64_t));
+    std::string req = "POST /api/cards/batch HTTP/1.1\r\nAuthorization: Basic YWRtaW46YWRtaW4=\r\nContent-Length: " +
+                      std::to_string(body.size()) + "\r\n\r\n" + body;
+    TestHandler h;
+    TestServer http(h);
+    FakeServer srv;
+    http.begin(&srv);
+    std::vector<std::shared_ptr<Conn>> conns = {conn(req), conn(req.substr(0, 50000))};
+    conns[0]->txBytesPerMs = 1u << 30;
+    conns[1]->open = false;   // Оборвался — буфер ответа освобождается
+    for (auto& c : conns) srv.incoming.push_back(c);
+
+    std::vector<uint32_t> steps = runLoop(http, srv, conns, 5000);
+    uint32_t worst = *std::max_element(steps.begin(), steps.end());
+    printf("  batch: %zu UID in %zu loop steps, handle() max %u us\n", uids.size(), steps.size(), (unsigned)worst);
+
+    TEST_ASSERT_TRUE(responseIs(conns[0], "HTTP/1.1 200 OK", uids.size() * sizeof(CardMembership)));
+    char hdr[48];
+    snprintf(hdr, sizeof(hdr), "X-Cards-Found: %u\r\n", (unsigned)expectFound);
+    TEST_ASSERT_TRUE(conns[0]->tx.find(hdr) != std::string::npos);
+    std::string reply = conns[0]->tx.substr(conns[0]->tx.find("\r\n\r\n") + 4);
+    TEST_ASSERT_EQUAL_MEMORY(expect.data(), reply.data(), reply.size());
+    TEST_ASSERT_TRUE(h.batches.empty());
+    TEST_ASSERT_EQUAL(1, h.aborted);
+    TEST_ASSERT_TRUE(worst < 5000);
+}
+
+// Прежний WebHandler::processClient: побайтовое чтение в String с ожиданием до 2 с
+static uint32_t legacyProcess(FakeClient& client) {
+    uint32_t a = micros();
+    std::string header;
+    uint32_t timeout = millis();
+    while (client.connected() && (millis() - timeout < 2000)) {
+        if (client.available()) {
+            header += (char)client.read();
+            if (header.size() >= 4 && header.compare(header.size() - 4, 4, "\r\n\r\n") == 0) break;
+        }
+    }
+    return micros() - a;
+}
+
+void test_legacy_blocking_baseline() {
+    // Тот же медленный клиент, что и выше: loop() стоял всё время приёма запроса
+    std::shared_ptr<Conn> c = conn(GET_REQ, 1000);
+    FakeClient client(c);
+    uint32_t stall = legacyProcess(client);
+    printf("  legacy: one slow client stalls loop() for %u ms (%zu B request)\n", (unsigned)(stall / 1000), c->rx.size());
+    TEST_ASSERT_TRUE(stall / 1000 >= c->rx.size() - 5);
+}
+
+int main(int argc, char** argv) {
+    LittleFS.begin();   // Корень — data/ проекта
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_any_split);
+    RUN_TEST(test_parse_methods);
+    RUN_TEST(test_parse_errors);
+    RUN_TEST(test_single_request);
+    RUN_TEST(test_concurrent_clients_jitter);
+    RUN_TEST(test_static_gzip_with_etag);
+    RUN_TEST(test_streamed_response);
+    RUN_TEST(test_api_request_rate);
+    RUN_TEST(test_streamed_body);
+    RUN_TEST(test_streamed_batch);
+    RUN_TEST(test_legacy_blocking_baseline);
+    return UNITY_END();
+}
@@ -0,0 +1,155 @@
+// Теневой регистр банка выходов и стоимость обновления 16 против 64 выходов.
+
+#include <unity.h>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <vector>
+#include "outputbank.h"
+
+struct Sent {
+    uint8_t addr;
+    uint8_t value;
+};
+
+template <typename Mask>
+static void addExpanders(OutputBankT<Mask>& bank, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) bank.addExpander(0x20 + i);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_write_mask_semantics() {
+    OutputBankT<uint32_t> bank;
+    addExpanders(bank, 4);
+    bank.reset(0xFFFFFFFF);
+    // Сначала гасится clear, затем поднимается set: бит в обеих масках остаётся HIGH
+    bank.writeMask(0x1, 0x3);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFD, bank.value());
+    bank.writeMask(0, 0xFF00);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFF00FD, bank.value());
+}
+
+void test_flush_only_changed_bytes() {
+    OutputBankT<uint64_t> bank;
+    addExpanders(bank, 8);
+    bank.reset(~0ULL);
+    std::vector<Sent> sent;
+    auto sink = [&](uint8_t a, uint8_t v) { sent.push_back({a, v}); return true; };
+
+    // Поколение не менялось — шина не нужна
+    TEST_ASSERT_EQUAL(0, bank.flush(sink));
+
+    // Шаг DSL, задевший выходы 3 и 50: ровно две транзакции
+    bank.writeMask(0, (1ULL << 3) | (1ULL << 50));
+    TEST_ASSERT_EQUAL(2, bank.flush(sink));
+    TEST_ASSERT_EQUAL(2, sent.size());
+    TEST_ASSERT_EQUAL(0x20, sent[0].addr);
+    TEST_ASSERT_EQUAL_HEX8(0xF7, sent[0].value);
+    TEST_ASSERT_EQUAL(0x26, sent[1].addr);
+    TEST_ASSERT_EQUAL_HEX8(0xFB, sent[1].value);
+
+    // Изменение туда и обратно до отправки — поколение сдвинулось, но байты те же
+    sent.clear();
+    bank.writeMask(0, 1ULL << 10);
+    bank.writeMask(1ULL << 10, 0);
+    TEST_ASSERT_EQUAL(0, bank.flush(sink));
+    TEST_ASSERT_EQUAL(0, sent.size());
+}
+
+void test_unwired_outputs_ignored() {
+    // Всего два расширителя: CLOSE ALL не порождает записей на несуществующие адреса
+    OutputBankT<uint64_t> bank;
+    addExpanders(bank, 2);
+    bank.reset(~0ULL);
+    std::vector<Sent> sent;
+    bank.writeMask(0, ~0ULL);
+    TEST_ASSERT_EQUAL(2, bank.flush([&](uint8_t a, uint8_t v) { sent.push_back({a, v}); return true; }));
+    TEST_ASSERT_EQUAL(0x21, sent[1].addr);
+}
+
+void test_rejected_byte_is_retried() {
+    OutputBankT<uint16_t> bank;
+    addExpanders(bank, 2);
+    bank.reset(0xFFFF);
+    bank.writeMask(0, 0x0101);
+    int calls = 0;
+    TEST_ASSERT_EQUAL(1, bank.flush([&](uint8_t a, uint8_t) { calls++; return a == 0x20; }));
+    // Второй байт не приняли — следующий вызов отдаст только его
+    std::vector<Sent> sent;
+    TEST_ASSERT_EQUAL(1, bank.flush([&](uint8_t a, uint8_t v) { sent.push_back({a, v}); return true; }));
+    TEST_ASSERT_EQUAL(0x21, sent[0].addr);
+    TEST_ASSERT_EQUAL(0, bank.flush([&](uint8_t, uint8_t) { return true; }));
+}
+
+// Шаг DSL: одна команда на случайный набор выходов + отправка
+template <typename Mask>
+static void benchBank(const char* name, uint8_t expanders, uint32_t touched) {
+    OutputBankT<Mask> bank;
+    addExpanders(bank, expanders);
+    bank.reset((Mask)~(Mask)0);
+    std::mt19937_64 rng(0xA16);
+    const uint32_t N = 1000000;
+    std::vector<Mask> masks(1024);
+    for (auto& m : masks) {
+        m = 0;
+        for (uint32_t i = 0; i < touched; i++) m |= (Mask)1 << (rng() % (8 * expanders));
+    }
+    uint32_t bytes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < N; i++) {
+        Mask m = masks[i & 1023];
+        if (i & 1) bank.writeMask(m, 0);
+        else bank.writeMask(0, m);
+        bytes += bank.flush([](uint8_t, uint8_t) { return true; });
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / N;
+    printf("[bench] outputs %-3s: %u pins, %u touched/step: %.1f ns/step, %.2f I2C writes/step\n",
+           name, (unsigned)(expanders * 8), (unsigned)touched, ns, (double)bytes / N);
+}
+
+// Прежний путь: 16 вызовов digitalWritePCF на команду и два флага по портам
+static void benchLegacy16() {
+    uint8_t portA = 0xFF, portB = 0xFF;
+    bool needA = false, needB = false;
+    std::mt19937_64 rng(0xA16);
+    std::vector<uint16_t> masks(1024);
+    for (auto& m : masks) m = (1 << (rng() % 16)) | (1 << (rng() % 16));
+    const uint32_t N = 1000000;
+    uint32_t bytes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < N; i++) {
+        uint16_t m = masks[i & 1023];
+        bool state = i & 1;
+        for (int p = 0; p < 16; p++) {
+            if (!(m & (1 << p))) continue;
+            if (p < 8) { if (state) portA |= 1 << p; else portA &= ~(1 << p); needA = true; }
+            else { if (state) portB |= 1 << (p - 8); else portB &= ~(1 << (p - 8)); needB = true; }
+        }
+        if (needA) { bytes++; needA = false; }
+        if (needB) { bytes++; needB = false; }
+        __asm__ volatile("" : : "r"(portA), "r"(portB));
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / N;
+    printf("[bench] outputs legacy: 16 pins, 2 touched/step: %.1f ns/step, %.2f I2C writes/step\n",
+           ns, (double)bytes / N);
+}
+
+void test_bench_update_cost() {
+    benchLegacy16();
+    benchBank<uint16_t>("16", 2, 2);
+    benchBank<uint32_t>("32", 4, 2);
+    benchBank<uint64_t>("64", 8, 2);
+    benchBank<uint64_t>("64", 8, 16);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_write_mask_semantics);
+    RUN_TEST(test_flush_only_changed_bytes);
+    RUN_TEST(test_unwired_outputs_ignored);
+    RUN_TEST(test_rejected_byte_is_retried);
+    RUN_TEST(test_bench_update_cost);
+    return UNITY_END();
+}
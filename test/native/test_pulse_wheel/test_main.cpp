@@ -0,0 +1,146 @@
+// Колесо таймеров импульсов: точность срабатывания, наложение, мигание, отмена.
+
+#include <unity.h>
+#include "pulsewheel.h"
+
+static const OutputMask P1 = 1, P2 = 2, P3 = 4;
+
+// Регистр выходов, как его видит банк: 1 — HIGH (отпущен)
+static OutputMask reg = (OutputMask)~(OutputMask)0;
+
+static void apply(const PulseOut& o) { reg = (reg & ~o.clear) | o.set; }
+
+// Продвинуть колесо на ms и вернуть, через сколько тиков впервые поменялся pins
+static uint32_t stepUntilChange(PulseWheel& w, OutputMask pins, uint32_t limit) {
+    OutputMask before = reg & pins;
+    for (uint32_t t = 1; t <= limit; t++) {
+        PulseOut o;
+        w.advance(1, o);
+        apply(o);
+        if ((reg & pins) != before) return t;
+    }
+    return 0;
+}
+
+void setUp() { reg = (OutputMask)~(OutputMask)0; }
+void tearDown() {}
+
+void test_pulse_exact_length() {
+    PulseWheel w;
+    PulseOut o;
+    TEST_ASSERT_NOT_EQUAL(0, w.pulse(P1, 500, o));
+    apply(o);
+    TEST_ASSERT_TRUE((reg & P1) == 0);
+    TEST_ASSERT_EQUAL(500, stepUntilChange(w, P1, 2000));
+    TEST_ASSERT_TRUE((reg & P1) != 0);
+    TEST_ASSERT_EQUAL(0, w.active());
+    TEST_ASSERT_EQUAL(1, w.stats().expired);
+}
+
+void test_long_pulses_span_rounds() {
+    // Длиннее оборота колеса и ровно на границе оборота
+    const uint32_t lens[] = {1, 255, 256, 257, 512, 1000, 70000};
+    for (uint32_t len : lens) {
+        PulseWheel w;
+        PulseOut o;
+        PulseOut skip;
+        w.advance(123, skip);   // Не с нулевой ячейки
+        w.pulse(P2, len, o);
+        apply(o);
+        TEST_ASSERT_EQUAL(len, stepUntilChange(w, P2, 100000));
+    }
+}
+
+void test_overlapping_pulses_same_pin() {
+    // Пин отпускается, только когда закончился последний импульс на нём
+    PulseWheel w;
+    PulseOut o;
+    w.pulse(P1 | P2, 100, o);
+    w.pulse(P1, 300, o);
+    apply(o);
+    TEST_ASSERT_EQUAL(100, stepUntilChange(w, P2, 1000));
+    TEST_ASSERT_TRUE((reg & P1) == 0);
+    TEST_ASSERT_EQUAL(200, stepUntilChange(w, P1, 1000));
+    TEST_ASSERT_EQUAL(0, w.active());
+}
+
+void test_blink_sequence() {
+    PulseWheel w;
+    PulseOut o;
+    w.blink(P3, 20, 30, 3, o);
+    apply(o);
+    // вкл 20, выкл 30, вкл 20, выкл 30, вкл 20 и конец
+    const uint32_t phases[] = {20, 30, 20, 30, 20};
+    for (uint32_t p : phases) TEST_ASSERT_EQUAL(p, stepUntilChange(w, P3, 1000));
+    TEST_ASSERT_TRUE((reg & P3) != 0);
+    TEST_ASSERT_EQUAL(0, w.active());
+    TEST_ASSERT_EQUAL(0, stepUntilChange(w, P3, 1000));
+}
+
+void test_blink_forever_until_cancel() {
+    PulseWheel w;
+    PulseOut o;
+    uint32_t h = w.blink(P1, 5, 5, 0, o);
+    apply(o);
+    uint32_t toggles = 0;
+    while (toggles < 100 && stepUntilChange(w, P1, 10)) toggles++;
+    TEST_ASSERT_EQUAL(100, toggles);
+    PulseOut c;
+    TEST_ASSERT_TRUE(w.cancel(h, c));
+    apply(c);
+    TEST_ASSERT_TRUE((reg & P1) != 0);
+    TEST_ASSERT_EQUAL(0, w.active());
+}
+
+void test_cancel() {
+    PulseWheel w;
+    PulseOut o;
+    uint32_t a = w.pulse(P1, 100, o);
+    uint32_t b = w.pulse(P1 | P2, 100, o);
+    w.pulse(P3, 100, o);
+    apply(o);
+
+    PulseOut c;
+    TEST_ASSERT_TRUE(w.cancel(a, c));
+    apply(c);
+    TEST_ASSERT_TRUE((reg & P1) == 0);   // Его ещё держит b
+    TEST_ASSERT_FALSE(w.cancel(a, c));   // Повторно — уже нечего
+
+    PulseOut d;
+    TEST_ASSERT_EQUAL(1, w.cancelPins(P2, d));
+    apply(d);
+    TEST_ASSERT_TRUE((reg & (P1 | P2)) == (P1 | P2));
+    TEST_ASSERT_FALSE(w.cancel(b, d));
+    TEST_ASSERT_EQUAL(1, w.active());
+
+    // Запись переиспользована — старый дескриптор на неё не действует
+    PulseOut e;
+    uint32_t again = w.pulse(P2, 50, e);
+    TEST_ASSERT_NOT_EQUAL(b, again);
+    TEST_ASSERT_FALSE(w.cancel(b, e));
+    TEST_ASSERT_EQUAL(2, w.active());
+}
+
+void test_pool_full() {
+    PulseWheel w;
+    PulseOut o;
+    for (int i = 0; i < PULSE_MAX; i++) TEST_ASSERT_NOT_EQUAL(0, w.pulse(P1, 10 + i, o));
+    TEST_ASSERT_EQUAL(0, w.pulse(P2, 10, o));
+    TEST_ASSERT_EQUAL(1, w.stats().dropped);
+    TEST_ASSERT_EQUAL(PULSE_MAX, w.stats().peak);
+    apply(o);
+    TEST_ASSERT_EQUAL(10 + PULSE_MAX - 1, stepUntilChange(w, P1, 1000));
+    TEST_ASSERT_EQUAL(0, w.active());
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_pulse_exact_length);
+    RUN_TEST(test_long_pulses_span_rounds);
+    RUN_TEST(test_overlapping_pulses_same_pin);
+    RUN_TEST(test_blink_sequence);
+    RUN_TEST(test_blink_forever_until_cancel);
+    RUN_TEST(test_cancel);
+    RUN_TEST(test_pool_full);
+    return UNITY_END();
+}
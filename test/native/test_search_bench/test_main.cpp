@@ -0,0 +1,431 @@
+// Host-бенчмарк CardDatabase::find на реальных образах data/*.bin.
+// Запуск: pio test -e native -v
+
+#include <unity.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <math.h>
+#include <new>
+#include <stdlib.h>
+#include <vector>
+#include "search.h"
+
+// Счётчик обращений к куче: глобальный operator new ловит std::vector, String и т.п.
+static size_t heapAllocs = 0;
+void* operator new(size_t n) {
+    heapAllocs++;
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static CardDatabase db;      // Бинарный поиск
+static CardDatabase dbEytz;  // Индекс Эйтцингера
+static CardDatabase dbFlash; // Образ в разделе carddb (файл-заглушка)
+static CardDatabase dbFilter; // Эйтцингер + отрицательный фильтр в SRAM
+static std::vector<uint64_t> keys34;   // UID из cards34.bin (без байта-тега)
+static std::vector<uint64_t> keys56;   // UID из cards56.bin
+static std::vector<uint64_t> allKeys;  // Все известные UID, отсортированы
+
+static const size_t STREAM_LEN = 100000;
+static const uint32_t SEED = 0xA16;
+
+// Ключи читаем из файлов напрямую, чтобы не зависеть от внутреннего формата CardDatabase
+static std::vector<uint64_t> readKeys(const char* path, size_t stride, size_t keyOff, size_t keyLen) {
+    std::vector<uint64_t> out;
+    File f = LittleFS.open(path, "r");
+    if (!f) return out;
+    std::vector<uint8_t> buf(f.size());
+    f.read(buf.data(), buf.size());
+    f.close();
+    for (size_t off = 0; off + stride <= buf.size(); off += stride) {
+        uint64_t k = 0;
+        for (size_t i = 0; i < keyLen; i++) k = (k << 8) | buf[off + keyOff + i];
+        out.push_back(k);
+    }
+    return out;
+}
+
+static bool isKnown(uint64_t uid) {
+    return std::binary_search(allKeys.begin(), allKeys.end(), uid);
+}
+
+static std::vector<uint64_t> hitStream(const std::vector<uint64_t>& src, std::mt19937_64& rng) {
+    std::vector<uint64_t> s(STREAM_LEN);
+    std::uniform_int_distribution<size_t> pick(0, src.size() - 1);
+    for (auto& uid : s) uid = src[pick(rng)];
+    return s;
+}
+
+static std::vector<uint64_t> missStream(std::mt19937_64& rng) {
+    std::vector<uint64_t> s;
+    s.reserve(STREAM_LEN);
+    while (s.size() < STREAM_LEN) {
+        // Половина промахов — 32-битные UID, половина — 56-битные
+        uint64_t uid = (s.size() & 1) ? (rng() & 0xFFFFFFFFULL) : (rng() & 0xFFFFFFFFFFFFFFULL);
+        if (!isKnown(uid)) s.push_back(uid);
+    }
+    return s;
+}
+
+struct BenchResult {
+    size_t found = 0;
+    size_t allocs = 0;
+};
+
+static BenchResult runStream(CardDatabase& db, const char* name, const std::vector<uint64_t>& stream, uint8_t bits = 0) {
+    using clock = std::chrono::steady_clock;
+    std::vector<uint32_t> ns(stream.size());
+    BenchResult r;
+
+    db.resetBytesTouched();
+    size_t allocs0 = heapAllocs;
+    auto t0 = clock::now();
+    for (size_t i = 0; i < stream.size(); i++) {
+        auto s = clock::now();
+        CardView res = db.findView(stream[i], bits);
+        auto e = clock::now();
+        ns[i] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(e - s).count();
+        if (res.found) r.found++;
+    }
+    double totalSec = std::chrono::duration<double>(clock::now() - t0).count();
+    r.allocs = heapAllocs - allocs0;
+
+    std::sort(ns.begin(), ns.end());
+    size_t n = ns.size();
+    printf("[bench] %-8s n=%zu found=%zu p50=%uns p99=%uns max=%uns %.0f lookups/s bytes/lookup=%.1f allocs/lookup=%.2f\n",
+           name, n, r.found, (unsigned)ns[n / 2], (unsigned)ns[(n * 99) / 100], (unsigned)ns[n - 1],
+           n / totalSec, (double)db.bytesTouched() / n, (double)r.allocs / n);
+    return r;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_load() {
+    TEST_ASSERT_TRUE(LittleFS.begin());
+    TEST_ASSERT_TRUE(db.begin(CardIndexLayout::BINARY, CardStorage::PSRAM, 0));
+    TEST_ASSERT_TRUE(dbEytz.begin(CardIndexLayout::EYTZINGER, CardStorage::PSRAM, 0));
+    TEST_ASSERT_TRUE(dbFilter.begin(CardIndexLayout::EYTZINGER));
+
+    keys34 = readKeys("/cards34.bin", 7, 1, 4);
+    keys56 = readKeys("/cards56.bin", 9, 0, 7);
+    TEST_ASSERT_FALSE(keys34.empty());
+    TEST_ASSERT_FALSE(keys56.empty());
+
+    allKeys = keys34;
+    allKeys.insert(allKeys.end(), keys56.begin(), keys56.end());
+    std::sort(allKeys.begin(), allKeys.end());
+}
+
+void test_hit56() {
+    std::mt19937_64 rng(SEED);
+    std::vector<uint64_t> s = hitStream(keys56, rng);
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(db, "hit56", s).found);
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(dbEytz, "hit56/ey", s).found);
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(dbEytz, "hit56/w58", s, 58).found);
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(dbFilter, "hit56/bf", s).found);
+}
+
+void test_hit34() {
+    std::mt19937_64 rng(SEED + 1);
+    std::vector<uint64_t> s = hitStream(keys34, rng);
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(db, "hit34", s).found);
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(dbEytz, "hit34/ey", s).found);
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(dbEytz, "hit34/w34", s, 34).found);
+}
+
+void test_miss() {
+    std::mt19937_64 rng(SEED + 2);
+    std::vector<uint64_t> s = missStream(rng);
+    TEST_ASSERT_EQUAL(0, runStream(db, "miss", s).found);
+    TEST_ASSERT_EQUAL(0, runStream(dbEytz, "miss/ey", s).found);
+    TEST_ASSERT_EQUAL(0, runStream(dbFilter, "miss/bf", s).found);
+}
+
+// Фильтр: ни одного ложного отказа для известных карт, доля ложных срабатываний как в оценке
+void test_filter() {
+    TEST_ASSERT_NOT_NULL(dbFilter.filter());
+    const CardFilter& f = *dbFilter.filter();
+    TEST_ASSERT_TRUE(f.enabled());
+    for (uint64_t uid : allKeys) TEST_ASSERT_TRUE(f.mayContain(uid));
+
+    std::mt19937_64 rng(SEED + 7);
+    std::vector<uint64_t> m = missStream(rng);
+    size_t passed = 0;
+    for (uint64_t uid : m) passed += f.mayContain(uid);
+    double measured = (double)passed / m.size();
+    printf("[bench] filter: %zu KB, %.1f bits/key, k=%u, false positives measured=%.2f%% estimated=%.2f%%\n",
+           f.memory() / 1024, f.bitsPerKey(), f.hashes(), measured * 100, f.falsePositiveRate() * 100);
+    TEST_ASSERT_TRUE(f.bitsPerKey() >= CARD_FILTER_BITS_PER_KEY - 0.5f);
+    TEST_ASSERT_TRUE(measured < 0.02);
+    TEST_ASSERT_TRUE(fabs(measured - f.falsePositiveRate()) < 0.005);
+
+    // Урезанный бюджет: размер упирается в maxBytes, оценка остаётся честной
+    CardFilter small;
+    TEST_ASSERT_TRUE(small.build(allKeys.size(), 128 * 1024));
+    for (uint64_t uid : allKeys) small.add(uid);
+    TEST_ASSERT_TRUE(small.bitsPerKey() < CARD_FILTER_MIN_BITS_PER_KEY);
+    passed = 0;
+    for (uint64_t uid : m) passed += small.mayContain(uid);
+    measured = (double)passed / m.size();
+    printf("[bench] filter: %zu KB, %.1f bits/key, k=%u, false positives measured=%.2f%% estimated=%.2f%%\n",
+           small.memory() / 1024, small.bitsPerKey(), small.hashes(), measured * 100, small.falsePositiveRate() * 100);
+    TEST_ASSERT_TRUE(fabs(measured - small.falsePositiveRate()) < 0.02);
+}
+
+void test_mixed() {
+    std::mt19937_64 rng(SEED + 3);
+    std::vector<uint64_t> hits = hitStream(keys56, rng);
+    std::vector<uint64_t> misses = missStream(rng);
+    std::vector<uint64_t> mixed(STREAM_LEN);
+    for (size_t i = 0; i < STREAM_LEN; i++) mixed[i] = (i & 1) ? hits[i] : misses[i];
+    TEST_ASSERT_EQUAL(STREAM_LEN / 2, runStream(db, "mixed", mixed).found);
+    TEST_ASSERT_EQUAL(STREAM_LEN / 2, runStream(dbEytz, "mixed/ey", mixed).found);
+    TEST_ASSERT_EQUAL(STREAM_LEN / 2, runStream(dbFilter, "mixed/bf", mixed).found);
+}
+
+// Прежний загрузчик групп и правил: два прохода с seek на группу, правила по 4 байта
+struct RefGroups {
+    std::vector<std::vector<uint16_t>> groups;
+    std::vector<uint32_t> rules;
+};
+
+static RefGroups loadReference() {
+    RefGroups r;
+    File f = LittleFS.open("/groups.bin", "r");
+    while (f.available() >= 2) {
+        uint16_t bSize;
+        f.read((uint8_t*)&bSize, 2);
+        bSize = (bSize << 8) | (bSize >> 8);
+        std::vector<uint16_t> g(bSize / 2);
+        f.read((uint8_t*)g.data(), bSize);
+        for (auto& idx : g) idx = (idx << 8) | (idx >> 8);
+        r.groups.push_back(g);
+    }
+    f.close();
+    f = LittleFS.open("/rules.bin", "r");
+    uint32_t raw;
+    while (f.read((uint8_t*)&raw, 4) == 4) r.rules.push_back(__builtin_bswap32(raw));
+    f.close();
+    return r;
+}
+
+void test_load_times() {
+    const CardLoadStats& st = db.loadStats();
+    auto t0 = std::chrono::steady_clock::now();
+    RefGroups ref = loadReference();
+    double refMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    printf("[bench] load: cards34=%.2fms cards56=%.2fms groups=%.2fms rules=%.2fms unpack=%.2fms (per-record reference groups+rules=%.2fms)\n",
+           st.cards34Us / 1000.0, st.cards56Us / 1000.0, st.groupsUs / 1000.0, st.rulesUs / 1000.0,
+           st.instrUs / 1000.0, refMs);
+    TEST_ASSERT_TRUE(st.groupsUs > 0);
+    TEST_ASSERT_TRUE(st.rulesUs > 0);
+
+    // Потоковый загрузчик даёт те же инструкции, что и прежний
+    std::mt19937_64 rng(SEED + 9);
+    std::vector<uint64_t> s = hitStream(keys56, rng);
+    for (size_t i = 0; i < 2000; i++) {
+        CardView v = db.findView(s[i]);
+        TEST_ASSERT_TRUE(v.group_id < ref.groups.size());
+        std::vector<uint32_t> expect;
+        for (uint16_t idx : ref.groups[v.group_id]) if (idx < ref.rules.size()) expect.push_back(ref.rules[idx]);
+        TEST_ASSERT_EQUAL(expect.size(), v.instructions.size());
+        for (size_t k = 0; k < expect.size(); k++) {
+            TEST_ASSERT_EQUAL(expect[k] & 0x0F, v.instructions[k].action);
+            TEST_ASSERT_EQUAL((expect[k] >> 5) & 0xFF, v.instructions[k].priority);
+            TEST_ASSERT_EQUAL((expect[k] >> 13) & 0x1FF, v.instructions[k].schedule);
+        }
+    }
+}
+
+// Типичная дверь: несколько сотен пропусков дают почти все считывания
+void test_hot_cards() {
+    std::mt19937_64 rng(SEED + 8);
+    std::vector<uint64_t> staff = hitStream(keys56, rng);
+    staff.resize(300);
+    std::vector<uint64_t> all = hitStream(keys56, rng);
+    std::vector<uint64_t> s(STREAM_LEN);
+    std::uniform_int_distribution<size_t> pick(0, staff.size() - 1);
+    for (size_t i = 0; i < STREAM_LEN; i++) s[i] = (rng() % 10) ? staff[pick(rng)] : all[i];
+
+    dbFilter.cache().resetStats();
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(dbFilter, "hot/cache", s).found);
+    uint32_t hits = dbFilter.cache().hits(), misses = dbFilter.cache().misses();
+    printf("[bench] cache: %u hits / %u misses (%.1f%%), %zu B SRAM\n",
+           (unsigned)hits, (unsigned)misses, 100.0 * hits / (hits + misses), dbFilter.cache().memory());
+    TEST_ASSERT_TRUE(hits > misses);
+
+    // Решение из кэша совпадает с полным поиском
+    for (size_t i = 0; i < 1000; i++) {
+        CardView a = dbEytz.findView(s[i]);
+        CardView b = dbFilter.findView(s[i]);
+        TEST_ASSERT_EQUAL(a.group_id, b.group_id);
+        TEST_ASSERT_EQUAL(a.limit, b.limit);
+        TEST_ASSERT_EQUAL(a.source, b.source);
+        TEST_ASSERT_EQUAL(a.instructions.size(), b.instructions.size());
+        TEST_ASSERT_EQUAL_MEMORY(a.instructions.ptr, b.instructions.ptr, a.instructions.size() * sizeof(Instruction));
+    }
+}
+
+// Обе раскладки должны давать одинаковый результат для любого UID
+void test_layouts_agree() {
+    std::mt19937_64 rng(SEED + 4);
+    std::vector<uint64_t> s = hitStream(keys56, rng);
+    std::vector<uint64_t> h34 = hitStream(keys34, rng);
+    std::vector<uint64_t> m = missStream(rng);
+    s.insert(s.end(), h34.begin(), h34.end());
+    s.insert(s.end(), m.begin(), m.end());
+    for (uint64_t uid : s) {
+        CardResult a = db.find(uid);
+        CardResult b = dbEytz.find(uid);
+        CardResult c = dbFilter.find(uid);
+        TEST_ASSERT_EQUAL(a.found, b.found);
+        TEST_ASSERT_EQUAL(a.group_id, b.group_id);
+        TEST_ASSERT_EQUAL(a.limit, b.limit);
+        TEST_ASSERT_EQUAL(a.instructions.size(), b.instructions.size());
+        TEST_ASSERT_EQUAL(a.found, c.found);
+        TEST_ASSERT_EQUAL(a.group_id, c.group_id);
+
+        // Сводка группы совпадает с её инструкциями
+        CardView v = dbFilter.findView(uid);
+        uint16_t mask = 0;
+        int top = -1;
+        uint8_t topAction = 0;
+        for (const Instruction& ins : v.instructions) {
+            if (ins.action == 0) continue;
+            mask |= 1u << ins.action;
+            if (ins.priority > top) { top = ins.priority; topAction = ins.action; }
+        }
+        TEST_ASSERT_EQUAL(mask, v.actionMask);
+        TEST_ASSERT_EQUAL(topAction, v.topAction);
+    }
+}
+
+// Горячий путь считывания (как onCardRead) не должен обращаться к куче
+void test_swipe_zero_alloc() {
+    std::mt19937_64 rng(SEED + 5);
+    std::vector<uint64_t> s = hitStream(keys56, rng);
+    std::vector<uint64_t> m = missStream(rng);
+    s.insert(s.end(), m.begin(), m.end());
+
+    size_t allocs0 = heapAllocs;
+    uint32_t actions = 0;
+    for (uint64_t uid : s) {
+        CardView v = dbEytz.findView(uid);
+        for (const Instruction& ins : v.instructions) actions += (ins.action > 0);
+    }
+    size_t viewAllocs = heapAllocs - allocs0;
+
+    allocs0 = heapAllocs;
+    for (size_t i = 0; i < 1000; i++) dbEytz.find(s[i]);
+    printf("[bench] allocs/swipe: findView=%.2f find=%.2f (actions=%u)\n",
+           (double)viewAllocs / s.size(), (heapAllocs - allocs0) / 1000.0, (unsigned)actions);
+
+    TEST_ASSERT_EQUAL(0, viewAllocs);
+}
+
+// Сверка пакетом против n вызовов find(): тот же ответ, меньше времени и чтений таблиц
+static void runBatch(CardDatabase& db, const char* name, const std::vector<uint64_t>& s, size_t batch) {
+    using clock = std::chrono::steady_clock;
+    std::vector<CardMembership> out(s.size());
+
+    db.resetBytesTouched();
+    auto t0 = clock::now();
+    size_t single = 0;
+    for (uint64_t uid : s) single += db.find(uid).found;
+    double singleSec = std::chrono::duration<double>(clock::now() - t0).count();
+    double singleBytes = (double)db.bytesTouched() / s.size();
+
+    db.resetBytesTouched();
+    t0 = clock::now();
+    size_t found = 0;
+    for (size_t i = 0; i < s.size(); i += batch) {
+        found += db.findBatch(s.data() + i, std::min(batch, s.size() - i), out.data() + i);
+    }
+    double batchSec = std::chrono::duration<double>(clock::now() - t0).count();
+
+    printf("[bench] %-9s batch=%-6zu find: %.0f/s %.1f B/key  findBatch: %.0f/s %.1f B/key (x%.1f)\n",
+           name, batch, s.size() / singleSec, singleBytes, s.size() / batchSec,
+           (double)db.bytesTouched() / s.size(), singleSec / batchSec);
+    TEST_ASSERT_EQUAL(single, found);
+    for (size_t i = 0; i < s.size(); i++) {
+        CardView v = db.findView(s[i]);
+        TEST_ASSERT_EQUAL(v.found, out[i].found());
+        TEST_ASSERT_EQUAL(v.source, out[i].source);
+        TEST_ASSERT_EQUAL(v.group_id, out[i].group());
+        TEST_ASSERT_EQUAL(v.limit, out[i].limit());
+    }
+}
+
+void test_batch() {
+    // Ночная сверка: выгрузка сервера, известные карты вперемешку с удалёнными на нём
+    std::mt19937_64 rng(SEED + 10);
+    std::vector<uint64_t> s = hitStream(keys56, rng);
+    std::vector<uint64_t> h34 = hitStream(keys34, rng);
+    std::vector<uint64_t> m = missStream(rng);
+    for (size_t i = 0; i < STREAM_LEN; i += 2) { s[i] = h34[i]; s[i + 1] = (i % 8) ? s[i + 1] : m[i]; }
+
+    runBatch(db, "bin", s, 128);
+    runBatch(db, "bin", s, 16384);
+    runBatch(dbEytz, "eytz", s, 128);
+    runBatch(dbEytz, "eytz", s, 16384);
+    runBatch(dbFilter, "eytz/bf", s, 16384);
+    // Полная выгрузка сервера почти целиком попадает в таблицы: слияние идёт подряд
+    runBatch(db, "bin/all", allKeys, allKeys.size());
+}
+
+// Копия в PSRAM против отображения раздела: время загрузки и занятая PSRAM
+void test_flash_mapped() {
+    CardDatabase first;
+    TEST_ASSERT_TRUE(first.begin(CardIndexLayout::BINARY, CardStorage::FLASH_MAPPED));
+    TEST_ASSERT_TRUE(first.isMapped());
+    uint32_t migrateMs = first.bootTimeMs();
+
+    TEST_ASSERT_TRUE(dbFlash.begin(CardIndexLayout::BINARY, CardStorage::FLASH_MAPPED));
+    TEST_ASSERT_TRUE(dbFlash.isMapped());
+    TEST_ASSERT_EQUAL(0, dbFlash.psramUsage());
+
+    printf("[bench] boot: copy=%ums (PSRAM %zu KB) first-flash=%ums mapped=%ums (PSRAM %zu KB)\n",
+           (unsigned)db.bootTimeMs(), db.psramUsage() / 1024, (unsigned)migrateMs, (unsigned)dbFlash.bootTimeMs(), dbFlash.psramUsage() / 1024);
+
+    std::mt19937_64 rng(SEED + 6);
+    std::vector<uint64_t> h56 = hitStream(keys56, rng);
+    std::vector<uint64_t> h34 = hitStream(keys34, rng);
+    std::vector<uint64_t> m = missStream(rng);
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(dbFlash, "hit56/fl", h56).found);
+    TEST_ASSERT_EQUAL(STREAM_LEN, runStream(dbFlash, "hit34/fl", h34).found);
+    TEST_ASSERT_EQUAL(0, runStream(dbFlash, "miss/fl", m).found);
+
+    for (size_t i = 0; i < 1000; i++) {
+        CardView a = db.findView(h56[i]);
+        CardView b = dbFlash.findView(h56[i]);
+        TEST_ASSERT_EQUAL(a.group_id, b.group_id);
+        TEST_ASSERT_EQUAL(a.instructions.size(), b.instructions.size());
+        TEST_ASSERT_EQUAL_MEMORY(a.instructions.ptr, b.instructions.ptr, a.instructions.size() * sizeof(Instruction));
+    }
+}
+
+int main(int argc, char** argv) {
+    // Раздел carddb эмулируется файлом во временном каталоге
+    char partDir[] = "/tmp/carddb_bench_XXXXXX";
+    if (!mkdtemp(partDir)) return 1;
+    setenv("PARTITION_ROOT", partDir, 1);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_load);
+    RUN_TEST(test_load_times);
+    RUN_TEST(test_hit56);
+    RUN_TEST(test_hit34);
+    RUN_TEST(test_miss);
+    RUN_TEST(test_filter);
+    RUN_TEST(test_mixed);
+    RUN_TEST(test_hot_cards);
+    RUN_TEST(test_layouts_agree);
+    RUN_TEST(test_swipe_zero_alloc);
+    RUN_TEST(test_batch);
+    RUN_TEST(test_flash_mapped);
+    return UNITY_END();
+}
@@ -0,0 +1,96 @@
+// Кольцо SPSC между стадиями конвейера карт.
+
+#include <unity.h>
+#include <stdint.h>
+#include <thread>
+#include "spsc.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_fifo_order() {
+    SpscRing<uint32_t, 8> r;
+    uint32_t v;
+    TEST_ASSERT_FALSE(r.pop(v));
+    for (uint32_t i = 1; i <= 5; i++) TEST_ASSERT_TRUE(r.push(i));
+    TEST_ASSERT_EQUAL(5, r.size());
+    for (uint32_t i = 1; i <= 5; i++) {
+        TEST_ASSERT_TRUE(r.pop(v));
+        TEST_ASSERT_EQUAL(i, v);
+    }
+    TEST_ASSERT_FALSE(r.pop(v));
+    TEST_ASSERT_EQUAL(0, r.size());
+}
+
+void test_full_ring_drops() {
+    // Писатель не ждёт: лишние элементы отбрасываются и считаются
+    SpscRing<uint32_t, 4> r;
+    for (uint32_t i = 0; i < 4; i++) TEST_ASSERT_TRUE(r.push(i));
+    TEST_ASSERT_FALSE(r.push(100));
+    TEST_ASSERT_FALSE(r.push(101));
+    TEST_ASSERT_EQUAL(2, r.dropped());
+    TEST_ASSERT_EQUAL(4, r.peak());
+
+    uint32_t v;
+    TEST_ASSERT_TRUE(r.pop(v));
+    TEST_ASSERT_EQUAL(0, v);
+    TEST_ASSERT_TRUE(r.push(4));
+    for (uint32_t i = 1; i <= 4; i++) {
+        TEST_ASSERT_TRUE(r.pop(v));
+        TEST_ASSERT_EQUAL(i, v);
+    }
+}
+
+void test_wraparound() {
+    // Индексы идут через многие обороты кольца; пик не выше реальной глубины
+    SpscRing<uint64_t, 4> r;
+    uint64_t v;
+    for (uint64_t i = 0; i < 1000; i++) {
+        TEST_ASSERT_TRUE(r.push(i));
+        TEST_ASSERT_TRUE(r.push(i + 1000000));
+        TEST_ASSERT_TRUE(r.pop(v));
+        TEST_ASSERT_EQUAL_UINT64(i, v);
+        TEST_ASSERT_TRUE(r.pop(v));
+        TEST_ASSERT_EQUAL_UINT64(i + 1000000, v);
+    }
+    TEST_ASSERT_EQUAL(2, r.peak());
+    TEST_ASSERT_EQUAL(0, r.dropped());
+}
+
+struct Frame {
+    uint64_t uid;
+    uint32_t seq;
+    uint32_t check;
+};
+
+void test_two_threads() {
+    // Писатель и читатель в разных потоках: всё доходит по порядку и целиком
+    static SpscRing<Frame, 16> r;
+    const uint32_t N = 200000;
+    std::thread producer([&] {
+        for (uint32_t i = 0; i < N; i++) {
+            Frame f{(uint64_t)i * 0x9E3779B97F4A7C15ULL, i, i ^ 0xA5A5A5A5u};
+            while (!r.push(f)) std::this_thread::yield();
+        }
+    });
+    uint32_t expect = 0, bad = 0;
+    Frame f;
+    while (expect < N) {
+        if (!r.pop(f)) { std::this_thread::yield(); continue; }
+        if (f.seq != expect || f.check != (expect ^ 0xA5A5A5A5u) || f.uid != (uint64_t)expect * 0x9E3779B97F4A7C15ULL) bad++;
+        expect++;
+    }
+    producer.join();
+    TEST_ASSERT_EQUAL(0, bad);
+    TEST_ASSERT_EQUAL(0, r.size());
+    TEST_ASSERT_TRUE(r.peak() <= 16);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_fifo_order);
+    RUN_TEST(test_full_ring_drops);
+    RUN_TEST(test_wraparound);
+    RUN_TEST(test_two_threads);
+    return UNITY_END();
+}
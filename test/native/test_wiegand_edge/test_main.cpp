@@ -0,0 +1,238 @@
+// Сборка кадров Wiegand из фронтов: имитатор считывателей вместо прерываний GPIO.
+
+#include <unity.h>
+#include <stdio.h>
+#include <vector>
+#include "wiegandedge.h"
+
+// Цикл задачи декодера в режиме прерываний: просыпается только на фронт
+// или на конец начатого кадра. Время модельное, в микросекундах.
+struct EdgeLoop {
+    WiegandEdgeRing ring;
+    WiegandSimSource sim{ring};
+    WiegandEdgeDecoder dec;
+    std::vector<WiegandRawFrame> frames;
+    std::vector<uint32_t> emittedAt;
+    uint32_t wakeups = 0;
+
+    void run(uint32_t endUs) {
+        uint32_t now = 0;
+        while (true) {
+            uint32_t tEdge = sim.nextEdge();
+            uint32_t left = dec.nextDeadline(now);
+            uint32_t tGap = (left == UINT32_MAX) ? UINT32_MAX : now + left;
+            uint32_t next = (tEdge < tGap) ? tEdge : tGap;
+            if (next == UINT32_MAX || next > endUs) break;
+            now = next;
+            wakeups++;
+            sim.run(now);
+            WiegandEdge e;
+            while (ring.pop(e)) dec.edge(e);
+            dec.poll(now, [this, now](const WiegandRawFrame& f) { frames.push_back(f); emittedAt.push_back(now); });
+        }
+    }
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_single_26bit_frame() {
+    EdgeLoop l;
+    l.sim.frame(0, 0x2ABCDEF, 26, 1000);
+    l.run(1000000);
+    TEST_ASSERT_EQUAL(1, l.frames.size());
+    TEST_ASSERT_EQUAL_UINT64(0x2ABCDEF, l.frames[0].code);
+    TEST_ASSERT_EQUAL(26, l.frames[0].bits);
+    TEST_ASSERT_EQUAL(0, l.frames[0].reader);
+    TEST_ASSERT_EQUAL(1000, l.frames[0].tFirst);
+    TEST_ASSERT_EQUAL(1000 + 25 * 2000, l.frames[0].tLast);
+}
+
+void test_overlapping_readers_34_and_58() {
+    // Два считывателя передают одновременно: фронты перемешаны, кадры — нет
+    EdgeLoop l;
+    uint64_t c34 = 0x2DEADBEEFULL;
+    uint64_t c58 = 0x2123456789ABCDEULL & ((1ULL << 58) - 1);
+    l.sim.frame(1, c34, 34, 500);
+    l.sim.frame(3, c58, 58, 1700, WiegandTiming{80, 1000});
+    l.run(1000000);
+    TEST_ASSERT_EQUAL(2, l.frames.size());
+    for (const auto& f : l.frames) {
+        if (f.reader == 1) {
+            TEST_ASSERT_EQUAL(34, f.bits);
+            TEST_ASSERT_EQUAL_UINT64(c34, f.code);
+        } else {
+            TEST_ASSERT_EQUAL(3, f.reader);
+            TEST_ASSERT_EQUAL(58, f.bits);
+            TEST_ASSERT_EQUAL_UINT64(c58, f.code);
+        }
+    }
+}
+
+void test_fast_and_slow_timings() {
+    // Быстрый считыватель (200 мкс между битами) и медленный (20 мс) — в пределах паузы 100 мс
+    EdgeLoop l;
+    l.sim.frame(0, 0x1555555, 26, 0, WiegandTiming{20, 200});
+    l.sim.frame(2, 0x0F0F0F0F0ULL, 34, 0, WiegandTiming{100, 20000});
+    l.run(5000000);
+    TEST_ASSERT_EQUAL(2, l.frames.size());
+    TEST_ASSERT_EQUAL(0, l.frames[0].reader);
+    TEST_ASSERT_EQUAL_UINT64(0x1555555, l.frames[0].code);
+    TEST_ASSERT_EQUAL(2, l.frames[1].reader);
+    TEST_ASSERT_EQUAL(34, l.frames[1].bits);
+    TEST_ASSERT_EQUAL_UINT64(0x0F0F0F0F0ULL, l.frames[1].code);
+}
+
+void test_frame_ends_only_after_gap() {
+    WiegandEdgeDecoder dec;
+    std::vector<WiegandRawFrame> out;
+    auto sink = [&](const WiegandRawFrame& f) { out.push_back(f); };
+    TEST_ASSERT_EQUAL(UINT32_MAX, dec.nextDeadline(0));
+
+    dec.edge(WiegandEdge{100, 5, 1});
+    dec.edge(WiegandEdge{2100, 5, 0});
+    TEST_ASSERT_EQUAL(WIEGAND_FRAME_GAP_US + 1, dec.nextDeadline(2100));
+    TEST_ASSERT_EQUAL(0, dec.poll(2100 + WIEGAND_FRAME_GAP_US, sink));
+    TEST_ASSERT_EQUAL(1, dec.poll(2101 + WIEGAND_FRAME_GAP_US, sink));
+    TEST_ASSERT_EQUAL(2, out[0].bits);
+    TEST_ASSERT_EQUAL_UINT64(2, out[0].code);
+    TEST_ASSERT_EQUAL(UINT32_MAX, dec.nextDeadline(2101 + WIEGAND_FRAME_GAP_US));
+}
+
+void test_micros_wraparound() {
+    // Кадр, во время которого micros() переполняется
+    WiegandEdgeDecoder dec;
+    std::vector<WiegandRawFrame> out;
+    uint32_t t = 0xFFFFFFFFu - 5000;
+    for (int i = 0; i < 8; i++, t += 2000) dec.edge(WiegandEdge{t, 0, (uint8_t)(i & 1)});
+    TEST_ASSERT_EQUAL(0, dec.poll(t, [&](const WiegandRawFrame& f) { out.push_back(f); }));
+    TEST_ASSERT_EQUAL(1, dec.poll(t + WIEGAND_FRAME_GAP_US, [&](const WiegandRawFrame& f) { out.push_back(f); }));
+    TEST_ASSERT_EQUAL(8, out[0].bits);
+    TEST_ASSERT_EQUAL_UINT64(0x55, out[0].code);
+}
+
+void test_ring_overflow_is_counted() {
+    // Задача декодера не успела разобрать кольцо: лишние фронты теряются и считаются
+    WiegandEdgeRing ring;
+    WiegandSimSource sim(ring);
+    for (int r = 0; r < 6; r++) sim.frame(r, 0, 58, 0, WiegandTiming{50, 10});
+    TEST_ASSERT_EQUAL(6 * 58, sim.run(10000));
+    TEST_ASSERT_EQUAL(WIEGAND_EDGE_RING, ring.size());
+    TEST_ASSERT_EQUAL(6 * 58 - WIEGAND_EDGE_RING, ring.dropped());
+}
+
+void test_cpu_wakeups_vs_polling() {
+    // 10 с, по карте в секунду на одном из 4 считывателей
+    EdgeLoop l;
+    const uint32_t seconds = 10;
+    const uint8_t lens[3] = {26, 34, 58};
+    for (uint32_t s = 0; s < seconds; s++) {
+        uint8_t bits = lens[s % 3];
+        l.sim.frame(s % 4, 0x0123456789ABCDEULL & ((1ULL << bits) - 1), bits, s * 1000000 + 1234);
+    }
+    l.run(seconds * 1000000);
+    TEST_ASSERT_EQUAL(seconds, l.frames.size());
+    for (uint32_t s = 0; s < seconds; s++) {
+        uint8_t bits = lens[s % 3];
+        TEST_ASSERT_EQUAL(bits, l.frames[s].bits);
+        TEST_ASSERT_EQUAL_UINT64(0x0123456789ABCDEULL & ((1ULL << bits) - 1), l.frames[s].code);
+    }
+
+    // Опрос: чтение PCF8574 на 400 кГц (~50 мкс) + delayMicroseconds(10) на проход
+    uint32_t polls = seconds * 1000000 / 60;
+    printf("edge capture: %u wakeups (%u edges) vs polling: %u I2C reads\n",
+           (unsigned)l.wakeups, (unsigned)l.dec.edges(), (unsigned)polls);
+    // Просыпаемся на каждый фронт и один раз на конец кадра
+    TEST_ASSERT_EQUAL(l.dec.edges() + seconds, l.wakeups);
+    TEST_ASSERT_TRUE(l.wakeups * 100 < polls);
+}
+
+void test_format_parity() {
+    // H10301: код объекта 1, номер 1
+    uint64_t c26 = WiegandFormat<26>::encode(0x010001);
+    TEST_ASSERT_TRUE(WiegandFormat<26>::valid(c26));
+    uint64_t uid = 0;
+    TEST_ASSERT_TRUE(wiegandDecode(c26, 26, uid));
+    TEST_ASSERT_EQUAL_UINT64(0x010001, uid);
+
+    uint64_t c34 = WiegandFormat<34>::encode(0xDEADBEEF);
+    uint64_t c58 = WiegandFormat<58>::encode(0x0123456789ABCDULL);
+    TEST_ASSERT_TRUE(wiegandDecode(c34, 34, uid));
+    TEST_ASSERT_EQUAL_UINT64(0xDEADBEEF, uid);
+    TEST_ASSERT_TRUE(wiegandDecode(c58, 58, uid));
+    TEST_ASSERT_EQUAL_UINT64(0x0123456789ABCDULL, uid);
+
+    // Любой одиночный сбой бита ловится одной из двух проверок
+    for (int i = 0; i < 26; i++) TEST_ASSERT_FALSE(wiegandValid(c26 ^ (1ULL << i), 26));
+    for (int i = 0; i < 34; i++) TEST_ASSERT_FALSE(wiegandValid(c34 ^ (1ULL << i), 34));
+    for (int i = 0; i < 58; i++) TEST_ASSERT_FALSE(wiegandValid(c58 ^ (1ULL << i), 58));
+    // Длина не та — кадр не принимается
+    TEST_ASSERT_FALSE(wiegandValid(c26, 25));
+    TEST_ASSERT_FALSE(wiegandValid(c26 >> 1, 25));
+    TEST_ASSERT_FALSE(wiegandValid(c34, 32));
+}
+
+void test_early_close_single_format() {
+    // Считыватель шлёт только 26 бит: кадр закрывается на последнем бите
+    EdgeLoop l;
+    l.dec.setFormats(0, WIEGAND_LEN(26));
+    l.sim.frame(0, WiegandFormat<26>::encode(0x123456), 26, 1000);
+    l.run(1000000);
+    TEST_ASSERT_EQUAL(1, l.frames.size());
+    TEST_ASSERT_TRUE(l.frames[0].early);
+    TEST_ASSERT_EQUAL(l.frames[0].tLast, l.emittedAt[0]);
+    TEST_ASSERT_EQUAL(1, l.dec.stats(0).early);
+    TEST_ASSERT_EQUAL(2000, l.dec.stats(0).avgGapUs);
+}
+
+void test_early_close_waits_for_longer_format() {
+    // Возможен и 34-битный кадр: ждём несколько межбитовых интервалов, а не 100 мс
+    EdgeLoop l;
+    l.sim.frame(0, WiegandFormat<26>::encode(0x123456), 26, 1000);
+    l.run(1000000);
+    TEST_ASSERT_EQUAL(1, l.frames.size());
+    TEST_ASSERT_TRUE(l.frames[0].early);
+    TEST_ASSERT_EQUAL(l.frames[0].tLast + WIEGAND_QUICK_GAP_FACTOR * 2000, l.emittedAt[0]);
+}
+
+void test_valid_prefix_does_not_cut_longer_frame() {
+    // 34-битный кадр, у которого первые 26 бит сами по себе — правильный 26-битный кадр
+    uint64_t c34 = 0;
+    for (uint64_t uid = 1; ; uid++) {
+        c34 = WiegandFormat<34>::encode(uid);
+        if (wiegandValid(c34 >> 8, 26)) break;
+    }
+    EdgeLoop l;
+    l.sim.frame(2, c34, 34, 0);
+    l.run(1000000);
+    TEST_ASSERT_EQUAL(1, l.frames.size());
+    TEST_ASSERT_EQUAL(34, l.frames[0].bits);
+    TEST_ASSERT_EQUAL_UINT64(c34, l.frames[0].code);
+}
+
+void test_bad_parity_waits_full_timeout() {
+    EdgeLoop l;
+    l.sim.frame(0, WiegandFormat<26>::encode(0x123456) ^ 0x100, 26, 1000);
+    l.run(1000000);
+    TEST_ASSERT_EQUAL(1, l.frames.size());
+    TEST_ASSERT_FALSE(l.frames[0].early);
+    TEST_ASSERT_EQUAL(l.frames[0].tLast + WIEGAND_FRAME_GAP_US + 1, l.emittedAt[0]);
+    TEST_ASSERT_EQUAL(0, l.dec.stats(0).early);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_single_26bit_frame);
+    RUN_TEST(test_overlapping_readers_34_and_58);
+    RUN_TEST(test_fast_and_slow_timings);
+    RUN_TEST(test_frame_ends_only_after_gap);
+    RUN_TEST(test_micros_wraparound);
+    RUN_TEST(test_ring_overflow_is_counted);
+    RUN_TEST(test_cpu_wakeups_vs_polling);
+    RUN_TEST(test_format_parity);
+    RUN_TEST(test_early_close_single_format);
+    RUN_TEST(test_early_close_waits_for_longer_format);
+    RUN_TEST(test_valid_prefix_does_not_cut_longer_frame);
+    RUN_TEST(test_bad_parity_waits_full_timeout);
+    return UNITY_END();
+}
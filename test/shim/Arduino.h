@@ -0,0 +1,74 @@
+#ifndef SHIM_ARDUINO_H
+#define SHIM_ARDUINO_H
+
+// Минимальная замена Arduino-ядра для сборки модулей под Linux (env:native).
+// Реализовано только то, что реально используют src/*.cpp.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <string>
+#include <chrono>
+#include <thread>
+#include "host_rtos.h"
+
+inline unsigned long micros() {
+    using namespace std::chrono;
+    static const auto t0 = steady_clock::now();
+    return (unsigned long)duration_cast<microseconds>(steady_clock::now() - t0).count();
+}
+
+inline unsigned long millis() {
+    return micros() / 1000;
+}
+
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void delayMicroseconds(unsigned int us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+inline void yield() { std::this_thread::yield(); }
+
+#define HIGH 1
+#define LOW 0
+
+class String {
+public:
+    String() {}
+    String(const char* s) : _s(s ? s : "") {}
+    String(const std::string& s) : _s(s) {}
+    String(int v) : _s(std::to_string(v)) {}
+
+    const char* c_str() const { return _s.c_str(); }
+    unsigned int length() const { return (unsigned int)_s.size(); }
+
+    String& operator+=(const String& o) { _s += o._s; return *this; }
+    String& operator+=(char c) { _s += c; return *this; }
+    bool operator==(const String& o) const { return _s == o._s; }
+    bool operator!=(const String& o) const { return _s != o._s; }
+    friend String operator+(const String& a, const String& b) { return String(a._s + b._s); }
+
+private:
+    std::string _s;
+};
+
+class HostSerial {
+public:
+    void begin(unsigned long) {}
+    int available() { return 0; }
+
+    size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vprintf(fmt, ap);
+        va_end(ap);
+        return n < 0 ? 0 : (size_t)n;
+    }
+    size_t print(const char* s) { return fputs(s, stdout) < 0 ? 0 : strlen(s); }
+    size_t print(const String& s) { return print(s.c_str()); }
+    size_t println(const char* s = "") { size_t n = print(s); putchar('\n'); return n + 1; }
+    size_t println(const String& s) { return println(s.c_str()); }
+};
+
+inline HostSerial Serial;
+
+#endif
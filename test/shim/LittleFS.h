@@ -0,0 +1,109 @@
+#ifndef SHIM_LITTLEFS_H
+#define SHIM_LITTLEFS_H
+
+// LittleFS поверх обычной файловой системы хоста.
+// Корень "/" отображается на каталог data/ проекта (или $LITTLEFS_ROOT).
+
+#include <cstdio>
+#include <string>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "Arduino.h"
+
+#define SHIM_LITTLEFS_SIZE  0x970000   // spiffs в partitions.csv
+#define SHIM_LITTLEFS_BLOCK 4096
+
+class File {
+public:
+    File() {}
+    explicit File(FILE* fp) : _fp(fp) {}
+
+    explicit operator bool() const { return _fp != nullptr; }
+
+    size_t size() {
+        if (!_fp) return 0;
+        long pos = ftell(_fp);
+        fseek(_fp, 0, SEEK_END);
+        long sz = ftell(_fp);
+        fseek(_fp, pos, SEEK_SET);
+        return (size_t)sz;
+    }
+    size_t position() { return _fp ? (size_t)ftell(_fp) : 0; }
+    bool seek(size_t pos) { return _fp && fseek(_fp, (long)pos, SEEK_SET) == 0; }
+    int available() { return _fp ? (int)(size() - position()) : 0; }
+
+    size_t read(uint8_t* buf, size_t len) { return _fp ? fread(buf, 1, len, _fp) : 0; }
+    int read() {
+        if (!_fp) return -1;
+        int c = fgetc(_fp);
+        return c == EOF ? -1 : c;
+    }
+    size_t readBytes(char* buf, size_t len) { return read((uint8_t*)buf, len); }
+    size_t write(const uint8_t* buf, size_t len) { return _fp ? fwrite(buf, 1, len, _fp) : 0; }
+    void flush() { if (_fp) fflush(_fp); }
+
+    void close() {
+        if (_fp) fclose(_fp);
+        _fp = nullptr;
+    }
+
+private:
+    FILE* _fp = nullptr;
+};
+
+class HostLittleFS {
+public:
+    bool begin(bool formatOnFail = false) {
+        (void)formatOnFail;
+        const char* env = getenv("LITTLEFS_ROOT");
+        _root = env ? env : "data";
+        const char* bytes = getenv("LITTLEFS_BYTES");
+        _total = bytes ? (size_t)strtoull(bytes, nullptr, 0) : SHIM_LITTLEFS_SIZE;
+        struct stat st;
+        return stat(_root.c_str(), &st) == 0;
+    }
+
+    bool exists(const char* path) {
+        struct stat st;
+        return stat(hostPath(path).c_str(), &st) == 0;
+    }
+
+    bool remove(const char* path) { return ::remove(hostPath(path).c_str()) == 0; }
+    bool rename(const char* from, const char* to) { return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0; }
+
+    // Размер раздела ($LITTLEFS_BYTES) и занятое: каждый файл — целые блоки плюс блок метаданных
+    size_t totalBytes() const { return _total; }
+    size_t usedBytes() const { return usedIn(_root); }
+
+    File open(const char* path, const char* mode = "r") {
+        std::string m = mode;
+        if (m.find('b') == std::string::npos) m += 'b';
+        return File(fopen(hostPath(path).c_str(), m.c_str()));
+    }
+
+private:
+    std::string _root = "data";
+    size_t _total = SHIM_LITTLEFS_SIZE;
+
+    static size_t usedIn(const std::string& dir) {
+        size_t used = 0;
+        DIR* d = opendir(dir.c_str());
+        if (!d) return 0;
+        while (dirent* e = readdir(d)) {
+            if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+            std::string path = dir + "/" + e->d_name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0) continue;
+            used += SHIM_LITTLEFS_BLOCK;
+            if (S_ISDIR(st.st_mode)) used += usedIn(path);
+            else used += ((size_t)st.st_size + SHIM_LITTLEFS_BLOCK - 1) / SHIM_LITTLEFS_BLOCK * SHIM_LITTLEFS_BLOCK;
+        }
+        closedir(d);
+        return used;
+    }
+    std::string hostPath(const char* path) const { return _root + path; }
+};
+
+inline HostLittleFS LittleFS;
+
+#endif
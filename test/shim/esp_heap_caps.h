@@ -0,0 +1,20 @@
+#ifndef SHIM_ESP_HEAP_CAPS_H
+#define SHIM_ESP_HEAP_CAPS_H
+
+// На хосте все регионы памяти — обычная куча.
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline void* heap_caps_malloc(size_t size, unsigned int caps) { (void)caps; return malloc(size); }
+inline void* heap_caps_realloc(void* ptr, size_t size, unsigned int caps) { (void)caps; return realloc(ptr, size); }
+inline void heap_caps_free(void* ptr) { free(ptr); }
+inline size_t heap_caps_get_free_size(unsigned int caps) { (void)caps; return 0; }
+inline size_t heap_caps_get_largest_free_block(unsigned int caps) { (void)caps; return SIZE_MAX; }
+
+#endif
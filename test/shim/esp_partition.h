@@ -0,0 +1,127 @@
+#ifndef SHIM_ESP_PARTITION_H
+#define SHIM_ESP_PARTITION_H
+
+// Разделы флеша на хосте: каждый раздел — файл <$PARTITION_ROOT>/<label>.img,
+// esp_partition_mmap отображает его через mmap(2). Так код с разделами
+// проходит тот же путь, что и на ESP32.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef int esp_err_t;
+#define ESP_OK   0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+
+#define SHIM_PARTITION_SIZE 0x480000   // carddb в partitions.csv
+
+typedef enum { ESP_PARTITION_TYPE_APP = 0x00, ESP_PARTITION_TYPE_DATA = 0x01 } esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+#define ESP_PARTITION_SUBTYPE_ANY 0xff
+
+typedef enum { SPI_FLASH_MMAP_DATA, SPI_FLASH_MMAP_INST } spi_flash_mmap_memory_t;
+typedef uint32_t spi_flash_mmap_handle_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+    int fd;
+} esp_partition_t;
+
+struct ShimMapping { void* addr; size_t len; };
+
+// Таблицы не разрушаются при выходе: глобальные объекты могут размапить раздел позже
+inline std::map<std::string, esp_partition_t>& shimPartitions() {
+    static auto* parts = new std::map<std::string, esp_partition_t>();
+    return *parts;
+}
+
+inline std::map<spi_flash_mmap_handle_t, ShimMapping>& shimMappings() {
+    static auto* maps = new std::map<spi_flash_mmap_handle_t, ShimMapping>();
+    return *maps;
+}
+
+inline const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label) {
+    if (!label) return nullptr;
+    auto& parts = shimPartitions();
+    auto it = parts.find(label);
+    if (it != parts.end()) return &it->second;
+
+    const char* root = getenv("PARTITION_ROOT");
+    std::string path = std::string(root ? root : ".") + "/" + label + ".img";
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size < SHIM_PARTITION_SIZE) {
+        // Новый раздел — "стёртый" флеш
+        if (ftruncate(fd, SHIM_PARTITION_SIZE) != 0) { ::close(fd); return nullptr; }
+        uint8_t blank[4096];
+        memset(blank, 0xFF, sizeof(blank));
+        for (off_t off = st.st_size; off < SHIM_PARTITION_SIZE; off += sizeof(blank)) {
+            if (pwrite(fd, blank, sizeof(blank), off) != (ssize_t)sizeof(blank)) break;
+        }
+    }
+
+    esp_partition_t p;
+    memset(&p, 0, sizeof(p));
+    p.type = type;
+    p.subtype = subtype;
+    p.size = SHIM_PARTITION_SIZE;
+    strncpy(p.label, label, sizeof(p.label) - 1);
+    p.fd = fd;
+    return &(parts[label] = p);
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* p, size_t off, void* dst, size_t size) {
+    if (!p || off + size > p->size) return ESP_ERR_INVALID_ARG;
+    return pread(p->fd, dst, size, off) == (ssize_t)size ? ESP_OK : ESP_FAIL;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t* p, size_t off, const void* src, size_t size) {
+    if (!p || off + size > p->size) return ESP_ERR_INVALID_ARG;
+    return pwrite(p->fd, src, size, off) == (ssize_t)size ? ESP_OK : ESP_FAIL;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* p, size_t off, size_t size) {
+    if (!p || off % 4096 || size % 4096 || off + size > p->size) return ESP_ERR_INVALID_ARG;
+    uint8_t blank[4096];
+    memset(blank, 0xFF, sizeof(blank));
+    for (size_t o = off; o < off + size; o += sizeof(blank)) {
+        if (pwrite(p->fd, blank, sizeof(blank), o) != (ssize_t)sizeof(blank)) return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+inline esp_err_t esp_partition_mmap(const esp_partition_t* p, size_t off, size_t size, spi_flash_mmap_memory_t memory,
+                                    const void** out_ptr, spi_flash_mmap_handle_t* out_handle) {
+    (void)memory;
+    if (!p || off % 0x10000 || off + size > p->size) return ESP_ERR_INVALID_ARG;
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, p->fd, off);
+    if (addr == MAP_FAILED) return ESP_FAIL;
+    static spi_flash_mmap_handle_t next = 1;
+    *out_handle = next++;
+    *out_ptr = addr;
+    shimMappings()[*out_handle] = { addr, size };
+    return ESP_OK;
+}
+
+inline void spi_flash_munmap(spi_flash_mmap_handle_t handle) {
+    auto& maps = shimMappings();
+    auto it = maps.find(handle);
+    if (it == maps.end()) return;
+    munmap(it->second.addr, it->second.len);
+    maps.erase(it);
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef SHIM_HOST_RTOS_H
+#define SHIM_HOST_RTOS_H
+
+// Подмножество FreeRTOS поверх std::thread / std::mutex.
+// На ESP32 эти функции приходят из Arduino.h через freertos/*.h.
+
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  1
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configMAX_PRIORITIES 25
+
+// Семафор-мьютекс. Take/Give могут вызываться из разных потоков, поэтому
+// используется флаг + condition_variable, а не голый std::mutex.
+struct HostSemaphore {
+    std::mutex m;
+    std::condition_variable cv;
+    bool taken = false;
+};
+typedef HostSemaphore* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new HostSemaphore(); }
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+    std::unique_lock<std::mutex> lk(s->m);
+    if (ticks == portMAX_DELAY) {
+        s->cv.wait(lk, [s] { return !s->taken; });
+    } else if (!s->cv.wait_for(lk, std::chrono::milliseconds(ticks), [s] { return !s->taken; })) {
+        return pdFALSE;
+    }
+    s->taken = true;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+    {
+        std::lock_guard<std::mutex> lk(s->m);
+        s->taken = false;
+    }
+    s->cv.notify_one();
+    return pdTRUE;
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t s) { delete s; }
+
+typedef void (*TaskFunction_t)(void*);
+typedef std::thread* TaskHandle_t;
+
+// Приоритет и ядро на хосте игнорируются
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void* arg,
+                                          UBaseType_t prio, TaskHandle_t* handle, BaseType_t core) {
+    (void)name; (void)stack; (void)prio; (void)core;
+    std::thread* t = new std::thread(fn, arg);
+    t->detach();
+    if (handle) *handle = t;
+    return pdPASS;
+}
+
+// Поток на хосте завершается сам, когда функция задачи вернётся
+inline void vTaskDelete(TaskHandle_t handle) { (void)handle; }
+
+inline void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
+
+inline TickType_t xTaskGetTickCount() {
+    using namespace std::chrono;
+    static const auto t0 = steady_clock::now();
+    return (TickType_t)duration_cast<milliseconds>(steady_clock::now() - t0).count();
+}
+
+#endif
@@ -0,0 +1,22 @@
+# Сжимает web/* в data/*.gz перед сборкой прошивки и образа LittleFS.
+# mtime=0 — одинаковый вход даёт одинаковый .gz (и тот же ETag на устройстве).
+import gzip
+import os
+
+Import("env")
+
+src_dir = os.path.join(env.subst("$PROJECT_DIR"), "web")
+dst_dir = os.path.join(env.subst("$PROJECT_DIR"), "data")
+
+for name in sorted(os.listdir(src_dir)):
+    src = os.path.join(src_dir, name)
+    dst = os.path.join(dst_dir, name + ".gz")
+    if not os.path.isfile(src):
+        continue
+    if os.path.exists(dst) and os.path.getmtime(dst) >= os.path.getmtime(src):
+        continue
+    with open(src, "rb") as f:
+        data = f.read()
+    with open(dst, "wb") as f:
+        f.write(gzip.compress(data, 9, mtime=0))
+    print("gzip_web: %s -> %s (%d -> %d B)" % (name, os.path.basename(dst), len(data), os.path.getsize(dst)))
@@ -0,0 +1,29 @@
+# Собирает файлы базы в один пакет для POST /api/db (формат — include/cardupload.h).
+#   python tools/make_db_bundle.py [data_dir] [out.kcup]
+#   curl -u admin:pass --data-binary @cards.kcup http://<ip>/api/db
+# Ход загрузки и подмены — GET /api/db; 507 — пакет не помещается на LittleFS рядом с живой базой.
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = 0x5055434B  # "KCUP"
+VERSION = 1
+FILES = ("cards34.bin", "cards56.bin", "groups.bin", "rules.bin")  # Порядок cardDbFiles
+HEADER = struct.Struct("<IHH4III")
+
+src_dir = sys.argv[1] if len(sys.argv) > 1 else "data"
+out_path = sys.argv[2] if len(sys.argv) > 2 else "cards.kcup"
+
+parts = []
+for name in FILES:
+    path = os.path.join(src_dir, name)
+    # Отсутствующий файл уходит пустым, как его и читает прошивка
+    parts.append(open(path, "rb").read() if os.path.exists(path) else b"")
+
+payload = b"".join(parts)
+header = HEADER.pack(MAGIC, VERSION, HEADER.size, *[len(p) for p in parts], zlib.crc32(payload), 0)
+with open(out_path, "wb") as f:
+    f.write(header)
+    f.write(payload)
+print("make_db_bundle: %s (%s, %d B)" % (out_path, ", ".join("%s %d" % (n, len(p)) for n, p in zip(FILES, parts)), len(header) + len(payload)))